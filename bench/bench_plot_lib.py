@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 
+import csv
 import logging
 from copy import deepcopy
 from typing import Dict, List, Tuple, Callable, Union
@@ -385,3 +386,56 @@ def bench_plot_groupped_results(
         legend_loc=legend_loc,
         text_center_list=text_center_list,
     )
+
+
+def read_sim_csv(path: str) -> Dict[str, Tuple[List[int], List[float]]]:
+    """Read a simulator or MRC profiler CSV into cache sizes and miss ratios
+    per policy, sorted by cache size."""
+    curves = {}
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            sizes, miss_ratios = curves.setdefault(row["policy"], ([], []))
+            sizes.append(int(row["cache_pages"]))
+            miss_ratios.append(1 - float(row["hit_ratio"]))
+    for policy, (sizes, miss_ratios) in curves.items():
+        order = np.argsort(sizes)
+        curves[policy] = (
+            [sizes[i] for i in order],
+            [miss_ratios[i] for i in order],
+        )
+    return curves
+
+
+def plot_miss_ratio_curves(
+    csv_paths: Dict[str, str],
+    filename="mrc.pdf",
+    page_size=4096,
+    x_label="Cache size (MiB)",
+    y_label="Miss ratio",
+    fontsize=12,
+    legend_fontsize=12,
+    legend_loc="best",
+):
+    """Plot miss ratio against cache size for every policy of every CSV.
+
+    csv_paths maps a label to the output of the simulator or of mrc_profiler,
+    e.g. {"LevelDB": "mrc.csv", "LevelDB (sim)": "sim.csv"}. Lines are labeled
+    "<label> <policy>".
+    """
+    for label, path in csv_paths.items():
+        for policy, (sizes, miss_ratios) in read_sim_csv(path).items():
+            plt.plot(
+                [size * page_size / 2**20 for size in sizes],
+                miss_ratios,
+                label=f"{label} {policy}",
+            )
+    plt.xscale("log")
+    plt.ylim(0, 1)
+    plt.xlabel(x_label, fontsize=fontsize)
+    plt.ylabel(y_label, fontsize=fontsize)
+    plt.xticks(fontsize=fontsize)
+    plt.yticks(fontsize=fontsize)
+    plt.legend(fontsize=legend_fontsize, loc=legend_loc)
+    plt.tight_layout()
+    plt.savefig(filename, metadata={"creationDate": None})
+    plt.clf()
@@ -12,6 +12,10 @@ def load(fname):
 start = load("bpf_stats_start.json")
 end = load("bpf_stats_end.json")
 
+# Optional label of the run, the reader threads for profile_bpf.sh
+if len(sys.argv) > 1:
+    print(f"Reader threads: {sys.argv[1]}")
+
 print(f"{'INFO': <30} | {'RUNS': <10} | {'TOTAL_NS': <15} | {'AVG_NS': <10}")
 print("-" * 75)
 
@@ -5,6 +5,12 @@ set -e
 TEST_DIR="/home/ubuntu/linux" # Adjust if needed, needs to be the watched dir
 CGROUP_PATH="/sys/fs/cgroup/cache_ext_test"
 RESULT_DIR="results_$(date +%Y%m%d_%H%M%S)"
+# Reader threads, one CPU each (can be overridden: THREADS=16 ./benchmark.sh)
+THREADS=${THREADS:-8}
+if [ "$THREADS" -gt "$(nproc)" ]; then
+    echo "Only $(nproc) CPUs, running $(nproc) reader threads"
+    THREADS=$(nproc)
+fi
 
 mkdir -p "$RESULT_DIR"
 
@@ -34,12 +40,13 @@ sudo sh -c 'echo 1 > /proc/sys/vm/drop_caches'
 sudo swapoff -a
 
 # Run filesearch inside the cgroup
-echo "Running filesearch (rg)..."
+echo "Running filesearch (rg) with $THREADS threads..."
 START_TIME=$(date +%s%N)
-sudo taskset -c 0-7 cgexec -g memory:cache_ext_test \
-    /bin/bash -c 'for i in {1..10}; do rg write /home/ubuntu/linux > /dev/null; done'
+sudo taskset -c 0-$((THREADS - 1)) cgexec -g memory:cache_ext_test \
+    /bin/bash -c "for i in {1..10}; do rg -j $THREADS write /home/ubuntu/linux > /dev/null; done"
 END_TIME=$(date +%s%N)
 
 DURATION=$(( (END_TIME - START_TIME) / 1000000 ))
 echo "Benchmark finished. Duration: ${DURATION} ms"
-echo "Duration: ${DURATION} ms" > "$RESULT_DIR/result.txt"
+echo "Threads: ${THREADS}" > "$RESULT_DIR/result.txt"
+echo "Duration: ${DURATION} ms" >> "$RESULT_DIR/result.txt"
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cgroup_size.h"
 #include "dir_watcher.h"
 #include "cache_ext_lhd.bpf.h"
 #include "cache_ext_lhd.skel.h"
@@ -155,6 +156,12 @@ int main(int argc, char **argv) {
 	watch_dir_path_len_map(skel) = strlen(watch_dir_path);
 	strcpy(watch_dir_path_map(skel), watch_dir_path);
 
+	// Size the folio maps to the cgroup
+	if (size_folio_maps_to_cgroup(skel->obj, args.cgroup_path)) {
+		ret = 1;
+		goto cleanup;
+	}
+
 	if (cache_ext_lhd_bpf__load(skel)) {
 		perror("Failed to load BPF skeleton");
 		goto cleanup;
@@ -10,10 +10,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cgroup_size.h"
 #include "dir_watcher.h"
 #include "cache_ext_s3fifo.skel.h"
 
-char *USAGE = "Usage: ./cache_ext_s3fifo --watch_dir <dir> --cgroup_size <size> --cgroup_path <path>\n";
+char *USAGE = "Usage: ./cache_ext_s3fifo --watch_dir <dir> [--cgroup_size <size>] --cgroup_path <path>\n";
 struct cmdline_args {
 	char *watch_dir;
         uint64_t cgroup_size;
@@ -22,7 +23,7 @@ struct cmdline_args {
 
 static struct argp_option options[] = {
 	{ "watch_dir", 'w', "DIR", 0, "Directory to watch" },
-        {"cgroup_size", 's', "SIZE", 0, "Size of the cgroup"},
+        {"cgroup_size", 's', "SIZE", 0, "Size of the cgroup (default: its memory.max)"},
         {"cgroup_path", 'c', "PATH", 0, "Path to cgroup (e.g., /sys/fs/cgroup/cache_ext_test)"},
 	{ 0 },
 };
@@ -46,8 +47,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
                 // TODO: move this to parse_args()
                 errno = 0;
                 args->cgroup_size = strtoull(arg, NULL, 10);
-                if (errno)
-                        args->cgroup_size = 0;
+                if (errno || args->cgroup_size == 0)
+                        argp_error(state, "Invalid cgroup size");
 
                 break;
         case 'c':
@@ -68,11 +69,6 @@ static int parse_args(int argc, char **argv, struct cmdline_args *args) {
 		return 1;
 	}
 
-	if (args->cgroup_size == 0) {
-	        fprintf(stderr, "Invalid cgroup size\n");
-	        return 1;
-	}
-
 	if (args->cgroup_path == NULL) {
 		fprintf(stderr, "Missing required argument: cgroup_path\n");
 		return 1;
@@ -149,13 +145,21 @@ int main(int argc, char **argv) {
 	}
 
 	// Set cache size in terms of number of pages. Assumes uniform page size.
-	skel->rodata->cache_size = args.cgroup_size / page_size;
-	fprintf(stderr, "Cgroup size: %lu bytes\n", args.cgroup_size);
+	if (args.cgroup_size) {
+		skel->rodata->cache_size = args.cgroup_size / page_size;
+		fprintf(stderr, "Cgroup size: %lu bytes\n", args.cgroup_size);
+	} else {
+		uint64_t cache_pages;
+		if (cgroup_cache_pages(args.cgroup_path, &cache_pages)) {
+			ret = 1;
+			goto cleanup;
+		}
+		skel->rodata->cache_size = cache_pages;
+	}
 	fprintf(stderr, "Cache size: %lu pages\n", skel->rodata->cache_size);
 
-	// Resize ghost_map
-	if (bpf_map__set_max_entries(skel->maps.ghost_map, skel->rodata->cache_size)) {
-		perror("Failed to resize ghost_map");
+	// Resize folio_metadata_map and ghost_map
+	if (size_folio_maps(skel->obj, skel->rodata->cache_size)) {
 		ret = 1;
 		goto cleanup;
 	}
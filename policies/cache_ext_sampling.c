@@ -11,6 +11,7 @@
 #include <bpf/libbpf.h>
 
 #include "cache_ext_sampling.skel.h"
+#include "cgroup_size.h"
 #include "dir_watcher.h"
 
 char *USAGE = "Usage: ./cache_ext_sampling --watch_dir <dir> --cgroup_path <path>\n";
@@ -103,6 +104,12 @@ int main(int argc, char **argv)
 	skel->rodata->watch_dir_path_len = strlen(watch_dir_full_path);
 	strcpy(skel->rodata->watch_dir_path, watch_dir_full_path);
 
+	// Size the folio maps to the cgroup
+	if (size_folio_maps_to_cgroup(skel->obj, args.cgroup_path)) {
+		ret = 1;
+		goto cleanup;
+	}
+
 	// Load programs
 	ret = cache_ext_sampling_bpf__load(skel);
 	if (ret) {
@@ -5,6 +5,12 @@
 
 #include "cache_ext_lib.bpf.h"
 #include "dir_watcher.bpf.h"
+#ifdef CACHE_EXT_SHARDS
+#include "shards.bpf.h"
+#endif
+#ifdef CACHE_EXT_TOPK
+#include "topk.bpf.h"
+#endif
 
 // #define STATS
 
@@ -22,43 +28,229 @@ char _license[] SEC("license") = "GPL";
 #define PAGE_SHIFT 12
 #define NUM_BITS(type) (sizeof(type) * CHAR_BIT)
 
-// Default cache size bits if not provided by Makefile
+// Default cache size bits if not provided by Makefile. The loader sizes the
+// sketch to the cgroup's memory.max; this is only used if it cannot.
 #ifndef CACHE_SIZE_BITS
 // 1GiB (= 2^30/2^12) -> 18 bits
 // 8GiB (= 2^33/2^12) -> 21 bits
     #define CACHE_SIZE_BITS 18
 #endif
 
-#define DOORKEEPER_SIZE (1 << CACHE_SIZE_BITS)
-#define CBF_SIZE (1 << CACHE_SIZE_BITS)
-
 #define NUM_HASH_FUNCTIONS 4
 #define BITS_PER_COUNTER 4      // Must be a power of 2
 #define COUNTER_MASK ((1 << BITS_PER_COUNTER) - 1)
 
-#define SAMPLE_SIZE_BITS (BITS_PER_COUNTER + CACHE_SIZE_BITS)
+// Sketch geometry, set by the loader along with the sizes of doorkeeper_map
+// and cbf_map: a doorkeeper bit and a CBF counter per page of the cache, and
+// a sample of BITS_PER_COUNTER accesses per page
+const volatile u32 doorkeeper_mask = (1 << CACHE_SIZE_BITS) - 1;
+const volatile u32 cbf_mask = (1 << CACHE_SIZE_BITS) - 1;
+const volatile u64 sample_size = 1ULL << (BITS_PER_COUNTER + CACHE_SIZE_BITS);
 
-static u64 global_counter = 0;
+#define DOORKEEPER_SIZE (doorkeeper_mask + 1)
+#define CBF_SIZE (cbf_mask + 1)
 
 // Maps
 // Array sizes
 #define DOORKEEPER_MAP_SIZE (DOORKEEPER_SIZE / NUM_BITS(u64) + 1)
 #define CBF_MAP_SIZE (CBF_SIZE / (NUM_BITS(u64) / BITS_PER_COUNTER) + 1)
+// As compiled, before the loader resizes the maps
+#define DEFAULT_DOORKEEPER_MAP_SIZE ((1 << CACHE_SIZE_BITS) / NUM_BITS(u64) + 1)
+#define DEFAULT_CBF_MAP_SIZE ((1 << CACHE_SIZE_BITS) / (NUM_BITS(u64) / BITS_PER_COUNTER) + 1)
+
+#ifdef TINYLFU_PERCPU_SKETCH
+// Per-CPU sketch (make TINYLFU_SKETCH=percpu): every CPU counts the accesses
+// it sees in its own shard of cbf_map, so increments never bounce cache lines
+// between CPUs. Estimates sum the shards, each an overestimate of its own
+// accesses.
+//
+// Each CPU also counts its accesses towards a share of the sample, and adds
+// to shard_resets when the share is full. Once the CPUs filled as many shares
+// as there are CPUs, about one sample of the whole sketch, all shards are
+// halved together, so those of idle CPUs decay too.
+//
+// The doorkeeper stays shared: it is only written the first time a folio is
+// seen in a sample, so its lines are read-mostly.
+
+// Possible CPUs, set by the loader
+const volatile u32 tinylfu_nr_cpus = 1;
+
+// Shares of the sample filled so far
+static u64 shard_resets = 0;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, u64);
+} cbf_counter_map SEC(".maps");
+#else
+static u64 global_counter = 0;
+#endif
 
 struct {
     __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, DOORKEEPER_MAP_SIZE);
+    __uint(max_entries, DEFAULT_DOORKEEPER_MAP_SIZE);
     __type(key, u32);
     __type(value, u64);
 } doorkeeper_map SEC(".maps");
 
 struct {
+#ifdef TINYLFU_PERCPU_SKETCH
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+#else
     __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, CBF_MAP_SIZE);
+#endif
+    __uint(max_entries, DEFAULT_CBF_MAP_SIZE);
     __type(key, u32);
     __type(value, u64);
 } cbf_map SEC(".maps");
 
+// Halves each counter of a CBF word
+static __always_inline u64 cbf_halve_word(u64 v) {
+    u64 new_val = 0;
+
+    #pragma unroll
+    for (int i = 0; i < NUM_BITS(u64) / BITS_PER_COUNTER; i++) {
+        u32 shift = i * BITS_PER_COUNTER;
+        u64 counter = (v >> shift) & COUNTER_MASK;
+        counter >>= 1;
+        new_val |= (counter << shift);
+    }
+    return new_val;
+}
+
+#ifdef TINYLFU_TIMER_AGING
+// Background aging (make TINYLFU_AGING=timer): a full sample starts a sweep
+// on a bpf_timer, which clears the doorkeeper then halves the CBF, a bounded
+// number of words per tick, so that no read pays for the whole sketch.
+//
+// While a sweep runs, words it has not aged yet are read as if already aged,
+// so estimates compare folios as of the same sample wherever the sweep is.
+// A word about to be updated is aged first, by the writer, so that the update
+// counts towards the new sample and is not cleared or halved with the old
+// one. A bitmap per map records the words aged in the sweep that runs, by it
+// or by a writer, so each is aged once.
+
+#define AGING_WORDS_PER_TICK 256
+#define AGING_TICK_NS 100000
+
+#define AGING_DOORKEEPER 0
+#define AGING_CBF 1
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+struct tinylfu_aging {
+    struct bpf_timer timer;
+    // Sweeps started and completed: odd while a sweep runs
+    u64 seq;
+    // Map being swept, and its next word
+    u32 phase;
+    u32 cursor;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct tinylfu_aging);
+} aging_map SEC(".maps");
+
+// A bit per word of doorkeeper_map and of cbf_map, flipped when the word is
+// aged. The bits of the words aged in sweep n are all n % 2, so they need no
+// clearing in between.
+#define DEFAULT_DOORKEEPER_AGED_MAP_SIZE (DEFAULT_DOORKEEPER_MAP_SIZE / NUM_BITS(u64) + 1)
+#define DEFAULT_CBF_AGED_MAP_SIZE (DEFAULT_CBF_MAP_SIZE / NUM_BITS(u64) + 1)
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, DEFAULT_DOORKEEPER_AGED_MAP_SIZE);
+    __type(key, u32);
+    __type(value, u64);
+} doorkeeper_aged_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, DEFAULT_CBF_AGED_MAP_SIZE);
+    __type(key, u32);
+    __type(value, u64);
+} cbf_aged_map SEC(".maps");
+
+static __always_inline struct tinylfu_aging *aging_state() {
+    u32 zero = 0;
+    return bpf_map_lookup_elem(&aging_map, &zero);
+}
+
+// Bit of the words aged in the sweep that runs during seq
+static __always_inline u64 aging_parity(u64 seq) {
+    return ((seq + 1) / 2) & 1;
+}
+
+// True if a sweep runs and has not aged word word_idx yet
+static __always_inline bool aging_word_stale(void *aged_map, u32 word_idx) {
+    struct tinylfu_aging *aging = aging_state();
+    if (!aging) return false;
+
+    u64 seq = aging->seq;
+    if (!(seq & 1)) return false;
+
+    u32 key = word_idx / NUM_BITS(u64);
+    u64 *bits = bpf_map_lookup_elem(aged_map, &key);
+    if (!bits) return false;
+    return ((*bits >> (word_idx % NUM_BITS(u64))) & 1) != aging_parity(seq);
+}
+
+// Claims the aging of word word_idx in the sweep that runs: true if it was
+// stale, and the caller is to age it. Until then, readers see it unaged.
+static __always_inline bool aging_claim_word(void *aged_map, u32 word_idx) {
+    struct tinylfu_aging *aging = aging_state();
+    if (!aging) return false;
+
+    u64 seq = aging->seq;
+    if (!(seq & 1)) return false;
+
+    u32 key = word_idx / NUM_BITS(u64);
+    u64 *bits = bpf_map_lookup_elem(aged_map, &key);
+    if (!bits) return false;
+
+    u64 bit = 1ULL << (word_idx % NUM_BITS(u64));
+    if (aging_parity(seq))
+        return !(__sync_fetch_and_or(bits, bit) & bit);
+    return (__sync_fetch_and_and(bits, ~bit) & bit) != 0;
+}
+#endif
+
+// Value of doorkeeper word word_idx, as of the current sample
+static __always_inline u64 doorkeeper_word(u32 word_idx, u64 v) {
+#ifdef TINYLFU_TIMER_AGING
+    if (aging_word_stale(&doorkeeper_aged_map, word_idx))
+        return 0;
+#endif
+    return v;
+}
+
+// Doorkeeper word word_idx, to be updated: cleared first if a sweep has not
+// aged it yet, so that the update outlives the sweep
+static __always_inline u64 *doorkeeper_word_for_update(u32 word_idx) {
+    u64 *val = bpf_map_lookup_elem(&doorkeeper_map, &word_idx);
+#ifdef TINYLFU_TIMER_AGING
+    if (val && aging_claim_word(&doorkeeper_aged_map, word_idx))
+        *val = 0;
+#endif
+    return val;
+}
+
+// Value of CBF word word_idx, as of the current sample
+static __always_inline u64 cbf_word(u32 word_idx, u64 v) {
+#ifdef TINYLFU_TIMER_AGING
+    if (aging_word_stale(&cbf_aged_map, word_idx))
+        return cbf_halve_word(v);
+#endif
+    return v;
+}
+
 #ifdef STATS
     // Statistics Map
     #define STAT_TOTAL_ACCESSES 0
@@ -85,7 +277,17 @@ struct {
     }
 #endif
 
-// Hash function (Thomas Wang 64 bit Mix Function)
+// Hash families, selected with -DTINYLFU_HASH_{WANG,MURMUR3,XXH3}. wyhash
+// needs a 128-bit multiply, which BPF does not have.
+#if !defined(TINYLFU_HASH_WANG) && !defined(TINYLFU_HASH_XXH3)
+    #define TINYLFU_HASH_MURMUR3
+#endif
+
+static __always_inline u64 rotl64(u64 x, u32 r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Thomas Wang 64 bit Mix Function
 static __always_inline u64 hash_64(u64 key) {
     key = (~key) + (key << 21);
     key = key ^ (key >> 24);
@@ -96,6 +298,36 @@ static __always_inline u64 hash_64(u64 key) {
     return key;
 }
 
+// MurmurHash3 64 bit finalizer
+static __always_inline u64 hash_fmix64(u64 key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// XXH3 64 bit hash of the key's 8 bytes, seed 0 (XXH3_len_4to8_64b)
+static __always_inline u64 hash_xxh3_64(u64 key) {
+    u64 h = rotl64(key, 32) ^ 0xc73ab174c5ecd5a2ULL;
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= 0x9fb21c651e98df25ULL;
+    h ^= (h >> 35) + 8;
+    h *= 0x9fb21c651e98df25ULL;
+    return h ^ (h >> 28);
+}
+
+static __always_inline u64 hash_key(u64 key) {
+#if defined(TINYLFU_HASH_WANG)
+    return hash_64(key);
+#elif defined(TINYLFU_HASH_XXH3)
+    return hash_xxh3_64(key);
+#else
+    return hash_fmix64(key);
+#endif
+}
+
 static __always_inline u64 get_folio_id(u64 ino, u64 index) {
     // Simple bitwise mixing to avoid the overhead of multiple expensive hash calls.
     // This technique (XOR with a rotated value) is a standard hash combination primitive,
@@ -110,62 +342,175 @@ static __always_inline u64 get_folio_id_from_folio(struct folio *folio) {
     return get_folio_id(folio->mapping->host->i_ino, folio->index);
 }
 
-static __always_inline void get_hashes(u64 key, u32 *h) {
-    u64 hash = hash_64(key);
-    u32 h1 = (u32)hash;
-    u32 h2 = (u32)(hash >> 32);
+// Double hashing in 64 bits, as get_hashes() in src/include/hash.h. The step
+// is odd, so the probes of a key never coincide on the power-of-two tables.
+static __always_inline void get_hashes(u64 key, u64 *h) {
+    u64 h1 = hash_key(key);
+    u64 h2 = hash_fmix64(h1 ^ 0x9e3779b97f4a7c15ULL) | 1;
 
     for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        h[i] = h1 + i * h2;
+        h[i] = h1 + (i + 1) * h2;
     }
 }
 
 // Doorkeeper operations
-static __always_inline bool doorkeeper_contains(u32 *h) {
+#ifdef TINYLFU_CUCKOO_DOORKEEPER
+// Cuckoo filter doorkeeper, as src/src/cuckoo_filter.c: each word of
+// doorkeeper_map is a bucket of four 16-bit fingerprints, 0 marking an empty
+// slot. Unlike the bloom filter, the fingerprint of an evicted folio can be
+// deleted, so that it has to be seen twice again to reach the CBF.
+#define CF_NUM_BUCKETS (DOORKEEPER_SIZE / NUM_BITS(u64))
+#define CF_FINGERPRINT_BITS 16
+#define CF_SLOTS_PER_BUCKET (NUM_BITS(u64) / CF_FINGERPRINT_BITS)
+#define CF_FINGERPRINT_MASK ((1ULL << CF_FINGERPRINT_BITS) - 1)
+#define CF_SLOT_LOW_BITS  0x0001000100010001ULL
+#define CF_SLOT_HIGH_BITS 0x8000800080008000ULL
+// Relocations tried by an insert; the fingerprint left over is dropped
+#define CF_MAX_KICKS 32
+
+// Low bits of h[1], never 0
+static __always_inline u64 cf_fingerprint(u64 *h) {
+    u64 fp = h[1] & CF_FINGERPRINT_MASK;
+    return fp ? fp : 1;
+}
+
+// i1 + i2 = hash(fp) modulo the number of buckets
+static __always_inline u32 cf_alt_bucket(u32 i, u64 fp) {
+    u32 sum = hash_fmix64(fp) % CF_NUM_BUCKETS;
+    return (sum + CF_NUM_BUCKETS - i) % CF_NUM_BUCKETS;
+}
+
+// Non-zero if any slot of bucket equals fp (SWAR)
+static __always_inline u64 cf_match(u64 bucket, u64 fp) {
+    u64 x = bucket ^ (fp * CF_SLOT_LOW_BITS);
+    return (x - CF_SLOT_LOW_BITS) & ~x & CF_SLOT_HIGH_BITS;
+}
+
+// Replaces the first slot of bucket i holding from by to
+static __always_inline bool cf_bucket_replace(u32 i, u64 from, u64 to) {
+    u64 *val = doorkeeper_word_for_update(i);
+    if (!val) return false;
+
+    u64 old = *val;
+    #pragma unroll
+    for (int s = 0; s < CF_SLOTS_PER_BUCKET; s++) {
+        u32 shift = s * CF_FINGERPRINT_BITS;
+        if (((old >> shift) & CF_FINGERPRINT_MASK) == from) {
+            u64 new_val = old ^ ((from ^ to) << shift);
+            return __sync_val_compare_and_swap(val, old, new_val) == old;
+        }
+    }
+    return false;
+}
+
+static __always_inline bool doorkeeper_contains(u64 *h) {
+    u64 fp = cf_fingerprint(h);
+    u32 i1 = h[0] % CF_NUM_BUCKETS;
+    u32 i2 = cf_alt_bucket(i1, fp);
+
+    u64 *b1 = bpf_map_lookup_elem(&doorkeeper_map, &i1);
+    u64 *b2 = bpf_map_lookup_elem(&doorkeeper_map, &i2);
+    if (!b1 || !b2) return false;
+
+    return (cf_match(doorkeeper_word(i1, *b1), fp) | cf_match(doorkeeper_word(i2, *b2), fp)) != 0;
+}
+
+static __always_inline void doorkeeper_add(u64 *h) {
+    u64 fp = cf_fingerprint(h);
+    u32 i = h[0] % CF_NUM_BUCKETS;
+
+    if (cf_bucket_replace(i, 0, fp)) return;
+    i = cf_alt_bucket(i, fp);
+    if (cf_bucket_replace(i, 0, fp)) return;
+
+    // Both buckets are full: swap fp with a random slot of the second one,
+    // and move the fingerprint swapped out to its other bucket
+    for (int kick = 0; kick < CF_MAX_KICKS; kick++) {
+        u64 *val = doorkeeper_word_for_update(i);
+        if (!val) return;
+
+        u64 old = *val;
+        u32 shift = (bpf_get_prandom_u32() % CF_SLOTS_PER_BUCKET) * CF_FINGERPRINT_BITS;
+        u64 evicted = (old >> shift) & CF_FINGERPRINT_MASK;
+
+        // Lost to a concurrent update of the bucket: give up on fp
+        if (__sync_val_compare_and_swap(val, old, old ^ ((evicted ^ fp) << shift)) != old)
+            return;
+
+        fp = evicted;
+        i = cf_alt_bucket(i, fp);
+        if (cf_bucket_replace(i, 0, fp)) return;
+    }
+}
+
+static __always_inline void doorkeeper_delete(u64 *h) {
+    u64 fp = cf_fingerprint(h);
+    u32 i1 = h[0] % CF_NUM_BUCKETS;
+
+    if (!cf_bucket_replace(i1, fp, 0))
+        cf_bucket_replace(cf_alt_bucket(i1, fp), fp, 0);
+}
+#else
+static __always_inline bool doorkeeper_contains(u64 *h) {
     for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        u32 idx = h[i] % DOORKEEPER_SIZE;
+        u32 idx = h[i] & doorkeeper_mask;
         u32 word_idx = idx / NUM_BITS(u64);
         u32 bit_idx  = idx % NUM_BITS(u64);
 
         u64 *val = bpf_map_lookup_elem(&doorkeeper_map, &word_idx);
         if (!val) return false;
-        if (!(*val & (1ULL << bit_idx))) return false;
+        if (!(doorkeeper_word(word_idx, *val) & (1ULL << bit_idx))) return false;
     }
     return true;
 }
 
-static __always_inline void doorkeeper_add(u32 *h) {
+static __always_inline void doorkeeper_add(u64 *h) {
     for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        u32 idx = h[i] % DOORKEEPER_SIZE;
+        u32 idx = h[i] & doorkeeper_mask;
         u32 word_idx = idx / NUM_BITS(u64);
         u32 bit_idx  = idx % NUM_BITS(u64);
 
-        u64 *val = bpf_map_lookup_elem(&doorkeeper_map, &word_idx);
+        u64 *val = doorkeeper_word_for_update(word_idx);
         if (val) {
             __sync_fetch_and_or(val, (1ULL << bit_idx));
         }
     }
 }
+#endif
 
 // CBF operations
+// Halves a CBF word; an increment racing with it is halved too
+static __always_inline void cbf_halve_word_atomic(u64 *val) {
+    u64 old = *val;
+
+    for (int i = 0; i < 4; i++) {
+        u64 seen = __sync_val_compare_and_swap(val, old, cbf_halve_word(old));
+        if (seen == old) return;
+        old = seen;
+    }
+}
+
+#ifdef TINYLFU_PERCPU_SKETCH
+static int reset_cbf_shard_callback(u32 cpu, void *data) {
+    u64 *val = bpf_map_lookup_percpu_elem(&cbf_map, data, cpu);
+    if (val)
+        cbf_halve_word_atomic(val);
+    return 0;
+}
+#endif
+
+// Halves the counters of cbf_map, in every shard if per-CPU
 static int reset_cbf_loop_callback(u32 index, void *ctx) {
     u32 key = index;
+#ifdef TINYLFU_PERCPU_SKETCH
+    // The word in every shard; one raced by its own CPU may miss this halving
+    bpf_loop(tinylfu_nr_cpus, reset_cbf_shard_callback, &key, 0);
+#else
     u64 *val = bpf_map_lookup_elem(&cbf_map, &key);
     if (!val) return 0;
 
-    // We need to halve each 4-bit counter in the 64-bit word
-    u64 v = *val;
-    u64 new_val = 0;
-    
-    #pragma unroll
-    for (int i = 0; i < NUM_BITS(u64) / BITS_PER_COUNTER; i++) {
-        u32 shift = i * BITS_PER_COUNTER;
-        u64 counter = (v >> shift) & COUNTER_MASK;
-        counter >>= 1;
-        new_val |= (counter << shift);
-    }
-    
-    *val = new_val;
+    *val = cbf_halve_word(*val);
+#endif
     return 0;
 }
 
@@ -177,24 +522,147 @@ static int clear_doorkeeper_loop_callback(u32 index, void *ctx) {
     return 0;
 }
 
+static __always_inline void doorkeeper_reset() {
+    bpf_loop(DOORKEEPER_MAP_SIZE, clear_doorkeeper_loop_callback, NULL, 0);
+#ifdef CACHE_EXT_TOPK
+    topk_new_epoch();
+#endif
+}
+
 static __always_inline void cbf_reset() {
     bpf_loop(CBF_MAP_SIZE, reset_cbf_loop_callback, NULL, 0);
-    bpf_loop(DOORKEEPER_MAP_SIZE, clear_doorkeeper_loop_callback, NULL, 0);
+    doorkeeper_reset();
+}
+
+#ifdef TINYLFU_TIMER_AGING
+// Ages CBF word word_idx, unless it already was in the sweep that runs
+static __always_inline void cbf_age_word(u32 word_idx) {
+    if (!aging_claim_word(&cbf_aged_map, word_idx))
+        return;
+
+#ifdef TINYLFU_PERCPU_SKETCH
+    // The word in every shard; one raced by its own CPU may miss this halving
+    bpf_loop(tinylfu_nr_cpus, reset_cbf_shard_callback, &word_idx, 0);
+#else
+    u64 *val = bpf_map_lookup_elem(&cbf_map, &word_idx);
+    if (val)
+        cbf_halve_word_atomic(val);
+#endif
+}
+
+static int aging_word_callback(u32 index, void *data) {
+    struct tinylfu_aging *aging = data;
+    u32 key = aging->cursor + index;
+
+    if (aging->phase == AGING_DOORKEEPER) {
+        doorkeeper_word_for_update(key);
+        return 0;
+    }
+
+    cbf_age_word(key);
+    return 0;
 }
 
-static __always_inline bool cbf_add(u32 *h) {
+static int aging_timer_callback(void *map, int *key, struct tinylfu_aging *aging) {
+    u32 size = aging->phase == AGING_DOORKEEPER ? DOORKEEPER_MAP_SIZE : CBF_MAP_SIZE;
+    u32 n = aging->cursor < size ? size - aging->cursor : 0;
+    if (n > AGING_WORDS_PER_TICK) n = AGING_WORDS_PER_TICK;
+
+    bpf_loop(n, aging_word_callback, aging, 0);
+    aging->cursor += n;
+
+    if (aging->cursor >= size) {
+        if (aging->phase == AGING_CBF) {
+            // Readers ignore phase and cursor once seq is even
+            aging->phase = AGING_DOORKEEPER;
+            aging->cursor = 0;
+            __sync_fetch_and_add(&aging->seq, 1);
+            return 0;
+        }
+        aging->phase = AGING_CBF;
+        aging->cursor = 0;
+    }
+
+    bpf_timer_start(&aging->timer, AGING_TICK_NS, 0);
+    return 0;
+}
+
+static __always_inline int aging_init() {
+    struct tinylfu_aging *aging = aging_state();
+    if (!aging) return -1;
+
+    if (bpf_timer_init(&aging->timer, &aging_map, CLOCK_MONOTONIC))
+        return -1;
+    return bpf_timer_set_callback(&aging->timer, aging_timer_callback);
+}
+
+// Starts a sweep, unless one still runs: the sample it ends is then aged
+// with it
+static __always_inline void aging_start() {
+    struct tinylfu_aging *aging = aging_state();
+    if (!aging) return;
+
+    u64 seq = aging->seq;
+    if ((seq & 1) || __sync_val_compare_and_swap(&aging->seq, seq, seq + 1) != seq)
+        return;
+    if (bpf_timer_start(&aging->timer, 0, 0)) {
+        // Words aged meanwhile count as aged in the next sweep
+        aging->seq = seq;
+        return;
+    }
+#ifdef CACHE_EXT_TOPK
+    topk_new_epoch();
+#endif
+}
+#endif
+
+// Counts an access towards the sample, and resets the sketch when it is full
+static __always_inline void cbf_count_sample() {
+#ifdef TINYLFU_PERCPU_SKETCH
+    u32 zero = 0;
+    u64 *counter = bpf_map_lookup_elem(&cbf_counter_map, &zero);
+    if (!counter) return;
+
+    u32 nr_cpus = tinylfu_nr_cpus ? tinylfu_nr_cpus : 1;
+    if (++*counter < sample_size / nr_cpus)
+        return;
+    *counter = 0;
+    // Shards age together, once the CPUs filled a sample between them
+    if ((__sync_fetch_and_add(&shard_resets, 1) + 1) % nr_cpus)
+        return;
+#else
+    __sync_fetch_and_add(&global_counter, 1);
+    if (global_counter < sample_size)
+        return;
+    global_counter = 0;
+#endif
+#ifdef TINYLFU_TIMER_AGING
+    aging_start();
+#else
+    cbf_reset();
+#endif
+#ifdef STATS
+    inc_stat(STAT_SKETCH_RESETS);
+#endif
+}
+
+static __always_inline bool cbf_add(u64 *h) {
     u32 min_val = 0xFFFFFFFF;
     u32 vals[NUM_HASH_FUNCTIONS];
 
     // 1. Find min value
     #pragma unroll
     for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        u32 idx      = h[i] % CBF_SIZE;
+        u32 idx      = h[i] & cbf_mask;
         u32 word_idx = idx / (NUM_BITS(u64) / BITS_PER_COUNTER);
         u32 shift    = (idx % (NUM_BITS(u64) / BITS_PER_COUNTER)) * BITS_PER_COUNTER;
 
         u64 *val_ptr = bpf_map_lookup_elem(&cbf_map, &word_idx);
         if (val_ptr) {
+#ifdef TINYLFU_TIMER_AGING
+            // Increment the aged word, and check saturation in what is stored
+            cbf_age_word(word_idx);
+#endif
             vals[i] = (*val_ptr >> shift) & COUNTER_MASK;
             if (vals[i] < min_val) min_val = vals[i];
         } else {
@@ -210,41 +678,73 @@ static __always_inline bool cbf_add(u32 *h) {
     #pragma unroll
     for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
         if (vals[i] < new_min) {
-            u32 idx      = h[i] % CBF_SIZE;
+            u32 idx      = h[i] & cbf_mask;
             u32 word_idx = idx / (NUM_BITS(u64) / BITS_PER_COUNTER);
             u32 shift    = (idx % (NUM_BITS(u64) / BITS_PER_COUNTER)) * BITS_PER_COUNTER;
 
             u64 *val_ptr = bpf_map_lookup_elem(&cbf_map, &word_idx);
             if (val_ptr) {
                 // TODO: can we safely ignore overflow into the next counter?
+#ifdef TINYLFU_PERCPU_SKETCH
+                // Only raced by a nested program on this CPU, which may lose
+                // an increment
+                *val_ptr += 1ULL << shift;
+#else
                 __sync_fetch_and_add(val_ptr, 1ULL << shift);
+#endif
             }
         }
     }
 
-    // 3. Global reset logic
-    __sync_fetch_and_add(&global_counter, 1);
-    if (global_counter >= (1ULL << SAMPLE_SIZE_BITS)) {
-        global_counter = 0;
-        cbf_reset();
-#ifdef STATS
-        inc_stat(STAT_SKETCH_RESETS);
-#endif
-    }
+    // 3. Reset logic
+    cbf_count_sample();
 
     return new_min >= COUNTER_MASK;
 }
 
-static __always_inline u32 cbf_estimate(u32 *h) {
+#ifdef TINYLFU_PERCPU_SKETCH
+struct cbf_estimate_ctx {
+    u64 *h;
+    u32 sum;
+};
+
+// Adds the estimate of the shard of CPU cpu
+static int cbf_estimate_shard_callback(u32 cpu, void *data) {
+    struct cbf_estimate_ctx *ctx = data;
+    u32 min_val = 0xFFFFFFFF;
+
+    for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        u32 idx      = ctx->h[i] & cbf_mask;
+        u32 word_idx = idx / (NUM_BITS(u64) / BITS_PER_COUNTER);
+        u32 shift    = (idx % (NUM_BITS(u64) / BITS_PER_COUNTER)) * BITS_PER_COUNTER;
+
+        u64 *val_ptr = bpf_map_lookup_percpu_elem(&cbf_map, &word_idx, cpu);
+        if (!val_ptr) return 0;
+
+        u32 val = (cbf_word(word_idx, *val_ptr) >> shift) & COUNTER_MASK;
+        if (val < min_val) min_val = val;
+    }
+    ctx->sum += min_val;
+    return 0;
+}
+
+static __always_inline u32 cbf_estimate(u64 *h) {
+    struct cbf_estimate_ctx ctx = { .h = h, .sum = 0 };
+
+    bpf_loop(tinylfu_nr_cpus, cbf_estimate_shard_callback, &ctx, 0);
+    return ctx.sum;
+}
+#else
+static __always_inline u32 cbf_estimate(u64 *h) {
     u32 min_val = 0xFFFFFFFF;
     for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        u32 idx      = h[i] % CBF_SIZE;
+        u32 idx      = h[i] & cbf_mask;
         u32 word_idx = idx / (NUM_BITS(u64) / BITS_PER_COUNTER);
         u32 shift    = (idx % (NUM_BITS(u64) / BITS_PER_COUNTER)) * BITS_PER_COUNTER;
 
         u64 *val_ptr = bpf_map_lookup_elem(&cbf_map, &word_idx);
         if (val_ptr) {
-            u32 val = (*val_ptr >> shift) & COUNTER_MASK;
+            u32 val = (cbf_word(word_idx, *val_ptr) >> shift) & COUNTER_MASK;
             if (val < min_val) min_val = val;
         } else {
             return 0;
@@ -252,9 +752,10 @@ static __always_inline u32 cbf_estimate(u32 *h) {
     }
     return min_val;
 }
+#endif
 
 static __always_inline u32 tinylfu_estimate(u64 addr) {
-    u32 h[NUM_HASH_FUNCTIONS];
+    u64 h[NUM_HASH_FUNCTIONS];
     get_hashes(addr, h);
 
     u32 estimate = cbf_estimate(h);
@@ -321,9 +822,109 @@ inline bool is_folio_relevant(struct folio *folio)
  * TinyLFU Implementation *****************************************************
  *****************************************************************************/
 
+// Victim candidate offered to admission by tinylfu_peek_victim: the folio the
+// latest dry pass of evict_folios selected (head of FIFO or S3-FIFO small,
+// tail of the oldest MGLRU generation, best of the LHD sample), which the
+// kernel runs for admission when there is no candidate. It is the backend's
+// next victim, still cached, and stands in for it without a pass per
+// admission until a real pass selects it, whether evicting it succeeds or
+// not, or VICTIM_MAX_AGE other evictions may have moved it in the backend's
+// order. As real passes start from the backend's next victims, this takes
+// about one dry pass per real one.
+#define VICTIM_MAX_AGE 32
+
+// request_nr_folios_to_evict of the kernel's dry pass for admission
+#define VICTIM_DRY_PASS_FOLIOS 1
+
+struct victim_candidate {
+    struct bpf_spin_lock lock;
+    // 0 if none
+    u64 ino;
+    u64 index;
+    // victim_evictions when recorded
+    u64 seq;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct victim_candidate);
+} victim_map SEC(".maps");
+
+// Folios evicted so far
+static u64 victim_evictions = 0;
+
+static __always_inline struct victim_candidate *victim_candidate() {
+    u32 zero = 0;
+    return bpf_map_lookup_elem(&victim_map, &zero);
+}
+
+// Withdraws the candidate if it is the page index of ino. Checked without the
+// lock first, which every eviction would take otherwise.
+static __always_inline void victim_candidate_drop(struct victim_candidate *victim, u64 ino, u64 index) {
+    if (victim->ino != ino || victim->index != index)
+        return;
+
+    bpf_spin_lock(&victim->lock);
+    if (victim->ino == ino && victim->index == index)
+        victim->ino = 0;
+    bpf_spin_unlock(&victim->lock);
+}
+
+// Records the folio of a dry pass as the candidate, and withdraws it if a
+// real pass selected it
+static __always_inline void victim_candidate_update(struct cache_ext_eviction_ctx *eviction_ctx) {
+    struct victim_candidate *victim = victim_candidate();
+    int nr = eviction_ctx->nr_folios_to_evict;
+    if (!victim || nr <= 0)
+        return;
+
+    if (eviction_ctx->request_nr_folios_to_evict == VICTIM_DRY_PASS_FOLIOS) {
+        struct folio *folio = eviction_ctx->folios_to_evict[0];
+        if (!folio || !folio->mapping || !folio->mapping->host)
+            return;
+
+        u64 ino = folio->mapping->host->i_ino;
+        u64 index = folio->index;
+        bpf_spin_lock(&victim->lock);
+        victim->ino = ino;
+        victim->index = index;
+        victim->seq = victim_evictions;
+        bpf_spin_unlock(&victim->lock);
+        return;
+    }
+
+    if (!victim->ino)
+        return;
+
+    for (int i = 0; i < 32 && i < nr; i++) {
+        struct folio *folio = eviction_ctx->folios_to_evict[i];
+        if (folio && folio->mapping && folio->mapping->host)
+            victim_candidate_drop(victim, folio->mapping->host->i_ino, folio->index);
+    }
+}
+
+// Withdraws the candidate if it is the folio being evicted
+static __always_inline void victim_candidate_evicted(struct folio *folio) {
+    struct victim_candidate *victim = victim_candidate();
+
+    __sync_fetch_and_add(&victim_evictions, 1);
+    if (!victim || !folio->mapping || !folio->mapping->host)
+        return;
+
+    victim_candidate_drop(victim, folio->mapping->host->i_ino, folio->index);
+}
+
 s32 BPF_STRUCT_OPS_SLEEPABLE(tinylfu_init, struct mem_cgroup *memcg)
 {
     dbg_printk("cache_ext: TinyLFU: Initialize TinyLFU\n");
+#ifdef TINYLFU_TIMER_AGING
+    if (aging_init()) {
+        bpf_printk("cache_ext: TinyLFU: Failed to initialize aging timer\n");
+        return -1;
+    }
+#endif
     return BACKEND_INIT(memcg);
 }
 
@@ -333,10 +934,43 @@ void BPF_STRUCT_OPS(
     struct mem_cgroup *memcg
 ) {
     BACKEND_EVICT_FOLIOS(eviction_ctx, memcg);
+    victim_candidate_update(eviction_ctx);
+}
+
+s32 BPF_STRUCT_OPS(
+    tinylfu_peek_victim,
+    struct cache_ext_admission_ctx *admission_ctx,
+    struct mem_cgroup *memcg
+) {
+    struct victim_candidate *victim = victim_candidate();
+    if (!victim)
+        return -1;
+
+    bpf_spin_lock(&victim->lock);
+    u64 ino = victim->ino;
+    u64 index = victim->index;
+    u64 seq = victim->seq;
+    bpf_spin_unlock(&victim->lock);
+
+    // None, or too old: let the kernel ask evict_folios
+    if (!ino || victim_evictions - seq > VICTIM_MAX_AGE)
+        return -1;
+
+    admission_ctx->victim_ino = ino;
+    admission_ctx->victim_page_offset = index;
+    return 0;
 }
 
 void BPF_STRUCT_OPS(tinylfu_folio_evicted, struct folio *folio) {
     dbg_printk("cache_ext: TinyLFU: Evicted Folio %ld\n", folio->mapping->host->i_ino);
+    victim_candidate_evicted(folio);
+#ifdef TINYLFU_CUCKOO_DOORKEEPER
+    if (is_folio_relevant(folio)) {
+        u64 h[NUM_HASH_FUNCTIONS];
+        get_hashes(get_folio_id_from_folio(folio), h);
+        doorkeeper_delete(h);
+    }
+#endif
     BACKEND_FOLIO_EVICTED(folio);
 }
 
@@ -345,6 +979,7 @@ void BPF_STRUCT_OPS(tinylfu_folio_added, struct folio *folio) {
         return;
 
     dbg_printk("cache_ext: TinyLFU: Added %ld\n", folio->mapping->host->i_ino);
+    // Not a reference for SHARDS: the read that missed reaches folio_accessed
     BACKEND_FOLIO_ADDED(folio);
 }
 
@@ -353,9 +988,15 @@ void BPF_STRUCT_OPS(tinylfu_folio_accessed, struct folio *folio) {
         return;
 
     dbg_printk("cache_ext: TinyLFU: Access:    %ld", folio->mapping->host->i_ino);
+#ifdef CACHE_EXT_SHARDS
+    shards_folio_access(folio);
+#endif
+#ifdef CACHE_EXT_TOPK
+    topk_folio_access(folio);
+#endif
 
     u64 id = get_folio_id_from_folio(folio);
-    u32 h[NUM_HASH_FUNCTIONS];
+    u64 h[NUM_HASH_FUNCTIONS];
     get_hashes(id, h);
 
 #ifdef STATS
@@ -377,29 +1018,26 @@ void BPF_STRUCT_OPS(tinylfu_folio_accessed, struct folio *folio) {
     BACKEND_FOLIO_ACCESSED(folio);
 }
 
-/*
- * Returns:
- * - False: Admits folio and uses page cache normally
- * - True:  Does not admit folio and causes that folio 
- *          to bypass the page cache.
- * 
- * This might seem counter-intuitive, but that's how it is explained
- * by the authors of cache_ext in 
- * damon_cache_ext/rocksdb/cachestream/bpf/cachestream_admit_hook.bpf.c
- */
-bool BPF_STRUCT_OPS(tinylfu_folio_admission, struct cache_ext_admission_ctx *admission_ctx) {
-    u64 new_id = get_folio_id(admission_ctx->ino, admission_ctx->offset >> PAGE_SHIFT);
-    u64 victim_id = get_folio_id(admission_ctx->victim_ino, admission_ctx->victim_page_offset);
+// Pages of a read scored by tinylfu_admit_range, as
+// CACHE_EXT_ADMISSION_MAX_PAGES in the kernel: one bit each
+#define ADMISSION_MAX_PAGES 64
 
-    if (victim_id == 0) {
-        // No victim (cache likely not full), always admit.
-#ifdef STATS
-        inc_stat(STAT_UNCONTESTED_ADMISSIONS);
-#endif
-        return false;
-    }
+static __always_inline u64 admission_first_page(struct cache_ext_admission_ctx *admission_ctx) {
+    return admission_ctx->offset >> PAGE_SHIFT;
+}
 
-    u32 h[NUM_HASH_FUNCTIONS];
+static __always_inline u64 admission_end_page(struct cache_ext_admission_ctx *admission_ctx) {
+    return (admission_ctx->offset + admission_ctx->size + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+}
+
+/*
+ * Counts an access to the page index of ino, and returns true if it loses
+ * against a victim estimated at victim_est, i.e. if it should bypass the
+ * page cache.
+ */
+static __always_inline bool tinylfu_reject_page(u64 ino, u64 index, u32 victim_est) {
+    u64 new_id = get_folio_id(ino, index);
+    u64 h[NUM_HASH_FUNCTIONS];
     get_hashes(new_id, h);
 
     if (!doorkeeper_contains(h)) {
@@ -415,7 +1053,6 @@ bool BPF_STRUCT_OPS(tinylfu_folio_admission, struct cache_ext_admission_ctx *adm
     }
 
     u32 new_est = tinylfu_estimate(new_id);
-    u32 victim_est = tinylfu_estimate(victim_id);
 
     dbg_printk(
         "TinyLFU: New %u vs Victim %u, Admit=%d\n",
@@ -429,12 +1066,170 @@ bool BPF_STRUCT_OPS(tinylfu_folio_admission, struct cache_ext_admission_ctx *adm
         inc_stat(STAT_ADMISSIONS);
 #endif
         return false;
-    } else {
+    }
+#ifdef STATS
+    inc_stat(STAT_REJECTIONS);
+#endif
+#ifdef CACHE_EXT_SHARDS
+    // Bypassed reads are references too, but never reach folio_added
+    shards_access(ino, index);
+#endif
+    return true;
+}
+
+/*
+ * Returns:
+ * - False: Admits folio and uses page cache normally
+ * - True:  Does not admit folio and causes that folio 
+ *          to bypass the page cache.
+ * 
+ * This might seem counter-intuitive, but that's how it is explained
+ * by the authors of cache_ext in 
+ * damon_cache_ext/rocksdb/cachestream/bpf/cachestream_admit_hook.bpf.c
+ *
+ * Only used by kernels without admit_range: the whole read follows the
+ * decision for its first page.
+ */
+bool BPF_STRUCT_OPS(tinylfu_folio_admission, struct cache_ext_admission_ctx *admission_ctx) {
+    u64 victim_id = get_folio_id(admission_ctx->victim_ino, admission_ctx->victim_page_offset);
+
+    if (victim_id == 0) {
+        // No victim (cache likely not full), always admit.
+#ifdef STATS
+        inc_stat(STAT_UNCONTESTED_ADMISSIONS);
+#endif
+        return false;
+    }
+
+    u64 first = admission_first_page(admission_ctx);
+    if (!tinylfu_reject_page(admission_ctx->ino, first, tinylfu_estimate(victim_id)))
+        return false;
+
+#ifdef CACHE_EXT_SHARDS
+    u64 end = admission_end_page(admission_ctx);
+    for (u32 i = 1; i < SHARDS_MAX_RANGE_PAGES && first + i < end; i++)
+        shards_access(admission_ctx->ino, first + i);
+#endif
+    return true;
+}
+
+struct admit_range_ctx {
+    u64 ino;
+    u64 first;
+    u32 victim_est;
+    u64 bypass;
+};
+
+static int admit_range_callback(u32 i, void *data) {
+    struct admit_range_ctx *ctx = data;
+
+    if (tinylfu_reject_page(ctx->ino, ctx->first + i, ctx->victim_est))
+        ctx->bypass |= 1ULL << (i & (ADMISSION_MAX_PAGES - 1));
+    return 0;
+}
+
+// Rest of the last range scored on a CPU: the kernel serves the leading run of
+// pages with the same decision, then asks again for the rest of the read from
+// the page after it
+struct admission_range {
+    u64 ino;
+    // Page the next request of the read starts at, bit 0 of bypass
+    u64 next;
+    // End of the pages scored, 0 once all served, and of the read
+    u64 end;
+    u64 read_end;
+    u64 bypass;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct admission_range);
+    __uint(max_entries, 1);
+} admission_range_map SEC(".maps");
+
+/*
+ * Returns the bitmap of the pages of last from last->next on, and consumes
+ * its leading run of pages with the same decision, as the kernel serves it.
+ * Past the pages scored, the bits are set against the last one, so that the
+ * run stops there.
+ */
+static __always_inline u64 admission_range_take(struct admission_range *last) {
+    u64 n = last->end - last->next;
+    u64 bypass = last->bypass;
+
+    if (n < ADMISSION_MAX_PAGES) {
+        u64 mask = (1ULL << n) - 1;
+        bypass &= mask;
+        if (!((bypass >> ((n - 1) & (ADMISSION_MAX_PAGES - 1))) & 1))
+            bypass |= ~mask;
+    }
+
+    u64 run_end = (bypass & 1) ? ~bypass : bypass;
+    // Trailing zeros of run_end; BPF has no ctz
+    u64 run = run_end ? __builtin_popcountll((run_end & -run_end) - 1) : ADMISSION_MAX_PAGES;
+    if (run > n)
+        run = n;
+
+    last->next += run;
+    if (last->next >= last->end)
+        last->end = 0;
+    else
+        last->bypass >>= run;
+    return bypass;
+}
+
+/*
+ * Scores each page of the read on its own against the victim, and returns
+ * the bitmap of the pages to bypass the page cache, bit 0 for the first one.
+ * Hot pages of a large read are cached and its cold ones bypass it, rather
+ * than all of them following the first page.
+ *
+ * The next request of the same read, for the page after the run served,
+ * gets the rest of the bitmap, so that each page is counted once per read.
+ * Any other request scores its pages again.
+ */
+u64 BPF_STRUCT_OPS(tinylfu_admit_range, struct cache_ext_admission_ctx *admission_ctx) {
+    u64 first = admission_first_page(admission_ctx);
+    u64 read_end = admission_end_page(admission_ctx);
+    u32 zero = 0;
+
+    struct admission_range *last = bpf_map_lookup_elem(&admission_range_map, &zero);
+    if (!last)
+        return 0;
+    if (last->end && last->ino == admission_ctx->ino && last->next == first
+        && last->read_end == read_end)
+        return admission_range_take(last);
+    last->end = 0;
+
+    u64 victim_id = get_folio_id(admission_ctx->victim_ino, admission_ctx->victim_page_offset);
+
+    if (victim_id == 0) {
+        // No victim (cache likely not full), always admit.
 #ifdef STATS
-        inc_stat(STAT_REJECTIONS);
+        inc_stat(STAT_UNCONTESTED_ADMISSIONS);
 #endif
-        return true;
+        return 0;
     }
+
+    struct admit_range_ctx ctx = {
+        .ino = admission_ctx->ino,
+        .first = first,
+        .victim_est = tinylfu_estimate(victim_id),
+        .bypass = 0,
+    };
+    u64 nr_pages = read_end - first;
+    if (nr_pages > ADMISSION_MAX_PAGES)
+        nr_pages = ADMISSION_MAX_PAGES;
+
+    bpf_loop(nr_pages, admit_range_callback, &ctx, 0);
+
+    last->ino = ctx.ino;
+    last->next = first;
+    last->end = first + nr_pages;
+    last->read_end = read_end;
+    last->bypass = ctx.bypass;
+    return admission_range_take(last);
 }
 
 bool BPF_STRUCT_OPS(tinylfu_filter_inode, u64 ino)
@@ -451,5 +1246,7 @@ struct cache_ext_ops tinylfu_ops = {
     .folio_evicted = (void *)tinylfu_folio_evicted,
     .folio_added = (void *)tinylfu_folio_added,
     .admit_folio = (void *)tinylfu_folio_admission,
+    .admit_range = (void *)tinylfu_admit_range,
+    .peek_victim = (void *)tinylfu_peek_victim,
     .filter_inode = (void *)tinylfu_filter_inode,
 };
@@ -9,7 +9,17 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cgroup_size.h"
 #include "dir_watcher.h"
+#ifdef CACHE_EXT_SHARDS
+#include "shards.h"
+#endif
+#ifdef CACHE_EXT_TOPK
+#include "topk.h"
+#endif
+#if defined(CACHE_EXT_SHARDS) || defined(CACHE_EXT_TOPK)
+#define CACHE_EXT_EXPORTS
+#endif
 
 #ifndef SKEL_HEADER
 #define SKEL_HEADER "cache_ext_tinylfu.skel.h"
@@ -22,11 +32,31 @@ char *USAGE = "Usage: ./cache_ext_tinylfu --watch_dir <dir> --cgroup_path <path>
 struct cmdline_args {
 	char *watch_dir;
 	char *cgroup_path;
+#ifdef CACHE_EXT_SHARDS
+	double shards_rate;
+	char *mrc_path;
+#endif
+#ifdef CACHE_EXT_TOPK
+	char *topk_path;
+#endif
+#ifdef CACHE_EXT_EXPORTS
+	unsigned int interval;
+#endif
 };
 
 static struct argp_option options[] = {
 	{ "watch_dir", 'w', "DIR", 0, "Directory to watch" },
 	{ "cgroup_path", 'c', "PATH", 0, "Path to cgroup (e.g., /sys/fs/cgroup/cache_ext_test)" },
+#ifdef CACHE_EXT_SHARDS
+	{ "shards_rate", 'r', "RATE", 0, "SHARDS sample rate (default: 0.01)" },
+	{ "mrc_path", 'm', "PATH", 0, "Miss ratio curve CSV, rewritten every interval" },
+#endif
+#ifdef CACHE_EXT_TOPK
+	{ "topk_path", 'k', "PATH", 0, "Hottest folios CSV, rewritten every interval" },
+#endif
+#ifdef CACHE_EXT_EXPORTS
+	{ "interval", 'i', "SECONDS", 0, "Seconds between exports (default: 10)" },
+#endif
 	{ 0 },
 };
 
@@ -46,6 +76,24 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	case 'c':
 		args->cgroup_path = arg;
 		break;
+#ifdef CACHE_EXT_SHARDS
+	case 'r':
+		args->shards_rate = strtod(arg, NULL);
+		break;
+	case 'm':
+		args->mrc_path = arg;
+		break;
+#endif
+#ifdef CACHE_EXT_TOPK
+	case 'k':
+		args->topk_path = arg;
+		break;
+#endif
+#ifdef CACHE_EXT_EXPORTS
+	case 'i':
+		args->interval = strtoul(arg, NULL, 10);
+		break;
+#endif
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -66,6 +114,30 @@ static int parse_args(int argc, char **argv, struct cmdline_args *args) {
 		return 1;
 	}
 
+#ifdef CACHE_EXT_SHARDS
+	if (args->shards_rate <= 0 || args->shards_rate > 1) {
+		fprintf(stderr, "shards_rate must be in (0, 1]\n");
+		return 1;
+	}
+
+	if (args->mrc_path == NULL) {
+		fprintf(stderr, "Missing required argument: mrc_path\n");
+		return 1;
+	}
+#endif
+
+#ifdef CACHE_EXT_TOPK
+	if (args->topk_path == NULL) {
+		fprintf(stderr, "Missing required argument: topk_path\n");
+		return 1;
+	}
+#endif
+
+#ifdef CACHE_EXT_EXPORTS
+	if (args->interval == 0)
+		args->interval = 1;
+#endif
+
 	return 0;
 }
 
@@ -96,6 +168,67 @@ static int validate_watch_dir(const char *watch_dir, char *watch_dir_full_path)
 	return 0;
 }
 
+// Bounds of the sketch, in log2 of its counters
+#define TINYLFU_MIN_SIZE_BITS 10
+#define TINYLFU_MAX_SIZE_BITS 28
+// Bound of each CPU's shard of a per-CPU sketch: 512 KiB of counters per CPU
+#define TINYLFU_PERCPU_MAX_SIZE_BITS 20
+// BITS_PER_COUNTER of cache_ext_tinylfu.bpf.c
+#define TINYLFU_BITS_PER_COUNTER 4
+
+/*
+ * Sizes the sketch to the pages of the cgroup, rounded up to a power of two,
+ * and the folio maps of the backend policy with it. The sizes as compiled
+ * (CACHE_SIZE_BITS) are kept if memory.max cannot be read or has no limit.
+ *
+ * A per-CPU CBF is allocated once per CPU, so its shards are bounded apart,
+ * and the sample shrunk so that no shard counts more than its own size allows.
+ */
+static int size_sketch(struct cache_ext_tinylfu_bpf *skel, const char *cgroup_path) {
+	uint64_t pages;
+
+	if (cgroup_cache_pages(cgroup_path, &pages)) {
+		fprintf(stderr, "Keeping the compiled sketch size\n");
+		return 0;
+	}
+
+	unsigned int bits = TINYLFU_MIN_SIZE_BITS;
+	while (bits < TINYLFU_MAX_SIZE_BITS && (1ULL << bits) < pages)
+		bits++;
+	uint64_t size = 1ULL << bits;
+
+	uint64_t cbf_size = size;
+	uint64_t sample_size = size;
+#ifdef TINYLFU_PERCPU_SKETCH
+	if (cbf_size > 1ULL << TINYLFU_PERCPU_MAX_SIZE_BITS)
+		cbf_size = 1ULL << TINYLFU_PERCPU_MAX_SIZE_BITS;
+	if (sample_size > cbf_size * skel->rodata->tinylfu_nr_cpus)
+		sample_size = cbf_size * skel->rodata->tinylfu_nr_cpus;
+#endif
+
+	skel->rodata->doorkeeper_mask = size - 1;
+	skel->rodata->cbf_mask = cbf_size - 1;
+	skel->rodata->sample_size = sample_size << TINYLFU_BITS_PER_COUNTER;
+	uint64_t doorkeeper_words = size / 64 + 1;
+	uint64_t cbf_words = cbf_size / (64 / TINYLFU_BITS_PER_COUNTER) + 1;
+	if (bpf_map__set_max_entries(skel->maps.doorkeeper_map, doorkeeper_words) ||
+	    bpf_map__set_max_entries(skel->maps.cbf_map, cbf_words)) {
+		perror("Failed to resize the sketch maps");
+		return 1;
+	}
+#ifdef TINYLFU_TIMER_AGING
+	if (bpf_map__set_max_entries(skel->maps.doorkeeper_aged_map, doorkeeper_words / 64 + 1) ||
+	    bpf_map__set_max_entries(skel->maps.cbf_aged_map, cbf_words / 64 + 1)) {
+		perror("Failed to resize the aging maps");
+		return 1;
+	}
+#endif
+	fprintf(stderr, "Cache size: %lu pages, sketch of 2^%u counters, %lu in the CBF\n",
+		pages, bits, cbf_size);
+
+	return size_folio_maps(skel->obj, pages);
+}
+
 int main(int argc, char **argv) {
 	struct cmdline_args args = { 0 };
 	struct cache_ext_tinylfu_bpf *skel = NULL;
@@ -107,6 +240,12 @@ int main(int argc, char **argv) {
 
 	libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
 
+#ifdef CACHE_EXT_SHARDS
+	args.shards_rate = 0.01;
+#endif
+#ifdef CACHE_EXT_EXPORTS
+	args.interval = 10;
+#endif
 	if (parse_args(argc, argv, &args))
 		return 1;
 
@@ -137,6 +276,14 @@ int main(int argc, char **argv) {
 
 	watch_dir_path_len_map(skel) = strlen(watch_dir_path);
 	strcpy(watch_dir_path_map(skel), watch_dir_path);
+#ifdef CACHE_EXT_SHARDS
+	shards_threshold_map(skel) = shards_rate_threshold(args.shards_rate);
+#endif
+#ifdef TINYLFU_PERCPU_SKETCH
+	skel->rodata->tinylfu_nr_cpus = libbpf_num_possible_cpus();
+#endif
+	if (size_sketch(skel, args.cgroup_path))
+		goto cleanup;
 
 	if (cache_ext_tinylfu_bpf__load(skel)) {
 		perror("Failed to load BPF skeleton");
@@ -162,9 +309,25 @@ int main(int argc, char **argv) {
 
 	// Wait for signal (SIGINT)
 	printf("Running... Press Ctrl-C to exit.\n");
+#ifdef CACHE_EXT_EXPORTS
+	// sleep() returns early on SIGINT, so the last exports cover the whole run
+	while (!exiting) {
+		sleep(args.interval);
+#ifdef CACHE_EXT_SHARDS
+		if (shards_export_mrc(bpf_map__fd(shards_hist_map(skel)), args.shards_rate,
+				      args.mrc_path))
+			fprintf(stderr, "Failed to export miss ratio curve to %s\n", args.mrc_path);
+#endif
+#ifdef CACHE_EXT_TOPK
+		if (topk_export(bpf_map__fd(topk_summaries_map(skel)), args.topk_path))
+			fprintf(stderr, "Failed to export hottest folios to %s\n", args.topk_path);
+#endif
+	}
+#else
 	while (!exiting) {
 		pause();
 	}
+#endif
 	ret = 0;
 
 #ifdef DEBUG
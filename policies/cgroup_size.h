@@ -0,0 +1,110 @@
+#ifndef _CGROUP_SIZE_H
+#define _CGROUP_SIZE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bpf/libbpf.h>
+
+/*
+ * Sizing of the policies' maps to the cgroup they serve, read from its
+ * memory.max, so that one build fits any cache size. Maps are resized
+ * between opening and loading the skeleton.
+ */
+
+// Headroom of folio_metadata_map over the pages of the cgroup: a folio can be
+// added before the one it replaces is evicted
+#define FOLIO_METADATA_HEADROOM_SHIFT 3
+#define FOLIO_METADATA_MIN_ENTRIES 4096
+
+/*
+ * Stores the pages of memory.max of the cgroup at cgroup_path in pages.
+ * Returns 0 on success, and -1 if it cannot be read or is "max": maps sized
+ * to all of physical memory would be preallocated, per CPU for some, and
+ * could fail to load, so callers keep their compiled sizes instead.
+ */
+static int cgroup_cache_pages(const char *cgroup_path, uint64_t *pages)
+{
+	char path[PATH_MAX], buf[64];
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint64_t bytes;
+
+	snprintf(path, sizeof(path), "%s/memory.max", cgroup_path);
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror("Failed to open memory.max");
+		return -1;
+	}
+	if (!fgets(buf, sizeof(buf), f)) {
+		fprintf(stderr, "Failed to read %s\n", path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	if (!strncmp(buf, "max", 3)) {
+		fprintf(stderr, "%s has no memory limit\n", path);
+		return -1;
+	}
+	bytes = strtoull(buf, NULL, 10);
+
+	*pages = bytes / page_size;
+	return *pages ? 0 : -1;
+}
+
+/*
+ * Sets the max entries of the map called name, if obj has one. Returns 0 on
+ * success.
+ */
+static int set_map_max_entries(struct bpf_object *obj, const char *name, uint64_t entries)
+{
+	struct bpf_map *map = bpf_object__find_map_by_name(obj, name);
+	if (!map)
+		return 0;
+
+	if (entries > UINT32_MAX)
+		entries = UINT32_MAX;
+	if (bpf_map__set_max_entries(map, entries)) {
+		fprintf(stderr, "Failed to resize %s to %lu entries\n", name, entries);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Sizes the per-folio maps of a policy to a cache of pages: folio_metadata_map
+ * to the folios it can hold, and ghost_map to as many evicted ones.
+ */
+static int size_folio_maps(struct bpf_object *obj, uint64_t pages)
+{
+	uint64_t entries = pages + (pages >> FOLIO_METADATA_HEADROOM_SHIFT);
+	if (entries < FOLIO_METADATA_MIN_ENTRIES)
+		entries = FOLIO_METADATA_MIN_ENTRIES;
+
+	if (set_map_max_entries(obj, "folio_metadata_map", entries))
+		return -1;
+	return set_map_max_entries(obj, "ghost_map", pages);
+}
+
+/*
+ * Sizes the per-folio maps of obj to the cgroup at cgroup_path, keeping them
+ * as compiled if its memory.max cannot be read or has no limit. Returns 0 on
+ * success.
+ */
+static int size_folio_maps_to_cgroup(struct bpf_object *obj, const char *cgroup_path)
+{
+	uint64_t pages;
+
+	if (cgroup_cache_pages(cgroup_path, &pages)) {
+		fprintf(stderr, "Keeping the compiled map sizes\n");
+		return 0;
+	}
+	fprintf(stderr, "Cache size: %lu pages\n", pages);
+	return size_folio_maps(obj, pages);
+}
+
+#endif /* _CGROUP_SIZE_H */
@@ -1,26 +1,31 @@
 #!/bin/bash
 set -e
 
+# Reader thread counts to profile (can be overridden: THREAD_COUNTS="1 64" ./profile_bpf.sh)
+THREAD_COUNTS=${THREAD_COUNTS:-"1 2 4 8 16 32 64"}
+
 # Enable BPF stats
 sudo sysctl -w kernel.bpf_stats_enabled=1 > /dev/null
 
 echo "Starting BPF Profiling..."
 echo "Please ensure the policy is RUNNING in another terminal."
 
-# Capture initial stats
-echo "Capturing initial stats..."
-sudo bpftool prog show --json > bpf_stats_start.json
+for THREADS in $THREAD_COUNTS; do
+    # Capture initial stats
+    echo "Capturing initial stats..."
+    sudo bpftool prog show --json > bpf_stats_start.json
+
+    # Run the benchmark
+    THREADS=$THREADS ./benchmark.sh
 
-# Run the benchmark
-./benchmark.sh
+    # Capture final stats
+    echo "Capturing final stats..."
+    sudo bpftool prog show --json > bpf_stats_end.json
 
-# Capture final stats
-echo "Capturing final stats..."
-sudo bpftool prog show --json > bpf_stats_end.json
+    echo "Analysis:"
+    # Simple python script to diff the stats
+    python3 analyze_stats.py "$THREADS"
+done
 
 # Disable BPF stats (optional, clean up)
 # sudo sysctl -w kernel.bpf_stats_enabled=0 > /dev/null
-
-echo "Analysis:"
-# Simple python script to diff the stats
-python3 analyze_stats.py
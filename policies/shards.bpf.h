@@ -0,0 +1,120 @@
+#ifndef __BPF_SHARDS_H
+#define __BPF_SHARDS_H
+
+#include <bpf/bpf_helpers.h>
+#include "vmlinux.h"
+#include "shards_hist.h"
+
+/*
+ * Online miss-ratio curve estimation (SHARDS, Waldspurger et al., FAST '15),
+ * for inclusion in any policy. Call shards_access() once per reference to a
+ * relevant folio: in folio_accessed, which reads reach on hits and misses
+ * alike, and for reads that bypass the cache. Not in folio_added as well,
+ * which would count every miss twice, with a reuse time of about 1.
+ *
+ * Folios are sampled by hash: those whose hash falls below shards_threshold
+ * get their reuse time, in sampled accesses, added to a per-CPU histogram.
+ * The loader turns the histogram into an LRU MRC with the AET model
+ * (shards.h). Unsampled accesses cost a hash, a compare and a per-CPU
+ * increment of the access count.
+ */
+
+// Sampled folios remembered at once; the least recently used are forgotten
+#ifndef SHARDS_MAX_KEYS
+#define SHARDS_MAX_KEYS (1 << 16)
+#endif
+
+// Pages of a bypassed range counted at most, to bound the loop
+#ifndef SHARDS_MAX_RANGE_PAGES
+#define SHARDS_MAX_RANGE_PAGES 32
+#endif
+
+// Read-only variable, filled by loader
+const volatile u32 shards_threshold = SHARDS_DEFAULT_THRESHOLD;
+
+// Sampled accesses so far
+static u64 shards_clock = 0;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, u64);
+    __uint(max_entries, SHARDS_MAX_KEYS);
+} shards_last_access SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, u64);
+    __uint(max_entries, SHARDS_HIST_BUCKETS);
+} shards_hist SEC(".maps");
+
+// MurmurHash3 64 bit finalizer, seeded apart from the policy's hashes
+static __always_inline u64 shards_hash(u64 key) {
+    key ^= 0x2545f4914f6cdd1dULL;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Index of the highest bit set; BPF has no count-leading-zeros instruction
+static __always_inline u32 shards_log2(u64 x) {
+    u32 r = 0;
+
+    if (x >> 32) { x >>= 32; r += 32; }
+    if (x >> 16) { x >>= 16; r += 16; }
+    if (x >> 8)  { x >>= 8;  r += 8; }
+    if (x >> 4)  { x >>= 4;  r += 4; }
+    if (x >> 2)  { x >>= 2;  r += 2; }
+    if (x >> 1)  { r += 1; }
+    return r;
+}
+
+static __always_inline u32 shards_bucket(u64 reuse_time) {
+    if (reuse_time < (1 << SHARDS_SUB_BITS))
+        return reuse_time;
+
+    u32 exp = shards_log2(reuse_time);
+    return ((exp - SHARDS_SUB_BITS + 1) << SHARDS_SUB_BITS) |
+           ((reuse_time >> (exp - SHARDS_SUB_BITS)) & SHARDS_SUB_MASK);
+}
+
+static __always_inline void shards_access(u64 ino, u64 index) {
+    u64 key = ino ^ ((index << 29) | (index >> 35));
+    u32 accesses_bucket = SHARDS_HIST_ACCESSES;
+
+    // Lets the loader correct for the sample missing or catching the most
+    // popular folios (SHARDS_adj)
+    u64 *accesses = bpf_map_lookup_elem(&shards_hist, &accesses_bucket);
+    if (accesses)
+        (*accesses)++;
+
+    if ((shards_hash(key) & (SHARDS_MODULUS - 1)) >= shards_threshold)
+        return;
+
+    u64 now = __sync_fetch_and_add(&shards_clock, 1) + 1;
+    u32 bucket = SHARDS_HIST_COLD;
+
+    u64 *last = bpf_map_lookup_elem(&shards_last_access, &key);
+    if (last) {
+        // A concurrent access to the same folio may have got a later time
+        u64 prev = *last;
+        bucket = shards_bucket(now > prev ? now - prev : 1);
+        *last = now;
+    } else {
+        bpf_map_update_elem(&shards_last_access, &key, &now, BPF_ANY);
+    }
+
+    u64 *count = bpf_map_lookup_elem(&shards_hist, &bucket);
+    if (count)
+        (*count)++;
+}
+
+static __always_inline void shards_folio_access(struct folio *folio) {
+    shards_access(folio->mapping->host->i_ino, folio->index);
+}
+
+#endif /* __BPF_SHARDS_H */
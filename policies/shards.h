@@ -0,0 +1,180 @@
+#ifndef _SHARDS_H
+#define _SHARDS_H
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "shards_hist.h"
+
+/*
+ * Loader side of shards.bpf.h: sets the sample rate, and turns the reuse-time
+ * histogram into an LRU miss-ratio curve with the AET model (Hu et al., ATC
+ * '16). A reference misses in an LRU cache of c pages if its reuse time
+ * exceeds the average eviction time T, the time at which the sum over t < T
+ * of P(reuse time > t) reaches c. Over sampled accesses, the curve of the
+ * sampled folios at rate R and c * R pages estimates the full one at c pages.
+ *
+ * As in SHARDS_adj, the difference between the expected and the actual
+ * number of sampled accesses is added to the shortest reuse times: it comes
+ * mostly from the sample missing, or catching, the most popular folios.
+ */
+
+#define shards_threshold_map(skel)	((skel)->rodata->shards_threshold)
+#define shards_hist_map(skel)		((skel)->maps.shards_hist)
+#define shards_last_access_map(skel)	((skel)->maps.shards_last_access)
+
+// Cache sizes of an exported curve
+#define SHARDS_MRC_POINTS 64
+
+static inline uint32_t shards_rate_threshold(double rate)
+{
+	if (rate <= 0 || rate > 1)
+		return SHARDS_DEFAULT_THRESHOLD;
+	return (uint32_t)(rate * SHARDS_MODULUS);
+}
+
+/*
+ * Sums the per-CPU histograms of map_fd into hist.
+ */
+static int shards_read_hist(int map_fd, uint64_t *hist)
+{
+	int num_cpus = libbpf_num_possible_cpus();
+	if (num_cpus <= 0)
+		return -1;
+
+	uint64_t *values = calloc(num_cpus, sizeof(uint64_t));
+	if (!values)
+		return -ENOMEM;
+
+	for (uint32_t b = 0; b < SHARDS_HIST_BUCKETS; b++) {
+		hist[b] = 0;
+		if (bpf_map_lookup_elem(map_fd, &b, values)) {
+			free(values);
+			return -1;
+		}
+		for (int cpu = 0; cpu < num_cpus; cpu++)
+			hist[b] += values[cpu];
+	}
+
+	free(values);
+	return 0;
+}
+
+static uint64_t shards_sampled(const uint64_t *hist)
+{
+	uint64_t sampled = hist[SHARDS_HIST_COLD];
+	for (int b = 0; b < SHARDS_HIST_ACCESSES; b++)
+		sampled += hist[b];
+	return sampled;
+}
+
+/*
+ * Moves the count of the shortest reuse time by the sampled accesses missing
+ * from, or in excess of, the rate.
+ */
+static void shards_adjust(uint64_t *hist, double rate)
+{
+	double diff = hist[SHARDS_HIST_ACCESSES] * rate - (double)shards_sampled(hist);
+
+	if (diff < -(double)hist[1])
+		diff = -(double)hist[1];
+	hist[1] += (int64_t)diff;
+}
+
+/*
+ * Miss ratios of LRU caches of sizes[0..n) pages, ascending, from hist at
+ * sample rate rate. P(reuse time > t) is taken as linear within a bucket.
+ */
+static void shards_aet_mrc(const uint64_t *hist, double rate, const uint64_t *sizes,
+			   size_t n, double *miss_ratios)
+{
+	uint64_t total = shards_sampled(hist);
+
+	size_t i = 0;
+	if (total == 0) {
+		for (; i < n; i++)
+			miss_ratios[i] = 1;
+		return;
+	}
+
+	// References with a reuse time of at least the current time
+	uint64_t remaining = total;
+	double area = 0;
+
+	for (int b = 1; b < SHARDS_HIST_ACCESSES && i < n; b++) {
+		double width = SHARDS_BUCKET_WIDTH(b);
+		double p0 = (double)remaining / total;
+		double p1 = (double)(remaining - hist[b]) / total;
+		double bucket_area = width * (p0 + p1) / 2;
+
+		while (i < n && area + bucket_area >= sizes[i] * rate) {
+			double x = (sizes[i] * rate - area) / ((p0 + p1) / 2);
+			miss_ratios[i++] = p0 + (p1 - p0) * x / width;
+		}
+		area += bucket_area;
+		remaining -= hist[b];
+	}
+
+	// Beyond the longest reuse time, only first references miss
+	for (; i < n; i++)
+		miss_ratios[i] = (double)hist[SHARDS_HIST_COLD] / total;
+}
+
+/*
+ * Writes the curve of the histogram in map_fd to path, as CSV with the
+ * columns of the simulator (src/src/sim_main.c), for cache sizes up to the
+ * estimated number of distinct pages. The file is replaced atomically.
+ */
+static int shards_export_mrc(int map_fd, double rate, const char *path)
+{
+	uint64_t hist[SHARDS_HIST_BUCKETS];
+	uint64_t sizes[SHARDS_MRC_POINTS];
+	double miss_ratios[SHARDS_MRC_POINTS];
+	char tmp_path[PATH_MAX];
+	int ret;
+
+	ret = shards_read_hist(map_fd, hist);
+	if (ret)
+		return ret;
+
+	uint64_t accesses = hist[SHARDS_HIST_ACCESSES];
+	shards_adjust(hist, rate);
+
+	double max_pages = hist[SHARDS_HIST_COLD] / rate;
+	if (max_pages < 2)
+		max_pages = 2;
+	for (int i = 0; i < SHARDS_MRC_POINTS; i++)
+		sizes[i] = (uint64_t)(pow(max_pages, (double)(i + 1) / SHARDS_MRC_POINTS) + 0.5);
+	shards_aet_mrc(hist, rate, sizes, SHARDS_MRC_POINTS, miss_ratios);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = fopen(tmp_path, "w");
+	if (!f)
+		return -errno;
+
+	fprintf(f, "policy,cache_pages,accesses,hits,misses,hit_ratio\n");
+	for (int i = 0; i < SHARDS_MRC_POINTS; i++) {
+		if (i > 0 && sizes[i] == sizes[i - 1])
+			continue;
+
+		uint64_t misses = (uint64_t)(miss_ratios[i] * accesses);
+		fprintf(f, "shards,%lu,%lu,%lu,%lu,%.6f\n", sizes[i], accesses,
+			accesses - misses, misses, 1 - miss_ratios[i]);
+	}
+
+	if (fclose(f))
+		return -errno;
+	if (rename(tmp_path, path))
+		return -errno;
+	return 0;
+}
+
+#endif /* _SHARDS_H */
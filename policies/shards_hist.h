@@ -0,0 +1,37 @@
+#ifndef _SHARDS_HIST_H
+#define _SHARDS_HIST_H
+
+/*
+ * Layout of the SHARDS reuse-time histogram, shared by shards.bpf.h and the
+ * loaders (shards.h).
+ *
+ * Reuse times are counted in sampled accesses. Times below 2^SHARDS_SUB_BITS
+ * have a bucket each; above, every power of two is split into
+ * 2^SHARDS_SUB_BITS buckets, up to bucket 251. The last bucket counts
+ * first references, and the one before every access, sampled or not.
+ */
+
+#define SHARDS_SUB_BITS 2
+#define SHARDS_SUB_MASK ((1ULL << SHARDS_SUB_BITS) - 1)
+#define SHARDS_HIST_BUCKETS 256
+#define SHARDS_HIST_COLD (SHARDS_HIST_BUCKETS - 1)
+#define SHARDS_HIST_ACCESSES (SHARDS_HIST_BUCKETS - 2)
+
+// Keys are sampled if their hash modulo SHARDS_MODULUS is below the
+// threshold, a rate of threshold / SHARDS_MODULUS
+#define SHARDS_MODULUS_BITS 24
+#define SHARDS_MODULUS (1ULL << SHARDS_MODULUS_BITS)
+// 1%
+#define SHARDS_DEFAULT_THRESHOLD (SHARDS_MODULUS / 100)
+
+// Lowest reuse time and width of bucket b
+#define SHARDS_BUCKET_EXP(b) (((b) >> SHARDS_SUB_BITS) + SHARDS_SUB_BITS - 1)
+#define SHARDS_BUCKET_LOW(b)                                                   \
+	((b) < (1 << SHARDS_SUB_BITS) ? (unsigned long long)(b) :              \
+	 (1ULL << SHARDS_BUCKET_EXP(b)) +                                      \
+		 (((b) & SHARDS_SUB_MASK) << (SHARDS_BUCKET_EXP(b) - SHARDS_SUB_BITS)))
+#define SHARDS_BUCKET_WIDTH(b)                                                 \
+	((b) < (1 << SHARDS_SUB_BITS) ? 1ULL :                                 \
+	 1ULL << (SHARDS_BUCKET_EXP(b) - SHARDS_SUB_BITS))
+
+#endif /* _SHARDS_HIST_H */
@@ -0,0 +1,241 @@
+#ifndef __BPF_TOPK_H
+#define __BPF_TOPK_H
+
+#include <bpf/bpf_helpers.h>
+#include "vmlinux.h"
+#include "topk_summary.h"
+
+/*
+ * Heavy-hitter folios (Space-Saving, as src/include/topk.h), for inclusion in
+ * any policy. Call topk_access() on every access to a relevant folio, and
+ * topk_new_epoch() when the frequency sketch is reset.
+ *
+ * Each CPU keeps its own summary, so updates take no lock and stay O(1).
+ * Rather than being halved, a summary is cleared when it is reused for a new
+ * sample: the loader (topk.h) sums the current summaries and half of the
+ * previous ones, over all CPUs.
+ *
+ * Lists are walked with bounded loops and indices are masked, so a summary
+ * corrupted by a nested update on the same CPU only loses accuracy.
+ */
+
+// Longest index chain followed; a folio further down is counted anew
+#define TOPK_MAX_CHAIN 16
+
+// TinyLFU resets so far
+static u64 topk_epoch = 0;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct topk_summary);
+    __uint(max_entries, TOPK_GENERATIONS);
+} topk_summaries SEC(".maps");
+
+static __always_inline void topk_new_epoch(void) {
+    __sync_fetch_and_add(&topk_epoch, 1);
+}
+
+static __always_inline u32 topk_slot(u64 ino, u64 index) {
+    u64 key = ino ^ ((index << 29) | (index >> 35));
+
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & TOPK_INDEX_MASK;
+}
+
+static __always_inline struct topk_summary_entry *topk_entry(struct topk_summary *s, u32 e) {
+    return &s->entries[e & TOPK_MASK];
+}
+
+static __always_inline struct topk_summary_bucket *topk_bucket(struct topk_summary *s, u32 b) {
+    return &s->buckets[b & TOPK_MASK];
+}
+
+static __always_inline u16 topk_find(struct topk_summary *s, u32 slot, u64 ino, u64 index) {
+    u16 e = s->index[slot & TOPK_INDEX_MASK];
+
+    for (int i = 0; i < TOPK_MAX_CHAIN && e; i++) {
+        struct topk_summary_entry *entry = topk_entry(s, e);
+        if (entry->ino == ino && entry->index == index)
+            return e;
+        e = entry->chain;
+    }
+    return 0;
+}
+
+static __always_inline void topk_index_remove(struct topk_summary *s, u32 slot, u16 e) {
+    u16 *link = &s->index[slot & TOPK_INDEX_MASK];
+
+    for (int i = 0; i < TOPK_MAX_CHAIN && *link; i++) {
+        if (*link == e) {
+            *link = topk_entry(s, e)->chain;
+            return;
+        }
+        link = &topk_entry(s, *link)->chain;
+    }
+}
+
+// Links a new bucket of the given count after the bucket after, or first if
+// after is 0. Returns 0 if none is left.
+static __always_inline u16 topk_bucket_insert_after(struct topk_summary *s, u16 after,
+                                                    u64 count) {
+    u16 b = s->free_buckets;
+
+    if (b) {
+        s->free_buckets = topk_bucket(s, b)->next;
+    } else if (s->num_buckets < TOPK_SLOTS - 1) {
+        b = ++s->num_buckets;
+    } else {
+        return 0;
+    }
+
+    struct topk_summary_bucket *bucket = topk_bucket(s, b);
+    bucket->count = count;
+    bucket->first = 0;
+    bucket->prev = after;
+    bucket->next = after ? topk_bucket(s, after)->next : s->min_bucket;
+
+    if (bucket->next)
+        topk_bucket(s, bucket->next)->prev = b;
+    if (after)
+        topk_bucket(s, after)->next = b;
+    else
+        s->min_bucket = b;
+    return b;
+}
+
+static __always_inline void topk_bucket_release(struct topk_summary *s, u16 b) {
+    struct topk_summary_bucket *bucket = topk_bucket(s, b);
+
+    if (bucket->prev)
+        topk_bucket(s, bucket->prev)->next = bucket->next;
+    else
+        s->min_bucket = bucket->next;
+    if (bucket->next)
+        topk_bucket(s, bucket->next)->prev = bucket->prev;
+
+    bucket->next = s->free_buckets;
+    s->free_buckets = b;
+}
+
+static __always_inline void topk_entry_link(struct topk_summary *s, u16 e, u16 b) {
+    struct topk_summary_entry *entry = topk_entry(s, e);
+    struct topk_summary_bucket *bucket = topk_bucket(s, b);
+
+    entry->bucket = b;
+    entry->prev = 0;
+    entry->next = bucket->first;
+    if (bucket->first)
+        topk_entry(s, bucket->first)->prev = e;
+    bucket->first = e;
+}
+
+static __always_inline void topk_entry_unlink(struct topk_summary *s, u16 e) {
+    struct topk_summary_entry *entry = topk_entry(s, e);
+    struct topk_summary_bucket *bucket = topk_bucket(s, entry->bucket);
+
+    if (entry->prev)
+        topk_entry(s, entry->prev)->next = entry->next;
+    else
+        bucket->first = entry->next;
+    if (entry->next)
+        topk_entry(s, entry->next)->prev = entry->prev;
+
+    if (!bucket->first)
+        topk_bucket_release(s, entry->bucket);
+}
+
+static __always_inline void topk_increment(struct topk_summary *s, u16 e) {
+    struct topk_summary_entry *entry = topk_entry(s, e);
+    u16 b = entry->bucket;
+    u64 count = topk_bucket(s, b)->count + 1;
+    u16 next = topk_bucket(s, b)->next;
+    bool next_fits = next && topk_bucket(s, next)->count == count;
+
+    // Alone in its bucket: the bucket moves with it
+    if (!next_fits && topk_bucket(s, b)->first == e && !entry->next) {
+        topk_bucket(s, b)->count = count;
+        return;
+    }
+
+    if (!next_fits) {
+        next = topk_bucket_insert_after(s, b, count);
+        if (!next)
+            return;
+    }
+    topk_entry_unlink(s, e);
+    topk_entry_link(s, e, next);
+}
+
+static __always_inline void topk_clear(struct topk_summary *s, u64 epoch) {
+    for (int i = 0; i < TOPK_INDEX_SLOTS; i++)
+        s->index[i] = 0;
+
+    s->epoch = epoch;
+    s->accesses = 0;
+    s->num_entries = 0;
+    s->num_buckets = 0;
+    s->min_bucket = 0;
+    s->free_buckets = 0;
+}
+
+static __always_inline void topk_access(u64 ino, u64 index) {
+    u64 epoch = topk_epoch;
+    u32 generation = epoch % TOPK_GENERATIONS;
+
+    struct topk_summary *s = bpf_map_lookup_elem(&topk_summaries, &generation);
+    if (!s)
+        return;
+    if (s->epoch != epoch)
+        topk_clear(s, epoch);
+    s->accesses++;
+
+    u32 slot = topk_slot(ino, index);
+    u16 e = topk_find(s, slot, ino, index);
+    if (e) {
+        topk_increment(s, e);
+        return;
+    }
+
+    if (s->num_entries < TOPK_SLOTS - 1) {
+        e = ++s->num_entries;
+
+        struct topk_summary_entry *entry = topk_entry(s, e);
+        entry->ino = ino;
+        entry->index = index;
+        entry->error = 0;
+        entry->bucket = 0;
+        entry->chain = s->index[slot];
+        s->index[slot] = e;
+
+        u16 b = s->min_bucket;
+        if (!b || topk_bucket(s, b)->count != 1)
+            b = topk_bucket_insert_after(s, 0, 1);
+        if (b)
+            topk_entry_link(s, e, b);
+        return;
+    }
+
+    // Replaces a folio of the lowest count, which becomes the error
+    struct topk_summary_bucket *min = topk_bucket(s, s->min_bucket);
+    e = min->first;
+    if (!e)
+        return;
+
+    struct topk_summary_entry *entry = topk_entry(s, e);
+    topk_index_remove(s, topk_slot(entry->ino, entry->index), e);
+    entry->ino = ino;
+    entry->index = index;
+    entry->error = min->count;
+    entry->chain = s->index[slot];
+    s->index[slot] = e;
+    topk_increment(s, e);
+}
+
+static __always_inline void topk_folio_access(struct folio *folio) {
+    topk_access(folio->mapping->host->i_ino, folio->index);
+}
+
+#endif /* __BPF_TOPK_H */
@@ -0,0 +1,175 @@
+#ifndef _TOPK_H
+#define _TOPK_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/types.h>
+
+#include "topk_summary.h"
+
+/*
+ * Loader side of topk.bpf.h: merges the per-CPU summaries into the hottest
+ * folios and dumps them. A folio counts in full in the summaries of the
+ * current sample, and for half in those of the previous one, as if the
+ * summary had been halved with the sketch. Counts and errors of a folio are
+ * summed over CPUs, so both bounds of Space-Saving still hold.
+ */
+
+#define topk_summaries_map(skel)	((skel)->maps.topk_summaries)
+
+// Folios dumped by topk_export()
+#define TOPK_DUMP 64
+
+struct topk_folio {
+	uint64_t ino;
+	uint64_t index;
+	uint64_t count;
+	uint64_t error;
+};
+
+static int topk_compare_folio(const void *a, const void *b)
+{
+	const struct topk_folio *x = a, *y = b;
+
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	if (x->index != y->index)
+		return x->index < y->index ? -1 : 1;
+	return 0;
+}
+
+static int topk_compare_count(const void *a, const void *b)
+{
+	const struct topk_folio *x = a, *y = b;
+
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return topk_compare_folio(a, b);
+}
+
+/*
+ * Appends the monitored folios of s, with counts shifted right by shift, to
+ * folios.
+ */
+static size_t topk_collect(const struct topk_summary *s, unsigned int shift,
+			   struct topk_folio *folios)
+{
+	size_t n = 0;
+
+	for (int e = 1; e <= s->num_entries && e < TOPK_SLOTS; e++) {
+		const struct topk_summary_entry *entry = &s->entries[e];
+		if (!entry->bucket || entry->bucket >= TOPK_SLOTS)
+			continue;
+
+		folios[n].ino = entry->ino;
+		folios[n].index = entry->index;
+		folios[n].count = s->buckets[entry->bucket].count >> shift;
+		folios[n].error = entry->error >> shift;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Stores up to n of the hottest folios in top, by decreasing count, and
+ * returns how many were stored, or a negative error.
+ */
+static int topk_read(int map_fd, struct topk_folio *top, size_t n)
+{
+	int num_cpus = libbpf_num_possible_cpus();
+	if (num_cpus <= 0)
+		return -1;
+
+	struct topk_summary *values[TOPK_GENERATIONS] = { 0 };
+	size_t max_folios = (size_t)num_cpus * TOPK_GENERATIONS * TOPK_SLOTS;
+	struct topk_folio *folios = calloc(max_folios, sizeof(struct topk_folio));
+	int ret = -ENOMEM;
+
+	for (uint32_t g = 0; g < TOPK_GENERATIONS; g++) {
+		values[g] = calloc(num_cpus, sizeof(struct topk_summary));
+		if (!values[g])
+			goto out;
+		if (bpf_map_lookup_elem(map_fd, &g, values[g])) {
+			ret = -1;
+			goto out;
+		}
+	}
+	if (!folios)
+		goto out;
+
+	size_t num_folios = 0;
+	for (int cpu = 0; cpu < num_cpus; cpu++) {
+		const struct topk_summary *cur = &values[0][cpu], *prev = &values[1][cpu];
+		if (prev->epoch > cur->epoch) {
+			cur = &values[1][cpu];
+			prev = &values[0][cpu];
+		}
+
+		num_folios += topk_collect(cur, 0, folios + num_folios);
+		if (prev->epoch + 1 == cur->epoch)
+			num_folios += topk_collect(prev, 1, folios + num_folios);
+	}
+
+	// Sums the counts of a folio over summaries
+	qsort(folios, num_folios, sizeof(struct topk_folio), topk_compare_folio);
+	size_t merged = 0;
+	for (size_t i = 0; i < num_folios; i++) {
+		if (merged > 0 && !topk_compare_folio(&folios[merged - 1], &folios[i])) {
+			folios[merged - 1].count += folios[i].count;
+			folios[merged - 1].error += folios[i].error;
+		} else {
+			folios[merged++] = folios[i];
+		}
+	}
+
+	qsort(folios, merged, sizeof(struct topk_folio), topk_compare_count);
+	if (merged > n)
+		merged = n;
+	memcpy(top, folios, merged * sizeof(struct topk_folio));
+	ret = merged;
+
+out:
+	for (int g = 0; g < TOPK_GENERATIONS; g++)
+		free(values[g]);
+	free(folios);
+	return ret;
+}
+
+/*
+ * Writes the hottest folios to path, as CSV with the columns
+ * rank,ino,index,count,error. The file is replaced atomically.
+ */
+static int topk_export(int map_fd, const char *path)
+{
+	struct topk_folio top[TOPK_DUMP];
+	char tmp_path[PATH_MAX];
+
+	int n = topk_read(map_fd, top, TOPK_DUMP);
+	if (n < 0)
+		return n;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = fopen(tmp_path, "w");
+	if (!f)
+		return -errno;
+
+	fprintf(f, "rank,ino,index,count,error\n");
+	for (int i = 0; i < n; i++)
+		fprintf(f, "%d,%lu,%lu,%lu,%lu\n", i + 1, top[i].ino, top[i].index,
+			top[i].count, top[i].error);
+
+	if (fclose(f))
+		return -errno;
+	if (rename(tmp_path, path))
+		return -errno;
+	return 0;
+}
+
+#endif /* _TOPK_H */
@@ -0,0 +1,60 @@
+#ifndef _TOPK_SUMMARY_H
+#define _TOPK_SUMMARY_H
+
+/*
+ * Layout of the per-CPU Space-Saving summaries of topk.bpf.h, shared with
+ * the loaders (topk.h). As in src/include/topk.h, monitored folios are
+ * grouped in buckets of equal count, linked by increasing count.
+ *
+ * Entries and buckets are numbered from 1, so that a zeroed summary is an
+ * empty one and 0 ends every list.
+ */
+
+// Entries and buckets of a summary, entry 0 and bucket 0 unused
+#define TOPK_SLOTS 128
+#define TOPK_MASK (TOPK_SLOTS - 1)
+
+// Index of the entries by folio hash
+#define TOPK_INDEX_SLOTS 256
+#define TOPK_INDEX_MASK (TOPK_INDEX_SLOTS - 1)
+
+// Summaries per CPU: the current TinyLFU sample and the previous one
+#define TOPK_GENERATIONS 2
+
+struct topk_summary_entry {
+	__u64 ino;
+	__u64 index;
+	// Overestimation inherited from the replaced folio
+	__u64 error;
+	__u16 bucket;
+	// Entries of the same bucket
+	__u16 prev;
+	__u16 next;
+	// Entries of the same index slot
+	__u16 chain;
+};
+
+struct topk_summary_bucket {
+	__u64 count;
+	__u16 first;
+	// Buckets by increasing count; next also links free buckets
+	__u16 prev;
+	__u16 next;
+	__u16 pad;
+};
+
+struct topk_summary {
+	// TinyLFU resets before the sample this summary counts
+	__u64 epoch;
+	__u64 accesses;
+	__u16 num_entries;
+	__u16 num_buckets;
+	// Bucket of the lowest count
+	__u16 min_bucket;
+	__u16 free_buckets;
+	__u16 index[TOPK_INDEX_SLOTS];
+	struct topk_summary_entry entries[TOPK_SLOTS];
+	struct topk_summary_bucket buckets[TOPK_SLOTS];
+};
+
+#endif /* _TOPK_SUMMARY_H */
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Words aged at once: one cache line, so aging the chunk of a word an access
+// is about to touch costs no extra memory traffic
+#define AGING_CHUNK_WORDS 8
+
+// Chunks swept per access while a reset is in progress
+#define AGING_CHUNKS_PER_ACCESS 8
+
+/**
+ * Tracks an incremental reset over an array of words split in chunks.
+ *
+ * Starting a reset only bumps the epoch. A chunk whose tag is behind the
+ * epoch has not been reset yet; it must be reset before any of its words is
+ * read or written, and is otherwise reset by a sweep advancing a few chunks
+ * per access. The array is thus always observed as if the reset had been
+ * applied to all of it at once.
+ */
+struct aging {
+    uint8_t *chunk_epochs;
+    size_t num_chunks;
+    size_t num_words;
+    uint8_t epoch;
+    // Next chunk visited by the sweep
+    size_t cursor;
+    // Chunks not reset yet in the current epoch
+    size_t num_stale;
+};
+
+struct aging* aging_init(size_t num_words);
+void aging_free(struct aging **a);
+
+static inline bool aging_in_progress(struct aging *a)
+{
+    return a->num_stale > 0;
+}
+
+static inline size_t aging_chunk_of(size_t word)
+{
+    return word / AGING_CHUNK_WORDS;
+}
+
+static inline bool aging_is_stale(struct aging *a, size_t chunk)
+{
+    return a->chunk_epochs[chunk] != a->epoch;
+}
+
+/**
+ * Returns the range of words [*first_word, *first_word + *num_words) of
+ * a chunk.
+ */
+static inline void aging_chunk_range(struct aging *a, size_t chunk,
+                                     size_t *first_word, size_t *num_words)
+{
+    *first_word = chunk * AGING_CHUNK_WORDS;
+    *num_words  = a->num_words - *first_word < AGING_CHUNK_WORDS
+                      ? a->num_words - *first_word
+                      : AGING_CHUNK_WORDS;
+}
+
+/**
+ * Marks a stale chunk as reset in the current epoch.
+ */
+static inline void aging_mark_done(struct aging *a, size_t chunk)
+{
+    a->chunk_epochs[chunk] = a->epoch;
+    a->num_stale--;
+}
+
+/**
+ * Starts a new reset, marking every chunk stale. Must not be called while a
+ * reset is in progress.
+ */
+void aging_start(struct aging *a);
+
+/**
+ * Moves the sweep to the next stale chunk and stores it in *chunk.
+ * Returns false if the reset is complete.
+ */
+bool aging_next_stale(struct aging *a, size_t *chunk);
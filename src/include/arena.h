@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Allocator of the sketch tables. Tables are mapped directly, backed by the
+ * largest pages available for their size, so that random probes into a
+ * table of hundreds of MiB hit a handful of TLB entries instead of one per
+ * 4K page:
+ *
+ *   1. 1G hugetlbfs pages (MAP_HUGETLB), for tables of at least 1 GiB,
+ *   2. 2M hugetlbfs pages, for tables of at least 2 MiB,
+ *   3. transparent huge pages (madvise(MADV_HUGEPAGE) on a 2M-aligned
+ *      mapping), when the hugetlbfs pool is empty,
+ *   4. small pages.
+ *
+ * Memory is zeroed and at least cache-line aligned. Each table is its own
+ * mapping, since tables are large and freed independently.
+ *
+ * Alternatively, tables can be mapped from a file (arena_set_file()), so that
+ * they outlive the process.
+ */
+
+enum arena_backing {
+    ARENA_HUGETLB_1G,
+    ARENA_HUGETLB_2M,
+    ARENA_THP,
+    ARENA_SMALL_PAGES,
+    // Shared mapping of a file, small pages
+    ARENA_FILE,
+    ARENA_NUM_BACKINGS,
+};
+
+struct arena_options {
+    // Try huge pages (1 to 3 above). Otherwise tables use small pages.
+    bool huge_pages;
+    // NUMA node the tables are bound to with mbind(2), -1 for the default
+    // policy of the process
+    int numa_node;
+};
+
+/**
+ * Sets the options of the allocations that follow. The default is huge
+ * pages and no NUMA binding.
+ */
+void arena_set_options(const struct arena_options *opts);
+void arena_get_options(struct arena_options *opts);
+
+/**
+ * Maps the allocations that follow on the calling thread from the file fd,
+ * shared, one after the other from offset on page boundaries, growing the
+ * file as needed. fd < 0 goes back to anonymous memory.
+ *
+ * Such memory holds whatever the file does, zeroes past its end: allocating
+ * the same sizes in the same order reattaches to the tables of a previous
+ * run, without copying them.
+ */
+void arena_set_file(int fd, size_t offset);
+
+/**
+ * File offset of the next allocation from the file of the calling thread.
+ */
+size_t arena_file_offset(void);
+
+/**
+ * Returns bytes of zeroed memory, or NULL if the mapping (or the binding to
+ * the NUMA node) failed. See arena_set_file() for file-backed memory.
+ */
+void* arena_alloc(size_t bytes);
+
+/**
+ * Frees memory returned by arena_alloc(). NULL is ignored.
+ */
+void arena_free(void *ptr);
+
+/**
+ * Pages backing memory returned by arena_alloc().
+ */
+enum arena_backing arena_backing_of(const void *ptr);
+
+const char* arena_backing_name(enum arena_backing backing);
+
+/**
+ * Bytes currently mapped for each backing.
+ */
+struct arena_stats {
+    size_t bytes[ARENA_NUM_BACKINGS];
+};
+
+void arena_get_stats(struct arena_stats *stats);
@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+ * Runs the summary benchmarks and prints their results: doorkeeper layouts
+ * and admission accuracy, sketch operations, batching, lock-free scaling,
+ * aging latency and W-TinyLFU throughput.
+ */
+void bench_summary(void);
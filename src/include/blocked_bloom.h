@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <string.h>
+#include "hash.h"
+#include "utils.h"
+
+// One block is one 64-byte cache line
+#define BLOCK_BITS  512
+#define BLOCK_WORDS (BLOCK_BITS / NUM_BITS(uint64_t))
+
+// Number of bits needed to address a bit inside a block
+#define BLOCK_BIT_SHIFT 9
+
+/**
+ * Cache-line-blocked bloom filter.
+ *
+ * All NUM_HASH_FUNCTIONS bits of a key are set inside the same 512-bit block,
+ * so that every add / contains touches a single cache line. The block index
+ * comes from h[0], the in-block bit positions from h[1..NUM_HASH_FUNCTIONS-1].
+ */
+struct blocked_bloom {
+    uint64_t *blocks;
+    size_t num_blocks;
+};
+
+struct blocked_bloom* blocked_bloom_init(size_t num_bits);
+void blocked_bloom_free(struct blocked_bloom **b);
+
+/**
+ * The block index is taken from the high bits of h[0] (multiply-shift
+ * reduction) so that it is independent of the low bits used in-block.
+ */
+static inline uint64_t* blocked_bloom_block(struct blocked_bloom *b,
+                                            struct hashes *hs)
+{
+    size_t block_idx = reduce(hs->h[0], b->num_blocks);
+    return b->blocks + block_idx * BLOCK_WORDS;
+}
+
+/**
+ * Returns the position of the j-th bit of a key inside its block.
+ * Each of the remaining hashes provides several 9-bit offsets.
+ */
+static inline uint32_t blocked_bloom_bit(struct hashes *hs, size_t j)
+{
+    uint64_t hash  = hs->h[1 + j % (NUM_HASH_FUNCTIONS - 1)];
+    uint32_t shift = BLOCK_BIT_SHIFT * (j / (NUM_HASH_FUNCTIONS - 1));
+
+    return (hash >> shift) & (BLOCK_BITS - 1);
+}
+
+static inline size_t blocked_bloom_num_words(struct blocked_bloom *b)
+{
+    return b->num_blocks * BLOCK_WORDS;
+}
+
+/**
+ * Index of the first word of the block of the key hashed to hs. All the bits
+ * of a key share one block, so i is ignored.
+ */
+static inline size_t blocked_bloom_word_with_hashes(struct blocked_bloom *b,
+                                                    struct hashes *hs, size_t i)
+{
+    (void) i;
+    return blocked_bloom_block(b, hs) - b->blocks;
+}
+
+static inline void blocked_bloom_prefetch_with_hashes(struct blocked_bloom *b,
+                                                      struct hashes *hs)
+{
+    __builtin_prefetch(blocked_bloom_block(b, hs));
+}
+
+/**
+ * Adds an address addr to the blocked bloom filter b.
+ */
+void blocked_bloom_add(struct blocked_bloom *b, uint64_t addr);
+void blocked_bloom_add_with_hashes(struct blocked_bloom *b, struct hashes *hs);
+
+/**
+ * Clears all entries in the blocked bloom filter b.
+ */
+void blocked_bloom_clear(struct blocked_bloom *b);
+
+/**
+ * Clears words [first_word, first_word + num_words) of the blocked bloom
+ * filter b.
+ */
+void blocked_bloom_clear_range(struct blocked_bloom *b, size_t first_word,
+                               size_t num_words);
+
+/**
+ * Checks if an address addr is possibly in the blocked bloom filter b.
+ * Returns true if possibly present, false if *definitely* not present.
+ */
+bool blocked_bloom_contains(struct blocked_bloom *b, uint64_t addr);
+bool blocked_bloom_contains_with_hashes(struct blocked_bloom *b, struct hashes *hs);
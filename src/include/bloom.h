@@ -50,20 +50,61 @@ static inline void bit_vector_set(struct bit_vector *vect, size_t bit_idx, bool
 struct bloom* bloom_init(size_t num_bits);
 void bloom_free(struct bloom **b);
 
+static inline size_t bloom_num_words(struct bloom *b)
+{
+    return (b->vector->size + NUM_BITS(uint64_t) - 1) / NUM_BITS(uint64_t);
+}
+
+/**
+ * Index of the word holding the i-th bit of the key hashed to hs.
+ */
+static inline size_t bloom_word_with_hashes(struct bloom *b, struct hashes *hs,
+                                            size_t i)
+{
+    return reduce(hs->h[i], b->vector->size) / NUM_BITS(uint64_t);
+}
+
+/**
+ * Prefetches the words holding the bits of the key hashed to hs.
+ */
+static inline void bloom_prefetch_with_hashes(struct bloom *b, struct hashes *hs)
+{
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        __builtin_prefetch(&b->vector->start[bloom_word_with_hashes(b, hs, i)]);
+    }
+}
+
 /**
  * Adds an address addr to the bloom filter b.
  */
 void bloom_add(struct bloom *b, uint64_t addr);
 void bloom_add_with_hashes(struct bloom *b, struct hashes *hs);
 
+/**
+ * Adds addrs[0..n) to the bloom filter b, hashing and prefetching
+ * BATCH_GROUP addresses ahead.
+ */
+void bloom_add_batch(struct bloom *b, const uint64_t *addrs, size_t n);
+
 /**
  * Clears all entries in the bloom filter b.
  */
 void bloom_clear(struct bloom *b);
 
+/**
+ * Clears words [first_word, first_word + num_words) of the bloom filter b.
+ */
+void bloom_clear_range(struct bloom *b, size_t first_word, size_t num_words);
+
 /**
  * Checks if an address addr is possibly in the bloom filter b.
  * Returns true if possibly present, false if *definitely* not present.
  */
 bool bloom_contains(struct bloom *b, uint64_t addr);
 bool bloom_contains_with_hashes(struct bloom *b, struct hashes *hs);
+
+/**
+ * Sets out[i] to bloom_contains(b, addrs[i]) for i in [0, n).
+ */
+void bloom_contains_batch(struct bloom *b, const uint64_t *addrs, size_t n,
+                          bool *out);
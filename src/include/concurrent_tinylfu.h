@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blocked_bloom.h"
+#include "frequency_sketch.h"
+
+// Number of access buffers, threads are spread over them round-robin
+#define CTLFU_NUM_STRIPES 64
+
+// Slots per access buffer (power of two)
+#define CTLFU_BUFFER_SIZE 128
+
+// Pending records in a buffer after which a drain is attempted
+#define CTLFU_DRAIN_THRESHOLD (CTLFU_BUFFER_SIZE / 2)
+
+struct access_buffer_slot {
+    uint64_t seq;
+    uint64_t addr;
+};
+
+/**
+ * Bounded MPMC ring buffer of accessed addresses (Vyukov): each slot carries
+ * a sequence number telling producers and consumers whose turn it is, so
+ * push and pop only need a CAS on their own position.
+ */
+struct access_buffer {
+    uint64_t enqueue_pos __attribute__((aligned(64)));
+    uint64_t dequeue_pos __attribute__((aligned(64)));
+    bool drain_lock      __attribute__((aligned(64)));
+    struct access_buffer_slot slots[CTLFU_BUFFER_SIZE];
+};
+
+/**
+ * TinyLFU that can be shared by many threads.
+ *
+ * Accesses are recorded in a striped access buffer and applied to the sketch
+ * in batches by whichever thread wins the buffer's drain lock, as in Caffeine.
+ * Records are dropped when a buffer is full and being drained, which only
+ * loses frequency information under heavy contention.
+ *
+ * Buffers are drained concurrently, so the sketch itself is updated with
+ * atomics: the doorkeeper is a blocked bloom filter whose bits are set with
+ * fetch-or, and the sketch is a frequency sketch whose counters of a key live
+ * in one word, incremented conservatively with a single CAS.
+ */
+struct concurrent_tinylfu {
+    struct blocked_bloom *doorkeeper;
+    struct frequency_sketch *sketch;
+    bool reset_lock;
+    struct access_buffer *buffers;
+};
+
+struct concurrent_tinylfu* concurrent_tinylfu_init(size_t doorkeeper_size,
+                                                   size_t sketch_size);
+void concurrent_tinylfu_free(struct concurrent_tinylfu **ctfu);
+
+/**
+ * Records an access to addr. Thread-safe.
+ */
+void concurrent_tinylfu_access(struct concurrent_tinylfu *ctfu, uint64_t addr);
+
+/**
+ * Applies all buffered accesses to the sketch. Thread-safe, but only
+ * guaranteed to be complete when no other thread is accessing ctfu.
+ */
+void concurrent_tinylfu_drain(struct concurrent_tinylfu *ctfu);
+
+/**
+ * Returns the estimated frequency of addr. Thread-safe, does not see
+ * accesses that are still buffered.
+ */
+uint64_t concurrent_tinylfu_estimate(struct concurrent_tinylfu *ctfu, uint64_t addr);
+
+/**
+ * Same as tinylfu_admit(). Thread-safe.
+ */
+bool concurrent_tinylfu_admit(struct concurrent_tinylfu *ctfu, uint64_t new,
+                              uint64_t victim_candidate);
@@ -14,6 +14,33 @@ struct counting_bloom {
 struct counting_bloom* counting_bloom_init(size_t num_bits);
 void counting_bloom_free(struct counting_bloom **cb);
 
+static inline size_t counting_bloom_num_words(struct counting_bloom *cb)
+{
+    return (cb->size * BITS_PER_COUNTER + NUM_BITS(uint64_t) - 1)
+               / NUM_BITS(uint64_t);
+}
+
+/**
+ * Index of the word holding the i-th counter of the key hashed to hs.
+ */
+static inline size_t counting_bloom_word_with_hashes(struct counting_bloom *cb,
+                                                     struct hashes *hs, size_t i)
+{
+    size_t idx = reduce(hs->h[i], cb->size);
+    return (idx * BITS_PER_COUNTER) / NUM_BITS(uint64_t);
+}
+
+/**
+ * Prefetches the words holding the counters of the key hashed to hs.
+ */
+static inline void counting_bloom_prefetch_with_hashes(struct counting_bloom *cb,
+                                                       struct hashes *hs)
+{
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        __builtin_prefetch(&cb->counters[counting_bloom_word_with_hashes(cb, hs, i)]);
+    }
+}
+
 /**
  * Given an address addr, for each of the k hash functions h_i,
  * increments the minimal counter among all h_i(addr).
@@ -24,6 +51,15 @@ void counting_bloom_free(struct counting_bloom **cb);
 bool counting_bloom_add(struct counting_bloom *cb, uint64_t addr);
 bool counting_bloom_add_with_hashes(struct counting_bloom *cb, struct hashes *hs);
 
+/**
+ * Adds addrs[0..n) to the counting bloom filter cb, hashing and prefetching
+ * BATCH_GROUP addresses ahead.
+ *
+ * Returns the number of adds for which a counter reached W.
+ */
+size_t counting_bloom_add_batch(struct counting_bloom *cb, const uint64_t *addrs,
+                                size_t n);
+
 /**
  * Given an address addr, for each of the k hash functions h_i,
  * returns the minimum counter value among all h_i(addr).
@@ -31,7 +67,20 @@ bool counting_bloom_add_with_hashes(struct counting_bloom *cb, struct hashes *hs
 uint64_t counting_bloom_estimate(struct counting_bloom *cb, uint64_t addr);
 uint64_t counting_bloom_estimate_with_hashes(struct counting_bloom *cb, struct hashes *hs);
 
+/**
+ * Sets out[i] to counting_bloom_estimate(cb, addrs[i]) for i in [0, n).
+ */
+void counting_bloom_estimate_batch(struct counting_bloom *cb, const uint64_t *addrs,
+                                   size_t n, uint64_t *out);
+
 /**
  * Resets all counters in the counting bloom filter to half their current value.
  */
 void counting_bloom_reset(struct counting_bloom *cb);
+
+/**
+ * Same as counting_bloom_reset(), restricted to the counters held in words
+ * [first_word, first_word + num_words).
+ */
+void counting_bloom_reset_range(struct counting_bloom *cb, size_t first_word,
+                                size_t num_words);
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdbool.h>
+#include <string.h>
+#include "hash.h"
+#include "utils.h"
+
+// Fingerprint width, 8 or 16 bits (can be overridden: -DCUCKOO_FINGERPRINT_BITS=8)
+#ifndef CUCKOO_FINGERPRINT_BITS
+#define CUCKOO_FINGERPRINT_BITS 16
+#endif
+
+#if CUCKOO_FINGERPRINT_BITS != 8 && CUCKOO_FINGERPRINT_BITS != 16
+#error "CUCKOO_FINGERPRINT_BITS must be 8 or 16"
+#endif
+
+// One bucket is one 64-bit word of fingerprints, 0 marking an empty slot
+#define CF_SLOTS_PER_BUCKET (NUM_BITS(uint64_t) / CUCKOO_FINGERPRINT_BITS)
+#define CF_FINGERPRINT_MASK ((1ULL << CUCKOO_FINGERPRINT_BITS) - 1)
+
+// Lowest and highest bit of every slot of a bucket
+#define CF_SLOT_LOW_BITS  (UINT64_MAX / CF_FINGERPRINT_MASK)
+#define CF_SLOT_HIGH_BITS (CF_SLOT_LOW_BITS << (CUCKOO_FINGERPRINT_BITS - 1))
+
+// Relocations tried by an insert before the filter is considered full
+#define CF_MAX_KICKS 500
+
+// Load factor the filter is sized for by cuckoo_filter_bits_for()
+#define CF_MAX_LOAD 0.95
+
+/**
+ * Cuckoo filter (Fan et al., CoNEXT 2014) with partial-key cuckoo hashing.
+ *
+ * A key is stored as a fingerprint in one of two buckets: i1 from h[0], and
+ * i2, derived from i1 and the fingerprint alone so that a fingerprint can be
+ * moved between its buckets without the key. Unlike a bloom filter, a key
+ * can be deleted. The false positive rate is about
+ * 2 * CF_SLOTS_PER_BUCKET / 2^CUCKOO_FINGERPRINT_BITS.
+ *
+ * Lookups compare a fingerprint against all slots of a bucket at once, in
+ * one 64-bit word (SWAR).
+ */
+struct cuckoo_filter {
+    uint64_t *buckets;
+    size_t num_buckets;
+    size_t num_items;
+    // Fingerprint evicted by the last failed insert, kept so that no key is
+    // lost; the filter accepts no insert until it is back in a bucket
+    uint64_t victim_fingerprint;
+    size_t victim_bucket;
+    // State of the choice of the slot to relocate
+    uint64_t rng;
+    // Called with each bucket a relocation or the waiting fingerprint is
+    // about to use besides the key's own, if set
+    void (*before_use)(void *arg, size_t bucket);
+    void *before_use_arg;
+};
+
+/**
+ * Creates a cuckoo filter of about num_bits bits, at least one bucket.
+ */
+struct cuckoo_filter* cuckoo_filter_init(size_t num_bits);
+void cuckoo_filter_free(struct cuckoo_filter **cf);
+
+/**
+ * Sets the function called with each bucket that an insert or a delete is
+ * about to use besides the two buckets of its key: those fingerprints are
+ * relocated through, and those of the fingerprint waiting for a slot. Lets an
+ * incremental reset clear a bucket before it is used (see tinylfu.c).
+ */
+void cuckoo_filter_set_before_use(struct cuckoo_filter *cf,
+                                  void (*before_use)(void *arg, size_t bucket), void *arg);
+
+/**
+ * Number of bits of a cuckoo filter holding n keys at CF_MAX_LOAD.
+ */
+size_t cuckoo_filter_bits_for(size_t n);
+
+/**
+ * Fingerprint of the key hashed to hs, never 0. Taken from the low bits of
+ * h[1]: its high bits follow those of h[0], which pick the bucket, when h1
+ * is small (Wang's mix of small keys).
+ */
+static inline uint64_t cuckoo_filter_fingerprint(struct hashes *hs)
+{
+    uint64_t fp = hs->h[1] & CF_FINGERPRINT_MASK;
+    return fp ? fp : 1;
+}
+
+static inline size_t cuckoo_filter_bucket(struct cuckoo_filter *cf, struct hashes *hs)
+{
+    return reduce(hs->h[0], cf->num_buckets);
+}
+
+/**
+ * The other bucket of a fingerprint in bucket i. i1 + i2 = hash(fp) modulo
+ * the number of buckets, which works for any number of buckets, not only
+ * powers of two as the xor of the original paper.
+ */
+static inline size_t cuckoo_filter_alt_bucket(struct cuckoo_filter *cf, size_t i,
+                                              uint64_t fp)
+{
+    size_t sum = reduce(hash_fmix64(fp), cf->num_buckets);
+    return sum >= i ? sum - i : sum + cf->num_buckets - i;
+}
+
+/**
+ * Bit set in the high bit of each slot of bucket equal to fp. Only the
+ * lowest set bit is exact, which is enough to test for and find a match.
+ */
+static inline uint64_t cuckoo_filter_match(uint64_t bucket, uint64_t fp)
+{
+    uint64_t x = bucket ^ (fp * CF_SLOT_LOW_BITS);
+    return (x - CF_SLOT_LOW_BITS) & ~x & CF_SLOT_HIGH_BITS;
+}
+
+/**
+ * Index of the word holding the i-th probe of the key hashed to hs: even
+ * probes are in the first bucket, odd ones in the second.
+ */
+static inline size_t cuckoo_filter_word_with_hashes(struct cuckoo_filter *cf,
+                                                    struct hashes *hs, size_t i)
+{
+    size_t i1 = cuckoo_filter_bucket(cf, hs);
+    if (i % 2 == 0) return i1;
+
+    return cuckoo_filter_alt_bucket(cf, i1, cuckoo_filter_fingerprint(hs));
+}
+
+static inline void cuckoo_filter_prefetch_with_hashes(struct cuckoo_filter *cf,
+                                                      struct hashes *hs)
+{
+    __builtin_prefetch(&cf->buckets[cuckoo_filter_word_with_hashes(cf, hs, 0)]);
+    __builtin_prefetch(&cf->buckets[cuckoo_filter_word_with_hashes(cf, hs, 1)]);
+}
+
+/**
+ * Adds the key hashed to hs. Returns false if the filter is full; the key is
+ * then not added, and no other key is lost.
+ */
+bool cuckoo_filter_add(struct cuckoo_filter *cf, uint64_t addr);
+bool cuckoo_filter_add_with_hashes(struct cuckoo_filter *cf, struct hashes *hs);
+
+/**
+ * Checks if the key is possibly in the filter. Returns false if it is
+ * *definitely* not.
+ */
+bool cuckoo_filter_contains(struct cuckoo_filter *cf, uint64_t addr);
+bool cuckoo_filter_contains_with_hashes(struct cuckoo_filter *cf, struct hashes *hs);
+
+/**
+ * Deletes one copy of the key. Returns false if it was not found. Deleting a
+ * key that was never added may delete another key sharing its fingerprint.
+ */
+bool cuckoo_filter_delete(struct cuckoo_filter *cf, uint64_t addr);
+bool cuckoo_filter_delete_with_hashes(struct cuckoo_filter *cf, struct hashes *hs);
+
+/**
+ * Clears all entries in the cuckoo filter cf.
+ */
+void cuckoo_filter_clear(struct cuckoo_filter *cf);
+
+/**
+ * Clears buckets [first_word, first_word + num_words) of the cuckoo filter cf.
+ */
+void cuckoo_filter_clear_range(struct cuckoo_filter *cf, size_t first_word,
+                               size_t num_words);
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdbool.h>
+#include "bloom.h"
+#include "blocked_bloom.h"
+#include "cuckoo_filter.h"
+
+/**
+ * Filter used as the TinyLFU doorkeeper.
+ */
+enum doorkeeper_type {
+    // Plain bloom filter, one word per hash function
+    DOORKEEPER_BLOOM,
+    // Cache-line-blocked bloom filter, one block per key
+    DOORKEEPER_BLOCKED_BLOOM,
+    // Cuckoo filter, two buckets per key; the only one keys can be deleted
+    // from
+    DOORKEEPER_CUCKOO,
+};
+
+struct doorkeeper {
+    enum doorkeeper_type type;
+    union {
+        struct bloom *bloom;
+        struct blocked_bloom *blocked;
+        struct cuckoo_filter *cuckoo;
+    };
+};
+
+struct doorkeeper* doorkeeper_init(enum doorkeeper_type type, size_t num_bits);
+void doorkeeper_free(struct doorkeeper **dk);
+
+static inline size_t doorkeeper_num_words(struct doorkeeper *dk)
+{
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        return blocked_bloom_num_words(dk->blocked);
+    case DOORKEEPER_CUCKOO:
+        return dk->cuckoo->num_buckets;
+    default:
+        return bloom_num_words(dk->bloom);
+    }
+}
+
+/**
+ * Table of doorkeeper_num_words() words holding the whole filter.
+ */
+static inline uint64_t* doorkeeper_words(struct doorkeeper *dk)
+{
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        return dk->blocked->blocks;
+    case DOORKEEPER_CUCKOO:
+        return dk->cuckoo->buckets;
+    default:
+        return dk->bloom->vector->start;
+    }
+}
+
+/**
+ * Index of the word holding the i-th bit of the key hashed to hs.
+ */
+static inline size_t doorkeeper_word_with_hashes(struct doorkeeper *dk,
+                                                 struct hashes *hs, size_t i)
+{
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        return blocked_bloom_word_with_hashes(dk->blocked, hs, i);
+    case DOORKEEPER_CUCKOO:
+        return cuckoo_filter_word_with_hashes(dk->cuckoo, hs, i);
+    default:
+        return bloom_word_with_hashes(dk->bloom, hs, i);
+    }
+}
+
+static inline void doorkeeper_prefetch_with_hashes(struct doorkeeper *dk,
+                                                   struct hashes *hs)
+{
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        blocked_bloom_prefetch_with_hashes(dk->blocked, hs);
+        break;
+    case DOORKEEPER_CUCKOO:
+        cuckoo_filter_prefetch_with_hashes(dk->cuckoo, hs);
+        break;
+    default:
+        bloom_prefetch_with_hashes(dk->bloom, hs);
+        break;
+    }
+}
+
+/**
+ * Adds the key hashed to hs. Returns false if the doorkeeper is full, which
+ * only a cuckoo filter can be.
+ */
+static inline bool doorkeeper_add_with_hashes(struct doorkeeper *dk,
+                                              struct hashes *hs)
+{
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        blocked_bloom_add_with_hashes(dk->blocked, hs);
+        return true;
+    case DOORKEEPER_CUCKOO:
+        return cuckoo_filter_add_with_hashes(dk->cuckoo, hs);
+    default:
+        bloom_add_with_hashes(dk->bloom, hs);
+        return true;
+    }
+}
+
+static inline bool doorkeeper_contains_with_hashes(struct doorkeeper *dk,
+                                                   struct hashes *hs)
+{
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        return blocked_bloom_contains_with_hashes(dk->blocked, hs);
+    case DOORKEEPER_CUCKOO:
+        return cuckoo_filter_contains_with_hashes(dk->cuckoo, hs);
+    default:
+        return bloom_contains_with_hashes(dk->bloom, hs);
+    }
+}
+
+/**
+ * Deletes the key hashed to hs from a cuckoo doorkeeper. Bloom doorkeepers
+ * cannot forget a single key and are left unchanged. Returns true if the key
+ * was deleted.
+ */
+static inline bool doorkeeper_delete_with_hashes(struct doorkeeper *dk,
+                                                 struct hashes *hs)
+{
+    switch (dk->type) {
+    case DOORKEEPER_CUCKOO:
+        return cuckoo_filter_delete_with_hashes(dk->cuckoo, hs);
+    default:
+        return false;
+    }
+}
+
+/**
+ * Sets the function called with each word of a cuckoo doorkeeper that an add
+ * or a delete is about to use besides those of its key (see
+ * cuckoo_filter_set_before_use()). Bloom doorkeepers only write the words of
+ * the key, and ignore it.
+ */
+static inline void doorkeeper_set_before_use(struct doorkeeper *dk,
+                                             void (*before_use)(void *arg, size_t word),
+                                             void *arg)
+{
+    if (dk->type == DOORKEEPER_CUCKOO) {
+        cuckoo_filter_set_before_use(dk->cuckoo, before_use, arg);
+    }
+}
+
+/**
+ * Clears all entries in the doorkeeper dk.
+ */
+void doorkeeper_clear(struct doorkeeper *dk);
+
+/**
+ * Clears words [first_word, first_word + num_words) of the doorkeeper dk.
+ */
+void doorkeeper_clear_range(struct doorkeeper *dk, size_t first_word,
+                            size_t num_words);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "hash.h"
+#include "utils.h"
+
+// Caffeine-style frequency sketch: 16 4-bit counters per 64-bit word
+#define FS_BITS_PER_COUNTER  4
+#define FS_COUNTER_MASK      ((1ULL << FS_BITS_PER_COUNTER) - 1)
+#define FS_COUNTERS_PER_WORD (NUM_BITS(uint64_t) / FS_BITS_PER_COUNTER)
+
+// Counters of a word are split in NUM_HASH_FUNCTIONS groups, one per hash
+#define FS_COUNTERS_PER_GROUP (FS_COUNTERS_PER_WORD / NUM_HASH_FUNCTIONS)
+
+// Clears the bit shifted into each counter from its neighbour on halving
+#define FS_RESET_MASK 0x7777777777777777ULL
+
+/**
+ * Count-min sketch in which all the counters of a key live in the same
+ * 64-bit word: the word is selected by h[0] and the i-th counter is picked
+ * from the i-th group of the word by h[i]. An add or estimate therefore reads
+ * (and writes) exactly one word, i.e. one cache line.
+ */
+struct frequency_sketch {
+    uint64_t *table;
+    size_t num_words;
+};
+
+struct frequency_sketch* frequency_sketch_init(size_t num_counters);
+void frequency_sketch_free(struct frequency_sketch **fs);
+
+static inline uint64_t* frequency_sketch_word(struct frequency_sketch *fs,
+                                              struct hashes *hs)
+{
+    size_t word_idx = reduce(hs->h[0], fs->num_words);
+    return fs->table + word_idx;
+}
+
+/**
+ * Bit offset of the i-th counter of a key inside its word.
+ */
+static inline uint32_t frequency_sketch_shift(struct hashes *hs, size_t i)
+{
+    uint32_t slot = (hs->h[i] >> 8) % FS_COUNTERS_PER_GROUP;
+    return (i * FS_COUNTERS_PER_GROUP + slot) * FS_BITS_PER_COUNTER;
+}
+
+/**
+ * Index of the word holding the counters of the key hashed to hs. All the
+ * counters of a key share one word, so i is ignored.
+ */
+static inline size_t frequency_sketch_word_with_hashes(struct frequency_sketch *fs,
+                                                       struct hashes *hs, size_t i)
+{
+    (void) i;
+    return frequency_sketch_word(fs, hs) - fs->table;
+}
+
+static inline void frequency_sketch_prefetch_with_hashes(struct frequency_sketch *fs,
+                                                         struct hashes *hs)
+{
+    __builtin_prefetch(frequency_sketch_word(fs, hs));
+}
+
+/**
+ * Same API as counting_bloom_add(): conservatively increments the minimal
+ * counters of addr and returns true when they saturate.
+ */
+bool frequency_sketch_add(struct frequency_sketch *fs, uint64_t addr);
+bool frequency_sketch_add_with_hashes(struct frequency_sketch *fs, struct hashes *hs);
+
+/**
+ * Returns the minimum counter value of addr.
+ */
+uint64_t frequency_sketch_estimate(struct frequency_sketch *fs, uint64_t addr);
+uint64_t frequency_sketch_estimate_with_hashes(struct frequency_sketch *fs, struct hashes *hs);
+
+/**
+ * Halves every counter of the sketch.
+ */
+void frequency_sketch_reset(struct frequency_sketch *fs);
+
+/**
+ * Halves the counters held in words [first_word, first_word + num_words).
+ */
+void frequency_sketch_reset_range(struct frequency_sketch *fs, size_t first_word,
+                                  size_t num_words);
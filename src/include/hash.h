@@ -1,13 +1,35 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "utils.h"
 
+/*
+ * Hash families. get_hashes() hashes a key once with the family selected at
+ * compile time by HASH_FAMILY, and derives NUM_HASH_FUNCTIONS 64-bit indices
+ * from it by double hashing.
+ */
+enum hash_family {
+    HASH_WANG,
+    HASH_MURMUR3,
+    HASH_XXH3,
+    HASH_WYHASH,
+    HASH_NUM_FAMILIES,
+};
+
+#ifndef HASH_FAMILY
+#define HASH_FAMILY HASH_WANG
+#endif
+
 struct hashes {
-    uint32_t h[NUM_HASH_FUNCTIONS];
+    uint64_t h[NUM_HASH_FUNCTIONS];
 };
 
+static __always_inline uint64_t hash_rotl64(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
 /**
  * Thomas Wang 64 bit Mix Functions
  * https://gist.github.com/badboy/6267743
@@ -23,17 +45,182 @@ static __always_inline uint64_t hash_64(uint64_t key) {
     return key;
 }
 
-static __always_inline void get_hashes(
-    uint64_t key, struct hashes *out
-) {
-    uint64_t hash = hash_64(key);
+/**
+ * MurmurHash3 64 bit finalizer
+ * https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+ */
+static __always_inline uint64_t hash_fmix64(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+// XXH3_len_4to8_64b constants: readLE64(kSecret + 8) ^ readLE64(kSecret + 16),
+// and PRIME_MX2
+#define XXH3_BITFLIP_8 0xc73ab174c5ecd5a2ULL
+#define XXH3_PRIME_MX2 0x9fb21c651e98df25ULL
+
+/**
+ * XXH3 64-bit hash of the 8 bytes of key (little-endian), seed 0, as
+ * XXH3_len_4to8_64b computes it.
+ * https://github.com/Cyan4973/xxHash/blob/dev/xxhash.h
+ */
+static __always_inline uint64_t hash_xxh3_64(uint64_t key) {
+    uint64_t h = hash_rotl64(key, 32) ^ XXH3_BITFLIP_8;
+
+    h ^= hash_rotl64(h, 49) ^ hash_rotl64(h, 24);
+    h *= XXH3_PRIME_MX2;
+    h ^= (h >> 35) + 8;
+    h *= XXH3_PRIME_MX2;
+
+    return h ^ (h >> 28);
+}
+
+// wyhash final3 secret
+#define WYHASH_P0 0xa0761d6478bd642fULL
+#define WYHASH_P1 0xe7037ed1a0b428dbULL
+
+/*
+ * 64x64 -> 128-bit multiply, folded as lo ^ hi.
+ */
+static __always_inline uint64_t hash_wymix(uint64_t a, uint64_t b) {
+    unsigned __int128 r = (unsigned __int128) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+/**
+ * wyhash (final3) of the 8 bytes of key (little-endian), seed 0.
+ * https://github.com/wangyi-fudan/wyhash
+ */
+static __always_inline uint64_t hash_wyhash64(uint64_t key) {
+    uint64_t a = hash_rotl64(key, 32);
+    uint64_t b = key;
+
+    return hash_wymix(WYHASH_P1 ^ 8, hash_wymix(a ^ WYHASH_P1, b ^ WYHASH_P0));
+}
+
+static __always_inline uint64_t hash_key(enum hash_family family, uint64_t key) {
+    switch (family) {
+    case HASH_MURMUR3:
+        return hash_fmix64(key);
+    case HASH_XXH3:
+        return hash_xxh3_64(key);
+    case HASH_WYHASH:
+        return hash_wyhash64(key);
+    default:
+        return hash_64(key);
+    }
+}
 
-    uint32_t h1 = (uint32_t) hash;
-    uint32_t h2 = (uint32_t) (hash >> 32);
+const char* hash_family_name(enum hash_family family);
+
+// Mixed into h1 to derive the step h2
+#define HASH_STEP_SEED 0x9e3779b97f4a7c15ULL
+
+/**
+ * Double hashing in 64 bits: h_i = h1 + (i + 1) * h2, where h2 is a second mix
+ * of h1, made odd, and indices can address more than 2^32 slots. An odd h2
+ * only keeps the probes of a key apart when they are reduced with the low-bits
+ * mask h & (n - 1) of power-of-two tables (SKETCH_REDUCE_MASK); reduce() keeps
+ * the high bits, where two probes of a key can land on the same slot, about
+ * as often as independent hashes would. Starting at h1 + h2 keeps every index
+ * well mixed in its high bits, even for families that are weak there (Wang's
+ * mix of small keys).
+ */
+static __always_inline void get_hashes_with(
+    enum hash_family family, uint64_t key, struct hashes *out
+) {
+    uint64_t h1 = hash_key(family, key);
+    uint64_t h2 = hash_fmix64(h1 ^ HASH_STEP_SEED) | 1;
 
-    // Formula: h_i = (h1 + i * h2)
     for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        out->h[i] = h1 + i * h2;
+        out->h[i] = h1 + (i + 1) * h2;
     }
 }
 
+static __always_inline void get_hashes(
+    uint64_t key, struct hashes *out
+) {
+    get_hashes_with(HASH_FAMILY, key, out);
+}
+
+/**
+ * Maps a 64-bit hash to [0, n) with a multiply and a shift instead of a
+ * modulo (Lemire's fast range reduction). The result depends on the high bits
+ * of hash, and n does not need to be a power of two.
+ */
+static __always_inline size_t reduce(uint64_t hash, size_t n) {
+    return (size_t) (((unsigned __int128) hash * n) >> 64);
+}
+
+// Number of keys hashed and prefetched ahead of use by the batch APIs
+#define BATCH_GROUP 8
+
+/**
+ * Hashes keys[0..n) into out[0..n) with get_hashes(). Uses the AVX2 kernel
+ * (four keys per vector) on x86-64 CPUs that support it, the scalar
+ * get_hashes() otherwise.
+ */
+void get_hashes_batch(const uint64_t *keys, size_t n, struct hashes *out);
+
+/**
+ * As get_hashes_batch(), with the given family instead of HASH_FAMILY.
+ */
+void get_hashes_batch_with(enum hash_family family, const uint64_t *keys, size_t n,
+                           struct hashes *out);
+
+/**
+ * Selects the implementation behind get_hashes_batch(). AVX2 is only enabled
+ * if the CPU supports it. Returns true if the AVX2 kernel is in use.
+ */
+bool get_hashes_batch_use_avx2(bool enable);
+
+/*
+ * Software-pipelined loop over addrs[0..n). Keys are hashed BATCH_GROUP at a
+ * time, and PREFETCH runs on every key of group g+1 before BODY runs on the
+ * keys of group g, so that the memory accesses of a whole group are in flight
+ * while the previous one is being processed. Both statements can refer to
+ * the current key's hashes as `hs` and to its position in addrs as `idx`.
+ */
+#define HASH_PIPELINE(addrs, n, hs, idx, PREFETCH, BODY)                      \
+do {                                                                          \
+    struct hashes __group[2][BATCH_GROUP];                                    \
+    size_t __len = (n) < BATCH_GROUP ? (n) : BATCH_GROUP;                     \
+    size_t __cur = 0;                                                         \
+                                                                              \
+    get_hashes_batch((addrs), __len, __group[0]);                             \
+    for (size_t __i = 0; __i < __len; __i++) {                                \
+        struct hashes *hs = &__group[0][__i];                                 \
+        PREFETCH;                                                             \
+    }                                                                         \
+                                                                              \
+    for (size_t __start = 0; __start < (n); __start += BATCH_GROUP) {         \
+        size_t __next = __start + BATCH_GROUP;                                \
+        size_t __next_len = 0;                                                \
+                                                                              \
+        if (__next < (n)) {                                                   \
+            __next_len = (n) - __next < BATCH_GROUP ? (n) - __next            \
+                                                    : BATCH_GROUP;            \
+            get_hashes_batch((addrs) + __next, __next_len,                    \
+                             __group[__cur ^ 1]);                             \
+            for (size_t __i = 0; __i < __next_len; __i++) {                   \
+                struct hashes *hs = &__group[__cur ^ 1][__i];                 \
+                PREFETCH;                                                     \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        for (size_t __i = 0; __i < __len; __i++) {                            \
+            struct hashes *hs = &__group[__cur][__i];                         \
+            size_t idx = __start + __i;                                       \
+            (void) idx;                                                       \
+            BODY;                                                             \
+        }                                                                     \
+                                                                              \
+        __len = __next_len;                                                   \
+        __cur ^= 1;                                                           \
+    }                                                                         \
+} while (0)
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sim.h"
+
+/*
+ * Exact LRU miss-ratio curves of page reference traces (Mattson et al.).
+ *
+ * The stack distance of a reference is the number of distinct pages
+ * referenced since the previous reference to its page: an LRU cache of c
+ * pages hits exactly the references of distance below c, so one histogram of
+ * the distances gives the misses of every cache size. Distances are counted
+ * with a Fenwick tree over time holding a mark at the last reference of
+ * every page, in O(log n) per reference.
+ *
+ * Traces are split into one time segment per thread. References whose page
+ * was referenced earlier in their segment are resolved by their thread; the
+ * first reference of each page in a segment is then resolved by replaying the
+ * segment's distinct pages, in order of first reference, after the end of
+ * the segments before it.
+ */
+
+struct mrc {
+    uint64_t accesses;
+    // Distinct pages, whose first references miss at every size
+    uint64_t num_pages;
+    // hist[d]: references of stack distance d, for d < num_pages
+    uint64_t *hist;
+    // misses[c]: misses of an LRU cache of c pages, for c <= num_pages
+    uint64_t *misses;
+};
+
+/**
+ * Computes the miss-ratio curve of trace on num_threads threads. Returns 0 on
+ * success.
+ */
+int mrc_build(const struct sim_trace *trace, int num_threads, struct mrc *mrc);
+
+/**
+ * mrc_build() of a stream. The references themselves are never loaded: the
+ * curve holds one 32-bit page id per reference, as mrc_build() does on top
+ * of the trace.
+ */
+int mrc_build_stream(const struct sim_trace_stream *s, int num_threads, struct mrc *mrc);
+void mrc_free(struct mrc *mrc);
+
+/**
+ * Misses of an LRU cache of capacity pages.
+ */
+static inline uint64_t mrc_misses(const struct mrc *mrc, uint64_t capacity)
+{
+    return mrc->misses[capacity < mrc->num_pages ? capacity : mrc->num_pages];
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sim.h"
+
+/*
+ * Belady's MIN, the optimal replacement, as an upper bound for the policies
+ * on a trace, and a measure of how far their evictions are from it.
+ *
+ * A trace is first annotated with the next reference to the page of every
+ * reference, by a reverse scan of one time segment per thread. MIN evicts the
+ * cached page, or skips the incoming one, referenced furthest in the future.
+ * Replaying a policy model over the annotated trace compares each of its
+ * victims with the page MIN would evict from the same cache, and with the
+ * incoming page, as tinylfu_folio_admission() compares victim and candidate.
+ *
+ * Unlike the simulator and the miss-ratio curves, MIN needs the whole trace
+ * in memory: the annotation scans it backwards and every replay looks up the
+ * next reference of arbitrary positions, so traces are loaded with
+ * sim_trace_load() rather than streamed, at 36 bytes per reference with the
+ * annotation.
+ */
+
+// Next reference of a page never referenced again
+#define OPT_NEVER UINT64_MAX
+
+struct opt_trace {
+    const struct sim_trace *trace;
+    // Dense page id of every reference (sim_trace_page_ids())
+    uint32_t *ids;
+    uint64_t num_pages;
+    // Position of the next reference to the same page, or OPT_NEVER
+    uint64_t *next;
+};
+
+/**
+ * Annotates trace on num_threads threads. The trace must outlive the result.
+ */
+struct opt_trace* opt_trace_init(const struct sim_trace *trace, int num_threads);
+void opt_trace_free(struct opt_trace **t);
+
+/**
+ * Policy models replayed by opt_replay(): LRU, and S3-FIFO as published
+ * (10% small FIFO, ghost FIFO as large as the main one, frequencies up to
+ * 3), evicting one page per miss.
+ */
+enum opt_model {
+    OPT_MODEL_MIN,
+    OPT_MODEL_LRU,
+    OPT_MODEL_S3FIFO,
+    OPT_NUM_MODELS,
+};
+
+struct opt_stats {
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // Misses MIN does not cache, the incoming page being the furthest
+    uint64_t bypasses;
+    // Evictions of a page referenced sooner than the one MIN would evict
+    uint64_t victim_disagreements;
+    // Evictions for a page referenced later than the victim, which MIN
+    // admission would have rejected
+    uint64_t admission_disagreements;
+};
+
+const char* opt_model_name(enum opt_model model);
+
+/**
+ * Looks up a model by name: min, lru or s3fifo. Returns -1 if there is none.
+ */
+int opt_model_parse(const char *name, enum opt_model *model);
+
+/**
+ * Replays t against model with a cache of capacity pages. Returns 0 on
+ * success.
+ */
+int opt_replay(const struct opt_trace *t, enum opt_model model, size_t capacity,
+               struct opt_stats *stats);
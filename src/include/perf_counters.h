@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_NUM_COUNTERS,
+};
+
+/**
+ * Hardware counters of the calling thread, in user mode, read through
+ * perf_event_open(2). Counters the CPU, the kernel or perf_event_paranoid do
+ * not allow are left unavailable rather than failing the whole set.
+ */
+struct perf_counters {
+    int fds[PERF_NUM_COUNTERS];
+    // Counts of the last measurement, scaled up if the counters were
+    // multiplexed
+    uint64_t values[PERF_NUM_COUNTERS];
+};
+
+/**
+ * Opens the counters. Returns the number that are available.
+ */
+int perf_counters_open(struct perf_counters *pc);
+void perf_counters_close(struct perf_counters *pc);
+
+static inline bool perf_counter_available(const struct perf_counters *pc,
+                                          enum perf_counter counter)
+{
+    return pc->fds[counter] >= 0;
+}
+
+/**
+ * Resets and enables the counters.
+ */
+void perf_counters_start(struct perf_counters *pc);
+
+/**
+ * Disables the counters and reads them into values.
+ */
+void perf_counters_stop(struct perf_counters *pc);
+
+const char* perf_counter_name(enum perf_counter counter);
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "trace.h"
+
+/*
+ * Userspace model of the cache_ext framework, used to replay page reference
+ * traces against ports of the policies in policies/.
+ *
+ * Each policy keeps the hooks of its BPF version (init, folio_added,
+ * folio_accessed, folio_evicted, evict_folios and, for TinyLFU, admit_folio
+ * and admit_range)
+ * and calls the list API below where it called the bpf_cache_ext_list_*
+ * kfuncs. Per-folio metadata, kept in BPF hash maps keyed by the folio, lives
+ * in a private area of each folio instead.
+ */
+
+// Folios the kernel asks a policy to select per eviction (SWAP_CLUSTER_MAX,
+// the size of cache_ext_eviction_ctx.folios_to_evict)
+#define SIM_EVICT_BATCH 32
+
+// Lists a policy may create
+#define SIM_MAX_LISTS 8
+
+// Pages of a read scored per admission (CACHE_EXT_ADMISSION_MAX_PAGES), one
+// bit each in the bitmap of sim_tinylfu_admit_range()
+#define SIM_ADMISSION_MAX_PAGES 64
+
+// No list, or the list iterated itself in struct sim_iterate_opts
+#define SIM_LIST_NONE 0
+#define SIM_ITERATE_SELF 0
+
+// Reference and folio flags
+#define SIM_REF_SCAN      (1 << 0) // Issued by a scanning thread (get_scan)
+#define SIM_REF_LAST_PAGE (1 << 1) // Last page of its file
+#define SIM_FOLIO_SELECTED (1 << 7) // Candidate in the current eviction
+
+enum sim_iter_ret {
+    SIM_CONTINUE_ITER,
+    SIM_EVICT_NODE,
+    SIM_STOP_ITER,
+};
+
+enum sim_iterate_mode {
+    SIM_ITERATE_TAIL,
+    SIM_ITERATE_HEAD,
+};
+
+/**
+ * A cached page. Pages are identified by (ino, index), as the policies do
+ * for ghost entries.
+ */
+struct sim_folio {
+    uint64_t ino;
+    uint64_t index;
+    struct sim_folio *prev;
+    struct sim_folio *next;
+    // Kernel LRU order, for the fallback reclaim
+    struct sim_folio *lru_prev;
+    struct sim_folio *lru_next;
+    uint8_t list;
+    uint8_t flags;
+};
+
+struct sim_list {
+    struct sim_folio *head;
+    struct sim_folio *tail;
+    size_t size;
+};
+
+/**
+ * Folios selected by evict_folios(), as in cache_ext_eviction_ctx.
+ */
+struct sim_eviction_ctx {
+    size_t request_nr_folios_to_evict;
+    size_t nr_folios_to_evict;
+    struct sim_folio *folios_to_evict[SIM_EVICT_BATCH];
+    int64_t scores[SIM_EVICT_BATCH];
+};
+
+struct sim_iterate_opts {
+    uint8_t continue_list;
+    enum sim_iterate_mode continue_mode;
+    uint8_t evict_list;
+    enum sim_iterate_mode evict_mode;
+    // Set by the iteration
+    size_t nr_folios_continue;
+};
+
+struct sim_admission_ctx {
+    uint64_t ino;
+    uint64_t index;
+    // Pages of the read from index, for sim_tinylfu_admit_range()
+    uint64_t nr_pages;
+    // 0 if there is no victim
+    uint64_t victim_ino;
+    uint64_t victim_index;
+};
+
+/**
+ * One page reference of a trace.
+ */
+struct sim_ref {
+    uint64_t ino;
+    uint64_t index;
+    uint8_t flags;
+};
+
+struct sim_trace {
+    struct sim_ref *refs;
+    size_t num_refs;
+};
+
+struct sim_cache;
+
+struct sim_policy_ops {
+    const char *name;
+    // Bytes of per-folio metadata, see sim_folio_meta()
+    size_t folio_meta_size;
+
+    int  (*init)(struct sim_cache *c);
+    void (*exit)(struct sim_cache *c);
+    void (*evict_folios)(struct sim_cache *c, struct sim_eviction_ctx *ctx);
+    void (*folio_added)(struct sim_cache *c, struct sim_folio *folio);
+    void (*folio_accessed)(struct sim_cache *c, struct sim_folio *folio);
+    void (*folio_evicted)(struct sim_cache *c, struct sim_folio *folio);
+};
+
+struct sim_tinylfu;
+
+struct sim_stats {
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // Misses TinyLFU kept out of the cache
+    uint64_t rejections;
+    // Folios requested from evict_folios() but not selected, and reclaimed
+    // in LRU order instead
+    uint64_t failed_evictions;
+};
+
+/**
+ * A page cache of capacity pages managed by one policy.
+ */
+struct sim_cache {
+    const struct sim_policy_ops *ops;
+    void *policy;
+    // TinyLFU admission in front of the policy, or NULL
+    struct sim_tinylfu *tinylfu;
+
+    size_t capacity;
+    size_t batch;
+    size_t nr_folios;
+
+    // Folios and their metadata, in one arena of stride bytes per folio
+    uint8_t *arena;
+    size_t stride;
+    struct sim_folio *free_folios;
+
+    // Open-addressing index of cached folios
+    struct sim_folio **index;
+    size_t index_mask;
+
+    struct sim_list lists[SIM_MAX_LISTS + 1];
+    uint8_t num_lists;
+
+    // Every cached folio, most recently used first
+    struct sim_folio *lru_head;
+    struct sim_folio *lru_tail;
+
+    // Flags of the reference being replayed
+    uint8_t ref_flags;
+
+    struct sim_stats stats;
+};
+
+/**
+ * Creates a cache of capacity pages managed by ops, with TinyLFU admission in
+ * front of it if tinylfu is set. Evictions select batch folios at a time.
+ */
+struct sim_cache* sim_cache_init(const struct sim_policy_ops *ops, size_t capacity,
+                                 size_t batch, bool tinylfu);
+void sim_cache_free(struct sim_cache **c);
+
+/**
+ * Replays one reference. Returns true on a hit.
+ */
+bool sim_cache_access(struct sim_cache *c, const struct sim_ref *ref);
+
+/**
+ * Replays a read of nr_pages pages from ref, as filemap_read() does with
+ * admit_range: each cached page is a hit, and a missing one asks admission
+ * about the rest of the read, whose leading run of pages with the same
+ * decision is then served. Returns the hits.
+ */
+size_t sim_cache_read(struct sim_cache *c, const struct sim_ref *ref, size_t nr_pages);
+
+static inline void *sim_folio_meta(struct sim_folio *folio)
+{
+    return folio + 1;
+}
+
+/*
+ * List API, following bpf_cache_ext_list_*(). Lists are numbered from 1.
+ */
+
+uint8_t sim_list_new(struct sim_cache *c);
+int sim_list_add(struct sim_cache *c, uint8_t list, struct sim_folio *folio);
+int sim_list_add_tail(struct sim_cache *c, uint8_t list, struct sim_folio *folio);
+int sim_list_del(struct sim_cache *c, struct sim_folio *folio);
+int sim_list_move(struct sim_cache *c, uint8_t list, struct sim_folio *folio, bool tail);
+
+static inline size_t sim_list_size(struct sim_cache *c, uint8_t list)
+{
+    return c->lists[list].size;
+}
+
+/**
+ * Walks list from its head, calling iter_fn on each folio until the request
+ * of ctx is met, iter_fn stops or every folio present at the start has been
+ * visited. Folios for which iter_fn returns SIM_EVICT_NODE are selected.
+ * Folios already selected are skipped.
+ */
+int sim_list_iterate(struct sim_cache *c, uint8_t list,
+                     int (*iter_fn)(struct sim_cache *c, int idx, struct sim_folio *folio),
+                     struct sim_eviction_ctx *ctx);
+
+/**
+ * As sim_list_iterate(), then moves selected folios to opts->evict_list and
+ * the others visited to opts->continue_list, at the head or tail.
+ */
+int sim_list_iterate_extended(struct sim_cache *c, uint8_t list,
+                              int (*iter_fn)(struct sim_cache *c, int idx,
+                                             struct sim_folio *folio),
+                              struct sim_iterate_opts *opts,
+                              struct sim_eviction_ctx *ctx);
+
+/**
+ * Scores sample_size folios per requested folio, taken from the head of list
+ * and rotated to its tail, and selects the lowest scores.
+ */
+int sim_list_sample(struct sim_cache *c, uint8_t list,
+                    int64_t (*score_fn)(struct sim_cache *c, struct sim_folio *folio),
+                    size_t sample_size, struct sim_eviction_ctx *ctx);
+
+/**
+ * Bounded map of evicted pages to a small value, dropping the least recently
+ * inserted entry when full (BPF_MAP_TYPE_LRU_HASH).
+ */
+struct sim_ghost_entry {
+    uint64_t ino;
+    uint64_t index;
+    uint32_t prev;
+    uint32_t next;
+    uint8_t value;
+};
+
+struct sim_ghost {
+    struct sim_ghost_entry *entries;
+    size_t capacity;
+    size_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t *index;
+    size_t index_mask;
+};
+
+struct sim_ghost* sim_ghost_init(size_t capacity);
+void sim_ghost_free(struct sim_ghost **g);
+void sim_ghost_put(struct sim_ghost *g, uint64_t ino, uint64_t index, uint8_t value);
+
+/**
+ * Removes the entry of a page. Returns false if there is none, otherwise
+ * stores its value in *value.
+ */
+bool sim_ghost_take(struct sim_ghost *g, uint64_t ino, uint64_t index, uint8_t *value);
+
+/**
+ * Policies, by name: fifo, mru, s3fifo, mglru, lhd, sampling, get_scan.
+ * A "tinylfu_" prefix puts TinyLFU admission in front of the policy, as the
+ * cache_ext_tiny_* variants do.
+ */
+extern const struct sim_policy_ops sim_fifo_ops;
+extern const struct sim_policy_ops sim_mru_ops;
+extern const struct sim_policy_ops sim_s3fifo_ops;
+extern const struct sim_policy_ops sim_mglru_ops;
+extern const struct sim_policy_ops sim_lhd_ops;
+extern const struct sim_policy_ops sim_sampling_ops;
+extern const struct sim_policy_ops sim_get_scan_ops;
+
+/**
+ * Looks up a policy by name. Sets *tinylfu if the name has the TinyLFU prefix.
+ * Returns NULL if there is no such policy.
+ */
+const struct sim_policy_ops* sim_policy_find(const char *name, bool *tinylfu);
+
+/*
+ * TinyLFU admission of cache_ext_tinylfu.bpf.c, sized for the cache.
+ */
+struct sim_tinylfu* sim_tinylfu_init(size_t capacity);
+void sim_tinylfu_free(struct sim_tinylfu **t);
+void sim_tinylfu_accessed(struct sim_tinylfu *t, struct sim_folio *folio);
+
+/**
+ * Returns true if the page of ctx should bypass the cache.
+ */
+bool sim_tinylfu_reject(struct sim_tinylfu *t, struct sim_admission_ctx *ctx);
+
+/**
+ * Scores each page of the read of ctx, up to SIM_ADMISSION_MAX_PAGES, and
+ * returns the bitmap of those to bypass the cache, bit 0 for ctx->index. The
+ * caller serves the leading run of pages with the same decision; the next
+ * request of the read, for the page after that run, gets the rest of the
+ * bitmap without counting its pages again.
+ */
+uint64_t sim_tinylfu_admit_range(struct sim_tinylfu *t, struct sim_admission_ctx *ctx);
+
+/**
+ * Returns the frequency TinyLFU estimates for a page.
+ */
+uint32_t sim_tinylfu_estimate(struct sim_tinylfu *t, uint64_t ino, uint64_t index);
+
+/**
+ * Reads a text trace of one reference per line: "<ino> <index> [scan]", or
+ * "<index>" for a single file. A nonzero scan field marks references of a
+ * scanning thread. The last page of each file is the highest index the trace
+ * references in it. Binary traces (see trace.h) are also read, with each key
+ * a page of a single file and TRACE_OP_SCAN records marked as references of
+ * a scanning thread. Returns 0 on success.
+ */
+int sim_trace_load(const char *path, struct sim_trace *trace);
+void sim_trace_free(struct sim_trace *trace);
+
+/**
+ * Numbers the pages of trace densely from 0, in order of first reference:
+ * sets ids[i] to the id of the page of reference i, and *num_pages to the
+ * number of pages. Returns 0 on success.
+ */
+int sim_trace_page_ids(const struct sim_trace *trace, uint32_t *ids, uint64_t *num_pages);
+
+/**
+ * A trace replayed in place. Binary traces stay in their mapping and every
+ * cursor decodes them one chunk at a time, so replaying one costs a chunk
+ * buffer per cursor whatever its length; references to the last page of
+ * their file are found by one pass over the chunks at open. Text traces are
+ * loaded with sim_trace_load().
+ */
+struct sim_trace_stream {
+    struct trace_reader *reader;
+    // Highest key of a binary trace, the last page of its single file
+    uint64_t last_index;
+    // Text traces
+    struct sim_trace trace;
+    size_t num_refs;
+};
+
+struct sim_trace_cursor {
+    const struct sim_trace_stream *stream;
+    struct trace_cursor records;
+    size_t pos;
+    struct sim_ref ref;
+};
+
+/**
+ * Opens the trace at path, read as by sim_trace_load(). Returns 0 on success.
+ */
+int sim_trace_stream_open(const char *path, struct sim_trace_stream *s);
+void sim_trace_stream_close(struct sim_trace_stream *s);
+
+/**
+ * Starts a replay of the whole trace. Threads replaying the same stream each
+ * use their own cursor.
+ */
+int sim_trace_cursor_init(struct sim_trace_cursor *cur, const struct sim_trace_stream *s);
+void sim_trace_cursor_free(struct sim_trace_cursor *cur);
+
+/**
+ * Returns the next reference, or NULL at the end of the trace. The reference
+ * stays valid until the next call.
+ */
+static inline const struct sim_ref* sim_trace_cursor_next(struct sim_trace_cursor *cur)
+{
+    const struct sim_trace_stream *s = cur->stream;
+
+    if (!s->reader) {
+        return cur->pos < s->trace.num_refs ? &s->trace.refs[cur->pos++] : NULL;
+    }
+
+    const struct trace_record *record = trace_cursor_next(&cur->records);
+    if (!record) return NULL;
+
+    cur->ref.ino   = 1;
+    cur->ref.index = record->key;
+    cur->ref.flags = (record->op == TRACE_OP_SCAN ? SIM_REF_SCAN : 0)
+                   | (record->key == s->last_index ? SIM_REF_LAST_PAGE : 0);
+    cur->pos++;
+    return &cur->ref;
+}
+
+/**
+ * sim_trace_page_ids() of a stream. The keys of binary traces are already
+ * dense (trace.h) and are only renumbered in order of first reference, with
+ * one id per key rather than a table of the pages.
+ */
+int sim_trace_stream_page_ids(const struct sim_trace_stream *s, uint32_t *ids,
+                              uint64_t *num_pages);
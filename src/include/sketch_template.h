@@ -0,0 +1,319 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "arena.h"
+#include "utils.h"
+
+/*
+ * Compile-time specialized sketches.
+ *
+ * DEFINE_COUNTING_SKETCH, DEFINE_BLOOM_FILTER and DEFINE_TINYLFU expand to a
+ * struct and static inline functions prefixed with name, in which the counter
+ * width, the number of hash functions, the hash family and the index
+ * reduction are constants. Only the sizes are chosen at runtime, by
+ * name_init().
+ *
+ * HASH is one of:
+ *   WANG       Thomas Wang's hash_64()
+ *   FMIX       MurmurHash3's 64-bit finalizer
+ *   XXH3       XXH3-64 of the key's 8 bytes
+ *   WYHASH     wyhash of the key's 8 bytes
+ *
+ * REDUCE is one of:
+ *   MASK       sizes are rounded up to a power of two, index = h & (n - 1)
+ *   FASTRANGE  sizes are kept, index = reduce(h, n)
+ */
+
+#define SKETCH_HASH_WANG(key) hash_64(key)
+#define SKETCH_HASH_FMIX(key) hash_fmix64(key)
+#define SKETCH_HASH_XXH3(key) hash_xxh3_64(key)
+#define SKETCH_HASH_WYHASH(key) hash_wyhash64(key)
+
+#define SKETCH_REDUCE_MASK(hash, n)      ((size_t) (hash) & ((n) - 1))
+#define SKETCH_REDUCE_FASTRANGE(hash, n) reduce((hash), (n))
+
+#define SKETCH_SIZE_MASK(n)      sketch_round_up_pow2(n)
+#define SKETCH_SIZE_FASTRANGE(n) ((n) ? (n) : 1)
+
+static inline size_t sketch_round_up_pow2(size_t n)
+{
+    size_t pow2 = 1;
+
+    while (pow2 < n) {
+        pow2 <<= 1;
+    }
+
+    return pow2;
+}
+
+/*
+ * Stores in idx[0..NUM_HASHES) the slots of key in a table of n slots,
+ * with the 64-bit h_i = h1 + (i + 1) * h2 of get_hashes_with().
+ */
+#define SKETCH_INDICES(HASH, REDUCE, NUM_HASHES, key, n, idx)                 \
+do {                                                                          \
+    uint64_t __h1 = SKETCH_HASH_##HASH(key);                                  \
+    uint64_t __h2 = hash_fmix64(__h1 ^ HASH_STEP_SEED) | 1;                   \
+                                                                              \
+    for (uint32_t __i = 0; __i < (NUM_HASHES); __i++) {                       \
+        (idx)[__i] = SKETCH_REDUCE_##REDUCE(__h1 + (__i + 1) * __h2, (n));    \
+    }                                                                         \
+} while (0)
+
+/**
+ * Counting bloom filter with COUNTER_BITS-bit counters (2, 4 or 8) and
+ * conservative increments, same semantics as struct counting_bloom.
+ */
+#define DEFINE_COUNTING_SKETCH(name, COUNTER_BITS, NUM_HASHES, HASH, REDUCE)  \
+_Static_assert(NUM_BITS(uint64_t) % (COUNTER_BITS) == 0,                      \
+               #name ": counters must not straddle words");                   \
+                                                                              \
+struct name {                                                                 \
+    uint64_t *counters;                                                       \
+    size_t size;                                                              \
+};                                                                            \
+                                                                              \
+static inline size_t name##_num_words(struct name *s)                         \
+{                                                                             \
+    return (s->size * (COUNTER_BITS) + NUM_BITS(uint64_t) - 1)                \
+               / NUM_BITS(uint64_t);                                          \
+}                                                                             \
+                                                                              \
+static inline struct name* name##_init(size_t num_counters)                   \
+{                                                                             \
+    struct name *s = (struct name*) malloc(sizeof(struct name));              \
+    if (!s) return NULL;                                                      \
+                                                                              \
+    s->size     = SKETCH_SIZE_##REDUCE(num_counters);                         \
+    s->counters = (uint64_t*) arena_alloc(                                    \
+        name##_num_words(s) * sizeof(uint64_t)                                \
+    );                                                                        \
+    if (!s->counters) {                                                       \
+        free(s);                                                              \
+        return NULL;                                                          \
+    }                                                                         \
+                                                                              \
+    return s;                                                                 \
+}                                                                             \
+                                                                              \
+static inline void name##_free(struct name **s)                               \
+{                                                                             \
+    if (s && *s) {                                                            \
+        arena_free((*s)->counters);                                           \
+        free(*s);                                                             \
+        *s = NULL;                                                            \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline uint64_t name##_max(void)                                       \
+{                                                                             \
+    return (1ULL << (COUNTER_BITS)) - 1;                                      \
+}                                                                             \
+                                                                              \
+static inline uint64_t name##_get(struct name *s, size_t idx)                 \
+{                                                                             \
+    size_t bit = idx * (COUNTER_BITS);                                        \
+    return (s->counters[bit / NUM_BITS(uint64_t)]                             \
+                >> (bit % NUM_BITS(uint64_t))) & name##_max();                \
+}                                                                             \
+                                                                              \
+static inline void name##_set(struct name *s, size_t idx, uint64_t val)       \
+{                                                                             \
+    size_t bit = idx * (COUNTER_BITS);                                        \
+    uint64_t *word = &s->counters[bit / NUM_BITS(uint64_t)];                  \
+                                                                              \
+    *word &= ~(name##_max() << (bit % NUM_BITS(uint64_t)));                   \
+    *word |= (val & name##_max()) << (bit % NUM_BITS(uint64_t));              \
+}                                                                             \
+                                                                              \
+/* Returns true when a counter reaches its maximum value */                   \
+static inline bool name##_add(struct name *s, uint64_t addr)                  \
+{                                                                             \
+    size_t idx[NUM_HASHES];                                                   \
+    uint64_t min_counter_value = name##_max();                                \
+                                                                              \
+    SKETCH_INDICES(HASH, REDUCE, NUM_HASHES, addr, s->size, idx);             \
+                                                                              \
+    for (size_t i = 0; i < (NUM_HASHES); i++) {                               \
+        uint64_t val = name##_get(s, idx[i]);                                 \
+        if (val < min_counter_value) {                                        \
+            min_counter_value = val;                                          \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    if (min_counter_value >= name##_max()) {                                  \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    for (size_t i = 0; i < (NUM_HASHES); i++) {                               \
+        if (name##_get(s, idx[i]) == min_counter_value) {                     \
+            name##_set(s, idx[i], min_counter_value + 1);                     \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    return min_counter_value + 1 >= name##_max();                             \
+}                                                                             \
+                                                                              \
+static inline uint64_t name##_estimate(struct name *s, uint64_t addr)         \
+{                                                                             \
+    size_t idx[NUM_HASHES];                                                   \
+    uint64_t min_counter_value = name##_max();                                \
+                                                                              \
+    SKETCH_INDICES(HASH, REDUCE, NUM_HASHES, addr, s->size, idx);             \
+                                                                              \
+    for (size_t i = 0; i < (NUM_HASHES); i++) {                               \
+        uint64_t val = name##_get(s, idx[i]);                                 \
+        if (val < min_counter_value) {                                        \
+            min_counter_value = val;                                          \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    return min_counter_value;                                                 \
+}                                                                             \
+                                                                              \
+/* Halves every counter */                                                    \
+static inline void name##_reset(struct name *s)                               \
+{                                                                             \
+    /* One in the lowest bit of every counter, times the half maximum */      \
+    uint64_t mask = (~0ULL / name##_max()) * (name##_max() >> 1);             \
+                                                                              \
+    for (size_t i = 0; i < name##_num_words(s); i++) {                        \
+        s->counters[i] = (s->counters[i] >> 1) & mask;                        \
+    }                                                                         \
+}
+
+/**
+ * Bloom filter, same semantics as struct bloom.
+ */
+#define DEFINE_BLOOM_FILTER(name, NUM_HASHES, HASH, REDUCE)                   \
+struct name {                                                                 \
+    uint64_t *bits;                                                           \
+    size_t size;                                                              \
+};                                                                            \
+                                                                              \
+static inline size_t name##_num_words(struct name *b)                         \
+{                                                                             \
+    return (b->size + NUM_BITS(uint64_t) - 1) / NUM_BITS(uint64_t);           \
+}                                                                             \
+                                                                              \
+static inline struct name* name##_init(size_t num_bits)                       \
+{                                                                             \
+    struct name *b = (struct name*) malloc(sizeof(struct name));              \
+    if (!b) return NULL;                                                      \
+                                                                              \
+    b->size = SKETCH_SIZE_##REDUCE(num_bits);                                 \
+    b->bits = (uint64_t*) arena_alloc(                                        \
+        name##_num_words(b) * sizeof(uint64_t)                                \
+    );                                                                        \
+    if (!b->bits) {                                                           \
+        free(b);                                                              \
+        return NULL;                                                          \
+    }                                                                         \
+                                                                              \
+    return b;                                                                 \
+}                                                                             \
+                                                                              \
+static inline void name##_free(struct name **b)                               \
+{                                                                             \
+    if (b && *b) {                                                            \
+        arena_free((*b)->bits);                                               \
+        free(*b);                                                             \
+        *b = NULL;                                                            \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline void name##_add(struct name *b, uint64_t addr)                  \
+{                                                                             \
+    size_t idx[NUM_HASHES];                                                   \
+                                                                              \
+    SKETCH_INDICES(HASH, REDUCE, NUM_HASHES, addr, b->size, idx);             \
+                                                                              \
+    for (size_t i = 0; i < (NUM_HASHES); i++) {                               \
+        b->bits[idx[i] / NUM_BITS(uint64_t)]                                  \
+            |= 1ULL << (idx[i] % NUM_BITS(uint64_t));                         \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline bool name##_contains(struct name *b, uint64_t addr)             \
+{                                                                             \
+    size_t idx[NUM_HASHES];                                                   \
+                                                                              \
+    SKETCH_INDICES(HASH, REDUCE, NUM_HASHES, addr, b->size, idx);             \
+                                                                              \
+    for (size_t i = 0; i < (NUM_HASHES); i++) {                               \
+        if (!((b->bits[idx[i] / NUM_BITS(uint64_t)]                           \
+                   >> (idx[i] % NUM_BITS(uint64_t))) & 1)) {                  \
+            return false;                                                     \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    return true;                                                              \
+}                                                                             \
+                                                                              \
+static inline void name##_clear(struct name *b)                               \
+{                                                                             \
+    memset(b->bits, 0, name##_num_words(b) * sizeof(uint64_t));               \
+}
+
+/**
+ * TinyLFU over a bloom filter type BLOOM and a counting sketch type SKETCH
+ * defined with the macros above, same semantics as struct tinylfu with
+ * stop-the-world aging.
+ */
+#define DEFINE_TINYLFU(name, BLOOM, SKETCH)                                   \
+struct name {                                                                 \
+    struct BLOOM *doorkeeper;                                                 \
+    struct SKETCH *sketch;                                                    \
+};                                                                            \
+                                                                              \
+static inline void name##_free(struct name **tfu)                             \
+{                                                                             \
+    if (tfu && *tfu) {                                                        \
+        BLOOM##_free(&(*tfu)->doorkeeper);                                    \
+        SKETCH##_free(&(*tfu)->sketch);                                       \
+        free(*tfu);                                                           \
+        *tfu = NULL;                                                          \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline struct name* name##_init(size_t doorkeeper_size,                \
+                                       size_t sketch_size)                    \
+{                                                                             \
+    struct name *tfu = (struct name*) malloc(sizeof(struct name));            \
+    if (!tfu) return NULL;                                                    \
+                                                                              \
+    tfu->doorkeeper = BLOOM##_init(doorkeeper_size);                          \
+    tfu->sketch     = SKETCH##_init(sketch_size);                             \
+    if (!tfu->doorkeeper || !tfu->sketch) {                                   \
+        name##_free(&tfu);                                                    \
+        return NULL;                                                          \
+    }                                                                         \
+                                                                              \
+    return tfu;                                                               \
+}                                                                             \
+                                                                              \
+static inline void name##_access(struct name *tfu, uint64_t addr)             \
+{                                                                             \
+    if (!BLOOM##_contains(tfu->doorkeeper, addr)) {                           \
+        BLOOM##_add(tfu->doorkeeper, addr);                                   \
+    } else if (SKETCH##_add(tfu->sketch, addr)) {                             \
+        SKETCH##_reset(tfu->sketch);                                          \
+        BLOOM##_clear(tfu->doorkeeper);                                       \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline uint64_t name##_estimate(struct name *tfu, uint64_t addr)       \
+{                                                                             \
+    return SKETCH##_estimate(tfu->sketch, addr)                               \
+           + BLOOM##_contains(tfu->doorkeeper, addr);                         \
+}                                                                             \
+                                                                              \
+static inline bool name##_admit(struct name *tfu, uint64_t new,               \
+                                uint64_t victim_candidate)                    \
+{                                                                             \
+    return name##_estimate(tfu, new) > name##_estimate(tfu, victim_candidate);\
+}
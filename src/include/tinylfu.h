@@ -1,15 +1,112 @@
 #pragma once
 
 #include "utils.h"
-#include "bloom.h"
-#include "counting_bloom.h"
+#include "doorkeeper.h"
+#include "aging.h"
+#include "topk.h"
+
+/*
+ * Frequency sketch behind the doorkeeper, selected at build time
+ * (make SKETCH=frequency_sketch).
+ */
+#ifdef TINYLFU_FREQUENCY_SKETCH
+    #include "frequency_sketch.h"
+
+    #define tinylfu_sketch                      frequency_sketch
+    #define tinylfu_sketch_init                 frequency_sketch_init
+    #define tinylfu_sketch_free                 frequency_sketch_free
+    #define tinylfu_sketch_add_with_hashes      frequency_sketch_add_with_hashes
+    #define tinylfu_sketch_estimate_with_hashes frequency_sketch_estimate_with_hashes
+    #define tinylfu_sketch_reset                frequency_sketch_reset
+    #define tinylfu_sketch_reset_range          frequency_sketch_reset_range
+    #define tinylfu_sketch_num_words(fs)        ((fs)->num_words)
+    #define tinylfu_sketch_words(fs)            ((fs)->table)
+    #define tinylfu_sketch_word_with_hashes     frequency_sketch_word_with_hashes
+    #define tinylfu_sketch_prefetch_with_hashes frequency_sketch_prefetch_with_hashes
+    #define TINYLFU_SKETCH_BITS_PER_COUNTER     FS_BITS_PER_COUNTER
+#else
+    #include "counting_bloom.h"
+
+    #define tinylfu_sketch                      counting_bloom
+    #define tinylfu_sketch_init                 counting_bloom_init
+    #define tinylfu_sketch_free                 counting_bloom_free
+    #define tinylfu_sketch_add_with_hashes      counting_bloom_add_with_hashes
+    #define tinylfu_sketch_estimate_with_hashes counting_bloom_estimate_with_hashes
+    #define tinylfu_sketch_reset                counting_bloom_reset
+    #define tinylfu_sketch_reset_range          counting_bloom_reset_range
+    #define tinylfu_sketch_num_words            counting_bloom_num_words
+    #define tinylfu_sketch_words(cb)            ((cb)->counters)
+    #define tinylfu_sketch_word_with_hashes     counting_bloom_word_with_hashes
+    #define tinylfu_sketch_prefetch_with_hashes counting_bloom_prefetch_with_hashes
+    #define TINYLFU_SKETCH_BITS_PER_COUNTER     BITS_PER_COUNTER
+#endif
+
+/**
+ * How the sketch is halved and the doorkeeper cleared once a counter
+ * saturates.
+ */
+enum tinylfu_aging {
+    // Chunks are reset when first touched or by a sweep of
+    // AGING_CHUNKS_PER_ACCESS chunks per access
+    TINYLFU_AGING_INCREMENTAL,
+    // Everything is reset inside the access that saturated the counter
+    TINYLFU_AGING_STOP_THE_WORLD,
+};
 
 struct tinylfu {
-    struct bloom *doorkeeper;
-    struct counting_bloom *cbf;
+    struct doorkeeper *doorkeeper;
+    struct tinylfu_sketch *sketch;
+    enum tinylfu_aging aging;
+    struct aging *doorkeeper_aging;
+    struct aging *sketch_aging;
+    // Accesses between resets, 0 to reset when a counter saturates
+    size_t sample_size;
+    size_t accesses;
+    // Resets started so far
+    uint64_t resets;
+    // Sizes requested at init, recorded in snapshots
+    size_t doorkeeper_size;
+    size_t sketch_size;
+    // File the doorkeeper and sketch are mapped from, NULL if in memory
+    struct tinylfu_file *file;
+    // Most accessed keys, halved with the sketch; NULL if not tracked
+    struct topk *topk;
+};
+
+/**
+ * Sizes left to 0 are derived from expected_entries and fp_rate, or default
+ * to 10240 if expected_entries is 0 too.
+ */
+struct tinylfu_config {
+    enum tinylfu_aging aging;
+    enum doorkeeper_type doorkeeper_type;
+    // Number of distinct items expected within a sample
+    size_t expected_entries;
+    // Target false positive rate of a bloom doorkeeper, 1% if 0
+    double fp_rate;
+    // Number of bits in the doorkeeper
+    size_t doorkeeper_size;
+    // Number of counters in the frequency sketch
+    size_t sketch_size;
+    // Accesses between resets (the sample size W of the TinyLFU paper), or
+    // 0 to reset only when a counter saturates
+    size_t sample_size;
+    // File to map the doorkeeper and sketch from, NULL to keep them in
+    // memory (see tinylfu_file.h)
+    const char *path;
+    // Keys tracked as heavy hitters (see topk.h), 0 for none
+    size_t topk_size;
 };
 
-struct tinylfu* tinylfu_init();
+/**
+ * Creates a TinyLFU with the sketch layout and sizes taken from config, or
+ * with the defaults if config is NULL.
+ *
+ * With config->path set, the doorkeeper and sketch are mapped from that file.
+ * If it was left by tinylfu_free() or tinylfu_snapshot() with the same
+ * layout, the TinyLFU resumes from its contents; otherwise it starts empty.
+ */
+struct tinylfu* tinylfu_init(const struct tinylfu_config *config);
 void tinylfu_free(struct tinylfu **tfu);
 
 /**
@@ -17,11 +114,34 @@ void tinylfu_free(struct tinylfu **tfu);
  */
 void tinylfu_access(struct tinylfu *tfu, uint64_t addr);
 
+/**
+ * Records accesses to addrs[0..n), in order. Equivalent to calling
+ * tinylfu_access() on each address, but hashes and prefetches the doorkeeper
+ * and sketch words of BATCH_GROUP addresses ahead of use.
+ */
+void tinylfu_access_batch(struct tinylfu *tfu, const uint64_t *addrs, size_t n);
+
 /**
  * Estimates the frequency of accesses to the given address addr.
+ *
+ * With incremental aging, also resets the chunks holding the counters of
+ * addr if a reset is in progress.
  */
 uint64_t tinylfu_estimate(struct tinylfu *tfu, uint64_t addr);
 
+/**
+ * Sets out[i] to tinylfu_estimate(tfu, addrs[i]) for i in [0, n).
+ */
+void tinylfu_estimate_batch(struct tinylfu *tfu, const uint64_t *addrs, size_t n,
+                            uint64_t *out);
+
+/**
+ * Records that the cache evicted addr. A cuckoo doorkeeper forgets it, so
+ * that only keys seen again while cached or since their eviction count as
+ * seen; bloom doorkeepers only forget at the next reset.
+ */
+void tinylfu_evict(struct tinylfu *tfu, uint64_t addr);
+
 /**
  * Decides whether to admit a new page "new" over a victim candidate
  * "victim_candidate", chosen by the cache's eviction policy.
@@ -29,3 +149,33 @@ uint64_t tinylfu_estimate(struct tinylfu *tfu, uint64_t addr);
  * Returns true if "new" should be admitted, false otherwise.
  */
 bool tinylfu_admit(struct tinylfu *tfu, uint64_t new, uint64_t victim_candidate);
+
+/**
+ * Copies up to n of the most accessed keys since the last resets to items,
+ * by decreasing count, and returns how many were copied. Needs
+ * config->topk_size.
+ */
+size_t tinylfu_topk(struct tinylfu *tfu, struct topk_item *items, size_t n);
+
+/**
+ * Completes the incremental reset in progress, if any.
+ */
+void tinylfu_finish_aging(struct tinylfu *tfu);
+
+/**
+ * Writes the state of tfu to path, replacing it atomically: after a crash,
+ * path holds either this snapshot or the previous one. The snapshot can be
+ * restored with tinylfu_restore(), or mapped as is with config->path.
+ *
+ * Must not run concurrently with accesses. Returns 0, or -1 with errno set.
+ */
+int tinylfu_snapshot(struct tinylfu *tfu, const char *path);
+
+/**
+ * Replaces the state of tfu with the snapshot at path, which must have been
+ * taken from a TinyLFU with the same layout. tfu is left unchanged if the
+ * snapshot is missing, torn or of another layout.
+ *
+ * Returns 0, or -1 with errno set.
+ */
+int tinylfu_restore(struct tinylfu *tfu, const char *path);
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tinylfu.h"
+
+/*
+ * Files of a persistent TinyLFU (tinylfu_config.path) and of its snapshots:
+ * a header page, then the doorkeeper and sketch tables, each on a page
+ * boundary. The tables are mapped shared, so a process restarting with the
+ * same layout reattaches to them without reading them.
+ *
+ * While mapped, a file is marked dirty; tinylfu_free() syncs the tables
+ * before marking it clean. A dirty file, left by a crash, may hold a
+ * half-aged or partly written back sketch and is not reattached: the TinyLFU
+ * starts empty, and the last snapshot can be restored into it. Snapshots are
+ * written aside and renamed over the previous one, and carry a checksum of
+ * their tables.
+ */
+
+// "TINLFUSK"
+#define TINYLFU_FILE_MAGIC       0x4b5355464c4e4954ULL
+#define TINYLFU_FILE_VERSION     1
+#define TINYLFU_FILE_HEADER_SIZE 4096
+
+enum tinylfu_file_state {
+    TINYLFU_FILE_EMPTY,
+    // Mapped by a running TinyLFU, or left by a crash
+    TINYLFU_FILE_DIRTY,
+    // Tables synced and described by the header
+    TINYLFU_FILE_CLEAN,
+};
+
+struct tinylfu_file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t state;
+
+    // Build parameters, equal for a file to be attached or restored
+    uint32_t hash_family;
+    uint32_t num_hash_functions;
+    uint32_t doorkeeper_type;
+    uint32_t fingerprint_bits;
+    uint32_t sketch_type;
+    uint32_t bits_per_counter;
+
+    // Sizes requested at init, and the resulting tables
+    uint64_t doorkeeper_size;
+    uint64_t sketch_size;
+    uint64_t doorkeeper_words;
+    uint64_t sketch_words;
+
+    // Resets started so far: the aging epoch of the counters
+    uint64_t epoch;
+    uint64_t accesses;
+    // Cuckoo doorkeeper state outside the table
+    uint64_t cuckoo_items;
+    uint64_t cuckoo_victim_fingerprint;
+    uint64_t cuckoo_victim_bucket;
+    uint64_t cuckoo_rng;
+
+    // Checksum of the tables, 0 if not computed (files mapped at runtime)
+    uint64_t tables_checksum;
+    // Checksum of all fields above
+    uint64_t checksum;
+};
+
+struct tinylfu_file {
+    int fd;
+    struct tinylfu_file_header *header;
+    // The tables mapped from the file hold the state of the header
+    bool attached;
+};
+
+/**
+ * Fills the build parameters and requested sizes of a header.
+ */
+void tinylfu_file_layout(struct tinylfu_file_header *h, enum doorkeeper_type type,
+                         size_t doorkeeper_size, size_t sketch_size);
+
+/**
+ * Opens, or creates, the file at path and locks it against other processes.
+ * If it is clean and of the given layout, its tables are attached by the
+ * allocations that follow on this thread (see arena_set_file()); otherwise
+ * it is emptied first.
+ */
+struct tinylfu_file* tinylfu_file_open(const char *path,
+                                       const struct tinylfu_file_header *layout);
+
+/**
+ * Called once the tables of tfu are mapped: loads the state kept in the
+ * header if the file was attached, and marks the file dirty.
+ */
+int tinylfu_file_attach(struct tinylfu_file *f, struct tinylfu *tfu);
+
+/**
+ * Syncs the tables of tfu and marks the file clean, then unmaps the header
+ * and unlocks the file. With tfu NULL, the file is left as it is.
+ */
+int tinylfu_file_close(struct tinylfu_file **f, struct tinylfu *tfu);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "hash.h"
+
+#define TOPK_NONE UINT32_MAX
+
+/**
+ * Space-Saving heavy hitters (Metwally et al., ICDT 2005) over a stream
+ * summary: the k monitored keys are grouped in buckets of equal count, kept
+ * in a list sorted by count, so that incrementing a key only moves it to the
+ * next bucket and the key to replace is always in the first one. Every
+ * update is O(1), in memory allocated once by topk_init().
+ *
+ * A key that is not monitored replaces one of the least counted, inheriting
+ * its count as error. The count of a key is thus at most error above its
+ * true frequency, and every key more frequent than accesses / k is
+ * monitored.
+ */
+struct topk_entry {
+    uint64_t key;
+    // Overestimation inherited from the replaced key
+    uint64_t error;
+    uint32_t bucket;
+    // Entries of the same bucket
+    uint32_t prev, next;
+    // Entries of the same slot of the index
+    uint32_t chain;
+};
+
+struct topk_bucket {
+    uint64_t count;
+    uint32_t first;
+    // Buckets in increasing count order; next also links free buckets
+    uint32_t prev, next;
+};
+
+struct topk {
+    struct topk_entry *entries;
+    struct topk_bucket *buckets;
+    // Index of the entries by key hash, a power of two of slots
+    uint32_t *index;
+    size_t index_mask;
+    uint32_t k;
+    uint32_t num_entries;
+    // Bucket of the lowest count
+    uint32_t min_bucket;
+    uint32_t free_buckets;
+    uint64_t accesses;
+};
+
+/**
+ * A monitored key, as returned by topk_snapshot().
+ */
+struct topk_item {
+    uint64_t key;
+    uint64_t count;
+    uint64_t error;
+};
+
+struct topk* topk_init(size_t k);
+void topk_free(struct topk **tk);
+
+/**
+ * Counts an access to key.
+ */
+void topk_add(struct topk *tk, uint64_t key);
+
+/**
+ * Count of key, or 0 if it is not monitored.
+ */
+uint64_t topk_count(struct topk *tk, uint64_t key);
+
+/**
+ * Halves all counts and errors, keeping the order of the keys, so that the
+ * summary follows the TinyLFU sample.
+ */
+void topk_halve(struct topk *tk);
+
+/**
+ * Copies up to n monitored keys to items, by decreasing count, and returns
+ * how many were copied.
+ */
+size_t topk_snapshot(struct topk *tk, struct topk_item *items, size_t n);
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Columnar binary trace of key-value requests.
+ *
+ * A file is a header, a sequence of self-contained chunks and an index of the
+ * chunks followed by a footer:
+ *
+ *   trace_file_header
+ *   chunk 0 .. chunk n-1
+ *   trace_chunk_index[n]
+ *   trace_footer
+ *
+ * Each chunk holds up to chunk_records records stored column by column: keys
+ * and timestamps as zigzag varints of the delta from the previous record,
+ * sizes as varints and operations as one byte each. Deltas restart at zero in
+ * every chunk, so chunks decode independently and in parallel.
+ *
+ * Keys are dense ids below num_keys, so that consumers can keep per-key state
+ * in arrays of num_keys entries: in order of first reference in converted
+ * traces, page ids in generated ones. Integers are stored in host
+ * (little-endian) byte order.
+ */
+
+#define TRACE_MAGIC 0x3145434152545843ULL // "CXTRACE1"
+#define TRACE_VERSION 1
+
+// Records per chunk, unless set otherwise by the writer
+#define TRACE_CHUNK_RECORDS (1 << 16)
+
+enum trace_op {
+    TRACE_OP_GET,
+    TRACE_OP_GETS,
+    TRACE_OP_SET,
+    TRACE_OP_ADD,
+    TRACE_OP_REPLACE,
+    TRACE_OP_CAS,
+    TRACE_OP_APPEND,
+    TRACE_OP_PREPEND,
+    TRACE_OP_DELETE,
+    TRACE_OP_INCR,
+    TRACE_OP_DECR,
+    TRACE_OP_UNKNOWN,
+    // Page read by a range scan, in generated traces (workload.h)
+    TRACE_OP_SCAN,
+    TRACE_NUM_OPS,
+};
+
+/**
+ * One request.
+ */
+struct trace_record {
+    uint64_t timestamp;
+    uint64_t key;
+    // Key and value bytes
+    uint32_t size;
+    uint8_t op;
+};
+
+struct trace_file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t chunk_records;
+};
+
+struct trace_chunk_header {
+    uint32_t num_records;
+    uint32_t key_bytes;
+    uint32_t timestamp_bytes;
+    uint32_t size_bytes;
+};
+
+struct trace_chunk_index {
+    // Offset of the chunk header in the file
+    uint64_t offset;
+    // Number of records in the chunks before this one
+    uint64_t first_record;
+};
+
+struct trace_footer {
+    uint64_t index_offset;
+    uint64_t num_chunks;
+    uint64_t num_records;
+    uint64_t num_keys;
+    uint64_t magic;
+};
+
+/**
+ * Largest encoding of a chunk of n records.
+ */
+static inline size_t trace_chunk_max_bytes(size_t n)
+{
+    return sizeof(struct trace_chunk_header) + n * (10 + 10 + 5 + 1);
+}
+
+/**
+ * Encodes records[0..n) as one chunk into out, which must hold
+ * trace_chunk_max_bytes(n) bytes. Returns the bytes written.
+ */
+size_t trace_encode_chunk(const struct trace_record *records, size_t n, uint8_t *out);
+
+/**
+ * Writes a trace chunk by chunk. Records appended one at a time are encoded
+ * when a chunk fills up; chunks encoded elsewhere (e.g. by other threads) can
+ * be appended directly.
+ */
+struct trace_writer {
+    FILE *file;
+    uint32_t chunk_records;
+    uint64_t offset;
+    uint64_t num_records;
+    // Stored in the footer, set by the caller
+    uint64_t num_keys;
+
+    struct trace_chunk_index *index;
+    size_t num_chunks;
+    size_t index_capacity;
+
+    struct trace_record *pending;
+    size_t num_pending;
+    uint8_t *buffer;
+};
+
+struct trace_writer* trace_writer_open(const char *path, uint32_t chunk_records);
+
+/**
+ * Writes the pending records, the index and the footer, and closes the file.
+ * Returns 0 on success.
+ */
+int trace_writer_close(struct trace_writer **w);
+
+int trace_writer_append(struct trace_writer *w, const struct trace_record *record);
+
+/**
+ * Appends a chunk of n records encoded by trace_encode_chunk(). Records
+ * appended with trace_writer_append() and not yet written are written first.
+ */
+int trace_writer_append_chunk(struct trace_writer *w, const uint8_t *chunk, size_t bytes,
+                              size_t n);
+
+/**
+ * Read-only mapping of a trace file. Chunks are decoded straight from the
+ * mapping, so the trace is never copied or held in memory as a whole.
+ */
+struct trace_reader {
+    const uint8_t *data;
+    size_t size;
+    uint32_t chunk_records;
+    const struct trace_footer *footer;
+    const struct trace_chunk_index *index;
+};
+
+/**
+ * Maps the trace at path and checks its header, footer and index. Returns
+ * NULL if the file is not a valid trace.
+ */
+struct trace_reader* trace_reader_open(const char *path);
+void trace_reader_free(struct trace_reader **r);
+
+/**
+ * Returns true if the file at path starts with the trace magic.
+ */
+bool trace_is_binary(const char *path);
+
+static inline size_t trace_num_chunks(const struct trace_reader *r)
+{
+    return r->footer->num_chunks;
+}
+
+static inline uint64_t trace_num_records(const struct trace_reader *r)
+{
+    return r->footer->num_records;
+}
+
+/**
+ * Decodes chunk into out, which must hold r->chunk_records records. Returns
+ * the number of records, or 0 if the chunk is corrupt.
+ */
+size_t trace_decode_chunk(const struct trace_reader *r, size_t chunk, struct trace_record *out);
+
+/**
+ * Iterates over the records of chunks [first_chunk, end_chunk), decoding one
+ * chunk at a time into a buffer of chunk_records records. Threads replaying
+ * disjoint chunk ranges each use their own cursor.
+ */
+struct trace_cursor {
+    const struct trace_reader *reader;
+    size_t chunk;
+    size_t end_chunk;
+    struct trace_record *records;
+    size_t num_records;
+    size_t pos;
+};
+
+int trace_cursor_init(struct trace_cursor *cur, const struct trace_reader *r,
+                      size_t first_chunk, size_t end_chunk);
+void trace_cursor_free(struct trace_cursor *cur);
+
+/**
+ * Returns the next record, or NULL at the end of the range or on a corrupt
+ * chunk. The record stays valid until the cursor moves to the next chunk.
+ */
+static inline const struct trace_record* trace_cursor_next(struct trace_cursor *cur)
+{
+    while (cur->pos == cur->num_records) {
+        if (cur->chunk == cur->end_chunk) return NULL;
+
+        cur->num_records = trace_decode_chunk(cur->reader, cur->chunk++, cur->records);
+        cur->pos = 0;
+        if (cur->num_records == 0) return NULL;
+    }
+    return &cur->records[cur->pos++];
+}
+
+/**
+ * Parses one line of a Twitter cache trace,
+ * "timestamp,key,key_size,value_size,client_id,operation,TTL", ending at end
+ * or at a newline. The key of the record is left unset; *key_hash is set to a
+ * 64-bit hash of the key string. Returns false if the line is malformed.
+ */
+bool trace_parse_twitter(const char *line, const char *end, struct trace_record *record,
+                         uint64_t *key_hash);
+
+const char* trace_op_name(uint8_t op);
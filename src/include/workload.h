@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "trace.h"
+#include "zipf.h"
+
+/*
+ * Synthetic page reference streams, standing in for the datasets of the
+ * eval/ experiments.
+ *
+ * A stream is a sequence of operations, each referencing one or more pages
+ * (a scan or a file read references a run of pages). Everything random about
+ * operation i is drawn from a generator seeded with (seed, i) alone, so a
+ * stream is deterministic per seed and any range of operations can be
+ * generated on its own: threads generating consecutive ranges produce, once
+ * concatenated, exactly the stream of a single thread.
+ *
+ * Pages are dense ids from 0, grouped into files: page p is page p %
+ * pages_per_file of file p / pages_per_file + 1, except for sweeps, whose
+ * files have varying sizes.
+ */
+
+enum workload_kind {
+    // Zipf over the pages
+    WORKLOAD_ZIPF,
+    // YCSB core workloads over one record per page: A (50% reads, 50%
+    // updates), B (95/5), C (reads only), D (5% inserts, reads of the latest
+    // records), E (5% inserts, 95% short scans), F (50% reads, 50%
+    // read-modify-writes)
+    WORKLOAD_YCSB_A,
+    WORKLOAD_YCSB_B,
+    WORKLOAD_YCSB_C,
+    WORKLOAD_YCSB_D,
+    WORKLOAD_YCSB_E,
+    WORKLOAD_YCSB_F,
+    // Zipf GETs mixed with range scans from uniform start pages, as the
+    // LevelDB GET and SCAN threads of eval/get-scan
+    WORKLOAD_GET_SCAN,
+    // Whole files read in turn, as the searches of eval/filesearch
+    WORKLOAD_SWEEP,
+    WORKLOAD_NUM_KINDS,
+};
+
+// Reference flags
+#define WORKLOAD_REF_SCAN  (1 << 0) // Part of a range scan
+#define WORKLOAD_REF_WRITE (1 << 1) // Update, insert or the write of a RMW
+
+struct workload_config {
+    enum workload_kind kind;
+    uint64_t seed;
+    // Pages before any insert (YCSB D and E)
+    uint64_t num_pages;
+    // Zipf exponent of the page popularity
+    double zipf_s;
+    // Operations per hot set: every phase_ops operations, the popular pages
+    // move to other pages. 0 keeps one hot set.
+    uint64_t phase_ops;
+    // Fraction of scans of WORKLOAD_GET_SCAN
+    double scan_fraction;
+    // Pages per scan (the longest of YCSB E, whose lengths are uniform)
+    uint64_t scan_length;
+    // Pages per file, the mean for WORKLOAD_SWEEP
+    uint64_t pages_per_file;
+};
+
+/**
+ * One page reference.
+ */
+struct workload_ref {
+    // Dense page id
+    uint64_t page;
+    uint64_t ino;
+    uint64_t index;
+    // Operation number
+    uint64_t op_number;
+    // trace_op of the reference: GET, SET (update), ADD (insert) or SCAN
+    uint8_t op;
+    uint8_t flags;
+};
+
+struct workload {
+    struct workload_config config;
+    struct zipf zipf;
+    // Odd multiplier, coprime with num_pages, spreading ranks over the pages
+    uint64_t scatter;
+    // First page of every file, and the end of the last one, for sweeps
+    uint64_t *file_offsets;
+    uint64_t num_files;
+};
+
+/**
+ * Creates a workload of config. Zero fields of config take defaults: 1M
+ * pages, a Zipf exponent of 0.99, 5% scans of 64 pages and 512 pages per
+ * file (8 for sweeps).
+ */
+struct workload* workload_init(const struct workload_config *config);
+void workload_free(struct workload **w);
+
+const char* workload_kind_name(enum workload_kind kind);
+
+/**
+ * Looks up a kind by name: zipf, ycsb-a .. ycsb-f, get-scan or sweep.
+ * Returns -1 if there is no such kind.
+ */
+int workload_kind_parse(const char *name, enum workload_kind *kind);
+
+/**
+ * Number of distinct page ids referenced by operations [0, num_ops): the
+ * initial pages plus those inserted.
+ */
+uint64_t workload_num_pages(const struct workload *w, uint64_t num_ops);
+
+/**
+ * Iterates over the references of operations [first_op, end_op).
+ */
+struct workload_cursor {
+    const struct workload *w;
+    uint64_t op;
+    uint64_t end_op;
+    // Next reference of the current operation, and how many are left
+    struct workload_ref next;
+    uint64_t refs_left;
+    // The current operation is a read-modify-write: its second reference
+    // writes the page the first one read
+    bool rmw;
+};
+
+void workload_cursor_init(struct workload_cursor *cur, const struct workload *w,
+                          uint64_t first_op, uint64_t end_op);
+
+/**
+ * Sets *ref to the next reference. Returns false at the end of the range.
+ */
+bool workload_next(struct workload_cursor *cur, struct workload_ref *ref);
+
+/**
+ * Sets refs[0..n) to the next references. Returns how many were set, less
+ * than n only at the end of the range.
+ */
+size_t workload_next_batch(struct workload_cursor *cur, struct workload_ref *refs, size_t n);
+
+// References handed to a workload_generate() callback at once
+#define WORKLOAD_BATCH 4096
+
+/**
+ * Calls fn on the references of operations [first_op, end_op), in batches
+ * of at most WORKLOAD_BATCH. Stops at, and returns, the first nonzero value
+ * returned by fn; returns 0 otherwise.
+ */
+int workload_generate(const struct workload *w, uint64_t first_op, uint64_t end_op,
+                      int (*fn)(void *ctx, const struct workload_ref *refs, size_t n),
+                      void *ctx);
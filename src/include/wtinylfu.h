@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tinylfu.h"
+
+// Terminates lists and marks empty index slots
+#define WTINYLFU_NIL UINT32_MAX
+
+enum wtinylfu_queue {
+    WTINYLFU_FREE,
+    WTINYLFU_WINDOW,
+    WTINYLFU_PROBATION,
+    WTINYLFU_PROTECTED,
+};
+
+/**
+ * Cache entry, linked into one of the queues by arena index.
+ */
+struct wtinylfu_entry {
+    uint64_t key;
+    uint32_t prev;
+    uint32_t next;
+    uint8_t queue;
+};
+
+/**
+ * Intrusive doubly-linked list of entries, head is the most recently used.
+ */
+struct wtinylfu_list {
+    uint32_t head;
+    uint32_t tail;
+    size_t size;
+};
+
+/**
+ * W-TinyLFU cache of keys (Einziger et al., as in Caffeine).
+ *
+ * New keys enter an LRU window. Keys evicted from the window become
+ * candidates for the main area, a segmented LRU with a probation and a
+ * protected segment; a candidate replaces the probation victim only if
+ * TinyLFU estimates it to be more frequent. Hits in probation promote to
+ * protected.
+ *
+ * Entries live in a fixed arena of capacity + 1 slots and are found through
+ * an open-addressing index (linear probing, backward-shift deletion), so
+ * that no access allocates.
+ *
+ * The window size is tuned by hill climbing on the hit rate of each sample
+ * period.
+ */
+struct wtinylfu {
+    struct tinylfu *sketch;
+
+    struct wtinylfu_entry *entries;
+    uint32_t free_head;
+    size_t capacity;
+
+    uint32_t *index;
+    size_t index_mask;
+
+    struct wtinylfu_list window;
+    struct wtinylfu_list probation;
+    struct wtinylfu_list protected;
+    size_t window_max;
+    size_t protected_max;
+
+    // Hill climbing
+    uint64_t sample_hits;
+    uint64_t sample_accesses;
+    double prev_hit_rate;
+    double step;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/**
+ * Creates a cache of capacity keys. The admission sketch is created from
+ * sketch_config, or sized for capacity entries if sketch_config is NULL.
+ */
+struct wtinylfu* wtinylfu_init(size_t capacity,
+                               const struct tinylfu_config *sketch_config);
+void wtinylfu_free(struct wtinylfu **c);
+
+/**
+ * Accesses key, inserting it on a miss.
+ * Returns true on a hit, false on a miss.
+ */
+bool wtinylfu_access(struct wtinylfu *c, uint64_t key);
+
+/**
+ * Returns true if key is cached, without counting as an access.
+ */
+bool wtinylfu_contains(struct wtinylfu *c, uint64_t key);
+
+/**
+ * Number of cached keys.
+ */
+static inline size_t wtinylfu_size(struct wtinylfu *c)
+{
+    return c->window.size + c->probation.size + c->protected.size;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * SplitMix64: returns the next pseudo-random 64-bit value of the sequence
+ * whose position is *state.
+ */
+static inline uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+ * Uniform double in [0, 1).
+ */
+static inline double splitmix64_double(uint64_t *state)
+{
+    return (splitmix64(state) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Zipf distribution over [1, n] with exponent s, sampled in O(1) without
+ * tables by rejection-inversion (Hörmann and Derflinger, 1996).
+ */
+struct zipf {
+    uint64_t n;
+    double s;
+    double h_integral_x1;
+    double h_integral_n;
+    double threshold;
+};
+
+// log1p(x) / x, accurate around 0
+static inline double zipf_helper1(double x)
+{
+    if (fabs(x) > 1e-8) {
+        return log1p(x) / x;
+    }
+    return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+// expm1(x) / x, accurate around 0
+static inline double zipf_helper2(double x)
+{
+    if (fabs(x) > 1e-8) {
+        return expm1(x) / x;
+    }
+    return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static inline double zipf_h(const struct zipf *z, double x)
+{
+    return exp(-z->s * log(x));
+}
+
+static inline double zipf_h_integral(const struct zipf *z, double x)
+{
+    double log_x = log(x);
+    return zipf_helper2((1 - z->s) * log_x) * log_x;
+}
+
+static inline double zipf_h_integral_inverse(const struct zipf *z, double x)
+{
+    double t = x * (1 - z->s);
+    if (t < -1) {
+        t = -1;
+    }
+    return exp(zipf_helper1(t) * x);
+}
+
+static inline void zipf_init(struct zipf *z, uint64_t n, double s)
+{
+    z->n = n;
+    z->s = s;
+    z->h_integral_x1 = zipf_h_integral(z, 1.5) - 1;
+    z->h_integral_n  = zipf_h_integral(z, n + 0.5);
+    z->threshold     = 2 - zipf_h_integral_inverse(
+        z, zipf_h_integral(z, 2.5) - zipf_h(z, 2)
+    );
+}
+
+/**
+ * Returns the next rank in [1, n], rank 1 being the most frequent.
+ */
+static inline uint64_t zipf_next(const struct zipf *z, uint64_t *rng)
+{
+    for (;;) {
+        double u = z->h_integral_n
+                   + splitmix64_double(rng) * (z->h_integral_x1 - z->h_integral_n);
+        double x = zipf_h_integral_inverse(z, u);
+
+        uint64_t k = (uint64_t) (x + 0.5);
+        if (k < 1) {
+            k = 1;
+        } else if (k > z->n) {
+            k = z->n;
+        }
+
+        if (k - x <= z->threshold
+            || u >= zipf_h_integral(z, k + 0.5) - zipf_h(z, k)) {
+            return k;
+        }
+    }
+}
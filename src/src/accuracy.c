@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "tinylfu.h"
+#include "zipf.h"
+
+/*
+ * Accuracy of TinyLFU against exact counts. For every parameter point
+ * (workload, CACHE_SIZE_BITS, SAMPLE_SIZE_BITS), a TinyLFU and an exact
+ * counter are driven side by side by the same stream. The exact counts are
+ * halved whenever TinyLFU resets, so that both count over the same sample.
+ * Reported, as one CSV row per point:
+ *
+ *   - the distribution of the estimation error, the estimate of each
+ *     accessed key minus its exact count, just before the access is
+ *     recorded,
+ *   - how often tinylfu_admit() agrees with an exact-LFU oracle, for the
+ *     accessed key against a recently accessed one as the victim.
+ *
+ * The doorkeeper has 2^CACHE_SIZE_BITS bits and the sketch as many counters,
+ * as in the cache_ext policy. Points run in parallel, one per thread.
+ */
+
+#define MAX_WORKLOADS 16
+#define MAX_CACHE_SIZE_BITS 8
+#define MAX_SAMPLE_SIZE_BITS 8
+
+// Largest estimate: a saturated counter, plus one for the doorkeeper
+#ifdef TINYLFU_FREQUENCY_SKETCH
+    #define ESTIMATE_MAX (1 << FS_BITS_PER_COUNTER)
+#else
+    #define ESTIMATE_MAX (1 << BITS_PER_COUNTER)
+#endif
+
+// Errors are in [-ESTIMATE_MAX, ESTIMATE_MAX]
+#define ERROR_BINS (2 * ESTIMATE_MAX + 1)
+
+// Length of the scans of the scan workloads
+#define SCAN_LENGTH 4096
+
+// First key of the scans, above the Zipf keys of every phase
+#define SCAN_FIRST_KEY (1ULL << 62)
+
+// Accesses among which the victim of an admission is drawn
+#define VICTIM_WINDOW 65536
+
+// Fraction of the stream before errors and decisions are counted
+#define WARMUP_FRACTION 8
+
+static const char *USAGE =
+    "Usage: %s [-o <csv>] [-n <accesses>] [-k <keys>] [-t <threads>]\n"
+    "          [-w <workload>[,<workload>...]] [-c <bits>[,<bits>...]]\n"
+    "          [-s <bits>[,<bits>...]] [-D <doorkeeper>] [-a <aging>]\n"
+    "\n"
+    "-n        accesses per point (default 4M; K, M and G suffixes accepted).\n"
+    "-k        keys of the Zipf distributions (default 1M).\n"
+    "-t        threads, one point each at a time (default: online CPUs).\n"
+    "-w        workloads (default zipf0.8,zipf1.0,zipf1.2,scan0.3,shift8):\n"
+    "          zipf<s>, Zipf of exponent s; scan<f>, Zipf 1.0 with a fraction\n"
+    "          f of the accesses in scans of new keys; shift<p>, Zipf 1.0 whose\n"
+    "          hot set is replaced by new keys p times.\n"
+    "-c        CACHE_SIZE_BITS: log2 of the doorkeeper bits and sketch\n"
+    "          counters (default 14,16,18).\n"
+    "-s        SAMPLE_SIZE_BITS: log2 of the accesses between resets, +<d>\n"
+    "          for CACHE_SIZE_BITS + d, or sat to reset when a counter\n"
+    "          saturates (default sat,+2,+4,+6).\n"
+    "-D        doorkeeper (default bloom): bloom, blocked_bloom or cuckoo.\n"
+    "-a        aging (default incremental): incremental or stop.\n";
+
+/*
+ * Workloads
+ */
+
+enum workload_kind {
+    WORKLOAD_ZIPF,
+    WORKLOAD_SCAN,
+    WORKLOAD_SHIFT,
+};
+
+struct workload {
+    const char *name;
+    enum workload_kind kind;
+    // Zipf exponent
+    double s;
+    // Fraction of scan accesses of WORKLOAD_SCAN
+    double scan_fraction;
+    // Hot sets of WORKLOAD_SHIFT
+    size_t phases;
+};
+
+static int parse_workload(const char *name, struct workload *w)
+{
+    char *end;
+
+    w->name          = name;
+    w->s             = 1.0;
+    w->scan_fraction = 0;
+    w->phases        = 1;
+
+    if (strncmp(name, "zipf", 4) == 0) {
+        w->kind = WORKLOAD_ZIPF;
+        w->s    = strtod(name + 4, &end);
+        if (end != name + 4 && *end == '\0' && w->s > 0) return 0;
+    } else if (strncmp(name, "scan", 4) == 0) {
+        w->kind          = WORKLOAD_SCAN;
+        w->scan_fraction = strtod(name + 4, &end);
+        if (end != name + 4 && *end == '\0' && w->scan_fraction >= 0
+            && w->scan_fraction < 1) return 0;
+    } else if (strncmp(name, "shift", 5) == 0) {
+        w->kind   = WORKLOAD_SHIFT;
+        w->phases = strtoull(name + 5, &end, 10);
+        if (end != name + 5 && *end == '\0' && w->phases > 0) return 0;
+    }
+    return -1;
+}
+
+struct stream {
+    const struct workload *w;
+    struct zipf z;
+    uint64_t rng;
+    size_t n;
+    size_t i;
+    size_t scan_left;
+    uint64_t next_scan_key;
+    // Probability that a scan starts after a Zipf access
+    double scan_start;
+};
+
+static void stream_init(struct stream *st, const struct workload *w, size_t n, size_t keys)
+{
+    st->w             = w;
+    st->rng           = 42;
+    st->n             = n;
+    st->i             = 0;
+    st->scan_left     = 0;
+    st->next_scan_key = SCAN_FIRST_KEY;
+    st->scan_start    = w->scan_fraction / (SCAN_LENGTH * (1 - w->scan_fraction));
+
+    zipf_init(&st->z, keys, w->s);
+}
+
+static uint64_t stream_next(struct stream *st)
+{
+    size_t i = st->i++;
+
+    if (st->scan_left) {
+        st->scan_left--;
+        return st->next_scan_key++;
+    }
+    if (st->w->kind == WORKLOAD_SCAN && splitmix64_double(&st->rng) < st->scan_start) {
+        st->scan_left = SCAN_LENGTH;
+    }
+
+    uint64_t key = zipf_next(&st->z, &st->rng);
+    if (st->w->kind == WORKLOAD_SHIFT) {
+        key += (uint64_t) (i * st->w->phases / st->n) * st->z.n;
+    }
+    return key;
+}
+
+/*
+ * Exact counts, in an open-addressing hash table
+ */
+
+#define EMPTY_KEY UINT64_MAX
+
+struct exact_counts {
+    uint64_t *keys;
+    uint32_t *counts;
+    // Power of two
+    size_t capacity;
+    size_t size;
+};
+
+static int exact_counts_init(struct exact_counts *ec, size_t capacity)
+{
+    ec->keys     = (uint64_t*) malloc(capacity * sizeof(uint64_t));
+    ec->counts   = (uint32_t*) calloc(capacity, sizeof(uint32_t));
+    ec->capacity = capacity;
+    ec->size     = 0;
+
+    if (!ec->keys || !ec->counts) {
+        free(ec->keys);
+        free(ec->counts);
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        ec->keys[i] = EMPTY_KEY;
+    }
+    return 0;
+}
+
+static void exact_counts_free(struct exact_counts *ec)
+{
+    free(ec->keys);
+    free(ec->counts);
+}
+
+static size_t exact_counts_slot(const struct exact_counts *ec, uint64_t key)
+{
+    size_t i = hash_fmix64(key) & (ec->capacity - 1);
+    while (ec->keys[i] != EMPTY_KEY && ec->keys[i] != key) {
+        i = (i + 1) & (ec->capacity - 1);
+    }
+    return i;
+}
+
+static uint32_t exact_counts_get(const struct exact_counts *ec, uint64_t key)
+{
+    size_t i = exact_counts_slot(ec, key);
+    return ec->keys[i] == key ? ec->counts[i] : 0;
+}
+
+/*
+ * Moves the keys of ec with a count of at least 1 to a table of the given
+ * capacity.
+ */
+static int exact_counts_rehash(struct exact_counts *ec, size_t capacity)
+{
+    struct exact_counts next;
+    if (exact_counts_init(&next, capacity) != 0) return -1;
+
+    for (size_t i = 0; i < ec->capacity; i++) {
+        if (ec->keys[i] != EMPTY_KEY && ec->counts[i]) {
+            size_t j = exact_counts_slot(&next, ec->keys[i]);
+            next.keys[j]   = ec->keys[i];
+            next.counts[j] = ec->counts[i];
+            next.size++;
+        }
+    }
+
+    exact_counts_free(ec);
+    *ec = next;
+    return 0;
+}
+
+static int exact_counts_increment(struct exact_counts *ec, uint64_t key)
+{
+    // At most half full
+    if (2 * (ec->size + 1) > ec->capacity
+        && exact_counts_rehash(ec, 2 * ec->capacity) != 0) return -1;
+
+    size_t i = exact_counts_slot(ec, key);
+    if (ec->keys[i] == EMPTY_KEY) {
+        ec->keys[i] = key;
+        ec->size++;
+    }
+    ec->counts[i]++;
+    return 0;
+}
+
+/*
+ * Halves every count, as a TinyLFU reset halves the sketch, and drops the
+ * keys left at 0.
+ */
+static int exact_counts_halve(struct exact_counts *ec)
+{
+    for (size_t i = 0; i < ec->capacity; i++) {
+        ec->counts[i] >>= 1;
+    }
+
+    size_t capacity = ec->capacity;
+    while (capacity > 1024 && 8 * ec->size < capacity) {
+        capacity /= 2;
+    }
+    return exact_counts_rehash(ec, capacity);
+}
+
+/*
+ * Parameter points
+ */
+
+struct point_result {
+    uint64_t resets;
+    // Errors estimate - min(exact, ESTIMATE_MAX), offset by ESTIMATE_MAX
+    uint64_t errors[ERROR_BINS];
+    uint64_t decisions;
+    // Decisions where the exact counts of the keys differ
+    uint64_t decisive;
+    uint64_t agreements;
+    uint64_t decisive_agreements;
+    // Admitted by TinyLFU but not by the oracle, and conversely
+    uint64_t false_admits;
+    uint64_t false_rejects;
+};
+
+struct point {
+    const struct workload *w;
+    int cache_size_bits;
+    // 0 to reset when a counter saturates
+    int sample_size_bits;
+    struct point_result result;
+    int status;
+};
+
+struct params {
+    size_t n;
+    size_t keys;
+    enum doorkeeper_type doorkeeper_type;
+    enum tinylfu_aging aging;
+};
+
+static int run_point(const struct params *params, struct point *p)
+{
+    struct tinylfu_config config = {
+        .aging           = params->aging,
+        .doorkeeper_type = params->doorkeeper_type,
+        .doorkeeper_size = 1ULL << p->cache_size_bits,
+        .sketch_size     = 1ULL << p->cache_size_bits,
+        .sample_size     = p->sample_size_bits ? 1ULL << p->sample_size_bits : 0,
+    };
+    struct tinylfu *tfu = tinylfu_init(&config);
+    uint64_t *recent = (uint64_t*) malloc(VICTIM_WINDOW * sizeof(uint64_t));
+    struct exact_counts ec;
+
+    if (!tfu || !recent || exact_counts_init(&ec, 1024) != 0) {
+        tinylfu_free(&tfu);
+        free(recent);
+        return -1;
+    }
+    doorkeeper_clear(tfu->doorkeeper);
+    tinylfu_sketch_reset(tfu->sketch);
+
+    struct stream st;
+    stream_init(&st, p->w, params->n, params->keys);
+    uint64_t rng = 7;
+    size_t warmup = params->n / WARMUP_FRACTION;
+    struct point_result *r = &p->result;
+    int status = 0;
+
+    for (size_t i = 0; i < params->n && status == 0; i++) {
+        uint64_t key = stream_next(&st);
+
+        if (i >= warmup) {
+            uint64_t exact = exact_counts_get(&ec, key);
+            uint64_t capped = exact < (uint64_t) ESTIMATE_MAX ? exact : ESTIMATE_MAX;
+            uint64_t estimate = tinylfu_estimate(tfu, key);
+            r->errors[estimate + ESTIMATE_MAX - capped]++;
+
+            uint64_t victim = recent[splitmix64(&rng) % VICTIM_WINDOW];
+            uint64_t victim_exact = exact_counts_get(&ec, victim);
+            bool admit = tinylfu_admit(tfu, key, victim);
+            bool oracle = exact > victim_exact;
+
+            r->decisions++;
+            r->agreements    += admit == oracle;
+            r->false_admits  += admit && !oracle;
+            r->false_rejects += !admit && oracle;
+            if (exact != victim_exact) {
+                r->decisive++;
+                r->decisive_agreements += admit == oracle;
+            }
+        }
+
+        uint64_t resets = tfu->resets;
+        tinylfu_access(tfu, key);
+        status = exact_counts_increment(&ec, key);
+        if (status == 0 && tfu->resets != resets) {
+            status = exact_counts_halve(&ec);
+        }
+
+        recent[i % VICTIM_WINDOW] = key;
+    }
+    r->resets = tfu->resets;
+
+    exact_counts_free(&ec);
+    free(recent);
+    tinylfu_free(&tfu);
+    return status;
+}
+
+struct pool {
+    const struct params *params;
+    struct point *points;
+    size_t num_points;
+    size_t next;
+};
+
+static void *worker(void *arg)
+{
+    struct pool *pool = (struct pool*) arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->num_points) {
+        pool->points[i].status = run_point(pool->params, &pool->points[i]);
+    }
+    return NULL;
+}
+
+/*
+ * Report
+ */
+
+// Smallest |error| at or above fraction q of the errors
+static int abs_error_quantile(const struct point_result *r, uint64_t total, double q)
+{
+    uint64_t seen = 0;
+
+    for (int e = 0; e <= ESTIMATE_MAX; e++) {
+        seen += r->errors[ESTIMATE_MAX + e];
+        if (e) {
+            seen += r->errors[ESTIMATE_MAX - e];
+        }
+        if (seen >= q * total) return e;
+    }
+    return ESTIMATE_MAX;
+}
+
+static void print_point(FILE *out, const struct point *p, const struct params *params,
+                        const char *doorkeeper)
+{
+    const struct point_result *r = &p->result;
+    uint64_t total = 0, over = 0, under = 0;
+    double sum = 0, abs_sum = 0;
+
+    for (int b = 0; b < ERROR_BINS; b++) {
+        int e = b - ESTIMATE_MAX;
+        total   += r->errors[b];
+        sum     += (double) e * r->errors[b];
+        abs_sum += (double) (e < 0 ? -e : e) * r->errors[b];
+        over    += e > 0 ? r->errors[b] : 0;
+        under   += e < 0 ? r->errors[b] : 0;
+    }
+    double errors = total ? total : 1;
+    double decisions = r->decisions ? r->decisions : 1;
+    double decisive = r->decisive ? r->decisive : 1;
+
+    fprintf(out, "%s,%d,%d,%s,%zu,%" PRIu64 ",%.4f,%.4f,%d,%d,%d,%.4f,%.4f,"
+            "%.4f,%.4f,%.4f,%.4f,%.4f\n",
+            p->w->name, p->cache_size_bits, p->sample_size_bits, doorkeeper, params->n,
+            r->resets, sum / errors, abs_sum / errors,
+            abs_error_quantile(r, total, 0.5), abs_error_quantile(r, total, 0.9),
+            abs_error_quantile(r, total, 0.99), over / errors, under / errors,
+            r->agreements / decisions, r->decisive / decisions,
+            r->decisive_agreements / decisive, r->false_admits / decisions,
+            r->false_rejects / decisions);
+}
+
+static size_t parse_count(const char *arg)
+{
+    char *end;
+    size_t n = strtoull(arg, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+        n <<= 10;
+        // fall through
+    case 'M': case 'm':
+        n <<= 10;
+        // fall through
+    case 'K': case 'k':
+        n <<= 10;
+        break;
+    }
+    return n;
+}
+
+/*
+ * Parses a comma-separated list of bits into bits[], at most max of them.
+ * Returns the number of bits, or -1 on an invalid entry.
+ */
+static int parse_bits(char *list, int *bits, int max, bool sample)
+{
+    int n = 0;
+
+    for (char *s = strtok(list, ","); s && n < max; s = strtok(NULL, ",")) {
+        char *end;
+
+        if (sample && strcmp(s, "sat") == 0) {
+            bits[n++] = 0;
+            continue;
+        }
+        // Relative to CACHE_SIZE_BITS, stored as a negative offset
+        bool relative = sample && *s == '+';
+        long b = strtol(relative ? s + 1 : s, &end, 10);
+        if (end == s || *end != '\0' || b < 0 || b > 40 || (!relative && b == 0)) return -1;
+
+        bits[n++] = relative ? -(int) b - 1 : (int) b;
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    struct params params = {
+        .n               = 4 << 20,
+        .keys            = 1 << 20,
+        .doorkeeper_type = DOORKEEPER_BLOOM,
+        .aging           = TINYLFU_AGING_INCREMENTAL,
+    };
+    const char *doorkeeper = "bloom";
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char default_workloads[] = "zipf0.8,zipf1.0,zipf1.2,scan0.3,shift8";
+    char *workload_list = default_workloads;
+    char default_cache_bits[] = "14,16,18";
+    char *cache_bits_list = default_cache_bits;
+    char default_sample_bits[] = "sat,+2,+4,+6";
+    char *sample_bits_list = default_sample_bits;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:n:k:t:w:c:s:D:a:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'n':
+            params.n = parse_count(optarg);
+            break;
+        case 'k':
+            params.keys = parse_count(optarg);
+            break;
+        case 't':
+            threads = atol(optarg);
+            break;
+        case 'w':
+            workload_list = optarg;
+            break;
+        case 'c':
+            cache_bits_list = optarg;
+            break;
+        case 's':
+            sample_bits_list = optarg;
+            break;
+        case 'D':
+            doorkeeper = optarg;
+            if (strcmp(optarg, "bloom") == 0) {
+                params.doorkeeper_type = DOORKEEPER_BLOOM;
+            } else if (strcmp(optarg, "blocked_bloom") == 0) {
+                params.doorkeeper_type = DOORKEEPER_BLOCKED_BLOOM;
+            } else if (strcmp(optarg, "cuckoo") == 0) {
+                params.doorkeeper_type = DOORKEEPER_CUCKOO;
+            } else {
+                fprintf(stderr, "Unknown doorkeeper: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'a':
+            if (strcmp(optarg, "incremental") == 0) {
+                params.aging = TINYLFU_AGING_INCREMENTAL;
+            } else if (strcmp(optarg, "stop") == 0) {
+                params.aging = TINYLFU_AGING_STOP_THE_WORLD;
+            } else {
+                fprintf(stderr, "Unknown aging: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (params.n < WARMUP_FRACTION || params.keys < 1 || threads < 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    struct workload workloads[MAX_WORKLOADS];
+    size_t num_workloads = 0;
+    for (char *name = strtok(workload_list, ","); name && num_workloads < MAX_WORKLOADS;
+         name = strtok(NULL, ",")) {
+        if (parse_workload(name, &workloads[num_workloads]) != 0) {
+            fprintf(stderr, "Unknown workload: %s\n", name);
+            return 1;
+        }
+        num_workloads++;
+    }
+
+    int cache_bits[MAX_CACHE_SIZE_BITS], sample_bits[MAX_SAMPLE_SIZE_BITS];
+    int num_cache_bits = parse_bits(cache_bits_list, cache_bits, MAX_CACHE_SIZE_BITS, false);
+    int num_sample_bits = parse_bits(sample_bits_list, sample_bits, MAX_SAMPLE_SIZE_BITS, true);
+    if (num_cache_bits <= 0 || num_sample_bits <= 0) {
+        fprintf(stderr, "Invalid CACHE_SIZE_BITS or SAMPLE_SIZE_BITS\n");
+        return 1;
+    }
+
+    size_t num_points = num_workloads * num_cache_bits * num_sample_bits;
+    struct point *points = (struct point*) calloc(num_points, sizeof(struct point));
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!points || !out) {
+        fprintf(stderr, "Failed to open %s or allocate %zu points\n",
+                out_path ? out_path : "stdout", num_points);
+        free(points);
+        return 1;
+    }
+
+    size_t i = 0;
+    for (size_t w = 0; w < num_workloads; w++) {
+        for (int c = 0; c < num_cache_bits; c++) {
+            for (int s = 0; s < num_sample_bits; s++) {
+                points[i].w                = &workloads[w];
+                points[i].cache_size_bits  = cache_bits[c];
+                points[i].sample_size_bits = sample_bits[s] < 0
+                                                 ? cache_bits[c] - sample_bits[s] - 1
+                                                 : sample_bits[s];
+                i++;
+            }
+        }
+    }
+
+    struct pool pool = {.params = &params, .points = points, .num_points = num_points};
+    if ((size_t) threads > num_points) {
+        threads = num_points;
+    }
+    pthread_t *tids = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    if (!tids) {
+        fprintf(stderr, "Failed to allocate %ld threads\n", threads);
+        free(points);
+        return 1;
+    }
+    for (long t = 0; t < threads; t++) {
+        pthread_create(&tids[t], NULL, worker, &pool);
+    }
+    for (long t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    fprintf(out, "workload,cache_size_bits,sample_size_bits,doorkeeper,accesses,resets,"
+            "mean_error,mean_abs_error,p50_abs_error,p90_abs_error,p99_abs_error,"
+            "overestimates,underestimates,admit_agreement,decisive,"
+            "admit_agreement_decisive,false_admits,false_rejects\n");
+
+    int status = 0;
+    for (i = 0; i < num_points; i++) {
+        if (points[i].status != 0) {
+            fprintf(stderr, "Failed to run %s with CACHE_SIZE_BITS %d\n",
+                    points[i].w->name, points[i].cache_size_bits);
+            status = 1;
+            continue;
+        }
+        print_point(out, &points[i], &params, doorkeeper);
+    }
+
+    free(tids);
+    free(points);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return status;
+}
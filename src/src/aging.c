@@ -0,0 +1,57 @@
+#include "aging.h"
+
+struct aging* aging_init(size_t num_words)
+{
+    struct aging *a = (struct aging*) malloc(sizeof(struct aging));
+
+    if (a) {
+        a->num_words  = num_words;
+        a->num_chunks = (num_words + AGING_CHUNK_WORDS - 1) / AGING_CHUNK_WORDS;
+        a->epoch      = 0;
+        a->cursor     = 0;
+        a->num_stale  = 0;
+
+        // All chunks start in epoch 0, i.e. up to date
+        a->chunk_epochs = (uint8_t*) calloc(a->num_chunks ? a->num_chunks : 1,
+                                            sizeof(uint8_t));
+
+        if (!a->chunk_epochs) {
+            free(a);
+            return NULL;
+        }
+    }
+
+    return a;
+}
+
+void aging_free(struct aging **a)
+{
+    if (a && *a) {
+        free((*a)->chunk_epochs);
+        free(*a);
+        *a = NULL;
+    }
+}
+
+void aging_start(struct aging *a)
+{
+    if (!a) return;
+
+    // Tags are either epoch or epoch - 1, so wrapping around is harmless
+    a->epoch++;
+    a->cursor    = 0;
+    a->num_stale = a->num_chunks;
+}
+
+bool aging_next_stale(struct aging *a, size_t *chunk)
+{
+    if (!a || !aging_in_progress(a)) return false;
+
+    // Chunks touched by accesses may already have been reset
+    while (!aging_is_stale(a, a->cursor)) {
+        a->cursor++;
+    }
+
+    *chunk = a->cursor;
+    return true;
+}
@@ -0,0 +1,270 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define PAGE_SIZE_4K (4096UL)
+#define PAGE_SIZE_2M (2UL << 20)
+#define PAGE_SIZE_1G (1UL << 30)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define ARENA_MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define ARENA_MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+
+// Nodes addressable by arena_options.numa_node
+#define MAX_NUMA_NODES 1024
+
+static const char *BACKING_NAMES[ARENA_NUM_BACKINGS] = {
+    "hugetlb_1g", "hugetlb_2m", "thp", "small_pages", "file",
+};
+
+const char* arena_backing_name(enum arena_backing backing)
+{
+    return backing < ARENA_NUM_BACKINGS ? BACKING_NAMES[backing] : "unknown";
+}
+
+struct region {
+    void *addr;
+    size_t len;
+    enum arena_backing backing;
+    struct region *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct region *regions;
+static struct arena_options options = {
+    .huge_pages = true,
+    .numa_node  = -1,
+};
+
+void arena_set_options(const struct arena_options *opts)
+{
+    pthread_mutex_lock(&lock);
+    options = *opts;
+    pthread_mutex_unlock(&lock);
+}
+
+void arena_get_options(struct arena_options *opts)
+{
+    pthread_mutex_lock(&lock);
+    *opts = options;
+    pthread_mutex_unlock(&lock);
+}
+
+// File the allocations of this thread are mapped from, -1 for none
+static __thread int file_fd = -1;
+static __thread size_t file_offset;
+
+void arena_set_file(int fd, size_t offset)
+{
+    file_fd     = fd;
+    file_offset = offset;
+}
+
+size_t arena_file_offset(void)
+{
+    return file_offset;
+}
+
+static size_t round_up(size_t bytes, size_t page_size)
+{
+    return (bytes + page_size - 1) / page_size * page_size;
+}
+
+static void* map_anonymous(size_t len, int flags)
+{
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+/*
+ * Maps len bytes (a multiple of 2M) at a 2M boundary, so that the kernel can
+ * back all of it with transparent huge pages, and asks it to.
+ */
+static void* map_thp(size_t len)
+{
+    uint8_t *map = (uint8_t*) map_anonymous(len + PAGE_SIZE_2M, 0);
+    if (!map) return NULL;
+
+    uint8_t *addr = (uint8_t*) round_up((uintptr_t) map, PAGE_SIZE_2M);
+    size_t head = addr - map;
+    size_t tail = PAGE_SIZE_2M - head;
+
+    if (head) munmap(map, head);
+    if (tail) munmap(addr + len, tail);
+
+    // Only fails if THP is disabled, in which case the mapping still works
+    madvise(addr, len, MADV_HUGEPAGE);
+    return addr;
+}
+
+/*
+ * Maps len bytes with the largest pages available, and sets region to the
+ * mapping.
+ */
+static int map_region(size_t bytes, bool huge_pages, struct region *region)
+{
+    if (huge_pages && bytes >= PAGE_SIZE_1G) {
+        region->len     = round_up(bytes, PAGE_SIZE_1G);
+        region->backing = ARENA_HUGETLB_1G;
+        region->addr    = map_anonymous(region->len, MAP_HUGETLB | ARENA_MAP_HUGE_1GB);
+        if (region->addr) return 0;
+    }
+
+    if (huge_pages && bytes >= PAGE_SIZE_2M) {
+        region->len     = round_up(bytes, PAGE_SIZE_2M);
+        region->backing = ARENA_HUGETLB_2M;
+        region->addr    = map_anonymous(region->len, MAP_HUGETLB | ARENA_MAP_HUGE_2MB);
+        if (region->addr) return 0;
+
+        region->backing = ARENA_THP;
+        region->addr    = map_thp(region->len);
+        if (region->addr) return 0;
+    }
+
+    region->len     = round_up(bytes ? bytes : 1, PAGE_SIZE_4K);
+    region->backing = ARENA_SMALL_PAGES;
+    region->addr    = map_anonymous(region->len, 0);
+    if (!region->addr) return -1;
+
+    // Keeps small pages even if THP is enabled for all mappings
+    if (!huge_pages) {
+        madvise(region->addr, region->len, MADV_NOHUGEPAGE);
+    }
+    return 0;
+}
+
+/*
+ * Maps the next len bytes of the file of the calling thread, extending it if
+ * it is shorter.
+ */
+static int map_file_region(size_t bytes, struct region *region)
+{
+    struct stat st;
+
+    region->len     = round_up(bytes ? bytes : 1, PAGE_SIZE_4K);
+    region->backing = ARENA_FILE;
+
+    if (fstat(file_fd, &st) != 0) return -1;
+    if ((size_t) st.st_size < file_offset + region->len
+        && ftruncate(file_fd, file_offset + region->len) != 0) {
+        return -1;
+    }
+
+    region->addr = mmap(NULL, region->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        file_fd, file_offset);
+    if (region->addr == MAP_FAILED) return -1;
+
+    file_offset += region->len;
+    return 0;
+}
+
+/*
+ * Binds the pages of a region to node. Pages are not allocated until they
+ * are first touched, which is after this.
+ */
+static int bind_region(struct region *region, int node)
+{
+    unsigned long mask[MAX_NUMA_NODES / (sizeof(unsigned long) * CHAR_BIT)] = {0};
+    size_t bits = sizeof(unsigned long) * CHAR_BIT;
+
+    if (node < 0 || node >= MAX_NUMA_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask[node / bits] |= 1UL << (node % bits);
+
+    return (int) syscall(SYS_mbind, region->addr, region->len, MPOL_BIND, mask,
+                         MAX_NUMA_NODES + 1, 0);
+}
+
+void* arena_alloc(size_t bytes)
+{
+    struct arena_options opts;
+    arena_get_options(&opts);
+
+    struct region *region = (struct region*) malloc(sizeof(struct region));
+    if (!region) return NULL;
+
+    int mapped = file_fd >= 0 ? map_file_region(bytes, region)
+                              : map_region(bytes, opts.huge_pages, region);
+    if (mapped != 0) {
+        free(region);
+        return NULL;
+    }
+
+    if (opts.numa_node >= 0 && bind_region(region, opts.numa_node) != 0) {
+        munmap(region->addr, region->len);
+        free(region);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    region->next = regions;
+    regions = region;
+    pthread_mutex_unlock(&lock);
+
+    return region->addr;
+}
+
+void arena_free(void *ptr)
+{
+    if (!ptr) return;
+
+    pthread_mutex_lock(&lock);
+    struct region **prev = &regions;
+    while (*prev && (*prev)->addr != ptr) {
+        prev = &(*prev)->next;
+    }
+
+    struct region *region = *prev;
+    if (region) {
+        *prev = region->next;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (region) {
+        munmap(region->addr, region->len);
+        free(region);
+    }
+}
+
+enum arena_backing arena_backing_of(const void *ptr)
+{
+    enum arena_backing backing = ARENA_NUM_BACKINGS;
+
+    pthread_mutex_lock(&lock);
+    for (struct region *region = regions; region; region = region->next) {
+        if (region->addr == ptr) {
+            backing = region->backing;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return backing;
+}
+
+void arena_get_stats(struct arena_stats *stats)
+{
+    for (int i = 0; i < ARENA_NUM_BACKINGS; i++) {
+        stats->bytes[i] = 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (struct region *region = regions; region; region = region->next) {
+        stats->bytes[region->backing] += region->len;
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,740 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include "bloom.h"
+#include "blocked_bloom.h"
+#include "counting_bloom.h"
+#include "frequency_sketch.h"
+#include "tinylfu.h"
+#include "zipf.h"
+#include "perf_counters.h"
+#include "arena.h"
+#include "bench_summary.h"
+
+/*
+ * Micro-benchmarks of the sketch operations. Each operation is measured for
+ * every table size from min to max bytes and every key distribution, with
+ * wall-clock time and hardware counters, and reported as one CSV row per
+ * (operation, size, distribution).
+ */
+
+#define MAX_DISTRIBUTIONS 16
+
+// Ranks drawn by the Zipf distributions
+#define ZIPF_KEYS (1ULL << 24)
+
+static const char *USAGE =
+    "Usage: %s [-o <csv>] [-m <min bytes>] [-M <max bytes>] [-f <factor>]\n"
+    "          [-n <ops>] [-r <repetitions>] [-b <op>[,<op>...]]\n"
+    "          [-d <distribution>[,<distribution>...]] [-p <pages>[,<pages>...]]\n"
+    "       %s -H [-o <csv>] [-n <keys>] [-r <repetitions>]\n"
+    "       %s -S\n"
+    "\n"
+    "-m, -M    table sizes, from min to max multiplying by factor\n"
+    "          (default 16K to 256M by 4; K, M and G suffixes accepted).\n"
+    "-n        operations per measurement (default 1M).\n"
+    "-r        repetitions; the fastest is reported (default 3).\n"
+    "-b        operations (default all): %s.\n"
+    "-d        distributions (default uniform,zipf0.6,zipf0.8,zipf1.0,zipf1.2,scan):\n"
+    "          uniform over 2^32 keys, zipf<s> over 2^24 keys, or scan of keys\n"
+    "          never seen before.\n"
+    "-p        pages of the tables (default huge): small (4K), or huge (the\n"
+    "          largest the arena gets, reported in the pages column).\n"
+    "-H        compares the hash families instead: hashing throughput, scalar\n"
+    "          and batched, and the false positive rate of a bloom filter of\n"
+    "          %d bits per key on sequential and random keys.\n"
+    "-S        runs the summary benchmarks instead (doorkeeper layouts, batching,\n"
+    "          lock-free scaling, aging latency, W-TinyLFU), printed as text.\n";
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Operations
+ *
+ * Each operation creates its structure with a table of about the given
+ * bytes, touches the whole table so that page faults are not measured, and
+ * runs over keys[0..n). The table is filled beforehand with the add or access
+ * operation of the structure.
+ */
+
+struct bench_op {
+    const char *name;
+    void* (*create)(size_t bytes);
+    void (*destroy)(void *s);
+    void (*fill)(void *s, const uint64_t *keys, size_t n);
+    uint64_t (*run)(void *s, const uint64_t *keys, size_t n);
+};
+
+static void *bloom_create(size_t bytes)
+{
+    struct bloom *b = bloom_init(bytes * 8);
+    if (b) bloom_clear(b);
+    return b;
+}
+
+static void bloom_destroy(void *s)
+{
+    struct bloom *b = (struct bloom*) s;
+    bloom_free(&b);
+}
+
+static void bloom_fill(void *s, const uint64_t *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        bloom_add((struct bloom*) s, keys[i]);
+    }
+}
+
+static uint64_t bloom_run_add(void *s, const uint64_t *keys, size_t n)
+{
+    bloom_fill(s, keys, n);
+    return 0;
+}
+
+static uint64_t bloom_run_contains(void *s, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += bloom_contains((struct bloom*) s, keys[i]);
+    }
+    return sum;
+}
+
+static void *blocked_bloom_create(size_t bytes)
+{
+    struct blocked_bloom *b = blocked_bloom_init(bytes * 8);
+    if (b) blocked_bloom_clear(b);
+    return b;
+}
+
+static void blocked_bloom_destroy(void *s)
+{
+    struct blocked_bloom *b = (struct blocked_bloom*) s;
+    blocked_bloom_free(&b);
+}
+
+static void blocked_bloom_fill(void *s, const uint64_t *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        blocked_bloom_add((struct blocked_bloom*) s, keys[i]);
+    }
+}
+
+static uint64_t blocked_bloom_run_add(void *s, const uint64_t *keys, size_t n)
+{
+    blocked_bloom_fill(s, keys, n);
+    return 0;
+}
+
+static uint64_t blocked_bloom_run_contains(void *s, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += blocked_bloom_contains((struct blocked_bloom*) s, keys[i]);
+    }
+    return sum;
+}
+
+static void *counting_bloom_create(size_t bytes)
+{
+    struct counting_bloom *cb = counting_bloom_init(bytes * 8 / BITS_PER_COUNTER);
+    if (cb) counting_bloom_reset(cb);
+    return cb;
+}
+
+static void counting_bloom_destroy(void *s)
+{
+    struct counting_bloom *cb = (struct counting_bloom*) s;
+    counting_bloom_free(&cb);
+}
+
+static void counting_bloom_fill(void *s, const uint64_t *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        counting_bloom_add((struct counting_bloom*) s, keys[i]);
+    }
+}
+
+static uint64_t counting_bloom_run_add(void *s, const uint64_t *keys, size_t n)
+{
+    counting_bloom_fill(s, keys, n);
+    return 0;
+}
+
+static uint64_t counting_bloom_run_estimate(void *s, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += counting_bloom_estimate((struct counting_bloom*) s, keys[i]);
+    }
+    return sum;
+}
+
+static void *frequency_sketch_create(size_t bytes)
+{
+    struct frequency_sketch *fs = frequency_sketch_init(bytes * 8 / FS_BITS_PER_COUNTER);
+    if (fs) frequency_sketch_reset(fs);
+    return fs;
+}
+
+static void frequency_sketch_destroy(void *s)
+{
+    struct frequency_sketch *fs = (struct frequency_sketch*) s;
+    frequency_sketch_free(&fs);
+}
+
+static void frequency_sketch_fill(void *s, const uint64_t *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        frequency_sketch_add((struct frequency_sketch*) s, keys[i]);
+    }
+}
+
+static uint64_t frequency_sketch_run_add(void *s, const uint64_t *keys, size_t n)
+{
+    frequency_sketch_fill(s, keys, n);
+    return 0;
+}
+
+static uint64_t frequency_sketch_run_estimate(void *s, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += frequency_sketch_estimate((struct frequency_sketch*) s, keys[i]);
+    }
+    return sum;
+}
+
+/*
+ * TinyLFU splits the bytes evenly between the doorkeeper and the sketch,
+ * both of BITS_PER_COUNTER-bit counters with either sketch.
+ */
+static void *tinylfu_create(size_t bytes)
+{
+    struct tinylfu_config config = {
+        .aging           = TINYLFU_AGING_INCREMENTAL,
+        .doorkeeper_type = DOORKEEPER_BLOOM,
+        .doorkeeper_size = bytes / 2 * 8,
+        .sketch_size     = bytes / 2 * 8 / BITS_PER_COUNTER,
+    };
+    struct tinylfu *tfu = tinylfu_init(&config);
+    if (tfu) {
+        doorkeeper_clear(tfu->doorkeeper);
+        tinylfu_sketch_reset(tfu->sketch);
+    }
+    return tfu;
+}
+
+static void tinylfu_destroy(void *s)
+{
+    struct tinylfu *tfu = (struct tinylfu*) s;
+    tinylfu_free(&tfu);
+}
+
+static void tinylfu_fill(void *s, const uint64_t *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        tinylfu_access((struct tinylfu*) s, keys[i]);
+    }
+}
+
+static uint64_t tinylfu_run_access(void *s, const uint64_t *keys, size_t n)
+{
+    tinylfu_fill(s, keys, n);
+    return 0;
+}
+
+static uint64_t tinylfu_run_estimate(void *s, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += tinylfu_estimate((struct tinylfu*) s, keys[i]);
+    }
+    return sum;
+}
+
+// Each key against the next one as the victim
+static uint64_t tinylfu_run_admit(void *s, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i + 1 < n; i++) {
+        sum += tinylfu_admit((struct tinylfu*) s, keys[i], keys[i + 1]);
+    }
+    return sum;
+}
+
+static const struct bench_op OPS[] = {
+    {"bloom_add", bloom_create, bloom_destroy, bloom_fill, bloom_run_add},
+    {"bloom_contains", bloom_create, bloom_destroy, bloom_fill, bloom_run_contains},
+    {"blocked_bloom_add", blocked_bloom_create, blocked_bloom_destroy, blocked_bloom_fill,
+     blocked_bloom_run_add},
+    {"blocked_bloom_contains", blocked_bloom_create, blocked_bloom_destroy, blocked_bloom_fill,
+     blocked_bloom_run_contains},
+    {"counting_bloom_add", counting_bloom_create, counting_bloom_destroy, counting_bloom_fill,
+     counting_bloom_run_add},
+    {"counting_bloom_estimate", counting_bloom_create, counting_bloom_destroy,
+     counting_bloom_fill, counting_bloom_run_estimate},
+    {"frequency_sketch_add", frequency_sketch_create, frequency_sketch_destroy,
+     frequency_sketch_fill, frequency_sketch_run_add},
+    {"frequency_sketch_estimate", frequency_sketch_create, frequency_sketch_destroy,
+     frequency_sketch_fill, frequency_sketch_run_estimate},
+    {"tinylfu_access", tinylfu_create, tinylfu_destroy, tinylfu_fill, tinylfu_run_access},
+    {"tinylfu_estimate", tinylfu_create, tinylfu_destroy, tinylfu_fill, tinylfu_run_estimate},
+    {"tinylfu_admit", tinylfu_create, tinylfu_destroy, tinylfu_fill, tinylfu_run_admit},
+};
+
+#define NUM_OPS (sizeof(OPS) / sizeof(OPS[0]))
+
+/*
+ * Key distributions
+ */
+
+struct distribution {
+    const char *name;
+    // Zipf exponent, 0 for uniform keys
+    double s;
+    bool scan;
+};
+
+static int parse_distribution(const char *name, struct distribution *d)
+{
+    d->name = name;
+    d->s    = 0;
+    d->scan = false;
+
+    if (strcmp(name, "uniform") == 0) return 0;
+    if (strcmp(name, "scan") == 0) {
+        d->scan = true;
+        return 0;
+    }
+
+    char *end;
+    if (strncmp(name, "zipf", 4) == 0) {
+        d->s = strtod(name + 4, &end);
+        if (end != name + 4 && *end == '\0' && d->s > 0) return 0;
+    }
+    return -1;
+}
+
+/*
+ * Draws n keys of d for the fill and n more for the measurement. Scan keys
+ * are consecutive, so the measured ones were never filled.
+ */
+static void generate_keys(const struct distribution *d, uint64_t *keys, size_t n)
+{
+    uint64_t rng = 42;
+    struct zipf z;
+
+    if (d->s > 0) {
+        zipf_init(&z, ZIPF_KEYS, d->s);
+    }
+
+    for (size_t i = 0; i < 2 * n; i++) {
+        if (d->scan) {
+            keys[i] = i;
+        } else if (d->s > 0) {
+            keys[i] = zipf_next(&z, &rng);
+        } else {
+            keys[i] = splitmix64(&rng) >> 32;
+        }
+    }
+}
+
+/*
+ * Measurement
+ */
+
+struct result {
+    uint64_t ns;
+    uint64_t counters[PERF_NUM_COUNTERS];
+    // Pages backing most of the structure's bytes
+    enum arena_backing backing;
+};
+
+static volatile uint64_t sink;
+
+static int measure(const struct bench_op *op, size_t bytes, const uint64_t *keys, size_t n,
+                   struct perf_counters *pc, struct result *result)
+{
+    struct arena_stats before, after;
+    arena_get_stats(&before);
+
+    void *s = op->create(bytes);
+    if (!s) return -1;
+
+    arena_get_stats(&after);
+    result->backing = ARENA_SMALL_PAGES;
+    for (int i = 0; i < ARENA_NUM_BACKINGS; i++) {
+        if (after.bytes[i] - before.bytes[i]
+                > after.bytes[result->backing] - before.bytes[result->backing]) {
+            result->backing = i;
+        }
+    }
+
+    op->fill(s, keys, n);
+
+    perf_counters_start(pc);
+    uint64_t start = now_ns();
+    sink += op->run(s, keys + n, n);
+    result->ns = now_ns() - start;
+    perf_counters_stop(pc);
+
+    memcpy(result->counters, pc->values, sizeof(result->counters));
+    op->destroy(s);
+    return 0;
+}
+
+/*
+ * Hash families
+ */
+
+// Bloom filter size of the false positive measurement
+#define HASH_BITS_PER_KEY 10
+
+// Keys hashed per get_hashes_batch_with() call
+#define HASH_BATCH 256
+
+static uint64_t hash_run_scalar(enum hash_family family, const uint64_t *keys, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct hashes hs;
+        get_hashes_with(family, keys[i], &hs);
+        sum += hs.h[NUM_HASH_FUNCTIONS - 1];
+    }
+    return sum;
+}
+
+static uint64_t hash_run_batch(enum hash_family family, const uint64_t *keys, size_t n)
+{
+    struct hashes hs[HASH_BATCH];
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < n; i += HASH_BATCH) {
+        size_t len = n - i < HASH_BATCH ? n - i : HASH_BATCH;
+        get_hashes_batch_with(family, keys + i, len, hs);
+        for (size_t j = 0; j < len; j++) {
+            sum += hs[j].h[NUM_HASH_FUNCTIONS - 1];
+        }
+    }
+    return sum;
+}
+
+static double hash_ns_per_key(uint64_t (*run)(enum hash_family, const uint64_t*, size_t),
+                              enum hash_family family, const uint64_t *keys, size_t n,
+                              int repetitions)
+{
+    uint64_t best = UINT64_MAX;
+
+    for (int r = 0; r < repetitions; r++) {
+        uint64_t start = now_ns();
+        sink += run(family, keys, n);
+        uint64_t ns = now_ns() - start;
+        if (ns < best) {
+            best = ns;
+        }
+    }
+    return (double) best / n;
+}
+
+/*
+ * Adds keys[0..n) to a bloom filter of HASH_BITS_PER_KEY bits per key and
+ * returns the fraction of keys[n..2n), none of which were added, that it
+ * contains.
+ */
+static double hash_false_positive_rate(enum hash_family family, const uint64_t *keys, size_t n)
+{
+    struct bloom *b = bloom_init(n * HASH_BITS_PER_KEY);
+    if (!b) return NAN;
+    bloom_clear(b);
+
+    struct hashes hs;
+    for (size_t i = 0; i < n; i++) {
+        get_hashes_with(family, keys[i], &hs);
+        bloom_add_with_hashes(b, &hs);
+    }
+
+    size_t positives = 0;
+    for (size_t i = n; i < 2 * n; i++) {
+        get_hashes_with(family, keys[i], &hs);
+        positives += bloom_contains_with_hashes(b, &hs);
+    }
+
+    bloom_free(&b);
+    return (double) positives / n;
+}
+
+static int bench_hashes(FILE *out, size_t n, int repetitions)
+{
+    uint64_t *sequential = (uint64_t*) malloc(2 * n * sizeof(uint64_t));
+    uint64_t *random     = (uint64_t*) malloc(2 * n * sizeof(uint64_t));
+    if (!sequential || !random) {
+        fprintf(stderr, "Failed to allocate %zu keys\n", 2 * n);
+        free(sequential);
+        free(random);
+        return 1;
+    }
+
+    uint64_t rng = 42;
+    for (size_t i = 0; i < 2 * n; i++) {
+        sequential[i] = i;
+        random[i]     = splitmix64(&rng);
+    }
+
+    // (1 - e^(-kn/m))^k
+    double theoretical = pow(1 - exp(-(double) NUM_HASH_FUNCTIONS / HASH_BITS_PER_KEY),
+                             NUM_HASH_FUNCTIONS);
+
+    fprintf(out, "family,keys,scalar_ns_per_key,batch_ns_per_key,batch_avx2,bits_per_key,"
+            "fp_rate_sequential,fp_rate_random,fp_rate_theoretical\n");
+
+    bool avx2 = get_hashes_batch_use_avx2(true);
+    for (int f = 0; f < HASH_NUM_FAMILIES; f++) {
+        fprintf(out, "%s,%zu,%.3f,%.3f,%d,%d,%.6f,%.6f,%.6f\n", hash_family_name(f), n,
+                hash_ns_per_key(hash_run_scalar, f, random, n, repetitions),
+                hash_ns_per_key(hash_run_batch, f, random, n, repetitions),
+                avx2, HASH_BITS_PER_KEY,
+                hash_false_positive_rate(f, sequential, n),
+                hash_false_positive_rate(f, random, n),
+                theoretical);
+        fflush(out);
+    }
+
+    free(sequential);
+    free(random);
+    return 0;
+}
+
+static size_t parse_bytes(const char *arg)
+{
+    char *end;
+    size_t bytes = strtoull(arg, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+        bytes <<= 10;
+        // fall through
+    case 'M': case 'm':
+        bytes <<= 10;
+        // fall through
+    case 'K': case 'k':
+        bytes <<= 10;
+        break;
+    }
+    return bytes;
+}
+
+static char *op_names(void)
+{
+    static char names[512];
+    size_t len = 0;
+
+    for (size_t i = 0; i < NUM_OPS; i++) {
+        len += snprintf(names + len, sizeof(names) - len, "%s%s", i ? ", " : "", OPS[i].name);
+    }
+    return names;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    size_t min_bytes = 16 << 10;
+    size_t max_bytes = 256 << 20;
+    size_t factor = 4;
+    size_t n = 1 << 20;
+    int repetitions = 3;
+    char default_dists[] = "uniform,zipf0.6,zipf0.8,zipf1.0,zipf1.2,scan";
+    char *dist_list = default_dists;
+    char *op_list = NULL;
+    char default_pages[] = "huge";
+    char *page_list = default_pages;
+    bool hashes = false;
+    bool summary = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:m:M:f:n:r:b:d:p:HSh")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'm':
+            min_bytes = parse_bytes(optarg);
+            break;
+        case 'M':
+            max_bytes = parse_bytes(optarg);
+            break;
+        case 'f':
+            factor = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            n = parse_bytes(optarg);
+            break;
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        case 'b':
+            op_list = optarg;
+            break;
+        case 'd':
+            dist_list = optarg;
+            break;
+        case 'p':
+            page_list = optarg;
+            break;
+        case 'H':
+            hashes = true;
+            break;
+        case 'S':
+            summary = true;
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0], op_names(), HASH_BITS_PER_KEY);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (min_bytes < 64 || max_bytes < min_bytes || factor < 2 || n < 2 || repetitions < 1) {
+        fprintf(stderr, USAGE, argv[0], argv[0], argv[0], op_names(), HASH_BITS_PER_KEY);
+        return 1;
+    }
+
+    if (summary) {
+        bench_summary();
+        return 0;
+    }
+
+    if (hashes) {
+        FILE *out = out_path ? fopen(out_path, "w") : stdout;
+        if (!out) {
+            fprintf(stderr, "Failed to open %s\n", out_path);
+            return 1;
+        }
+
+        int status = bench_hashes(out, n, repetitions);
+        if (out != stdout) {
+            fclose(out);
+        }
+        return status;
+    }
+
+    bool selected[NUM_OPS];
+    for (size_t i = 0; i < NUM_OPS; i++) {
+        selected[i] = !op_list;
+    }
+    for (char *name = op_list ? strtok(op_list, ",") : NULL; name; name = strtok(NULL, ",")) {
+        size_t i = 0;
+        while (i < NUM_OPS && strcmp(OPS[i].name, name) != 0) {
+            i++;
+        }
+        if (i == NUM_OPS) {
+            fprintf(stderr, "Unknown operation: %s\n", name);
+            return 1;
+        }
+        selected[i] = true;
+    }
+
+    struct distribution dists[MAX_DISTRIBUTIONS];
+    size_t num_dists = 0;
+    for (char *name = strtok(dist_list, ","); name && num_dists < MAX_DISTRIBUTIONS;
+         name = strtok(NULL, ",")) {
+        if (parse_distribution(name, &dists[num_dists]) != 0) {
+            fprintf(stderr, "Unknown distribution: %s\n", name);
+            return 1;
+        }
+        num_dists++;
+    }
+
+    // Huge pages on or off, in the order given
+    bool page_modes[2];
+    size_t num_page_modes = 0;
+    for (char *name = strtok(page_list, ","); name && num_page_modes < 2;
+         name = strtok(NULL, ",")) {
+        if (strcmp(name, "small") != 0 && strcmp(name, "huge") != 0) {
+            fprintf(stderr, "Unknown pages: %s\n", name);
+            return 1;
+        }
+        page_modes[num_page_modes++] = strcmp(name, "huge") == 0;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    uint64_t *keys = (uint64_t*) malloc(2 * n * sizeof(uint64_t));
+    if (!out || !keys) {
+        fprintf(stderr, "Failed to open %s or allocate %zu keys\n",
+                out_path ? out_path : "stdout", 2 * n);
+        free(keys);
+        return 1;
+    }
+
+    struct perf_counters pc;
+    if (perf_counters_open(&pc) < PERF_NUM_COUNTERS) {
+        fprintf(stderr, "Some hardware counters are unavailable (perf_event_paranoid?); "
+                "their columns are left empty\n");
+    }
+
+    fprintf(out, "op,table_bytes,pages,distribution,ops,ns_per_op");
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        fprintf(out, ",%s_per_op", perf_counter_name(c));
+    }
+    fprintf(out, "\n");
+
+    int status = 0;
+    for (size_t d = 0; d < num_dists; d++) {
+        generate_keys(&dists[d], keys, n);
+
+        for (size_t i = 0; i < NUM_OPS; i++) {
+            if (!selected[i]) continue;
+
+            for (size_t bytes = min_bytes; bytes <= max_bytes; bytes *= factor) {
+                for (size_t p = 0; p < num_page_modes; p++) {
+                    struct arena_options opts = {.huge_pages = page_modes[p], .numa_node = -1};
+                    arena_set_options(&opts);
+
+                    struct result best = {.ns = UINT64_MAX};
+
+                    for (int r = 0; r < repetitions; r++) {
+                        struct result result;
+                        if (measure(&OPS[i], bytes, keys, n, &pc, &result) != 0) {
+                            fprintf(stderr, "Failed to create %s of %zu bytes\n",
+                                    OPS[i].name, bytes);
+                            status = 1;
+                            break;
+                        }
+                        if (result.ns < best.ns) {
+                            best = result;
+                        }
+                    }
+                    if (best.ns == UINT64_MAX) continue;
+
+                    fprintf(out, "%s,%zu,%s,%s,%zu,%.2f", OPS[i].name, bytes,
+                            arena_backing_name(best.backing), dists[d].name, n,
+                            (double) best.ns / n);
+                    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+                        if (perf_counter_available(&pc, c)) {
+                            fprintf(out, ",%.3f", (double) best.counters[c] / n);
+                        } else {
+                            fprintf(out, ",");
+                        }
+                    }
+                    fprintf(out, "\n");
+                    fflush(out);
+                }
+            }
+        }
+    }
+
+    perf_counters_close(&pc);
+    free(keys);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return status;
+}
@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include "counting_bloom.h"
+#include "frequency_sketch.h"
+#include "tinylfu.h"
+#include "concurrent_tinylfu.h"
+#include "wtinylfu.h"
+#include "zipf.h"
+#include "bench_summary.h"
+
+/*
+ * Benchmarks of the design choices (doorkeeper layouts, batching, locking,
+ * aging), reported as text by bench_runner -S.
+ */
+
+struct concurrent_worker {
+    struct concurrent_tinylfu *ctfu;
+    struct tinylfu *tfu;
+    pthread_mutex_t *lock;
+    int id;
+    int n;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Number of distinct 64-byte lines a doorkeeper probe touches. On tables that
+ * do not fit in the LLC this is the number of cache misses per access.
+ */
+static int doorkeeper_lines_touched(struct doorkeeper *dk, struct hashes *hs) {
+    if (dk->type == DOORKEEPER_BLOCKED_BLOOM) {
+        return 1;
+    }
+    if (dk->type == DOORKEEPER_CUCKOO) {
+        return doorkeeper_word_with_hashes(dk, hs, 0) / 8
+                   == doorkeeper_word_with_hashes(dk, hs, 1) / 8 ? 1 : 2;
+    }
+
+    size_t lines[NUM_HASH_FUNCTIONS];
+    int num_lines = 0;
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        size_t line = reduce(hs->h[i], dk->bloom->vector->size) / 512;
+        int seen = 0;
+        for (int j = 0; j < num_lines; j++) {
+            seen |= lines[j] == line;
+        }
+        if (!seen) {
+            lines[num_lines++] = line;
+        }
+    }
+    return num_lines;
+}
+
+static void bench_doorkeeper(int n) {
+    const char *names[] = { "bloom", "blocked_bloom", "cuckoo" };
+    enum doorkeeper_type types[] = {
+        DOORKEEPER_BLOOM, DOORKEEPER_BLOCKED_BLOOM, DOORKEEPER_CUCKOO
+    };
+
+    // 2^28 bits (32 MiB) does not fit in the LLC
+    size_t num_bits = 1ULL << 28;
+    size_t num_keys = num_bits / 10;
+
+    printf("Benchmarking doorkeeper layouts (%zu MiB, %d probes)...\n",
+           num_bits >> 23, n);
+
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        // False positive rate at 10 bits per element
+        struct doorkeeper *small = doorkeeper_init(types[t], n * 10);
+        struct doorkeeper *dk    = doorkeeper_init(types[t], num_bits);
+        if (!small || !dk) {
+            printf("Failed to init %s doorkeeper\n", names[t]);
+            doorkeeper_free(&small);
+            doorkeeper_free(&dk);
+            continue;
+        }
+
+        struct hashes hs;
+        for (int i = 0; i < n; i++) {
+            get_hashes((uint64_t)i, &hs);
+            doorkeeper_add_with_hashes(small, &hs);
+        }
+
+        int false_positives = 0;
+        for (int i = n; i < 2 * n; i++) {
+            get_hashes((uint64_t)i, &hs);
+            false_positives += doorkeeper_contains_with_hashes(small, &hs);
+        }
+
+        // Miss rate and latency on a DRAM-resident table
+        for (size_t i = 0; i < num_keys; i++) {
+            get_hashes((uint64_t)i, &hs);
+            doorkeeper_add_with_hashes(dk, &hs);
+        }
+
+        uint64_t lines = 0;
+        for (int i = 0; i < n; i++) {
+            get_hashes((uint64_t)i * 7919, &hs);
+            lines += doorkeeper_lines_touched(dk, &hs);
+        }
+
+        int hits = 0;
+        uint64_t start = now_ns();
+        for (int i = 0; i < n; i++) {
+            get_hashes((uint64_t)i * 7919, &hs);
+            hits += doorkeeper_contains_with_hashes(dk, &hs);
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        printf("  %-14s fp rate %.2f%%, lines/op %.2f, contains %.1f ns/op (%d hits)\n",
+               names[t], (double)false_positives / n * 100.0,
+               (double)lines / n, (double)elapsed / n, hits);
+
+        doorkeeper_free(&small);
+        doorkeeper_free(&dk);
+    }
+
+    printf("Doorkeeper benchmark complete.\n\n");
+}
+
+/*
+ * W-TinyLFU with each doorkeeper at the same number of bits, on a Zipf
+ * workload. Besides the hit ratio, every 16th miss checks the admission
+ * decision of the sketch, between the missed key and the main area's
+ * victim, against their exact number of accesses over the last
+ * ADMISSION_WINDOW accesses. Pairs with equal counts are skipped.
+ */
+#define ADMISSION_WINDOW(capacity) (10 * (capacity))
+
+static void bench_doorkeeper_admission(int n) {
+    const char *names[] = { "bloom", "blocked_bloom", "cuckoo" };
+    enum doorkeeper_type types[] = {
+        DOORKEEPER_BLOOM, DOORKEEPER_BLOCKED_BLOOM, DOORKEEPER_CUCKOO
+    };
+    size_t capacity = 1 << 14;
+    uint64_t num_keys = 1 << 20;
+    size_t window = ADMISSION_WINDOW(capacity);
+
+    printf("Benchmarking doorkeeper admission accuracy (%d accesses, capacity %zu, "
+           "%zu doorkeeper bits)...\n", n, capacity, 10 * capacity);
+
+    uint64_t *keys  = malloc(n * sizeof(uint64_t));
+    uint32_t *count = malloc((num_keys + 1) * sizeof(uint32_t));
+    if (!keys || !count) {
+        printf("Failed to allocate keys\n");
+        free(keys);
+        free(count);
+        return;
+    }
+
+    struct zipf z;
+    uint64_t rng = 7;
+    zipf_init(&z, num_keys, 0.9);
+    for (int i = 0; i < n; i++) {
+        keys[i] = zipf_next(&z, &rng);
+    }
+
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        struct tinylfu_config config = {
+            .aging           = TINYLFU_AGING_INCREMENTAL,
+            .doorkeeper_type = types[t],
+            .doorkeeper_size = 10 * capacity,
+            .sketch_size     = capacity,
+        };
+        struct wtinylfu *c = wtinylfu_init(capacity, &config);
+        if (!c) {
+            printf("Failed to init W-TinyLFU\n");
+            continue;
+        }
+        memset(count, 0, (num_keys + 1) * sizeof(uint32_t));
+
+        uint64_t decisions = 0, correct = 0, misses = 0;
+        for (int i = 0; i < n; i++) {
+            count[keys[i]]++;
+            if ((size_t)i >= window) {
+                count[keys[i - window]]--;
+            }
+
+            if (wtinylfu_access(c, keys[i]) || ++misses % 16) continue;
+            if ((size_t)i < window || c->probation.tail == WTINYLFU_NIL) continue;
+
+            uint64_t victim = c->entries[c->probation.tail].key;
+            if (count[keys[i]] == count[victim]) continue;
+
+            bool admit = tinylfu_admit(c->sketch, keys[i], victim);
+            correct += admit == (count[keys[i]] > count[victim]);
+            decisions++;
+        }
+
+        printf("  %-14s hit ratio %.2f%%, admission decisions correct %.2f%% (%" PRIu64 ")\n",
+               names[t], 100.0 * c->hits / n,
+               decisions ? 100.0 * correct / decisions : 0.0, decisions);
+        wtinylfu_free(&c);
+    }
+
+    free(keys);
+    free(count);
+    printf("Doorkeeper admission benchmark complete.\n\n");
+}
+
+static void bench_sketch(int n) {
+    // 2^26 counters (32 MiB) does not fit in the LLC
+    size_t num_counters = 1ULL << 26;
+
+    printf("Benchmarking frequency sketches (%zu MiB, %d ops)...\n",
+           num_counters * 4 >> 23, n);
+
+    struct counting_bloom *cb = counting_bloom_init(num_counters);
+    struct frequency_sketch *fs = frequency_sketch_init(num_counters);
+    if (!cb || !fs) {
+        printf("Failed to init sketches\n");
+        counting_bloom_free(&cb);
+        frequency_sketch_free(&fs);
+        return;
+    }
+
+    struct hashes hs;
+    uint64_t sum = 0;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < n; i++) {
+        get_hashes((uint64_t)i * 7919, &hs);
+        counting_bloom_add_with_hashes(cb, &hs);
+    }
+    uint64_t cb_add = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) {
+        get_hashes((uint64_t)i * 7919, &hs);
+        sum += counting_bloom_estimate_with_hashes(cb, &hs);
+    }
+    uint64_t cb_estimate = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) {
+        get_hashes((uint64_t)i * 7919, &hs);
+        frequency_sketch_add_with_hashes(fs, &hs);
+    }
+    uint64_t fs_add = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) {
+        get_hashes((uint64_t)i * 7919, &hs);
+        sum += frequency_sketch_estimate_with_hashes(fs, &hs);
+    }
+    uint64_t fs_estimate = now_ns() - start;
+
+    printf("  %-17s lines/op %d, add %.1f ns/op, estimate %.1f ns/op\n",
+           "counting_bloom", NUM_HASH_FUNCTIONS,
+           (double)cb_add / n, (double)cb_estimate / n);
+    printf("  %-17s lines/op %d, add %.1f ns/op, estimate %.1f ns/op\n",
+           "frequency_sketch", 1,
+           (double)fs_add / n, (double)fs_estimate / n);
+    printf("  (checksum %" PRIu64 ")\n", sum);
+
+    counting_bloom_free(&cb);
+    frequency_sketch_free(&fs);
+    printf("Frequency sketch benchmark complete.\n\n");
+}
+
+/*
+ * Times the second pass of accesses over addrs on a fresh TinyLFU, so that
+ * every access goes through both the doorkeeper and the sketch.
+ */
+static uint64_t bench_access_pass(const struct tinylfu_config *config,
+                                  const uint64_t *addrs, int n, bool batch) {
+    struct tinylfu *tfu = tinylfu_init(config);
+    if (!tfu) {
+        return 0;
+    }
+
+    tinylfu_access_batch(tfu, addrs, n);
+
+    uint64_t start = now_ns();
+    if (batch) {
+        tinylfu_access_batch(tfu, addrs, n);
+    } else {
+        for (int i = 0; i < n; i++) {
+            tinylfu_access(tfu, addrs[i]);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    tinylfu_free(&tfu);
+    return elapsed;
+}
+
+static void bench_batch(int n) {
+    // 2^26 counters / doorkeeper bits, well beyond the LLC
+    struct tinylfu_config config = {
+        .doorkeeper_type = DOORKEEPER_BLOCKED_BLOOM,
+        .doorkeeper_size = 1ULL << 26,
+        .sketch_size     = 1ULL << 26,
+    };
+
+    printf("Benchmarking batched TinyLFU access (%d ops)...\n", n);
+
+    uint64_t *addrs = malloc(n * sizeof(uint64_t));
+    struct hashes *hs = malloc(n * sizeof(struct hashes));
+    if (!addrs || !hs) {
+        printf("Failed to init batch benchmark\n");
+        free(addrs);
+        free(hs);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        addrs[i] = (uint64_t)i * 7919;
+    }
+
+    uint64_t elapsed = bench_access_pass(&config, addrs, n, false);
+    printf("  %-22s %6.1f Mkeys/s\n", "access (scalar)", n * 1e3 / elapsed);
+
+    bool avx2_modes[] = {false, true};
+    for (size_t m = 0; m < 2; m++) {
+        bool use_avx2 = get_hashes_batch_use_avx2(avx2_modes[m]);
+        if (avx2_modes[m] && !use_avx2) {
+            break;
+        }
+        const char *mode = use_avx2 ? "avx2" : "scalar";
+
+        uint64_t start = now_ns();
+        get_hashes_batch(addrs, n, hs);
+        elapsed = now_ns() - start;
+        printf("  hash_batch (%-6s)     %6.1f Mkeys/s\n", mode, n * 1e3 / elapsed);
+
+        elapsed = bench_access_pass(&config, addrs, n, true);
+        printf("  access_batch (%-6s)   %6.1f Mkeys/s\n", mode, n * 1e3 / elapsed);
+    }
+    get_hashes_batch_use_avx2(true);
+
+    free(addrs);
+    free(hs);
+    printf("Batched TinyLFU benchmark complete.\n\n");
+}
+
+static void *bench_concurrent_worker(void *arg) {
+    struct concurrent_worker *w = arg;
+    uint64_t x = 0x9E3779B97F4A7C15ULL * (w->id + 1);
+
+    for (int i = 0; i < w->n; i++) {
+        // xorshift64; a key space much larger than the sketch keeps resets
+        // rare, so that the access path itself is measured
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        uint64_t addr = x & ((1 << 24) - 1);
+
+        if (w->lock) {
+            pthread_mutex_lock(w->lock);
+            tinylfu_access(w->tfu, addr);
+            pthread_mutex_unlock(w->lock);
+        } else {
+            concurrent_tinylfu_access(w->ctfu, addr);
+        }
+    }
+
+    return NULL;
+}
+
+static double bench_concurrent_run(struct concurrent_worker *proto, int num_threads,
+                                   int n) {
+    pthread_t threads[64];
+    struct concurrent_worker workers[64];
+
+    uint64_t start = now_ns();
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = *proto;
+        workers[t].id = t;
+        workers[t].n = n / num_threads;
+        pthread_create(&threads[t], NULL, bench_concurrent_worker, &workers[t]);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    return (double)n * 1e3 / elapsed;
+}
+
+static void bench_concurrent_tinylfu(int n) {
+    printf("Benchmarking TinyLFU scaling (%d accesses in total)...\n", n);
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct concurrent_tinylfu *ctfu = concurrent_tinylfu_init(1 << 20, 1 << 20);
+    struct tinylfu_config config = {
+        .doorkeeper_type = DOORKEEPER_BLOCKED_BLOOM,
+        .doorkeeper_size = 1 << 20,
+        .sketch_size     = 1 << 20,
+    };
+    struct tinylfu *tfu = tinylfu_init(&config);
+    if (!ctfu || !tfu) {
+        printf("Failed to init TinyLFUs\n");
+        concurrent_tinylfu_free(&ctfu);
+        tinylfu_free(&tfu);
+        return;
+    }
+
+    printf("  %7s %16s %16s\n", "threads", "mutex Mops/s", "concurrent Mops/s");
+    for (int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+        struct concurrent_worker locked = { .tfu = tfu, .lock = &lock };
+        struct concurrent_worker lock_free = { .ctfu = ctfu };
+
+        printf("  %7d %16.1f %16.1f\n", num_threads,
+               bench_concurrent_run(&locked, num_threads, n),
+               bench_concurrent_run(&lock_free, num_threads, n));
+    }
+
+    concurrent_tinylfu_free(&ctfu);
+    tinylfu_free(&tfu);
+    printf("TinyLFU scaling benchmark complete.\n\n");
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_aging_run(enum tinylfu_aging aging, int n, uint64_t *latencies) {
+    // 2^26 counters (32 MiB): a stop-the-world reset takes milliseconds
+    struct tinylfu_config config = {
+        .aging           = aging,
+        .doorkeeper_type = DOORKEEPER_BLOCKED_BLOOM,
+        .doorkeeper_size = 1ULL << 26,
+        .sketch_size     = 1ULL << 26,
+    };
+    struct tinylfu *tfu = tinylfu_init(&config);
+    if (!tfu) {
+        printf("Failed to init TinyLFU\n");
+        return;
+    }
+
+    /*
+     * Mostly cold items, with a few hot ones saturating every ~500K accesses.
+     * The first n accesses are not measured, so that page faults on the
+     * first touch of the tables are not counted as aging.
+     */
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    uint64_t total = 0;
+    for (int i = -n; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        uint64_t addr = x % 2000 == 0 ? (x >> 32) % 32 : x & ((1ULL << 30) - 1);
+
+        uint64_t start = now_ns();
+        tinylfu_access(tfu, addr);
+        if (i >= 0) {
+            latencies[i] = now_ns() - start;
+            total += latencies[i];
+        }
+    }
+
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+
+    // Log2 histogram of access latencies
+    int buckets[64] = {0};
+    for (int i = 0; i < n; i++) {
+        int b = 0;
+        while ((2ULL << b) <= latencies[i]) b++;
+        buckets[b]++;
+    }
+
+    printf("  %s aging:\n", aging == TINYLFU_AGING_INCREMENTAL ? "incremental"
+                                                              : "stop-the-world");
+    for (int b = 0; b < 64; b++) {
+        if (buckets[b]) {
+            printf("    < %10llu ns: %d\n", 2ULL << b, buckets[b]);
+        }
+    }
+    printf("    mean %.1f ns, p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, p99.9 %" PRIu64
+           " ns, max %" PRIu64 " ns\n", (double)total / n,
+           latencies[n / 2], latencies[(int)(n * 0.99)],
+           latencies[(int)(n * 0.999)], latencies[n - 1]);
+
+    tinylfu_free(&tfu);
+}
+
+static void bench_aging(int n) {
+    printf("Benchmarking access latency under aging (%d accesses)...\n", n);
+
+    uint64_t *latencies = malloc(n * sizeof(uint64_t));
+    if (!latencies) {
+        printf("Failed to allocate latencies\n");
+        return;
+    }
+
+    bench_aging_run(TINYLFU_AGING_STOP_THE_WORLD, n, latencies);
+    bench_aging_run(TINYLFU_AGING_INCREMENTAL, n, latencies);
+
+    free(latencies);
+    printf("Aging latency benchmark complete.\n\n");
+}
+
+static void bench_wtinylfu(int n) {
+    uint64_t num_keys = 1 << 20;
+    printf("Benchmarking W-TinyLFU cache (%d accesses, Zipf 0.99 over %" PRIu64
+           " keys)...\n", n, num_keys);
+
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    if (!keys) {
+        printf("Failed to allocate keys\n");
+        return;
+    }
+
+    struct zipf z;
+    uint64_t rng = 1;
+    zipf_init(&z, num_keys, 0.99);
+    for (int i = 0; i < n; i++) {
+        // Scatter ranks so that hot keys are not adjacent
+        keys[i] = hash_64(zipf_next(&z, &rng));
+    }
+
+    for (size_t capacity = 1 << 10; capacity <= 1 << 16; capacity <<= 3) {
+        struct wtinylfu *c = wtinylfu_init(capacity, NULL);
+        if (!c) {
+            printf("Failed to init W-TinyLFU\n");
+            break;
+        }
+
+        uint64_t start = now_ns();
+        for (int i = 0; i < n; i++) {
+            wtinylfu_access(c, keys[i]);
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        printf("  capacity %6zu: hit ratio %.2f%%, window %zu, %.1f ns/op\n",
+               capacity, 100.0 * c->hits / n, c->window_max, (double)elapsed / n);
+        wtinylfu_free(&c);
+    }
+
+    free(keys);
+    printf("W-TinyLFU benchmark complete.\n\n");
+}
+
+void bench_summary(void) {
+    bench_doorkeeper(1 << 20);
+    bench_doorkeeper_admission(1 << 22);
+    bench_sketch(1 << 20);
+    bench_batch(1 << 20);
+    bench_concurrent_tinylfu(1 << 22);
+    bench_aging(1 << 22);
+    bench_wtinylfu(1 << 22);
+}
@@ -0,0 +1,98 @@
+#include "blocked_bloom.h"
+#include "arena.h"
+
+struct blocked_bloom* blocked_bloom_init(size_t num_bits)
+{
+    struct blocked_bloom *b = (struct blocked_bloom*) malloc(
+        sizeof(struct blocked_bloom)
+    );
+
+    if (b) {
+        // Round up to nearest block, at least one block
+        b->num_blocks = (num_bits + BLOCK_BITS - 1) / BLOCK_BITS;
+        if (b->num_blocks == 0) {
+            b->num_blocks = 1;
+        }
+
+        size_t num_bytes = b->num_blocks * BLOCK_WORDS * sizeof(uint64_t);
+
+        // Page aligned, so blocks never straddle two cache lines
+        b->blocks = (uint64_t*) arena_alloc(num_bytes);
+
+        if (!b->blocks) {
+            free(b);
+            return NULL;
+        }
+    }
+
+    return b;
+}
+
+void blocked_bloom_free(struct blocked_bloom **b)
+{
+    if (b && *b) {
+        arena_free((*b)->blocks);
+        free(*b);
+        *b = NULL;
+    }
+}
+
+void blocked_bloom_add_with_hashes(struct blocked_bloom *b, struct hashes *hs)
+{
+    if (!b || !hs) return;
+
+    uint64_t *block = blocked_bloom_block(b, hs);
+
+    for (size_t j = 0; j < NUM_HASH_FUNCTIONS; j++) {
+        uint32_t bit = blocked_bloom_bit(hs, j);
+        block[bit / NUM_BITS(uint64_t)] |= 1ULL << (bit % NUM_BITS(uint64_t));
+    }
+}
+
+void blocked_bloom_add(struct blocked_bloom *b, uint64_t addr)
+{
+    if (!b) return;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    blocked_bloom_add_with_hashes(b, &hs);
+}
+
+void blocked_bloom_clear(struct blocked_bloom *b)
+{
+    if (!b) return;
+
+    memset(b->blocks, 0, blocked_bloom_num_words(b) * sizeof(uint64_t));
+}
+
+void blocked_bloom_clear_range(struct blocked_bloom *b, size_t first_word,
+                               size_t num_words)
+{
+    if (!b) return;
+
+    memset(b->blocks + first_word, 0, num_words * sizeof(uint64_t));
+}
+
+bool blocked_bloom_contains_with_hashes(struct blocked_bloom *b, struct hashes *hs)
+{
+    if (!b || !hs) return false;
+
+    uint64_t *block = blocked_bloom_block(b, hs);
+
+    for (size_t j = 0; j < NUM_HASH_FUNCTIONS; j++) {
+        uint32_t bit = blocked_bloom_bit(hs, j);
+        if (!((block[bit / NUM_BITS(uint64_t)] >> (bit % NUM_BITS(uint64_t))) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool blocked_bloom_contains(struct blocked_bloom *b, uint64_t addr)
+{
+    if (!b) return false;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return blocked_bloom_contains_with_hashes(b, &hs);
+}
@@ -1,4 +1,5 @@
 #include "bloom.h"
+#include "arena.h"
 
 struct bit_vector* bit_vector_init(size_t num_bits)
 {
@@ -13,7 +14,7 @@ struct bit_vector* bit_vector_init(size_t num_bits)
         size_t num_words = (num_bits + NUM_BITS(uint64_t) - 1)
                                 / NUM_BITS(uint64_t);
 
-        res->start = (uint64_t*) calloc(num_words, sizeof(uint64_t));
+        res->start = (uint64_t*) arena_alloc(num_words * sizeof(uint64_t));
 
         if (!res->start) {
             free(res);
@@ -27,7 +28,7 @@ struct bit_vector* bit_vector_init(size_t num_bits)
 void bit_vector_free(struct bit_vector **vect)
 {
     if (vect && *vect) {
-        free((*vect)->start);
+        arena_free((*vect)->start);
         free(*vect);
         *vect = NULL;
     }
@@ -63,8 +64,8 @@ void bloom_add_with_hashes(struct bloom *b, struct hashes *hs)
     if (!b || !hs) return;
 
     for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        uint32_t hash = hs->h[i];
-        bit_vector_set(b->vector, hash % b->vector->size, true);
+        uint64_t hash = hs->h[i];
+        bit_vector_set(b->vector, reduce(hash, b->vector->size), true);
     }
 }
 
@@ -81,9 +82,14 @@ void bloom_clear(struct bloom *b)
 {
     if (!b) return;
 
-    size_t num_words = (b->vector->size + NUM_BITS(uint64_t) - 1)
-                            / NUM_BITS(uint64_t);
-    memset(b->vector->start, 0, num_words * sizeof(uint64_t));
+    memset(b->vector->start, 0, bloom_num_words(b) * sizeof(uint64_t));
+}
+
+void bloom_clear_range(struct bloom *b, size_t first_word, size_t num_words)
+{
+    if (!b) return;
+
+    memset(b->vector->start + first_word, 0, num_words * sizeof(uint64_t));
 }
 
 bool bloom_contains_with_hashes(struct bloom *b, struct hashes *hs)
@@ -91,8 +97,8 @@ bool bloom_contains_with_hashes(struct bloom *b, struct hashes *hs)
     if (!b || !hs) return false;
 
     for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        uint32_t hash = hs->h[i];
-        if (!bit_vector_get(b->vector, hash % b->vector->size)) {
+        uint64_t hash = hs->h[i];
+        if (!bit_vector_get(b->vector, reduce(hash, b->vector->size))) {
             return false;
         }
     }
@@ -107,3 +113,22 @@ bool bloom_contains(struct bloom *b, uint64_t addr)
     get_hashes(addr, &hs);
     return bloom_contains_with_hashes(b, &hs);
 }
+
+void bloom_add_batch(struct bloom *b, const uint64_t *addrs, size_t n)
+{
+    if (!b || !addrs) return;
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  bloom_prefetch_with_hashes(b, hs),
+                  bloom_add_with_hashes(b, hs));
+}
+
+void bloom_contains_batch(struct bloom *b, const uint64_t *addrs, size_t n,
+                          bool *out)
+{
+    if (!b || !addrs || !out) return;
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  bloom_prefetch_with_hashes(b, hs),
+                  out[idx] = bloom_contains_with_hashes(b, hs));
+}
@@ -0,0 +1,361 @@
+#include "concurrent_tinylfu.h"
+
+// Next stripe handed out to a thread on its first access
+static uint32_t next_stripe;
+static __thread int thread_stripe = -1;
+
+static struct access_buffer* access_buffer_of_thread(struct concurrent_tinylfu *ctfu)
+{
+    if (thread_stripe < 0) {
+        thread_stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED)
+                            % CTLFU_NUM_STRIPES;
+    }
+
+    return &ctfu->buffers[thread_stripe];
+}
+
+static void access_buffer_init(struct access_buffer *buf)
+{
+    buf->enqueue_pos = 0;
+    buf->dequeue_pos = 0;
+    buf->drain_lock  = false;
+
+    for (uint64_t i = 0; i < CTLFU_BUFFER_SIZE; i++) {
+        buf->slots[i].seq = i;
+    }
+}
+
+static bool access_buffer_push(struct access_buffer *buf, uint64_t addr)
+{
+    uint64_t pos = __atomic_load_n(&buf->enqueue_pos, __ATOMIC_RELAXED);
+    struct access_buffer_slot *slot;
+
+    for (;;) {
+        slot = &buf->slots[pos & (CTLFU_BUFFER_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) seq - (int64_t) pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&buf->enqueue_pos, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            pos = __atomic_load_n(&buf->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->addr = addr;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static bool access_buffer_pop(struct access_buffer *buf, uint64_t *addr)
+{
+    uint64_t pos = __atomic_load_n(&buf->dequeue_pos, __ATOMIC_RELAXED);
+    struct access_buffer_slot *slot;
+
+    for (;;) {
+        slot = &buf->slots[pos & (CTLFU_BUFFER_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) seq - (int64_t) (pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&buf->dequeue_pos, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Empty
+            return false;
+        } else {
+            pos = __atomic_load_n(&buf->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *addr = slot->addr;
+    __atomic_store_n(&slot->seq, pos + CTLFU_BUFFER_SIZE, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static uint64_t access_buffer_pending(struct access_buffer *buf)
+{
+    return __atomic_load_n(&buf->enqueue_pos, __ATOMIC_RELAXED)
+           - __atomic_load_n(&buf->dequeue_pos, __ATOMIC_RELAXED);
+}
+
+static bool try_lock(bool *lock)
+{
+    return !__atomic_test_and_set(lock, __ATOMIC_ACQUIRE);
+}
+
+static void unlock(bool *lock)
+{
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * Sets the bits of a key with fetch-or and returns true if they were all
+ * already set, i.e. if the doorkeeper contained the key before the add.
+ */
+static bool doorkeeper_test_and_add(struct blocked_bloom *b, struct hashes *hs)
+{
+    uint64_t *block = blocked_bloom_block(b, hs);
+    bool present = true;
+
+    for (size_t j = 0; j < NUM_HASH_FUNCTIONS; j++) {
+        uint32_t bit  = blocked_bloom_bit(hs, j);
+        uint64_t mask = 1ULL << (bit % NUM_BITS(uint64_t));
+
+        uint64_t *word = &block[bit / NUM_BITS(uint64_t)];
+
+        // Skip the locked RMW, and the cache line bouncing it causes, when
+        // the bit is already set
+        if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) continue;
+
+        uint64_t old = __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+        present &= (old & mask) != 0;
+    }
+
+    return present;
+}
+
+static bool doorkeeper_contains(struct blocked_bloom *b, struct hashes *hs)
+{
+    uint64_t *block = blocked_bloom_block(b, hs);
+
+    for (size_t j = 0; j < NUM_HASH_FUNCTIONS; j++) {
+        uint32_t bit = blocked_bloom_bit(hs, j);
+        uint64_t word = __atomic_load_n(&block[bit / NUM_BITS(uint64_t)],
+                                        __ATOMIC_RELAXED);
+
+        if (!(word & (1ULL << (bit % NUM_BITS(uint64_t))))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint64_t sketch_min_counter(uint64_t val, uint32_t *shifts)
+{
+    uint64_t min_counter_value = FS_COUNTER_MASK;
+
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        uint64_t counter = (val >> shifts[i]) & FS_COUNTER_MASK;
+        if (counter < min_counter_value) {
+            min_counter_value = counter;
+        }
+    }
+
+    return min_counter_value;
+}
+
+/*
+ * Conservative increment of frequency_sketch_add_with_hashes(), retried until
+ * the word did not change between the read and the CAS.
+ */
+static bool sketch_add(struct frequency_sketch *fs, struct hashes *hs)
+{
+    uint64_t *word = frequency_sketch_word(fs, hs);
+    uint32_t shifts[NUM_HASH_FUNCTIONS];
+
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        shifts[i] = frequency_sketch_shift(hs, i);
+    }
+
+    uint64_t val = __atomic_load_n(word, __ATOMIC_RELAXED);
+    uint64_t min_counter_value, new_val;
+
+    do {
+        min_counter_value = sketch_min_counter(val, shifts);
+        if (min_counter_value >= FS_COUNTER_MASK) {
+            return true;
+        }
+
+        new_val = val;
+        for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+            if (((val >> shifts[i]) & FS_COUNTER_MASK) == min_counter_value) {
+                new_val += 1ULL << shifts[i];
+            }
+        }
+    } while (!__atomic_compare_exchange_n(word, &val, new_val, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return min_counter_value + 1 >= FS_COUNTER_MASK;
+}
+
+static uint64_t sketch_estimate(struct frequency_sketch *fs, struct hashes *hs)
+{
+    uint64_t val = __atomic_load_n(frequency_sketch_word(fs, hs), __ATOMIC_RELAXED);
+    uint32_t shifts[NUM_HASH_FUNCTIONS];
+
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        shifts[i] = frequency_sketch_shift(hs, i);
+    }
+
+    return sketch_min_counter(val, shifts);
+}
+
+/*
+ * Halves the sketch and clears the doorkeeper. Increments racing with the
+ * reset are either halved or applied on top of the halved word, never lost.
+ */
+static void concurrent_tinylfu_reset(struct concurrent_tinylfu *ctfu)
+{
+    // Someone else is already resetting
+    if (!try_lock(&ctfu->reset_lock)) return;
+
+    struct frequency_sketch *fs = ctfu->sketch;
+    for (size_t i = 0; i < fs->num_words; i++) {
+        uint64_t val = __atomic_load_n(&fs->table[i], __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&fs->table[i], &val,
+                                            (val >> 1) & FS_RESET_MASK, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    struct blocked_bloom *b = ctfu->doorkeeper;
+    for (size_t i = 0; i < b->num_blocks * BLOCK_WORDS; i++) {
+        __atomic_store_n(&b->blocks[i], 0, __ATOMIC_RELAXED);
+    }
+
+    unlock(&ctfu->reset_lock);
+}
+
+static void concurrent_tinylfu_apply(struct concurrent_tinylfu *ctfu,
+                                     struct hashes *hs)
+{
+    if (!doorkeeper_test_and_add(ctfu->doorkeeper, hs)) return;
+
+    if (sketch_add(ctfu->sketch, hs)) {
+        concurrent_tinylfu_reset(ctfu);
+    }
+}
+
+static inline void concurrent_tinylfu_prefetch(struct concurrent_tinylfu *ctfu,
+                                               struct hashes *hs)
+{
+    blocked_bloom_prefetch_with_hashes(ctfu->doorkeeper, hs);
+    frequency_sketch_prefetch_with_hashes(ctfu->sketch, hs);
+}
+
+/*
+ * Drains buf into the sketch if no other thread is draining it.
+ */
+static void access_buffer_try_drain(struct concurrent_tinylfu *ctfu,
+                                    struct access_buffer *buf)
+{
+    if (!try_lock(&buf->drain_lock)) return;
+
+    uint64_t addrs[CTLFU_BUFFER_SIZE];
+    size_t n = 0;
+
+    while (n < CTLFU_BUFFER_SIZE && access_buffer_pop(buf, &addrs[n])) {
+        n++;
+    }
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  concurrent_tinylfu_prefetch(ctfu, hs),
+                  concurrent_tinylfu_apply(ctfu, hs));
+
+    unlock(&buf->drain_lock);
+}
+
+struct concurrent_tinylfu* concurrent_tinylfu_init(size_t doorkeeper_size,
+                                                   size_t sketch_size)
+{
+    struct concurrent_tinylfu *ctfu = (struct concurrent_tinylfu*) malloc(
+        sizeof(struct concurrent_tinylfu)
+    );
+    if (!ctfu) return NULL;
+
+    ctfu->doorkeeper = blocked_bloom_init(doorkeeper_size);
+    ctfu->sketch     = frequency_sketch_init(sketch_size);
+    ctfu->reset_lock = false;
+    ctfu->buffers    = (struct access_buffer*) aligned_alloc(
+        _Alignof(struct access_buffer),
+        CTLFU_NUM_STRIPES * sizeof(struct access_buffer)
+    );
+
+    if (!ctfu->doorkeeper || !ctfu->sketch || !ctfu->buffers) {
+        concurrent_tinylfu_free(&ctfu);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < CTLFU_NUM_STRIPES; i++) {
+        access_buffer_init(&ctfu->buffers[i]);
+    }
+
+    return ctfu;
+}
+
+void concurrent_tinylfu_free(struct concurrent_tinylfu **ctfu)
+{
+    if (ctfu && *ctfu) {
+        blocked_bloom_free(&(*ctfu)->doorkeeper);
+        frequency_sketch_free(&(*ctfu)->sketch);
+        free((*ctfu)->buffers);
+        free(*ctfu);
+        *ctfu = NULL;
+    }
+}
+
+void concurrent_tinylfu_access(struct concurrent_tinylfu *ctfu, uint64_t addr)
+{
+    if (!ctfu) return;
+
+    struct access_buffer *buf = access_buffer_of_thread(ctfu);
+
+    if (!access_buffer_push(buf, addr)) {
+        // Full: make room, dropping the record if another thread is draining
+        access_buffer_try_drain(ctfu, buf);
+        if (!access_buffer_push(buf, addr)) return;
+    }
+
+    if (access_buffer_pending(buf) >= CTLFU_DRAIN_THRESHOLD) {
+        access_buffer_try_drain(ctfu, buf);
+    }
+}
+
+void concurrent_tinylfu_drain(struct concurrent_tinylfu *ctfu)
+{
+    if (!ctfu) return;
+
+    for (size_t i = 0; i < CTLFU_NUM_STRIPES; i++) {
+        access_buffer_try_drain(ctfu, &ctfu->buffers[i]);
+    }
+}
+
+uint64_t concurrent_tinylfu_estimate(struct concurrent_tinylfu *ctfu, uint64_t addr)
+{
+    if (!ctfu) return 0;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+
+    uint64_t estimate = sketch_estimate(ctfu->sketch, &hs);
+
+    if (!doorkeeper_contains(ctfu->doorkeeper, &hs)) {
+        return estimate;
+    }
+
+    return estimate + 1;
+}
+
+bool concurrent_tinylfu_admit(struct concurrent_tinylfu *ctfu, uint64_t new,
+                              uint64_t victim_candidate)
+{
+    if (!ctfu) return true;
+
+    uint64_t new_estimate    = concurrent_tinylfu_estimate(ctfu, new);
+    uint64_t victim_estimate = concurrent_tinylfu_estimate(ctfu, victim_candidate);
+
+    return new_estimate > victim_estimate;
+}
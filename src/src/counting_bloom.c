@@ -1,4 +1,5 @@
 #include "counting_bloom.h"
+#include "arena.h"
 
 #define COUNTER_MASK ((1ULL << BITS_PER_COUNTER) - 1)
 
@@ -15,7 +16,7 @@ struct counting_bloom* counting_bloom_init(size_t num_counters)
         size_t num_words  = (total_bits + NUM_BITS(uint64_t) - 1)
                                 / NUM_BITS(uint64_t);
 
-        cb->counters = (uint64_t*) calloc(num_words, sizeof(uint64_t));
+        cb->counters = (uint64_t*) arena_alloc(num_words * sizeof(uint64_t));
 
         if (!cb->counters) {
             free(cb);
@@ -29,7 +30,7 @@ struct counting_bloom* counting_bloom_init(size_t num_counters)
 void counting_bloom_free(struct counting_bloom **cb)
 {
     if (cb && *cb) {
-        free((*cb)->counters);
+        arena_free((*cb)->counters);
         free(*cb);
         *cb = NULL;
     }
@@ -59,8 +60,8 @@ bool counting_bloom_add_with_hashes(struct counting_bloom *cb, struct hashes *hs
 
     // 1. Find min value
     for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        uint32_t hash = hs->h[i];
-        size_t idx = hash % cb->size;
+        uint64_t hash = hs->h[i];
+        size_t idx = reduce(hash, cb->size);
 
         uint64_t val = get_counter(cb, idx);
         if (val < min_counter_value) {
@@ -75,8 +76,8 @@ bool counting_bloom_add_with_hashes(struct counting_bloom *cb, struct hashes *hs
     }
 
     for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        uint32_t hash = hs->h[i];
-        size_t idx = hash % cb->size;
+        uint64_t hash = hs->h[i];
+        size_t idx = reduce(hash, cb->size);
         
         uint64_t val = get_counter(cb, idx);
         if (val <= new_min) {
@@ -96,6 +97,20 @@ bool counting_bloom_add(struct counting_bloom *cb, uint64_t addr)
     return counting_bloom_add_with_hashes(cb, &hs);
 }
 
+size_t counting_bloom_add_batch(struct counting_bloom *cb, const uint64_t *addrs,
+                                size_t n)
+{
+    if (!cb || !addrs) return 0;
+
+    size_t saturated = 0;
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  counting_bloom_prefetch_with_hashes(cb, hs),
+                  saturated += counting_bloom_add_with_hashes(cb, hs));
+
+    return saturated;
+}
+
 uint64_t counting_bloom_estimate_with_hashes(struct counting_bloom *cb, struct hashes *hs)
 {
     if (!cb || !hs) return 0;
@@ -103,8 +118,8 @@ uint64_t counting_bloom_estimate_with_hashes(struct counting_bloom *cb, struct h
     uint64_t min_counter_value = UINT64_MAX;
 
     for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
-        uint32_t hash = hs->h[i];
-        size_t idx = hash % cb->size;
+        uint64_t hash = hs->h[i];
+        size_t idx = reduce(hash, cb->size);
 
         uint64_t val = get_counter(cb, idx);
         if (val < min_counter_value) {
@@ -124,15 +139,47 @@ uint64_t counting_bloom_estimate(struct counting_bloom *cb, uint64_t addr)
     return counting_bloom_estimate_with_hashes(cb, &hs);
 }
 
-void counting_bloom_reset(struct counting_bloom *cb)
+void counting_bloom_estimate_batch(struct counting_bloom *cb, const uint64_t *addrs,
+                                   size_t n, uint64_t *out)
+{
+    if (!cb || !addrs || !out) return;
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  counting_bloom_prefetch_with_hashes(cb, hs),
+                  out[idx] = counting_bloom_estimate_with_hashes(cb, hs));
+}
+
+/*
+ * Mask applied after shifting a word right by one, so that the low bit of
+ * each counter does not leak into the high bit of its neighbour.
+ */
+static inline uint64_t reset_mask(void)
+{
+    uint64_t mask = 0;
+
+    for (size_t shift = 0; shift + BITS_PER_COUNTER <= NUM_BITS(uint64_t);
+         shift += BITS_PER_COUNTER) {
+        mask |= (COUNTER_MASK >> 1) << shift;
+    }
+
+    return mask;
+}
+
+void counting_bloom_reset_range(struct counting_bloom *cb, size_t first_word,
+                                size_t num_words)
 {
     if (!cb) return;
 
-    size_t total_bits = cb->size * BITS_PER_COUNTER;
-    size_t num_words  = (total_bits + NUM_BITS(uint64_t) - 1)
-                            / NUM_BITS(uint64_t);
+    uint64_t mask = reset_mask();
 
-    for (size_t i = 0; i < num_words; i++) {
-        cb->counters[i] = cb->counters[i] >> 1;
+    for (size_t i = first_word; i < first_word + num_words; i++) {
+        cb->counters[i] = (cb->counters[i] >> 1) & mask;
     }
 }
+
+void counting_bloom_reset(struct counting_bloom *cb)
+{
+    if (!cb) return;
+
+    counting_bloom_reset_range(cb, 0, counting_bloom_num_words(cb));
+}
@@ -0,0 +1,258 @@
+#include "cuckoo_filter.h"
+#include "arena.h"
+#include <math.h>
+
+struct cuckoo_filter* cuckoo_filter_init(size_t num_bits)
+{
+    struct cuckoo_filter *cf = (struct cuckoo_filter*)
+                                   malloc(sizeof(struct cuckoo_filter));
+
+    if (cf) {
+        // Round down to a bucket, at least one bucket
+        cf->num_buckets = num_bits / NUM_BITS(uint64_t);
+        if (cf->num_buckets == 0) {
+            cf->num_buckets = 1;
+        }
+
+        cf->num_items          = 0;
+        cf->victim_fingerprint = 0;
+        cf->victim_bucket      = 0;
+        cf->rng                = 0x9e3779b97f4a7c15ULL;
+        cf->before_use         = NULL;
+        cf->before_use_arg     = NULL;
+
+        cf->buckets = (uint64_t*) arena_alloc(cf->num_buckets * sizeof(uint64_t));
+
+        if (!cf->buckets) {
+            free(cf);
+            return NULL;
+        }
+    }
+
+    return cf;
+}
+
+void cuckoo_filter_free(struct cuckoo_filter **cf)
+{
+    if (cf && *cf) {
+        arena_free((*cf)->buckets);
+        free(*cf);
+        *cf = NULL;
+    }
+}
+
+void cuckoo_filter_set_before_use(struct cuckoo_filter *cf,
+                                  void (*before_use)(void *arg, size_t bucket), void *arg)
+{
+    if (!cf) return;
+
+    cf->before_use     = before_use;
+    cf->before_use_arg = arg;
+}
+
+static inline void before_use(struct cuckoo_filter *cf, size_t bucket)
+{
+    if (cf->before_use) {
+        cf->before_use(cf->before_use_arg, bucket);
+    }
+}
+
+/*
+ * Gives the waiting fingerprint's buckets to before_use(), which may clear
+ * them and the fingerprint with them. Returns true if one is still waiting.
+ */
+static inline bool victim_waiting(struct cuckoo_filter *cf)
+{
+    if (cf->victim_fingerprint && cf->before_use) {
+        size_t v1 = cf->victim_bucket;
+        size_t v2 = cuckoo_filter_alt_bucket(cf, v1, cf->victim_fingerprint);
+
+        before_use(cf, v1);
+        before_use(cf, v2);
+    }
+    return cf->victim_fingerprint != 0;
+}
+
+size_t cuckoo_filter_bits_for(size_t n)
+{
+    size_t num_buckets = (size_t) ceil(n / (CF_SLOTS_PER_BUCKET * CF_MAX_LOAD));
+    return num_buckets * NUM_BITS(uint64_t);
+}
+
+static inline uint64_t next_random(struct cuckoo_filter *cf)
+{
+    // xorshift64
+    cf->rng ^= cf->rng << 13;
+    cf->rng ^= cf->rng >> 7;
+    cf->rng ^= cf->rng << 17;
+    return cf->rng;
+}
+
+/*
+ * Number of non-empty slots of a bucket. Unlike cuckoo_filter_match(), exact
+ * for every slot: the low bits of a slot are added without carrying into the
+ * next one.
+ */
+static inline size_t bucket_occupied(uint64_t bucket)
+{
+    uint64_t low = ~CF_SLOT_HIGH_BITS;
+    uint64_t nonzero = (((bucket & low) + low) | bucket) & CF_SLOT_HIGH_BITS;
+
+    return __builtin_popcountll(nonzero);
+}
+
+static inline bool bucket_insert(uint64_t *bucket, uint64_t fp)
+{
+    uint64_t empty = cuckoo_filter_match(*bucket, 0);
+    if (!empty) return false;
+
+    size_t slot = __builtin_ctzll(empty) / CUCKOO_FINGERPRINT_BITS;
+    *bucket |= fp << (slot * CUCKOO_FINGERPRINT_BITS);
+    return true;
+}
+
+static inline bool bucket_delete(uint64_t *bucket, uint64_t fp)
+{
+    uint64_t match = cuckoo_filter_match(*bucket, fp);
+    if (!match) return false;
+
+    size_t slot = __builtin_ctzll(match) / CUCKOO_FINGERPRINT_BITS;
+    *bucket &= ~(CF_FINGERPRINT_MASK << (slot * CUCKOO_FINGERPRINT_BITS));
+    return true;
+}
+
+bool cuckoo_filter_add_with_hashes(struct cuckoo_filter *cf, struct hashes *hs)
+{
+    if (!cf || !hs || victim_waiting(cf)) return false;
+
+    uint64_t fp = cuckoo_filter_fingerprint(hs);
+    size_t i1 = cuckoo_filter_bucket(cf, hs);
+    size_t i2 = cuckoo_filter_alt_bucket(cf, i1, fp);
+
+    cf->num_items++;
+    if (bucket_insert(&cf->buckets[i1], fp) || bucket_insert(&cf->buckets[i2], fp)) {
+        return true;
+    }
+
+    // Both buckets are full: move a random fingerprint to its other bucket,
+    // and so on until one lands in a free slot
+    size_t i = next_random(cf) & 1 ? i1 : i2;
+    for (size_t kick = 0; kick < CF_MAX_KICKS; kick++) {
+        size_t shift = next_random(cf) % CF_SLOTS_PER_BUCKET * CUCKOO_FINGERPRINT_BITS;
+        uint64_t evicted = (cf->buckets[i] >> shift) & CF_FINGERPRINT_MASK;
+
+        cf->buckets[i] ^= (evicted ^ fp) << shift;
+        fp = evicted;
+        i  = cuckoo_filter_alt_bucket(cf, i, fp);
+
+        before_use(cf, i);
+        if (bucket_insert(&cf->buckets[i], fp)) {
+            return true;
+        }
+    }
+
+    cf->victim_fingerprint = fp;
+    cf->victim_bucket      = i;
+    return true;
+}
+
+bool cuckoo_filter_add(struct cuckoo_filter *cf, uint64_t addr)
+{
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return cuckoo_filter_add_with_hashes(cf, &hs);
+}
+
+static inline bool victim_matches(struct cuckoo_filter *cf, uint64_t fp, size_t i1,
+                                  size_t i2)
+{
+    return cf->victim_fingerprint == fp
+           && (cf->victim_bucket == i1 || cf->victim_bucket == i2);
+}
+
+bool cuckoo_filter_contains_with_hashes(struct cuckoo_filter *cf, struct hashes *hs)
+{
+    if (!cf || !hs) return false;
+
+    uint64_t fp = cuckoo_filter_fingerprint(hs);
+    size_t i1 = cuckoo_filter_bucket(cf, hs);
+    size_t i2 = cuckoo_filter_alt_bucket(cf, i1, fp);
+
+    return (cuckoo_filter_match(cf->buckets[i1], fp)
+            | cuckoo_filter_match(cf->buckets[i2], fp))
+           || victim_matches(cf, fp, i1, i2);
+}
+
+bool cuckoo_filter_contains(struct cuckoo_filter *cf, uint64_t addr)
+{
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return cuckoo_filter_contains_with_hashes(cf, &hs);
+}
+
+bool cuckoo_filter_delete_with_hashes(struct cuckoo_filter *cf, struct hashes *hs)
+{
+    if (!cf || !hs) return false;
+
+    uint64_t fp = cuckoo_filter_fingerprint(hs);
+    size_t i1 = cuckoo_filter_bucket(cf, hs);
+    size_t i2 = cuckoo_filter_alt_bucket(cf, i1, fp);
+
+    if (victim_matches(cf, fp, i1, i2)) {
+        cf->victim_fingerprint = 0;
+    } else if (!bucket_delete(&cf->buckets[i1], fp)
+               && !bucket_delete(&cf->buckets[i2], fp)) {
+        return false;
+    }
+    cf->num_items--;
+
+    // A slot was freed: the victim may fit again
+    if (victim_waiting(cf)) {
+        size_t v1 = cf->victim_bucket;
+        size_t v2 = cuckoo_filter_alt_bucket(cf, v1, cf->victim_fingerprint);
+
+        if (bucket_insert(&cf->buckets[v1], cf->victim_fingerprint)
+            || bucket_insert(&cf->buckets[v2], cf->victim_fingerprint)) {
+            cf->victim_fingerprint = 0;
+        }
+    }
+
+    return true;
+}
+
+bool cuckoo_filter_delete(struct cuckoo_filter *cf, uint64_t addr)
+{
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return cuckoo_filter_delete_with_hashes(cf, &hs);
+}
+
+void cuckoo_filter_clear(struct cuckoo_filter *cf)
+{
+    if (!cf) return;
+
+    memset(cf->buckets, 0, cf->num_buckets * sizeof(uint64_t));
+    cf->num_items          = 0;
+    cf->victim_fingerprint = 0;
+}
+
+void cuckoo_filter_clear_range(struct cuckoo_filter *cf, size_t first_word,
+                               size_t num_words)
+{
+    if (!cf || first_word >= cf->num_buckets) return;
+
+    if (num_words > cf->num_buckets - first_word) {
+        num_words = cf->num_buckets - first_word;
+    }
+
+    for (size_t i = first_word; i < first_word + num_words; i++) {
+        cf->num_items -= bucket_occupied(cf->buckets[i]);
+        cf->buckets[i] = 0;
+    }
+
+    if (cf->victim_fingerprint && cf->victim_bucket >= first_word
+        && cf->victim_bucket < first_word + num_words) {
+        cf->victim_fingerprint = 0;
+        cf->num_items--;
+    }
+}
@@ -0,0 +1,91 @@
+#include "doorkeeper.h"
+
+struct doorkeeper* doorkeeper_init(enum doorkeeper_type type, size_t num_bits)
+{
+    struct doorkeeper *dk = (struct doorkeeper*) malloc(sizeof(struct doorkeeper));
+    if (!dk) return NULL;
+
+    dk->type = type;
+
+    switch (type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        dk->blocked = blocked_bloom_init(num_bits);
+        if (!dk->blocked) {
+            free(dk);
+            return NULL;
+        }
+        break;
+    case DOORKEEPER_CUCKOO:
+        dk->cuckoo = cuckoo_filter_init(num_bits);
+        if (!dk->cuckoo) {
+            free(dk);
+            return NULL;
+        }
+        break;
+    default:
+        dk->type  = DOORKEEPER_BLOOM;
+        dk->bloom = bloom_init(num_bits);
+        if (!dk->bloom) {
+            free(dk);
+            return NULL;
+        }
+        break;
+    }
+
+    return dk;
+}
+
+void doorkeeper_free(struct doorkeeper **dk)
+{
+    if (dk && *dk) {
+        switch ((*dk)->type) {
+        case DOORKEEPER_BLOCKED_BLOOM:
+            blocked_bloom_free(&(*dk)->blocked);
+            break;
+        case DOORKEEPER_CUCKOO:
+            cuckoo_filter_free(&(*dk)->cuckoo);
+            break;
+        default:
+            bloom_free(&(*dk)->bloom);
+            break;
+        }
+
+        free(*dk);
+        *dk = NULL;
+    }
+}
+
+void doorkeeper_clear(struct doorkeeper *dk)
+{
+    if (!dk) return;
+
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        blocked_bloom_clear(dk->blocked);
+        break;
+    case DOORKEEPER_CUCKOO:
+        cuckoo_filter_clear(dk->cuckoo);
+        break;
+    default:
+        bloom_clear(dk->bloom);
+        break;
+    }
+}
+
+void doorkeeper_clear_range(struct doorkeeper *dk, size_t first_word,
+                            size_t num_words)
+{
+    if (!dk) return;
+
+    switch (dk->type) {
+    case DOORKEEPER_BLOCKED_BLOOM:
+        blocked_bloom_clear_range(dk->blocked, first_word, num_words);
+        break;
+    case DOORKEEPER_CUCKOO:
+        cuckoo_filter_clear_range(dk->cuckoo, first_word, num_words);
+        break;
+    default:
+        bloom_clear_range(dk->bloom, first_word, num_words);
+        break;
+    }
+}
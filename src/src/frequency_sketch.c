@@ -0,0 +1,122 @@
+#include "frequency_sketch.h"
+#include "arena.h"
+
+struct frequency_sketch* frequency_sketch_init(size_t num_counters)
+{
+    struct frequency_sketch *fs = (struct frequency_sketch*)
+                                      malloc(sizeof(struct frequency_sketch));
+
+    if (fs) {
+        // Round up to nearest word, at least one word
+        fs->num_words = (num_counters + FS_COUNTERS_PER_WORD - 1)
+                            / FS_COUNTERS_PER_WORD;
+        if (fs->num_words == 0) {
+            fs->num_words = 1;
+        }
+
+        fs->table = (uint64_t*) arena_alloc(fs->num_words * sizeof(uint64_t));
+
+        if (!fs->table) {
+            free(fs);
+            return NULL;
+        }
+    }
+
+    return fs;
+}
+
+void frequency_sketch_free(struct frequency_sketch **fs)
+{
+    if (fs && *fs) {
+        arena_free((*fs)->table);
+        free(*fs);
+        *fs = NULL;
+    }
+}
+
+bool frequency_sketch_add_with_hashes(struct frequency_sketch *fs, struct hashes *hs)
+{
+    if (!fs || !hs) return false;
+
+    uint64_t *word = frequency_sketch_word(fs, hs);
+    uint64_t val   = *word;
+
+    uint32_t shifts[NUM_HASH_FUNCTIONS];
+    uint64_t min_counter_value = FS_COUNTER_MASK;
+
+    // 1. Find min value
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        shifts[i] = frequency_sketch_shift(hs, i);
+
+        uint64_t counter = (val >> shifts[i]) & FS_COUNTER_MASK;
+        if (counter < min_counter_value) {
+            min_counter_value = counter;
+        }
+    }
+
+    if (min_counter_value >= FS_COUNTER_MASK) {
+        return true;
+    }
+
+    // 2. Increment all counters that are minimal, with a single store
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        if (((val >> shifts[i]) & FS_COUNTER_MASK) == min_counter_value) {
+            val += 1ULL << shifts[i];
+        }
+    }
+    *word = val;
+
+    return min_counter_value + 1 >= FS_COUNTER_MASK;
+}
+
+bool frequency_sketch_add(struct frequency_sketch *fs, uint64_t addr)
+{
+    if (!fs) return false;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return frequency_sketch_add_with_hashes(fs, &hs);
+}
+
+uint64_t frequency_sketch_estimate_with_hashes(struct frequency_sketch *fs, struct hashes *hs)
+{
+    if (!fs || !hs) return 0;
+
+    uint64_t val = *frequency_sketch_word(fs, hs);
+    uint64_t min_counter_value = FS_COUNTER_MASK;
+
+    for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        uint64_t counter = (val >> frequency_sketch_shift(hs, i)) & FS_COUNTER_MASK;
+        if (counter < min_counter_value) {
+            min_counter_value = counter;
+        }
+    }
+
+    return min_counter_value;
+}
+
+uint64_t frequency_sketch_estimate(struct frequency_sketch *fs, uint64_t addr)
+{
+    if (!fs) return 0;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return frequency_sketch_estimate_with_hashes(fs, &hs);
+}
+
+void frequency_sketch_reset_range(struct frequency_sketch *fs, size_t first_word,
+                                  size_t num_words)
+{
+    if (!fs) return;
+
+    for (size_t i = first_word; i < first_word + num_words; i++) {
+        fs->table[i] = (fs->table[i] >> 1) & FS_RESET_MASK;
+    }
+}
+
+void frequency_sketch_reset(struct frequency_sketch *fs)
+{
+    if (!fs) return;
+
+    frequency_sketch_reset_range(fs, 0, fs->num_words);
+}
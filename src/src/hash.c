@@ -0,0 +1,233 @@
+#include "hash.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+static const char *FAMILY_NAMES[HASH_NUM_FAMILIES] = {
+    "wang", "murmur3", "xxh3", "wyhash",
+};
+
+const char* hash_family_name(enum hash_family family)
+{
+    return family < HASH_NUM_FAMILIES ? FAMILY_NAMES[family] : "unknown";
+}
+
+typedef void (*get_hashes_batch_fn)(enum hash_family family, const uint64_t *keys,
+                                    size_t n, struct hashes *out);
+
+static void get_hashes_batch_scalar(enum hash_family family, const uint64_t *keys,
+                                    size_t n, struct hashes *out)
+{
+    for (size_t i = 0; i < n; i++) {
+        get_hashes_with(family, keys[i], &out[i]);
+    }
+}
+
+#if NUM_HASH_FUNCTIONS == 4 && defined(__x86_64__)
+
+/*
+ * The families below on four keys at once, one per 64-bit lane. AVX2 has
+ * 64-bit shifts, adds and xors per lane but only 32x32 -> 64-bit multiplies,
+ * from which the 64-bit products are assembled.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i rotl64_x4(__m256i x, int r)
+{
+    return _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64 - r));
+}
+
+// Low 64 bits of a * b
+__attribute__((target("avx2")))
+static inline __m256i mullo64_x4(__m256i a, __m256i b)
+{
+    __m256i lo    = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+// lo ^ hi of the 128-bit a * b
+__attribute__((target("avx2")))
+static inline __m256i wymix_x4(__m256i a, __m256i b)
+{
+    const __m256i low32 = _mm256_set1_epi64x(0xffffffffULL);
+    __m256i a_hi = _mm256_srli_epi64(a, 32);
+    __m256i b_hi = _mm256_srli_epi64(b, 32);
+
+    __m256i ll = _mm256_mul_epu32(a, b);
+    __m256i lh = _mm256_mul_epu32(a, b_hi);
+    __m256i hl = _mm256_mul_epu32(a_hi, b);
+    __m256i hh = _mm256_mul_epu32(a_hi, b_hi);
+
+    // At most 34 bits, so the carries into the high half are kept
+    __m256i mid = _mm256_add_epi64(_mm256_srli_epi64(ll, 32),
+                                   _mm256_add_epi64(_mm256_and_si256(lh, low32),
+                                                    _mm256_and_si256(hl, low32)));
+    __m256i lo = _mm256_or_si256(_mm256_and_si256(ll, low32), _mm256_slli_epi64(mid, 32));
+    __m256i hi = _mm256_add_epi64(_mm256_add_epi64(hh, _mm256_srli_epi64(mid, 32)),
+                                  _mm256_add_epi64(_mm256_srli_epi64(lh, 32),
+                                                   _mm256_srli_epi64(hl, 32)));
+
+    return _mm256_xor_si256(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hash_64_x4(__m256i key)
+{
+    key = _mm256_add_epi64(_mm256_xor_si256(key, _mm256_set1_epi64x(-1)),
+                           _mm256_slli_epi64(key, 21));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 24));
+    key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 3)),
+                           _mm256_slli_epi64(key, 8));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 14));
+    key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 2)),
+                           _mm256_slli_epi64(key, 4));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 28));
+
+    return key;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hash_fmix64_x4(__m256i key)
+{
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 33));
+    key = mullo64_x4(key, _mm256_set1_epi64x(0xff51afd7ed558ccdULL));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 33));
+    key = mullo64_x4(key, _mm256_set1_epi64x(0xc4ceb9fe1a85ec53ULL));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 33));
+
+    return key;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hash_xxh3_64_x4(__m256i key)
+{
+    const __m256i prime = _mm256_set1_epi64x(XXH3_PRIME_MX2);
+    __m256i h = _mm256_xor_si256(rotl64_x4(key, 32), _mm256_set1_epi64x(XXH3_BITFLIP_8));
+
+    h = _mm256_xor_si256(h, _mm256_xor_si256(rotl64_x4(h, 49), rotl64_x4(h, 24)));
+    h = mullo64_x4(h, prime);
+    h = _mm256_xor_si256(h, _mm256_add_epi64(_mm256_srli_epi64(h, 35), _mm256_set1_epi64x(8)));
+    h = mullo64_x4(h, prime);
+
+    return _mm256_xor_si256(h, _mm256_srli_epi64(h, 28));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hash_wyhash64_x4(__m256i key)
+{
+    __m256i a = _mm256_xor_si256(rotl64_x4(key, 32), _mm256_set1_epi64x(WYHASH_P1));
+    __m256i b = _mm256_xor_si256(key, _mm256_set1_epi64x(WYHASH_P0));
+
+    return wymix_x4(_mm256_set1_epi64x(WYHASH_P1 ^ 8), wymix_x4(a, b));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hash_key_x4(enum hash_family family, __m256i key)
+{
+    switch (family) {
+    case HASH_MURMUR3:
+        return hash_fmix64_x4(key);
+    case HASH_XXH3:
+        return hash_xxh3_64_x4(key);
+    case HASH_WYHASH:
+        return hash_wyhash64_x4(key);
+    default:
+        return hash_64_x4(key);
+    }
+}
+
+/*
+ * Each vector v_i holds h_i of four keys, one per lane. A 4x4 transpose of
+ * v_0..v_3 gives the struct hashes of each key.
+ */
+__attribute__((target("avx2")))
+static void get_hashes_batch_avx2(enum hash_family family, const uint64_t *keys,
+                                  size_t n, struct hashes *out)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i h1 = hash_key_x4(
+            family, _mm256_loadu_si256((const __m256i *) (keys + i))
+        );
+        __m256i h2 = _mm256_or_si256(
+            hash_fmix64_x4(_mm256_xor_si256(h1, _mm256_set1_epi64x(HASH_STEP_SEED))),
+            _mm256_set1_epi64x(1)
+        );
+
+        __m256i v0 = _mm256_add_epi64(h1, h2);
+        __m256i v1 = _mm256_add_epi64(v0, h2);
+        __m256i v2 = _mm256_add_epi64(v1, h2);
+        __m256i v3 = _mm256_add_epi64(v2, h2);
+
+        __m256i t0 = _mm256_unpacklo_epi64(v0, v1);
+        __m256i t1 = _mm256_unpackhi_epi64(v0, v1);
+        __m256i t2 = _mm256_unpacklo_epi64(v2, v3);
+        __m256i t3 = _mm256_unpackhi_epi64(v2, v3);
+
+        _mm256_storeu_si256((__m256i *) &out[i],     _mm256_permute2x128_si256(t0, t2, 0x20));
+        _mm256_storeu_si256((__m256i *) &out[i + 1], _mm256_permute2x128_si256(t1, t3, 0x20));
+        _mm256_storeu_si256((__m256i *) &out[i + 2], _mm256_permute2x128_si256(t0, t2, 0x31));
+        _mm256_storeu_si256((__m256i *) &out[i + 3], _mm256_permute2x128_si256(t1, t3, 0x31));
+    }
+
+    get_hashes_batch_scalar(family, keys + i, n - i, out + i);
+}
+
+static bool cpu_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+static void get_hashes_batch_avx2(enum hash_family family, const uint64_t *keys,
+                                  size_t n, struct hashes *out)
+{
+    get_hashes_batch_scalar(family, keys, n, out);
+}
+
+// The transpose assumes four hashes (one 256-bit vector) per key, and x86-64
+static bool cpu_has_avx2(void)
+{
+    return false;
+}
+
+#endif
+
+/*
+ * Resolved before main(), so that threads hashing concurrently never race on
+ * a lazy first resolution, and switched with atomic stores afterwards.
+ */
+static get_hashes_batch_fn get_hashes_batch_impl = get_hashes_batch_scalar;
+
+__attribute__((constructor))
+static void get_hashes_batch_resolve(void)
+{
+    get_hashes_batch_use_avx2(true);
+}
+
+bool get_hashes_batch_use_avx2(bool enable)
+{
+    bool use_avx2 = enable && cpu_has_avx2();
+
+    __atomic_store_n(&get_hashes_batch_impl,
+                     use_avx2 ? get_hashes_batch_avx2 : get_hashes_batch_scalar,
+                     __ATOMIC_RELAXED);
+    return use_avx2;
+}
+
+void get_hashes_batch(const uint64_t *keys, size_t n, struct hashes *out)
+{
+    __atomic_load_n(&get_hashes_batch_impl, __ATOMIC_RELAXED)(HASH_FAMILY, keys, n, out);
+}
+
+void get_hashes_batch_with(enum hash_family family, const uint64_t *keys, size_t n,
+                           struct hashes *out)
+{
+    __atomic_load_n(&get_hashes_batch_impl, __ATOMIC_RELAXED)(family, keys, n, out);
+}
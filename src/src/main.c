@@ -1,8 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "bloom.h"
+#include "blocked_bloom.h"
+#include "cuckoo_filter.h"
+#include "counting_bloom.h"
+#include "frequency_sketch.h"
 #include "tinylfu.h"
+#include "topk.h"
+#include "concurrent_tinylfu.h"
+#include "sketch_template.h"
+#include "wtinylfu.h"
+#include "zipf.h"
+#include "sim.h"
+#include "trace.h"
+#include "arena.h"
+#include "workload.h"
+#include "mrc.h"
+#include "opt.h"
 
 #include "utils.h"
 
@@ -47,9 +67,134 @@ void test_bloom(int n) {
     printf("Bloom Filter test complete.\n\n");
 }
 
-void test_tinylfu(int n) {
+void test_blocked_bloom(int n) {
+    printf("Testing Blocked Bloom Filter with %d elements...\n", n);
+    struct blocked_bloom *b = blocked_bloom_init(n * 10);
+    if (!b) {
+        printf("Failed to init blocked bloom filter\n");
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        blocked_bloom_add(b, (uint64_t)i);
+    }
+
+    int false_negatives = 0;
+    for (int i = 0; i < n; i++) {
+        if (!blocked_bloom_contains(b, (uint64_t)i)) {
+            false_negatives++;
+        }
+    }
+    if (false_negatives > 0) {
+        printf("FAIL: Found %d false negatives (should be 0)\n", false_negatives);
+    } else {
+        printf("PASS: No false negatives found.\n");
+    }
+
+    int false_positives = 0;
+    for (int i = n; i < n * 2; i++) {
+        if (blocked_bloom_contains(b, (uint64_t)i)) {
+            false_positives++;
+        }
+    }
+    printf("False positives: %d / %d (%.2f%%)\n", false_positives, n, (double)false_positives / n * 100.0);
+
+    blocked_bloom_clear(b);
+    if (blocked_bloom_contains(b, 0)) {
+        printf("FAIL: Blocked bloom filter not empty after clear\n");
+    } else {
+        printf("PASS: Blocked bloom filter empty after clear\n");
+    }
+
+    blocked_bloom_free(&b);
+    printf("Blocked Bloom Filter test complete.\n\n");
+}
+
+void test_cuckoo_filter(int n) {
+    printf("Testing Cuckoo Filter with %d elements...\n", n);
+    struct cuckoo_filter *cf = cuckoo_filter_init(cuckoo_filter_bits_for(n));
+    if (!cf) {
+        printf("Failed to init cuckoo filter\n");
+        return;
+    }
+
+    int added = 0;
+    for (int i = 0; i < n; i++) {
+        added += cuckoo_filter_add(cf, (uint64_t)i);
+    }
+    int missing = 0;
+    for (int i = 0; i < n; i++) {
+        missing += !cuckoo_filter_contains(cf, (uint64_t)i);
+    }
+    if (added != n || missing) {
+        printf("FAIL: %d / %d added at %.0f%% load, %d missing\n", added, n,
+               100.0 * CF_MAX_LOAD, missing);
+    } else {
+        printf("PASS: All %d elements found at %.0f%% load.\n", n, 100.0 * CF_MAX_LOAD);
+    }
+
+    // Expected rate 2 * slots / 2^bits, allowing for the variance of small n
+    int false_positives = 0;
+    for (int i = n; i < 101 * n; i++) {
+        false_positives += cuckoo_filter_contains(cf, (uint64_t)i);
+    }
+    double fp_rate  = (double)false_positives / (100.0 * n);
+    double expected = 2.0 * CF_SLOTS_PER_BUCKET / (1 << CUCKOO_FINGERPRINT_BITS);
+    if (fp_rate > 2 * expected + 1e-4) {
+        printf("FAIL: False positive rate %.4f%%, expected %.4f%%\n",
+               fp_rate * 100.0, expected * 100.0);
+    } else {
+        printf("PASS: False positive rate %.4f%% (expected %.4f%%)\n",
+               fp_rate * 100.0, expected * 100.0);
+    }
+
+    // Deleting the even keys leaves the odd ones
+    int deleted = 0;
+    for (int i = 0; i < n; i += 2) {
+        deleted += cuckoo_filter_delete(cf, (uint64_t)i);
+    }
+    int kept = 0, still_present = 0;
+    for (int i = 0; i < n; i++) {
+        bool present = cuckoo_filter_contains(cf, (uint64_t)i);
+        if (i % 2) {
+            kept += present;
+        } else {
+            still_present += present;
+        }
+    }
+    if (deleted != (n + 1) / 2 || kept != n / 2 || still_present > n / 100 + 1
+        || cf->num_items != (size_t)(n / 2)) {
+        printf("FAIL: Deleted %d, kept %d / %d, %d deleted still present, %zu items\n",
+               deleted, kept, n / 2, still_present, cf->num_items);
+    } else {
+        printf("PASS: Deleted %d elements, %d deleted still present (false positives).\n",
+               deleted, still_present);
+    }
+
+    // Overfilling fails without losing any added key
+    cuckoo_filter_clear(cf);
+    int num_added = 0;
+    while (num_added < 2 * n && cuckoo_filter_add(cf, (uint64_t)num_added)) {
+        num_added++;
+    }
+    missing = 0;
+    for (int i = 0; i < num_added; i++) {
+        missing += !cuckoo_filter_contains(cf, (uint64_t)i);
+    }
+    if (num_added == 2 * n || missing) {
+        printf("FAIL: Full filter took %d elements, %d missing\n", num_added, missing);
+    } else {
+        printf("PASS: Filter full at %.1f%% load with no element lost.\n",
+               100.0 * num_added / (cf->num_buckets * CF_SLOTS_PER_BUCKET));
+    }
+
+    cuckoo_filter_free(&cf);
+    printf("Cuckoo Filter test complete.\n\n");
+}
+
+void test_tinylfu_with_config(int n, const struct tinylfu_config *config) {
     printf("Testing TinyLFU with %d elements...\n", n);
-    struct tinylfu *tfu = tinylfu_init();
+    struct tinylfu *tfu = tinylfu_init(config);
     if (!tfu) {
         printf("Failed to init tinylfu\n");
         return;
@@ -100,6 +245,332 @@ void test_tinylfu(int n) {
     printf("TinyLFU test complete.\n\n");
 }
 
+void test_tinylfu(int n) {
+    struct tinylfu_config bloom_config = {
+        .doorkeeper_type = DOORKEEPER_BLOOM,
+        .doorkeeper_size = 10240,
+        .sketch_size     = 10240,
+    };
+    struct tinylfu_config blocked_config = bloom_config;
+    blocked_config.doorkeeper_type = DOORKEEPER_BLOCKED_BLOOM;
+    struct tinylfu_config cuckoo_config = bloom_config;
+    cuckoo_config.doorkeeper_type = DOORKEEPER_CUCKOO;
+
+    test_tinylfu_with_config(n, &bloom_config);
+    test_tinylfu_with_config(n, &blocked_config);
+    test_tinylfu_with_config(n, &cuckoo_config);
+
+    // A cuckoo doorkeeper forgets evicted keys, bloom ones do not
+    enum doorkeeper_type types[] = { DOORKEEPER_BLOOM, DOORKEEPER_CUCKOO };
+    for (size_t t = 0; t < 2; t++) {
+        struct tinylfu_config config = bloom_config;
+        config.doorkeeper_type = types[t];
+
+        struct tinylfu *tfu = tinylfu_init(&config);
+        if (!tfu) {
+            printf("Failed to init tinylfu\n");
+            continue;
+        }
+        tinylfu_access(tfu, 42);
+        tinylfu_evict(tfu, 42);
+
+        uint64_t expected = types[t] == DOORKEEPER_CUCKOO ? 0 : 1;
+        uint64_t est = tinylfu_estimate(tfu, 42);
+        if (est != expected) {
+            printf("FAIL: Estimate %" PRIu64 " after eviction, expected %" PRIu64 "\n",
+                   est, expected);
+        } else {
+            printf("PASS: Estimate %" PRIu64 " after eviction with a %s doorkeeper.\n",
+                   est, types[t] == DOORKEEPER_CUCKOO ? "cuckoo" : "bloom");
+        }
+        tinylfu_free(&tfu);
+    }
+
+    // With a sample size, resets happen every sample_size accesses, and
+    // not when a counter saturates
+    struct tinylfu_config sample_config = bloom_config;
+    sample_config.aging       = TINYLFU_AGING_STOP_THE_WORLD;
+    sample_config.sample_size = 100;
+
+    struct tinylfu *tfu = tinylfu_init(&sample_config);
+    if (!tfu) {
+        printf("Failed to init tinylfu\n");
+        return;
+    }
+    for (int i = 0; i < 250; i++) {
+        tinylfu_access(tfu, 42);
+    }
+    if (tfu->resets != 2) {
+        printf("FAIL: %" PRIu64 " resets after 250 accesses with a sample size of 100\n",
+               tfu->resets);
+    } else {
+        printf("PASS: 2 resets after 250 accesses with a sample size of 100.\n");
+    }
+    tinylfu_free(&tfu);
+}
+
+/*
+ * Records accesses of n keys with skewed frequencies to tfu.
+ */
+static void tinylfu_file_accesses(struct tinylfu *tfu, int n, uint64_t seed)
+{
+    for (int i = 0; i < n; i++) {
+        tinylfu_access(tfu, seed + i % (1 + i % 1000));
+    }
+}
+
+static bool tinylfu_file_same_estimates(struct tinylfu *tfu, const uint64_t *expected)
+{
+    for (uint64_t key = 0; key < 1000; key++) {
+        if (tinylfu_estimate(tfu, key) != expected[key]) return false;
+    }
+    return true;
+}
+
+void test_tinylfu_file(int n) {
+    char dir[] = "/tmp/tinylfu_file_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("Failed to create a temporary directory, skipping\n");
+        return;
+    }
+
+    char live_path[64], snapshot_path[64];
+    snprintf(live_path, sizeof(live_path), "%s/live", dir);
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/snapshot", dir);
+
+    enum doorkeeper_type types[] = { DOORKEEPER_BLOOM, DOORKEEPER_CUCKOO };
+    uint64_t expected[1000];
+
+    for (size_t t = 0; t < 2; t++) {
+        const char *name = types[t] == DOORKEEPER_CUCKOO ? "cuckoo" : "bloom";
+        struct tinylfu_config config = {
+            .doorkeeper_type = types[t],
+            .doorkeeper_size = 1 << 16,
+            .sketch_size     = 1 << 14,
+            .path            = live_path,
+        };
+        unlink(live_path);
+
+        struct tinylfu *tfu = tinylfu_init(&config);
+        if (!tfu) {
+            printf("Failed to init tinylfu on %s\n", live_path);
+            continue;
+        }
+        tinylfu_file_accesses(tfu, n, 0);
+        for (uint64_t key = 0; key < 1000; key++) {
+            expected[key] = tinylfu_estimate(tfu, key);
+        }
+        uint64_t resets = tfu->resets;
+        tinylfu_free(&tfu);
+
+        // A cleanly closed file is reattached as it was left
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tfu = tinylfu_init(&config);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+
+        if (!tfu || !tinylfu_file_same_estimates(tfu, expected) || tfu->resets != resets) {
+            printf("FAIL: %s TinyLFU not restored from %s\n", name, live_path);
+        } else {
+            printf("PASS: %s TinyLFU reattached after %" PRIu64 " resets in %.0f us.\n",
+                   name, resets, us);
+        }
+        if (!tfu) continue;
+
+        if (tinylfu_snapshot(tfu, snapshot_path) != 0) {
+            printf("FAIL: Snapshot of the %s TinyLFU to %s failed\n", name, snapshot_path);
+        }
+        tinylfu_file_accesses(tfu, n, 500);
+        if (tinylfu_restore(tfu, snapshot_path) != 0
+            || !tinylfu_file_same_estimates(tfu, expected)) {
+            printf("FAIL: %s TinyLFU not restored from %s\n", name, snapshot_path);
+        } else {
+            printf("PASS: %s TinyLFU restored from its snapshot.\n", name);
+        }
+        tinylfu_free(&tfu);
+
+        // A process dying with the file mapped leaves it dirty, and the
+        // next one starts empty
+        pid_t pid = fork();
+        if (pid == 0) {
+            struct tinylfu *child = tinylfu_init(&config);
+            if (child) tinylfu_file_accesses(child, n, 500);
+            _exit(child ? 0 : 1);
+        }
+        int status = 1;
+        if (pid > 0) waitpid(pid, &status, 0);
+
+        tfu = tinylfu_init(&config);
+        if (!tfu || status != 0) {
+            printf("FAIL: %s TinyLFU not reopened after a crash\n", name);
+            tinylfu_free(&tfu);
+            continue;
+        }
+        bool empty = true;
+        for (uint64_t key = 0; key < 1000; key++) {
+            empty &= tinylfu_estimate(tfu, key) == 0;
+        }
+        if (!empty || tinylfu_restore(tfu, snapshot_path) != 0
+            || !tinylfu_file_same_estimates(tfu, expected)) {
+            printf("FAIL: %s TinyLFU not recovered from its snapshot after a crash\n", name);
+        } else {
+            printf("PASS: Dirty %s file discarded, snapshot restored.\n", name);
+        }
+
+        // Snapshots of other layouts and torn ones are refused, and leave
+        // tfu as is
+        struct tinylfu_config small_config = config;
+        small_config.path        = NULL;
+        small_config.sketch_size = 1 << 10;
+        struct tinylfu *small = tinylfu_init(&small_config);
+        bool mismatched = !small || tinylfu_restore(small, snapshot_path) == 0;
+
+        FILE *f = fopen(snapshot_path, "r+");
+        if (f) {
+            fseek(f, 2 * 4096 + 8, SEEK_SET);
+            fputc(fgetc(f) ^ 1, f);
+            fclose(f);
+        }
+
+        if (mismatched || tinylfu_restore(tfu, snapshot_path) == 0
+            || !tinylfu_file_same_estimates(tfu, expected)) {
+            printf("FAIL: %s TinyLFU restored from a torn or mismatched snapshot\n", name);
+        } else {
+            printf("PASS: Torn and mismatched %s snapshots refused.\n", name);
+        }
+        tinylfu_free(&small);
+        tinylfu_free(&tfu);
+
+        // A file of another layout is emptied
+        config.sketch_size = 1 << 15;
+        tfu = tinylfu_init(&config);
+        if (!tfu || tinylfu_estimate(tfu, 0) != 0) {
+            printf("FAIL: %s file of another layout reattached\n", name);
+        } else {
+            printf("PASS: %s file of another layout emptied.\n", name);
+        }
+        tinylfu_free(&tfu);
+    }
+
+    unlink(live_path);
+    unlink(snapshot_path);
+    rmdir(dir);
+    printf("TinyLFU file test complete.\n\n");
+}
+
+void test_topk(int n) {
+    printf("Testing Space-Saving top-K with %d accesses...\n", n);
+    const size_t k = 64;
+    const uint64_t num_keys = 10000;
+
+    struct topk *tk = topk_init(k);
+    uint64_t *exact = calloc(num_keys + 1, sizeof(uint64_t));
+    struct topk_item *items = malloc(k * sizeof(struct topk_item));
+    if (!tk || !exact || !items) {
+        printf("Failed to init top-K\n");
+        topk_free(&tk);
+        free(exact);
+        free(items);
+        return;
+    }
+
+    struct zipf z;
+    uint64_t rng = 42;
+    zipf_init(&z, num_keys, 0.9);
+    for (int i = 0; i < n; i++) {
+        uint64_t key = zipf_next(&z, &rng);
+        exact[key]++;
+        topk_add(tk, key);
+    }
+
+    // Counts bound the true frequency from above, and count - error from
+    // below; keys more frequent than n / k are all monitored
+    size_t num_items = topk_snapshot(tk, items, k);
+    bool bounded = num_items == k;
+    for (size_t i = 0; i < num_items; i++) {
+        uint64_t true_count = exact[items[i].key];
+        bounded &= items[i].count >= true_count
+                && items[i].count - items[i].error <= true_count
+                && (i == 0 || items[i].count <= items[i - 1].count)
+                && topk_count(tk, items[i].key) == items[i].count;
+    }
+    bool complete = true;
+    for (uint64_t key = 1; key <= num_keys; key++) {
+        complete &= exact[key] <= (uint64_t) n / k || topk_count(tk, key) > 0;
+    }
+    if (!bounded || !complete) {
+        printf("FAIL: Space-Saving bounds violated (bounded %d, complete %d)\n",
+               bounded, complete);
+    } else {
+        printf("PASS: %zu keys monitored within their error bounds, top key %" PRIu64
+               " (%" PRIu64 " accesses, %" PRIu64 " counted).\n",
+               num_items, items[0].key, exact[items[0].key], items[0].count);
+    }
+
+    // Halving keeps the order and the bounds
+    topk_halve(tk);
+    struct topk_item *halved = malloc(k * sizeof(struct topk_item));
+    bool ordered = halved && topk_snapshot(tk, halved, k) == num_items;
+    for (size_t i = 0; ordered && i < num_items; i++) {
+        ordered &= halved[i].count <= items[0].count / 2 + 1
+                && halved[i].error <= halved[i].count
+                && (i == 0 || halved[i].count <= halved[i - 1].count);
+    }
+    for (int i = 0; i < n / 10; i++) {
+        topk_add(tk, zipf_next(&z, &rng));
+    }
+    ordered &= topk_snapshot(tk, items, k) == num_items;
+    for (size_t i = 1; ordered && i < num_items; i++) {
+        ordered &= items[i].count <= items[i - 1].count;
+    }
+    if (!ordered) {
+        printf("FAIL: Top-K out of order after halving\n");
+    } else {
+        printf("PASS: Top-K ordered after halving and further accesses.\n");
+    }
+    free(halved);
+    topk_free(&tk);
+
+    // Fed by TinyLFU accesses, scalar and batched alike
+    struct tinylfu_config config = { .topk_size = k };
+    struct tinylfu *scalar = tinylfu_init(&config);
+    struct tinylfu *batched = tinylfu_init(&config);
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    struct topk_item *batched_items = malloc(k * sizeof(struct topk_item));
+    if (scalar && batched && keys && batched_items) {
+        rng = 7;
+        for (int i = 0; i < n; i++) {
+            keys[i] = zipf_next(&z, &rng);
+            tinylfu_access(scalar, keys[i]);
+        }
+        tinylfu_access_batch(batched, keys, n);
+
+        size_t num_scalar = tinylfu_topk(scalar, items, k);
+        bool same = tinylfu_topk(batched, batched_items, k) == num_scalar && num_scalar > 0;
+        for (size_t i = 0; same && i < num_scalar; i++) {
+            same &= items[i].key == batched_items[i].key
+                 && items[i].count == batched_items[i].count;
+        }
+        if (!same) {
+            printf("FAIL: TinyLFU top-K differs between scalar and batched accesses\n");
+        } else {
+            printf("PASS: TinyLFU top-K fed by accesses, top key %" PRIu64 ".\n",
+                   items[0].key);
+        }
+    } else {
+        printf("Failed to init TinyLFU with top-K\n");
+    }
+
+    tinylfu_free(&scalar);
+    tinylfu_free(&batched);
+    free(keys);
+    free(batched_items);
+    free(exact);
+    free(items);
+    printf("Top-K test complete.\n\n");
+}
+
 void test_counting_bloom(int n) {
     printf("Testing Counting Bloom Filter with %d elements...\n", n);
     // Use enough counters to avoid too many collisions for this test
@@ -121,7 +592,11 @@ void test_counting_bloom(int n) {
         }
     }
 
+    // Collisions only add to the counters, so an estimate never falls below
+    // the true count and never exceeds the 4-bit maximum; how often it
+    // overestimates depends on the hash family
     printf("Checking Counting Bloom Filter estimates:\n");
+    int wrong = 0, exact = 0;
     for (int i = 0; i < max_count; i++) {
         uint64_t est = counting_bloom_estimate(cb, (uint64_t)i);
         uint64_t expected = i + 1;
@@ -129,18 +604,1604 @@ void test_counting_bloom(int n) {
         
         printf("  %d: Actual %d, Estimate %" PRIu64 "\n", i, i + 1, est);
         
-        if (est != expected) {
-             printf("FAIL: Estimate mismatch for %d. Expected %" PRIu64 ", got %" PRIu64 "\n", i, expected, est);
+        if (est < expected || est > 15) {
+             printf("FAIL: Estimate out of bounds for %d. Expected %" PRIu64 " to 15, got %" PRIu64 "\n", i, expected, est);
+             wrong++;
         }
+        exact += est == expected;
+    }
+    if (!wrong) {
+        printf("PASS: Estimates within [count, 15], %d / %d exact\n", exact, max_count);
     }
 
     counting_bloom_free(&cb);
     printf("Counting Bloom Filter test complete.\n\n");
 }
 
+void test_frequency_sketch(int n) {
+    printf("Testing Frequency Sketch with %d elements...\n", n);
+    struct frequency_sketch *fs = frequency_sketch_init(n * 10);
+    if (!fs) {
+        printf("Failed to init frequency sketch\n");
+        return;
+    }
+
+    int max_count = 20;
+    for (int i = 0; i < max_count; i++) {
+        for (int j = 0; j <= i; j++) {
+            frequency_sketch_add(fs, (uint64_t)i);
+        }
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < max_count; i++) {
+        uint64_t est = frequency_sketch_estimate(fs, (uint64_t)i);
+        uint64_t expected = i + 1;
+        if (expected > 15) expected = 15; // Saturation at 4 bits (0-15)
+
+        // Collisions may only over-estimate
+        if (est < expected) {
+            printf("FAIL: Under-estimate for %d. Expected %" PRIu64 ", got %" PRIu64 "\n", i, expected, est);
+            mismatches++;
+        } else if (est != expected) {
+            mismatches++;
+        }
+    }
+    printf("Estimates off by collisions: %d / %d\n", mismatches, max_count);
+
+    frequency_sketch_free(&fs);
+    printf("Frequency Sketch test complete.\n\n");
+}
+
+/*
+ * Halving must not leak the low bit of a counter into its neighbour: a key
+ * seen once must read 0 after a reset, a key seen 15 times must read 7.
+ */
+void test_sketch_reset(int n) {
+    printf("Testing sketch reset with %d elements...\n", n);
+    struct counting_bloom *cb = counting_bloom_init(n * 10);
+    struct frequency_sketch *fs = frequency_sketch_init(n * 10);
+    if (!cb || !fs) {
+        printf("Failed to init sketches\n");
+        counting_bloom_free(&cb);
+        frequency_sketch_free(&fs);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int count = (i % 2) ? 15 : 1;
+        for (int j = 0; j < count; j++) {
+            counting_bloom_add(cb, (uint64_t)i);
+            frequency_sketch_add(fs, (uint64_t)i);
+        }
+    }
+
+    counting_bloom_reset(cb);
+    frequency_sketch_reset(fs);
+
+    int cb_errors = 0, fs_errors = 0;
+    for (int i = 0; i < n; i++) {
+        // Collisions may raise a key seen once, never above the halved max
+        uint64_t max_expected = 7;
+        uint64_t expected = (i % 2) ? 7 : 0;
+
+        uint64_t cb_est = counting_bloom_estimate(cb, (uint64_t)i);
+        uint64_t fs_est = frequency_sketch_estimate(fs, (uint64_t)i);
+        cb_errors += cb_est > max_expected || (expected && cb_est != expected);
+        fs_errors += fs_est > max_expected || (expected && fs_est != expected);
+    }
+
+    if (cb_errors || fs_errors) {
+        printf("FAIL: Counters corrupted by reset (counting bloom %d, frequency sketch %d)\n",
+               cb_errors, fs_errors);
+    } else {
+        printf("PASS: Reset halves every counter in place\n");
+    }
+
+    counting_bloom_free(&cb);
+    frequency_sketch_free(&fs);
+    printf("Sketch reset test complete.\n\n");
+}
+
+void test_hashes_batch(int n) {
+    printf("Testing batched hashing with %d keys...\n", n);
+
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    struct hashes *batch = malloc(n * sizeof(struct hashes));
+    if (!keys || !batch) {
+        printf("Failed to allocate keys\n");
+        free(keys);
+        free(batch);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        keys[i] = (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+    }
+
+    bool avx2_modes[] = {false, true};
+    for (size_t m = 0; m < 2; m++) {
+        bool use_avx2 = get_hashes_batch_use_avx2(avx2_modes[m]);
+        if (avx2_modes[m] && !use_avx2) {
+            printf("AVX2 not supported, skipping\n");
+            continue;
+        }
+
+        for (int f = 0; f < HASH_NUM_FAMILIES; f++) {
+            // Odd lengths exercise the scalar tail of the vector path
+            get_hashes_batch_with(f, keys, n, batch);
+
+            int mismatches = 0;
+            for (int i = 0; i < n; i++) {
+                struct hashes hs;
+                get_hashes_with(f, keys[i], &hs);
+                for (size_t j = 0; j < NUM_HASH_FUNCTIONS; j++) {
+                    if (hs.h[j] != batch[i].h[j]) {
+                        mismatches++;
+                        break;
+                    }
+                }
+            }
+            if (mismatches > 0) {
+                printf("FAIL: %s %s batch hashes differ from get_hashes() for %d keys\n",
+                       use_avx2 ? "AVX2" : "scalar", hash_family_name(f), mismatches);
+            } else {
+                printf("PASS: %s %s batch hashes match get_hashes().\n",
+                       use_avx2 ? "AVX2" : "scalar", hash_family_name(f));
+            }
+        }
+    }
+    get_hashes_batch_use_avx2(true);
+
+    // XXH3_64bits() of the key's 8 little-endian bytes, from the reference
+    // implementation
+    if (hash_xxh3_64(1) != 0x2fbc593564db792eULL
+        || hash_xxh3_64(0x0123456789abcdefULL) != 0xb78df414284277a6ULL) {
+        printf("FAIL: hash_xxh3_64() differs from XXH3_64bits()\n");
+    } else {
+        printf("PASS: hash_xxh3_64() matches XXH3_64bits().\n");
+    }
+
+    // Indices past 2^32 are reachable
+    size_t large = (size_t) 1 << 40;
+    if (reduce(UINT64_MAX, large) != large - 1 || reduce(0, large) != 0) {
+        printf("FAIL: reduce() does not cover [0, 2^40)\n");
+    } else {
+        printf("PASS: reduce() covers [0, 2^40).\n");
+    }
+
+    free(keys);
+    free(batch);
+    printf("Batched hashing test complete.\n\n");
+}
+
+void test_batch(int n) {
+    printf("Testing batch APIs with %d elements...\n", n);
+
+    uint64_t *addrs = malloc(2 * n * sizeof(uint64_t));
+    uint64_t *estimates = malloc(2 * n * sizeof(uint64_t));
+    bool *present = malloc(2 * n * sizeof(bool));
+    struct bloom *b = bloom_init(n * 10);
+    struct counting_bloom *cb = counting_bloom_init(n * 4);
+    struct tinylfu *scalar = tinylfu_init(NULL);
+    struct tinylfu *batched = tinylfu_init(NULL);
+    if (!addrs || !estimates || !present || !b || !cb || !scalar || !batched) {
+        printf("Failed to init batch test\n");
+        goto out;
+    }
+
+    // Repeated addresses, so that sketch updates depend on earlier ones
+    for (int i = 0; i < 2 * n; i++) {
+        addrs[i] = (uint64_t)(i % (n / 2 + 1));
+    }
+
+    int mismatches = 0;
+
+    bloom_add_batch(b, addrs, n);
+    bloom_contains_batch(b, addrs, 2 * n, present);
+    for (int i = 0; i < 2 * n; i++) {
+        mismatches += present[i] != bloom_contains(b, addrs[i]);
+    }
+
+    counting_bloom_add_batch(cb, addrs, 2 * n);
+    counting_bloom_estimate_batch(cb, addrs, 2 * n, estimates);
+    for (int i = 0; i < 2 * n; i++) {
+        mismatches += estimates[i] != counting_bloom_estimate(cb, addrs[i]);
+    }
+
+    for (int i = 0; i < 2 * n; i++) {
+        tinylfu_access(scalar, addrs[i]);
+    }
+    tinylfu_access_batch(batched, addrs, 2 * n);
+    tinylfu_estimate_batch(batched, addrs, 2 * n, estimates);
+    for (int i = 0; i < 2 * n; i++) {
+        mismatches += estimates[i] != tinylfu_estimate(scalar, addrs[i]);
+    }
+
+    if (mismatches > 0) {
+        printf("FAIL: %d batch results differ from the scalar API\n", mismatches);
+    } else {
+        printf("PASS: Batch results match the scalar API.\n");
+    }
+
+out:
+    free(addrs);
+    free(estimates);
+    free(present);
+    bloom_free(&b);
+    counting_bloom_free(&cb);
+    tinylfu_free(&scalar);
+    tinylfu_free(&batched);
+    printf("Batch API test complete.\n\n");
+}
+
+void test_concurrent_tinylfu_single(int n) {
+    printf("Testing concurrent TinyLFU (1 thread) with %d elements...\n", n);
+    struct concurrent_tinylfu *ctfu = concurrent_tinylfu_init(1 << 16, 1 << 16);
+    if (!ctfu) {
+        printf("Failed to init concurrent TinyLFU\n");
+        return;
+    }
+
+    // Item i is accessed i % 10 + 1 times, never enough to saturate
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < n; i++) {
+            if (round <= i % 10) {
+                concurrent_tinylfu_access(ctfu, (uint64_t)i);
+            }
+        }
+    }
+    concurrent_tinylfu_drain(ctfu);
+
+    int errors = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t expected = i % 10 + 1;
+        if (concurrent_tinylfu_estimate(ctfu, (uint64_t)i) != expected) {
+            errors++;
+        }
+    }
+    if (errors > n / 100) {
+        printf("FAIL: %d / %d estimates differ from the access count\n", errors, n);
+    } else {
+        printf("PASS: %d / %d estimates differ from the access count (collisions)\n",
+               errors, n);
+    }
+
+    concurrent_tinylfu_free(&ctfu);
+    printf("Concurrent TinyLFU test complete.\n\n");
+}
+
+struct concurrent_worker {
+    struct concurrent_tinylfu *ctfu;
+    struct tinylfu *tfu;
+    pthread_mutex_t *lock;
+    int id;
+    int n;
+    int num_hot;
+};
+
+#define COLD_KEY_BASE (1ULL << 40)
+
+static void *stress_worker(void *arg) {
+    struct concurrent_worker *w = arg;
+
+    // Every thread hammers the same hot keys, cold keys are per thread
+    for (int i = 0; i < w->n; i++) {
+        concurrent_tinylfu_access(w->ctfu, (uint64_t)(i % w->num_hot));
+        if (i % 8 == 0) {
+            concurrent_tinylfu_access(w->ctfu,
+                                      COLD_KEY_BASE + (uint64_t)w->id * w->n + i);
+        }
+        if (i % 64 == 0) {
+            concurrent_tinylfu_estimate(w->ctfu, (uint64_t)(i % w->num_hot));
+        }
+    }
+
+    return NULL;
+}
+
+void test_concurrent_tinylfu(int num_threads, int n) {
+    printf("Stress testing concurrent TinyLFU with %d threads x %d accesses...\n",
+           num_threads, n);
+
+    int num_hot = 16;
+    struct concurrent_tinylfu *ctfu = concurrent_tinylfu_init(1 << 20, 1 << 20);
+    pthread_t threads[64];
+    struct concurrent_worker workers[64];
+    if (!ctfu || num_threads > 64) {
+        printf("Failed to init concurrent TinyLFU\n");
+        concurrent_tinylfu_free(&ctfu);
+        return;
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = (struct concurrent_worker) {
+            .ctfu = ctfu, .id = t, .n = n, .num_hot = num_hot,
+        };
+        pthread_create(&threads[t], NULL, stress_worker, &workers[t]);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    concurrent_tinylfu_drain(ctfu);
+
+    int wrong = 0;
+    for (int h = 0; h < num_hot; h++) {
+        for (int t = 0; t < num_threads; t++) {
+            uint64_t cold = COLD_KEY_BASE + (uint64_t)t * n + 8 * h;
+            if (!concurrent_tinylfu_admit(ctfu, (uint64_t)h, cold)
+                || concurrent_tinylfu_admit(ctfu, cold, (uint64_t)h)) {
+                wrong++;
+            }
+        }
+    }
+    if (wrong > 0) {
+        printf("FAIL: %d wrong admission decisions between hot and cold keys\n", wrong);
+    } else {
+        printf("PASS: Hot keys are always preferred over cold keys.\n");
+    }
+
+    concurrent_tinylfu_free(&ctfu);
+    printf("Concurrent TinyLFU stress test complete.\n\n");
+}
+
+void test_incremental_aging(int n) {
+    printf("Testing incremental aging with %d accesses...\n", n);
+
+    struct tinylfu_config config = {
+        .doorkeeper_type = DOORKEEPER_BLOOM,
+        .doorkeeper_size = 10240,
+        .sketch_size     = 10240,
+    };
+    config.aging = TINYLFU_AGING_STOP_THE_WORLD;
+    struct tinylfu *stw = tinylfu_init(&config);
+    config.aging = TINYLFU_AGING_INCREMENTAL;
+    struct tinylfu *incremental = tinylfu_init(&config);
+    if (!stw || !incremental) {
+        printf("Failed to init TinyLFUs\n");
+        tinylfu_free(&stw);
+        tinylfu_free(&incremental);
+        return;
+    }
+
+    /*
+     * A hot item saturates its counters every few hundred accesses, far
+     * apart enough for each incremental reset to complete before the next.
+     */
+    int mismatches = 0;
+    int num_keys = 4096;
+    for (int i = 0; i < n; i++) {
+        uint64_t addr = i % 32 == 0 ? 0 : (uint64_t)(i * 2654435761u) % num_keys;
+        tinylfu_access(stw, addr);
+        tinylfu_access(incremental, addr);
+
+        // Estimate items whose chunks may still be waiting for the sweep
+        uint64_t probe = (uint64_t)(i * 40503u) % num_keys;
+        mismatches += tinylfu_estimate(stw, probe) != tinylfu_estimate(incremental, probe);
+    }
+
+    if (mismatches > 0) {
+        printf("FAIL: %d estimates differ from stop-the-world aging\n", mismatches);
+    } else {
+        printf("PASS: Incremental aging matches stop-the-world aging.\n");
+    }
+
+    tinylfu_free(&stw);
+    tinylfu_free(&incremental);
+    printf("Incremental aging test complete.\n\n");
+}
+
+/*
+ * First key from *next on whose buckets are i1 (if i1 is not SIZE_MAX) and
+ * i2 (if i2 is not SIZE_MAX) in a cuckoo filter like cf.
+ */
+static uint64_t cuckoo_key_in(struct cuckoo_filter *cf, uint64_t *next, size_t i1,
+                              size_t i2) {
+    for (;; (*next)++) {
+        struct hashes hs;
+        get_hashes(*next, &hs);
+
+        size_t b1 = cuckoo_filter_bucket(cf, &hs);
+        size_t b2 = cuckoo_filter_alt_bucket(cf, b1, cuckoo_filter_fingerprint(&hs));
+        if ((i1 == SIZE_MAX || b1 == i1) && (i2 == SIZE_MAX || b2 == i2)) {
+            return (*next)++;
+        }
+    }
+}
+
+// Relocations forced by test_incremental_aging_cuckoo()
+#define CUCKOO_AGING_ROUNDS 16
+
+/*
+ * Incremental aging of a cuckoo doorkeeper, reset when it is full. Its last
+ * failed relocation left a pre-reset fingerprint waiting for a free slot.
+ * During the sweep, pairs of buckets are filled and a key of both is added,
+ * so that fingerprints are relocated, and a slot is freed next to the waiting
+ * fingerprint. Neither may bring a pre-reset key into a swept bucket, nor
+ * lose a new one in a bucket the sweep clears later.
+ */
+void test_incremental_aging_cuckoo(int n) {
+    printf("Testing incremental aging of a cuckoo doorkeeper with %d buckets...\n", n);
+
+    size_t num_bits = (size_t)n * NUM_BITS(uint64_t);
+    struct tinylfu_config config = {
+        .doorkeeper_type = DOORKEEPER_CUCKOO,
+        .doorkeeper_size = num_bits,
+        .sketch_size     = 10240,
+    };
+    config.aging = TINYLFU_AGING_STOP_THE_WORLD;
+    struct tinylfu *stw = tinylfu_init(&config);
+    config.aging = TINYLFU_AGING_INCREMENTAL;
+    struct tinylfu *incremental = tinylfu_init(&config);
+    struct cuckoo_filter *layout = cuckoo_filter_init(num_bits);
+    if (!stw || !incremental || !layout) {
+        printf("Failed to init TinyLFUs\n");
+        tinylfu_free(&stw);
+        tinylfu_free(&incremental);
+        cuckoo_filter_free(&layout);
+        return;
+    }
+
+    // Old keys until a full doorkeeper starts the reset
+    uint64_t num_old = 0;
+    while (!incremental->resets) {
+        tinylfu_access(stw, num_old);
+        tinylfu_access(incremental, num_old);
+        num_old++;
+    }
+    struct cuckoo_filter *cf = incremental->doorkeeper->cuckoo;
+    uint64_t waiting = cf->victim_fingerprint;
+    size_t waiting_bucket = cf->victim_bucket;
+
+    uint64_t next = 1ULL << 40;
+    uint64_t keys[CUCKOO_AGING_ROUNDS * (2 * CF_SLOTS_PER_BUCKET + 1) + 1];
+    size_t num_keys = 0;
+
+    for (int round = 0; round < CUCKOO_AGING_ROUNDS; round++) {
+        struct hashes hs;
+        uint64_t kicker = cuckoo_key_in(layout, &next, SIZE_MAX, SIZE_MAX);
+        get_hashes(kicker, &hs);
+        size_t a = cuckoo_filter_bucket(layout, &hs);
+        size_t b = cuckoo_filter_alt_bucket(layout, a, cuckoo_filter_fingerprint(&hs));
+
+        size_t first = num_keys;
+        for (size_t i = 0; i < CF_SLOTS_PER_BUCKET; i++) {
+            keys[num_keys++] = cuckoo_key_in(layout, &next, a, SIZE_MAX);
+            keys[num_keys++] = cuckoo_key_in(layout, &next, b, SIZE_MAX);
+        }
+        keys[num_keys++] = kicker;
+
+        for (size_t i = first; i < num_keys; i++) {
+            tinylfu_access(stw, keys[i]);
+            tinylfu_access(incremental, keys[i]);
+        }
+    }
+
+    // Frees a slot in the other bucket of the waiting fingerprint
+    if (waiting) {
+        size_t other = cuckoo_filter_alt_bucket(layout, waiting_bucket, waiting);
+        uint64_t key = cuckoo_key_in(layout, &next, other, SIZE_MAX);
+        tinylfu_access(stw, key);
+        tinylfu_access(incremental, key);
+        tinylfu_evict(stw, key);
+        tinylfu_evict(incremental, key);
+    }
+
+    int old_found = 0, new_mismatches = 0;
+    for (uint64_t i = 0; i < num_old; i++) {
+        old_found += tinylfu_estimate(stw, i) != tinylfu_estimate(incremental, i);
+    }
+    for (size_t i = 0; i < num_keys; i++) {
+        new_mismatches += tinylfu_estimate(stw, keys[i]) != tinylfu_estimate(incremental, keys[i]);
+    }
+
+    if (!waiting) {
+        printf("FAIL: The full doorkeeper has no fingerprint waiting for a slot\n");
+    }
+    if (old_found > 0) {
+        printf("FAIL: %d pre-reset keys survive the reset\n", old_found);
+    } else {
+        printf("PASS: No pre-reset key survives the reset.\n");
+    }
+    if (new_mismatches > 0) {
+        printf("FAIL: %d keys added during the sweep differ from stop-the-world aging\n",
+               new_mismatches);
+    } else {
+        printf("PASS: Keys added during the sweep match stop-the-world aging.\n");
+    }
+
+    tinylfu_free(&stw);
+    tinylfu_free(&incremental);
+    cuckoo_filter_free(&layout);
+    printf("Incremental cuckoo aging test complete.\n\n");
+}
+
+/*
+ * Every counting sketch and bloom filter specialization tested:
+ * (name, counter bits, hash functions, hash family, reduction).
+ */
+#define COUNTING_SKETCH_SPECIALIZATIONS(X)          \
+    X(cs_w2_k2_wang_mask,       2, 2, WANG, MASK)      \
+    X(cs_w2_k2_wang_fastrange,  2, 2, WANG, FASTRANGE) \
+    X(cs_w2_k2_fmix_mask,       2, 2, FMIX, MASK)      \
+    X(cs_w2_k2_fmix_fastrange,  2, 2, FMIX, FASTRANGE) \
+    X(cs_w2_k4_wang_mask,       2, 4, WANG, MASK)      \
+    X(cs_w2_k4_wang_fastrange,  2, 4, WANG, FASTRANGE) \
+    X(cs_w2_k4_fmix_mask,       2, 4, FMIX, MASK)      \
+    X(cs_w2_k4_fmix_fastrange,  2, 4, FMIX, FASTRANGE) \
+    X(cs_w4_k2_wang_mask,       4, 2, WANG, MASK)      \
+    X(cs_w4_k2_wang_fastrange,  4, 2, WANG, FASTRANGE) \
+    X(cs_w4_k2_fmix_mask,       4, 2, FMIX, MASK)      \
+    X(cs_w4_k2_fmix_fastrange,  4, 2, FMIX, FASTRANGE) \
+    X(cs_w4_k4_wang_mask,       4, 4, WANG, MASK)      \
+    X(cs_w4_k4_wang_fastrange,  4, 4, WANG, FASTRANGE) \
+    X(cs_w4_k4_fmix_mask,       4, 4, FMIX, MASK)      \
+    X(cs_w4_k4_fmix_fastrange,  4, 4, FMIX, FASTRANGE) \
+    X(cs_w8_k2_wang_mask,       8, 2, WANG, MASK)      \
+    X(cs_w8_k2_wang_fastrange,  8, 2, WANG, FASTRANGE) \
+    X(cs_w8_k2_fmix_mask,       8, 2, FMIX, MASK)      \
+    X(cs_w8_k2_fmix_fastrange,  8, 2, FMIX, FASTRANGE) \
+    X(cs_w8_k4_wang_mask,       8, 4, WANG, MASK)      \
+    X(cs_w8_k4_wang_fastrange,  8, 4, WANG, FASTRANGE) \
+    X(cs_w8_k4_fmix_mask,       8, 4, FMIX, MASK)      \
+    X(cs_w8_k4_fmix_fastrange,  8, 4, FMIX, FASTRANGE)
+
+#define BLOOM_FILTER_SPECIALIZATIONS(X)             \
+    X(bf_k4_wang_mask,       4, WANG, MASK)            \
+    X(bf_k4_wang_fastrange,  4, WANG, FASTRANGE)       \
+    X(bf_k4_fmix_mask,       4, FMIX, MASK)            \
+    X(bf_k4_fmix_fastrange,  4, FMIX, FASTRANGE)       \
+    X(bf_k7_wang_mask,       7, WANG, MASK)            \
+    X(bf_k7_wang_fastrange,  7, WANG, FASTRANGE)       \
+    X(bf_k7_fmix_mask,       7, FMIX, MASK)            \
+    X(bf_k7_fmix_fastrange,  7, FMIX, FASTRANGE)
+
+/*
+ * Item i is added (i % max) + 1 times, so that no counter saturates. A
+ * count-min sketch never underestimates, and a reset halves every estimate.
+ * Returns the number of violations.
+ */
+#define DEFINE_COUNTING_SKETCH_TEST(name, COUNTER_BITS, NUM_HASHES, HASH, REDUCE) \
+    DEFINE_COUNTING_SKETCH(name, COUNTER_BITS, NUM_HASHES, HASH, REDUCE)          \
+                                                                                  \
+    static int test_##name(int n) {                                               \
+        struct name *s = name##_init(n * 10);                                     \
+        uint64_t *before = malloc(n * sizeof(uint64_t));                          \
+        int errors = 0;                                                           \
+        if (!s || !before) {                                                      \
+            name##_free(&s);                                                      \
+            free(before);                                                         \
+            return n;                                                             \
+        }                                                                         \
+                                                                                  \
+        for (int i = 0; i < n; i++) {                                             \
+            uint64_t freq = i % (name##_max() - 1) + 1;                           \
+            for (uint64_t j = 0; j < freq; j++) {                                 \
+                name##_add(s, (uint64_t)i);                                       \
+            }                                                                     \
+        }                                                                         \
+        for (int i = 0; i < n; i++) {                                             \
+            before[i] = name##_estimate(s, (uint64_t)i);                          \
+            errors += before[i] < (uint64_t)(i % (name##_max() - 1) + 1);         \
+        }                                                                         \
+                                                                                  \
+        name##_reset(s);                                                          \
+        for (int i = 0; i < n; i++) {                                             \
+            errors += name##_estimate(s, (uint64_t)i) != before[i] >> 1;          \
+        }                                                                         \
+                                                                                  \
+        name##_free(&s);                                                          \
+        free(before);                                                             \
+        return errors;                                                            \
+    }
+
+/*
+ * No false negatives, and nothing left after a clear.
+ */
+#define DEFINE_BLOOM_FILTER_TEST(name, NUM_HASHES, HASH, REDUCE)                  \
+    DEFINE_BLOOM_FILTER(name, NUM_HASHES, HASH, REDUCE)                           \
+                                                                                  \
+    static int test_##name(int n) {                                               \
+        struct name *b = name##_init(n * 10);                                     \
+        int errors = 0;                                                           \
+        if (!b) return n;                                                         \
+                                                                                  \
+        for (int i = 0; i < n; i++) {                                             \
+            name##_add(b, (uint64_t)i);                                           \
+        }                                                                         \
+        for (int i = 0; i < n; i++) {                                             \
+            errors += !name##_contains(b, (uint64_t)i);                           \
+        }                                                                         \
+                                                                                  \
+        name##_clear(b);                                                          \
+        for (int i = 0; i < n; i++) {                                             \
+            errors += name##_contains(b, (uint64_t)i);                            \
+        }                                                                         \
+                                                                                  \
+        name##_free(&b);                                                          \
+        return errors;                                                            \
+    }
+
+COUNTING_SKETCH_SPECIALIZATIONS(DEFINE_COUNTING_SKETCH_TEST)
+BLOOM_FILTER_SPECIALIZATIONS(DEFINE_BLOOM_FILTER_TEST)
+
+DEFINE_TINYLFU(tinylfu_w4_k4_fmix, bf_k4_fmix_fastrange, cs_w4_k4_fmix_fastrange)
+
+#define RUN_COUNTING_SKETCH_TEST(name, ...) report_specialization(#name, test_##name(n), n);
+#define RUN_BLOOM_FILTER_TEST(name, ...)    report_specialization(#name, test_##name(n), n);
+
+static void report_specialization(const char *name, int errors, int n) {
+    if (errors > 0) {
+        printf("FAIL: %-25s %d / %d errors\n", name, errors, n);
+    } else {
+        printf("PASS: %s\n", name);
+    }
+}
+
+void test_sketch_templates(int n) {
+    printf("Testing sketch template specializations with %d elements...\n", n);
+
+    COUNTING_SKETCH_SPECIALIZATIONS(RUN_COUNTING_SKETCH_TEST)
+    BLOOM_FILTER_SPECIALIZATIONS(RUN_BLOOM_FILTER_TEST)
+
+    struct tinylfu_w4_k4_fmix *tfu = tinylfu_w4_k4_fmix_init(n * 10, n * 10);
+    if (!tfu) {
+        printf("Failed to init TinyLFU template\n");
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j <= i % 10; j++) {
+            tinylfu_w4_k4_fmix_access(tfu, (uint64_t)i);
+        }
+    }
+    if (tinylfu_w4_k4_fmix_admit(tfu, 9, 0) && !tinylfu_w4_k4_fmix_admit(tfu, 0, 9)) {
+        printf("PASS: TinyLFU template admits 9 (freq 10) over 0 (freq 1)\n");
+    } else {
+        printf("FAIL: TinyLFU template does not prefer 9 (freq 10) over 0 (freq 1)\n");
+    }
+    tinylfu_w4_k4_fmix_free(&tfu);
+
+    printf("Sketch template test complete.\n\n");
+}
+
+void test_tinylfu_sizing(void) {
+    printf("Testing TinyLFU sizing from expected entries...\n");
+
+    struct tinylfu_config config = {
+        .doorkeeper_type  = DOORKEEPER_BLOOM,
+        .expected_entries = 100000,
+        .fp_rate          = 0.01,
+    };
+    struct tinylfu *tfu = tinylfu_init(&config);
+    if (!tfu) {
+        printf("Failed to init TinyLFU\n");
+        return;
+    }
+
+    // -n ln(0.01) / ln(2)^2 = 9.59 bits per entry
+    size_t bits = tfu->doorkeeper->bloom->vector->size;
+    if (bits >= 958000 && bits <= 960000) {
+        printf("PASS: Doorkeeper has %zu bits for 100000 entries at 1%%\n", bits);
+    } else {
+        printf("FAIL: Doorkeeper has %zu bits for 100000 entries at 1%%\n", bits);
+    }
+
+    int false_positives = 0;
+    for (int i = 0; i < 100000; i++) {
+        tinylfu_access(tfu, (uint64_t)i);
+    }
+    for (int i = 100000; i < 200000; i++) {
+        false_positives += tinylfu_estimate(tfu, (uint64_t)i) > 0;
+    }
+    printf("Estimate false positive rate: %.2f%%\n", false_positives / 1000.0);
+
+    tinylfu_free(&tfu);
+    printf("TinyLFU sizing test complete.\n\n");
+}
+
+/*
+ * Checks that every queue is consistent with its size and the index.
+ */
+static bool wtinylfu_consistent(struct wtinylfu *c) {
+    struct wtinylfu_list *lists[] = {&c->window, &c->probation, &c->protected};
+    uint8_t queues[] = {WTINYLFU_WINDOW, WTINYLFU_PROBATION, WTINYLFU_PROTECTED};
+
+    if (wtinylfu_size(c) > c->capacity || c->window.size > c->window_max
+        || c->protected.size > c->protected_max) {
+        return false;
+    }
+
+    for (size_t q = 0; q < 3; q++) {
+        size_t n = 0;
+        for (uint32_t e = lists[q]->head; e != WTINYLFU_NIL; e = c->entries[e].next) {
+            if (c->entries[e].queue != queues[q] || !wtinylfu_contains(c, c->entries[e].key)) {
+                return false;
+            }
+            n++;
+        }
+        if (n != lists[q]->size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void test_wtinylfu(int capacity) {
+    printf("Testing W-TinyLFU cache with capacity %d...\n", capacity);
+
+    struct wtinylfu *c = wtinylfu_init(capacity, NULL);
+    if (!c) {
+        printf("Failed to init W-TinyLFU\n");
+        return;
+    }
+
+    // A working set that fits is fully cached after one pass
+    int misses = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < capacity; i++) {
+            misses += !wtinylfu_access(c, (uint64_t)i);
+        }
+    }
+    if (misses != capacity) {
+        printf("FAIL: %d misses on two passes over %d keys\n", misses, capacity);
+    } else {
+        printf("PASS: Working set of the cache size only misses once.\n");
+    }
+
+    // Queues stay consistent under a skewed workload
+    struct zipf z;
+    uint64_t rng = 42;
+    zipf_init(&z, 100 * capacity, 0.9);
+    bool consistent = true;
+    for (int i = 0; i < 1000 * capacity && consistent; i++) {
+        wtinylfu_access(c, zipf_next(&z, &rng));
+        consistent = wtinylfu_consistent(c);
+    }
+    if (!consistent) {
+        printf("FAIL: W-TinyLFU queues inconsistent with the index\n");
+    } else {
+        printf("PASS: W-TinyLFU queues consistent (window %zu, protected %zu / %zu)\n",
+               c->window.size, c->protected.size, c->protected_max);
+    }
+    wtinylfu_free(&c);
+
+    // Frequent keys survive a scan of one-hit wonders lasting two samples
+    c = wtinylfu_init(capacity, NULL);
+    if (!c) {
+        printf("Failed to init W-TinyLFU\n");
+        return;
+    }
+    int hot = capacity / 2;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < hot; i++) {
+            wtinylfu_access(c, (uint64_t)i);
+        }
+    }
+    for (int i = 0; i < 20 * capacity; i++) {
+        wtinylfu_access(c, (1ULL << 32) + i);
+    }
+    int cached = 0;
+    for (int i = 0; i < hot; i++) {
+        cached += wtinylfu_contains(c, (uint64_t)i);
+    }
+    if (cached < hot * 9 / 10) {
+        printf("FAIL: Only %d / %d hot keys survived a scan\n", cached, hot);
+    } else {
+        printf("PASS: %d / %d hot keys survived a scan\n", cached, hot);
+    }
+
+    wtinylfu_free(&c);
+    printf("W-TinyLFU test complete.\n\n");
+}
+
+/*
+ * Replays refs through a new cache and checks that the statistics add up and
+ * that the cache never exceeds its capacity.
+ */
+static bool sim_replay(const struct sim_policy_ops *ops, bool tinylfu, size_t capacity,
+                       size_t batch, const struct sim_ref *refs, size_t n,
+                       struct sim_stats *stats) {
+    struct sim_cache *c = sim_cache_init(ops, capacity, batch, tinylfu);
+    if (!c) return false;
+
+    bool ok = true;
+    for (size_t i = 0; i < n && ok; i++) {
+        sim_cache_access(c, &refs[i]);
+        ok = c->nr_folios <= c->capacity;
+    }
+    ok = ok && c->stats.accesses == n && c->stats.hits + c->stats.misses == n;
+
+    *stats = c->stats;
+    sim_cache_free(&c);
+    return ok;
+}
+
+void test_sim(int capacity) {
+    printf("Testing cache_ext simulator with capacity %d...\n", capacity);
+
+    const char *policies[] = {
+        "fifo", "mru", "s3fifo", "mglru", "lhd", "sampling", "get_scan",
+        "tinylfu", "tinylfu_s3fifo", "tinylfu_lhd",
+    };
+    size_t n = 50 * capacity;
+    struct sim_ref *refs = (struct sim_ref*) calloc(n, sizeof(struct sim_ref));
+    if (!refs) {
+        printf("Failed to allocate trace\n");
+        return;
+    }
+
+    // Skewed references over two files, with every eighth block a scan
+    struct zipf z;
+    uint64_t rng = 42;
+    zipf_init(&z, 10 * capacity, 0.9);
+    for (size_t i = 0; i < n; i++) {
+        refs[i].ino   = 1 + (i & 1);
+        refs[i].index = zipf_next(&z, &rng);
+        refs[i].flags = (i / 1000) % 8 == 7 ? SIM_REF_SCAN : 0;
+    }
+
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        bool tinylfu;
+        const struct sim_policy_ops *ops = sim_policy_find(policies[p], &tinylfu);
+        struct sim_stats stats;
+
+        if (!ops || !sim_replay(ops, tinylfu, capacity, SIM_EVICT_BATCH, refs, n, &stats)) {
+            printf("FAIL: %s statistics or capacity inconsistent\n", policies[p]);
+        } else {
+            printf("PASS: %s hit ratio %.3f, %" PRIu64 " rejected, %" PRIu64
+                   " reclaimed in LRU order\n", policies[p],
+                   (double) stats.hits / stats.accesses, stats.rejections,
+                   stats.failed_evictions);
+        }
+    }
+
+    // A loop just over the cache size defeats FIFO but not MRU
+    for (size_t i = 0; i < n; i++) {
+        refs[i].ino   = 1;
+        refs[i].index = i % (capacity + 1);
+        refs[i].flags = 0;
+    }
+    struct sim_stats fifo, mru;
+    if (!sim_replay(&sim_fifo_ops, false, capacity, 1, refs, n, &fifo)
+        || !sim_replay(&sim_mru_ops, false, capacity, 1, refs, n, &mru)) {
+        printf("FAIL: Loop replay inconsistent\n");
+    } else if (fifo.hits != 0 || mru.hits < n / 2) {
+        printf("FAIL: Loop hits: FIFO %" PRIu64 ", MRU %" PRIu64 "\n", fifo.hits, mru.hits);
+    } else {
+        printf("PASS: Loop hits: FIFO %" PRIu64 ", MRU %" PRIu64 "\n", fifo.hits, mru.hits);
+    }
+    free(refs);
+
+    // Ghost entries are found once and dropped oldest first
+    struct sim_ghost *g = sim_ghost_init(capacity);
+    if (!g) {
+        printf("Failed to init ghost map\n");
+        return;
+    }
+    for (int i = 0; i < 2 * capacity; i++) {
+        sim_ghost_put(g, 1, i, (uint8_t) i);
+    }
+    int found = 0, wrong = 0;
+    for (int i = 0; i < 2 * capacity; i++) {
+        uint8_t value;
+        if (sim_ghost_take(g, 1, i, &value)) {
+            found++;
+            wrong += i < capacity || value != (uint8_t) i;
+        }
+        if (sim_ghost_take(g, 1, i, &value)) {
+            wrong++;
+        }
+    }
+    if (found != capacity || wrong) {
+        printf("FAIL: Ghost map found %d / %d entries, %d wrong\n", found, capacity, wrong);
+    } else {
+        printf("PASS: Ghost map keeps the %d most recent entries\n", capacity);
+    }
+    sim_ghost_free(&g);
+    printf("Simulator test complete.\n\n");
+}
+
+// Counts n accesses to a page in the admission sketch of t
+static void sim_tinylfu_heat(struct sim_tinylfu *t, uint64_t ino, uint64_t index, int n) {
+    struct sim_folio folio = { .ino = ino, .index = index };
+
+    for (int i = 0; i < n; i++) {
+        sim_tinylfu_accessed(t, &folio);
+    }
+}
+
+// Pages 0-3 and 8-11 of ino seen 8 times, 4-7 and 12-15 never
+static void sim_admit_range_pages(struct sim_tinylfu *t, uint64_t ino) {
+    for (uint64_t i = 0; i < 16; i++) {
+        if ((i / 4) % 2 == 0) {
+            sim_tinylfu_heat(t, ino, i, 8);
+        }
+    }
+}
+
+void test_sim_admit_range(int capacity) {
+    printf("Testing simulator range admission with capacity %d...\n", capacity);
+
+    struct sim_tinylfu *t = sim_tinylfu_init(capacity);
+    if (!t) {
+        printf("Failed to init TinyLFU\n");
+        return;
+    }
+
+    // A victim seen 4 times beats the cold pages but not the hot ones
+    sim_tinylfu_heat(t, 1, 1000, 4);
+    sim_admit_range_pages(t, 2);
+    sim_admit_range_pages(t, 3);
+
+    // A read of 16 pages, asked again after each run as the kernel does
+    struct sim_admission_ctx ctx = {
+        .ino = 2, .index = 0, .nr_pages = 16, .victim_ino = 1, .victim_index = 1000,
+    };
+    uint64_t bypass = sim_tinylfu_admit_range(t, &ctx);
+    uint32_t est[16];
+    for (int i = 0; i < 16; i++) {
+        est[i] = sim_tinylfu_estimate(t, 2, i);
+    }
+
+    const uint64_t expected[] = { 0xF0F0, 0xF0F, 0xF0, 0xF };
+    bool ok = bypass == expected[0];
+    for (int run = 1; run < 4; run++) {
+        ctx.index    = 4 * run;
+        ctx.nr_pages = 16 - ctx.index;
+        ok = ok && sim_tinylfu_admit_range(t, &ctx) == expected[run];
+    }
+    for (int i = 0; i < 16; i++) {
+        ok = ok && sim_tinylfu_estimate(t, 2, i) == est[i];
+    }
+    if (!ok) {
+        printf("FAIL: A read is not served its first bitmap, each page counted once\n");
+    } else {
+        printf("PASS: A read is served its first bitmap, each page counted once\n");
+    }
+
+    // Once the read is served, a new read of its tail is scored again
+    uint32_t before = sim_tinylfu_estimate(t, 2, 12);
+    sim_tinylfu_admit_range(t, &ctx);
+    if (sim_tinylfu_estimate(t, 2, 12) != before + 1) {
+        printf("FAIL: A served read is reused by the next one\n");
+    } else {
+        printf("PASS: A served read is not reused by the next one\n");
+    }
+
+    // A request off the run the kernel served, or from another read, is
+    // scored again: a page gone hot meanwhile is admitted
+    ctx.ino      = 3;
+    ctx.index    = 0;
+    ctx.nr_pages = 16;
+    sim_tinylfu_admit_range(t, &ctx);
+    sim_tinylfu_heat(t, 3, 6, 8);
+    ctx.index    = 6;
+    ctx.nr_pages = 10;
+    bypass = sim_tinylfu_admit_range(t, &ctx);
+    before = sim_tinylfu_estimate(t, 3, 7);
+    ctx.index    = 7;
+    ctx.nr_pages = 1;
+    sim_tinylfu_admit_range(t, &ctx);
+    if ((bypass & 3) != 2 || sim_tinylfu_estimate(t, 3, 7) != before + 1) {
+        printf("FAIL: Stale bitmap served off the run: %#" PRIx64 "\n", bypass);
+    } else {
+        printf("PASS: Pages off the run, or of another read, are scored again\n");
+    }
+    sim_tinylfu_free(&t);
+
+    // Reads of 1 to 32 pages from skewed offsets
+    struct sim_cache *c = sim_cache_init(&sim_fifo_ops, capacity, SIM_EVICT_BATCH, true);
+    if (!c) {
+        printf("Failed to init simulator\n");
+        return;
+    }
+    struct zipf z;
+    uint64_t rng = 42;
+    size_t pages = 0, hits = 0;
+    zipf_init(&z, 10 * capacity, 0.9);
+    ok = true;
+    for (int i = 0; i < 10 * capacity && ok; i++) {
+        struct sim_ref ref = { .ino = 1, .index = zipf_next(&z, &rng) };
+        size_t nr_pages = 1 + (i * 7) % 32;
+
+        hits  += sim_cache_read(c, &ref, nr_pages);
+        pages += nr_pages;
+        ok = c->nr_folios <= c->capacity;
+    }
+    ok = ok && c->stats.accesses == pages && c->stats.hits == hits
+         && c->stats.hits + c->stats.misses == pages && c->stats.rejections <= c->stats.misses;
+    if (!ok || c->stats.rejections == 0) {
+        printf("FAIL: Range reads inconsistent, or none rejected\n");
+    } else {
+        printf("PASS: Range reads hit ratio %.3f, %" PRIu64 " of %" PRIu64 " misses rejected\n",
+               (double) c->stats.hits / c->stats.accesses, c->stats.rejections,
+               c->stats.misses);
+    }
+    sim_cache_free(&c);
+    printf("Simulator range admission test complete.\n\n");
+}
+
+void test_trace(int n) {
+    printf("Testing binary traces with %d records...\n", n);
+
+    char path[] = "/tmp/test_trace.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Failed to create trace file\n");
+        return;
+    }
+    close(fd);
+
+    struct trace_record *records = (struct trace_record*) malloc(n * sizeof(struct trace_record));
+    struct trace_record *decoded = (struct trace_record*) malloc(n * sizeof(struct trace_record));
+    uint8_t *chunk = (uint8_t*) malloc(trace_chunk_max_bytes(n));
+    if (!records || !decoded || !chunk) {
+        printf("Failed to allocate records\n");
+        goto out;
+    }
+
+    // Small chunks, so that both halves end with a partial chunk
+    uint32_t chunk_records = 1000;
+    struct zipf z;
+    uint64_t rng = 42;
+    zipf_init(&z, 100000, 0.9);
+    for (int i = 0; i < n; i++) {
+        records[i].timestamp = 1000000 + i / 7;
+        records[i].key       = i % 3 ? zipf_next(&z, &rng) : UINT64_MAX - i;
+        records[i].size      = (uint32_t) (splitmix64(&rng) >> 40);
+        records[i].op        = (uint8_t) (i % TRACE_NUM_OPS);
+    }
+
+    // First half appended record by record, second half as encoded chunks
+    struct trace_writer *w = trace_writer_open(path, chunk_records);
+    int half = n / 2;
+    int err = !w;
+    for (int i = 0; i < half && !err; i++) {
+        err = trace_writer_append(w, &records[i]);
+    }
+    for (int i = half; i < n && !err; i += chunk_records) {
+        int count = n - i < (int) chunk_records ? n - i : (int) chunk_records;
+        size_t bytes = trace_encode_chunk(&records[i], count, chunk);
+        err = trace_writer_append_chunk(w, chunk, bytes, count);
+    }
+    if (w) {
+        w->num_keys = 100000;
+        err |= trace_writer_close(&w);
+    }
+
+    struct trace_reader *r = err ? NULL : trace_reader_open(path);
+    if (!r || trace_num_records(r) != (uint64_t) n || r->footer->num_keys != 100000) {
+        printf("FAIL: Trace not written or not readable\n");
+        trace_reader_free(&r);
+        goto out;
+    }
+
+    struct trace_cursor cur;
+    int count = 0;
+    int mismatches = 0;
+    if (trace_cursor_init(&cur, r, 0, trace_num_chunks(r)) == 0) {
+        const struct trace_record *record;
+        while ((record = trace_cursor_next(&cur)) && count < n) {
+            mismatches += record->timestamp != records[count].timestamp
+                || record->key != records[count].key || record->size != records[count].size
+                || record->op != records[count].op;
+            count++;
+        }
+        trace_cursor_free(&cur);
+    }
+    if (count != n || mismatches) {
+        printf("FAIL: Decoded %d / %d records, %d mismatches\n", count, n, mismatches);
+    } else {
+        printf("PASS: %d records in %zu chunks decode unchanged (%.2f bytes per record)\n",
+               n, trace_num_chunks(r), (double) r->size / n);
+    }
+
+    // A chunk decoded on its own starts at its index entry
+    size_t last = trace_num_chunks(r) - 1;
+    size_t decoded_n = trace_decode_chunk(r, last, decoded);
+    if (decoded_n == 0
+        || memcmp(&decoded[0], &records[r->index[last].first_record], sizeof(decoded[0])) != 0) {
+        printf("FAIL: Chunk %zu decoded out of place\n", last);
+    } else {
+        printf("PASS: Chunks decode independently\n");
+    }
+    trace_reader_free(&r);
+
+    // Simulator replay: every cursor streams the same references
+    struct sim_trace_stream stream;
+    struct sim_trace_cursor cursors[2];
+    uint64_t last_key = 0;
+    for (int i = 0; i < n; i++) {
+        if (records[i].key > last_key) last_key = records[i].key;
+    }
+    count = 0;
+    mismatches = 0;
+    if (sim_trace_stream_open(path, &stream) == 0) {
+        if (sim_trace_cursor_init(&cursors[0], &stream) == 0
+            && sim_trace_cursor_init(&cursors[1], &stream) == 0) {
+            const struct sim_ref *a, *b;
+            while ((a = sim_trace_cursor_next(&cursors[0])) && count < n) {
+                uint8_t flags = (records[count].op == TRACE_OP_SCAN ? SIM_REF_SCAN : 0)
+                              | (records[count].key == last_key ? SIM_REF_LAST_PAGE : 0);
+                mismatches += a->ino != 1 || a->index != records[count].key || a->flags != flags;
+                b = sim_trace_cursor_next(&cursors[1]);
+                mismatches += !b || b->index != a->index || b->flags != a->flags;
+                count++;
+            }
+        }
+        sim_trace_cursor_free(&cursors[0]);
+        sim_trace_cursor_free(&cursors[1]);
+        sim_trace_stream_close(&stream);
+    }
+    if (count != n || mismatches) {
+        printf("FAIL: Streamed %d / %d references, %d mismatches\n", count, n, mismatches);
+    } else {
+        printf("PASS: References stream with their scan and last page flags\n");
+    }
+
+    // Truncation loses the footer
+    if (truncate(path, 100) != 0 || (r = trace_reader_open(path)) != NULL) {
+        printf("FAIL: Truncated trace accepted\n");
+        trace_reader_free(&r);
+    } else {
+        printf("PASS: Truncated trace rejected\n");
+    }
+
+    // Twitter trace lines
+    const char *lines[] = {
+        "1,key-a,10,100,7,get,0\n",
+        "2,key-b,5,20,7,set,3600\r\n",
+        "3,key-a,10,100,8,delete,0",
+        "4,,1,1,1,get,0",
+        "oops",
+    };
+    bool parsed[5];
+    uint64_t hashes[5];
+    struct trace_record rec[5];
+    for (int i = 0; i < 5; i++) {
+        parsed[i] = trace_parse_twitter(lines[i], lines[i] + strlen(lines[i]), &rec[i], &hashes[i]);
+    }
+    if (!parsed[0] || !parsed[1] || !parsed[2] || parsed[3] || parsed[4]
+        || hashes[0] != hashes[2] || hashes[0] == hashes[1]
+        || rec[0].op != TRACE_OP_GET || rec[1].op != TRACE_OP_SET || rec[2].op != TRACE_OP_DELETE
+        || rec[0].size != 110 || rec[1].timestamp != 2) {
+        printf("FAIL: Twitter trace lines parsed incorrectly\n");
+    } else {
+        printf("PASS: Twitter trace lines parsed\n");
+    }
+
+out:
+    unlink(path);
+    free(records);
+    free(decoded);
+    free(chunk);
+    printf("Binary trace test complete.\n\n");
+}
+
+struct ref_list {
+    struct workload_ref *refs;
+    size_t n;
+    size_t capacity;
+};
+
+static int collect_refs(void *ctx, const struct workload_ref *refs, size_t n) {
+    struct ref_list *list = (struct ref_list*) ctx;
+
+    if (list->n + n > list->capacity) {
+        size_t capacity = 2 * (list->n + n);
+        struct workload_ref *grown = (struct workload_ref*) realloc(
+            list->refs, capacity * sizeof(struct workload_ref)
+        );
+        if (!grown) return -1;
+        list->refs     = grown;
+        list->capacity = capacity;
+    }
+    memcpy(list->refs + list->n, refs, n * sizeof(struct workload_ref));
+    list->n += n;
+    return 0;
+}
+
+static bool same_refs(const struct workload_ref *a, const struct workload_ref *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i].page != b[i].page || a[i].ino != b[i].ino || a[i].index != b[i].index
+            || a[i].op_number != b[i].op_number || a[i].op != b[i].op
+            || a[i].flags != b[i].flags) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_workload(int n) {
+    printf("Testing workload generator with %d operations...\n", n);
+
+    int failures = 0;
+    for (int k = 0; k < WORKLOAD_NUM_KINDS; k++) {
+        struct workload_config config = {
+            .kind      = (enum workload_kind) k,
+            .seed      = 7,
+            .num_pages = 1 << 16,
+            .phase_ops = n / 4,
+        };
+        struct workload *w = workload_init(&config);
+        struct ref_list whole = {0}, split = {0}, again = {0};
+        const char *name = workload_kind_name(config.kind);
+
+        // The same seed gives the same stream, however it is split
+        if (!w || workload_generate(w, 0, n, collect_refs, &whole) != 0
+            || workload_generate(w, 0, n / 3, collect_refs, &split) != 0
+            || workload_generate(w, n / 3, n, collect_refs, &split) != 0
+            || workload_generate(w, 0, n, collect_refs, &again) != 0) {
+            printf("FAIL: %s: failed to generate\n", name);
+            failures++;
+        } else if (whole.n != split.n || !same_refs(whole.refs, split.refs, whole.n)
+                   || whole.n != again.n || !same_refs(whole.refs, again.refs, whole.n)) {
+            printf("FAIL: %s: stream differs when split or regenerated\n", name);
+            failures++;
+        } else {
+            uint64_t ops[TRACE_NUM_OPS] = {0};
+            uint64_t pages = workload_num_pages(w, n);
+            bool in_range = true;
+
+            for (size_t i = 0; i < whole.n; i++) {
+                ops[whole.refs[i].op]++;
+                in_range &= whole.refs[i].page < pages && whole.refs[i].op_number < (uint64_t) n;
+            }
+
+            double writes = (double) (ops[TRACE_OP_SET] + ops[TRACE_OP_ADD]) / n;
+            bool mix = true;
+            switch (config.kind) {
+            case WORKLOAD_YCSB_A:
+            case WORKLOAD_YCSB_F:
+                mix = writes > 0.45 && writes < 0.55;
+                break;
+            case WORKLOAD_YCSB_C:
+                mix = ops[TRACE_OP_GET] == (uint64_t) n;
+                break;
+            case WORKLOAD_YCSB_D:
+            case WORKLOAD_YCSB_E:
+                mix = ops[TRACE_OP_ADD] == (uint64_t) n / 20;
+                break;
+            case WORKLOAD_SWEEP:
+                // Files are read whole, page after page
+                for (size_t i = 0; i + 1 < whole.n; i++) {
+                    const struct workload_ref *a = &whole.refs[i], *b = &whole.refs[i + 1];
+                    if (a->op_number == b->op_number) {
+                        mix &= b->page == a->page + 1 && b->ino == a->ino
+                               && b->index == a->index + 1;
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+
+            if (!in_range || !mix) {
+                printf("FAIL: %s: pages in range %d, operation mix as expected %d\n",
+                       name, in_range, mix);
+                failures++;
+            } else {
+                printf("  %-8s %zu references, %.1f%% writes, %.1f%% scans\n", name, whole.n,
+                       100 * writes, 100.0 * ops[TRACE_OP_SCAN] / whole.n);
+            }
+        }
+
+        free(whole.refs);
+        free(split.refs);
+        free(again.refs);
+        workload_free(&w);
+    }
+
+    if (failures == 0) {
+        printf("PASS: Workload streams are deterministic, splittable and mixed as configured.\n");
+    }
+    printf("Workload generator test complete.\n\n");
+}
+
+void test_mrc(int n) {
+    printf("Testing LRU miss-ratio curves with %d references...\n", n);
+
+    const uint64_t num_pages = 1000;
+    struct sim_trace trace = {
+        .refs     = (struct sim_ref*) calloc(n, sizeof(struct sim_ref)),
+        .num_refs = (size_t) n,
+    };
+    uint64_t *stack = (uint64_t*) malloc(num_pages * sizeof(uint64_t));
+    uint64_t *expected = (uint64_t*) calloc(num_pages + 1, sizeof(uint64_t));
+    struct zipf zipf;
+    uint64_t seed = 42;
+    zipf_init(&zipf, num_pages, 0.9);
+
+    // Stack distances of an explicit LRU stack, most recent first
+    size_t depth = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t page = zipf_next(&zipf, &seed);
+        trace.refs[i].ino   = page % 7 + 1;
+        trace.refs[i].index = page / 7;
+
+        size_t d = 0;
+        while (d < depth && stack[d] != page) d++;
+        if (d < depth) {
+            expected[d]++;
+        } else {
+            depth++;
+        }
+        memmove(stack + 1, stack, d * sizeof(uint64_t));
+        stack[0] = page;
+    }
+
+    int failures = 0;
+    const int threads[] = {1, 2, 3, 8, 64};
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        struct mrc mrc;
+        if (mrc_build(&trace, threads[t], &mrc) != 0) {
+            printf("FAIL: Could not build the curve on %d threads\n", threads[t]);
+            failures++;
+            continue;
+        }
+
+        bool same = mrc.num_pages == depth && mrc.accesses == (uint64_t) n;
+        for (size_t d = 0; same && d < depth; d++) {
+            same = mrc.hist[d] == expected[d];
+        }
+        if (!same || mrc_misses(&mrc, 0) != (uint64_t) n || mrc_misses(&mrc, num_pages) != depth) {
+            printf("FAIL: Stack distances on %d threads differ from an LRU stack\n", threads[t]);
+            failures++;
+        }
+        mrc_free(&mrc);
+    }
+
+    if (failures == 0) {
+        printf("PASS: Stack distances of %zu pages match an LRU stack on 1 to 64 threads.\n",
+               depth);
+    }
+
+    // The same pages as keys of a binary trace, streamed
+    char path[] = "/tmp/test_mrc.XXXXXX";
+    int fd = mkstemp(path);
+    struct trace_writer *w = NULL;
+    if (fd >= 0) {
+        close(fd);
+        w = trace_writer_open(path, 1000);
+    }
+    int err = !w;
+    for (int i = 0; i < n && !err; i++) {
+        struct trace_record record = {
+            .key = trace.refs[i].index * 7 + trace.refs[i].ino - 1,
+        };
+        err = trace_writer_append(w, &record);
+    }
+    if (w) {
+        w->num_keys = num_pages + 1;
+        err |= trace_writer_close(&w);
+    }
+
+    struct sim_trace_stream stream;
+    struct mrc mrc;
+    if (err || sim_trace_stream_open(path, &stream) != 0) {
+        printf("FAIL: Could not write the binary trace\n");
+    } else {
+        bool same = mrc_build_stream(&stream, 4, &mrc) == 0 && mrc.num_pages == depth
+                    && mrc.accesses == (uint64_t) n;
+        for (size_t d = 0; same && d < depth; d++) {
+            same = mrc.hist[d] == expected[d];
+        }
+        if (!same) {
+            printf("FAIL: Stack distances of the streamed trace differ from an LRU stack\n");
+        } else {
+            printf("PASS: Stack distances of the streamed trace match.\n");
+        }
+        mrc_free(&mrc);
+        sim_trace_stream_close(&stream);
+    }
+    if (fd >= 0) unlink(path);
+
+    free(expected);
+    free(stack);
+    free(trace.refs);
+    printf("LRU miss-ratio curve test complete.\n\n");
+}
+
+void test_opt(int n) {
+    printf("Testing Belady's MIN with %d references...\n", n);
+
+    const uint64_t num_pages = 2000;
+    struct sim_trace trace = {
+        .refs     = (struct sim_ref*) calloc(n, sizeof(struct sim_ref)),
+        .num_refs = (size_t) n,
+    };
+    uint64_t *next = (uint64_t*) malloc(n * sizeof(uint64_t));
+    uint64_t *seen = (uint64_t*) malloc((num_pages + 1) * sizeof(uint64_t));
+    struct zipf zipf;
+    uint64_t seed = 7;
+    zipf_init(&zipf, num_pages, 0.8);
+
+    for (int i = 0; i < n; i++) {
+        uint64_t page = zipf_next(&zipf, &seed);
+        trace.refs[i].ino   = page % 5 + 1;
+        trace.refs[i].index = page / 5;
+    }
+    // Next references of a plain reverse scan
+    for (uint64_t p = 0; p <= num_pages; p++) seen[p] = OPT_NEVER;
+    for (int i = n - 1; i >= 0; i--) {
+        uint64_t page = (trace.refs[i].index * 5) + trace.refs[i].ino - 1;
+        next[i] = seen[page];
+        seen[page] = i;
+    }
+
+    int failures = 0;
+    const int threads[] = {1, 3, 16};
+    for (size_t k = 0; k < sizeof(threads) / sizeof(threads[0]); k++) {
+        struct opt_trace *t = opt_trace_init(&trace, threads[k]);
+        if (!t || memcmp(t->next, next, n * sizeof(uint64_t)) != 0) {
+            printf("FAIL: Next references on %d threads differ from a reverse scan\n",
+                   threads[k]);
+            failures++;
+        }
+        opt_trace_free(&t);
+    }
+
+    struct opt_trace *t = opt_trace_init(&trace, 4);
+    struct mrc mrc;
+    if (!t || mrc_build(&trace, 1, &mrc) != 0) {
+        printf("FAIL: Could not annotate the trace\n");
+        failures++;
+    } else {
+        const size_t sizes[] = {1, 10, 100, 1000, 4000};
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            struct opt_stats min, lru, s3fifo;
+            opt_replay(t, OPT_MODEL_MIN, sizes[i], &min);
+            opt_replay(t, OPT_MODEL_LRU, sizes[i], &lru);
+            opt_replay(t, OPT_MODEL_S3FIFO, sizes[i], &s3fifo);
+
+            // MIN bounds every policy; the LRU model matches the stack
+            // distances, and disagrees with MIN unless it holds one page or
+            // everything fits
+            if (min.hits < lru.hits || min.hits < s3fifo.hits
+                || lru.misses != mrc_misses(&mrc, sizes[i])
+                || min.victim_disagreements != 0
+                || (sizes[i] > 1 && lru.evictions > 0 && lru.victim_disagreements == 0)) {
+                printf("FAIL: %zu pages: MIN %" PRIu64 ", LRU %" PRIu64 " (%" PRIu64
+                       " by stack distance), S3-FIFO %" PRIu64 " hits\n",
+                       sizes[i], min.hits, lru.hits, mrc.accesses - mrc_misses(&mrc, sizes[i]),
+                       s3fifo.hits);
+                failures++;
+            } else {
+                printf("  %4zu pages: MIN %.3f, LRU %.3f, S3-FIFO %.3f hit ratio, "
+                       "S3-FIFO victims %.1f%% off MIN\n",
+                       sizes[i], (double) min.hits / n, (double) lru.hits / n,
+                       (double) s3fifo.hits / n,
+                       s3fifo.evictions ? 100.0 * s3fifo.victim_disagreements / s3fifo.evictions
+                                        : 0);
+            }
+        }
+        mrc_free(&mrc);
+    }
+    opt_trace_free(&t);
+
+    if (failures == 0) {
+        printf("PASS: Next references match on 1 to 16 threads, and MIN bounds LRU and S3-FIFO.\n");
+    }
+
+    free(seen);
+    free(next);
+    free(trace.refs);
+    printf("Belady's MIN test complete.\n\n");
+}
+
+void test_arena(void) {
+    printf("Testing arena allocator...\n");
+
+    struct arena_options saved;
+    arena_get_options(&saved);
+
+    struct arena_stats before;
+    arena_get_stats(&before);
+
+    // Sizes below and above a 2M page, with and without huge pages
+    size_t sizes[] = {100, 3 << 20};
+    bool huge_modes[] = {false, true};
+    int failures = 0;
+
+    for (size_t m = 0; m < 2; m++) {
+        struct arena_options opts = {.huge_pages = huge_modes[m], .numa_node = -1};
+        arena_set_options(&opts);
+
+        for (size_t i = 0; i < 2; i++) {
+            uint8_t *p = arena_alloc(sizes[i]);
+            if (!p) {
+                printf("FAIL: arena_alloc(%zu) returned NULL\n", sizes[i]);
+                failures++;
+                continue;
+            }
+
+            bool zeroed = true;
+            for (size_t j = 0; j < sizes[i]; j++) {
+                zeroed &= p[j] == 0;
+            }
+            memset(p, 0xff, sizes[i]);
+
+            enum arena_backing backing = arena_backing_of(p);
+            bool huge = backing != ARENA_SMALL_PAGES;
+            bool expected_huge = huge_modes[m] && sizes[i] >= (2 << 20);
+
+            if (!zeroed || (uintptr_t) p % 64 != 0 || huge != expected_huge) {
+                printf("FAIL: arena_alloc(%zu) %s: zeroed %d, address %p, backing %s\n",
+                       sizes[i], huge_modes[m] ? "huge" : "small", zeroed, (void*) p,
+                       arena_backing_name(backing));
+                failures++;
+            } else {
+                printf("  %zu bytes, huge pages %s: %s\n", sizes[i],
+                       huge_modes[m] ? "on" : "off", arena_backing_name(backing));
+            }
+            arena_free(p);
+        }
+    }
+
+    // Sketch tables come from the arena
+    arena_set_options(&saved);
+    struct bloom *b = bloom_init(1 << 25);
+    if (!b || arena_backing_of(b->vector->start) == ARENA_NUM_BACKINGS) {
+        printf("FAIL: bloom table not allocated from the arena\n");
+        failures++;
+    }
+    bloom_free(&b);
+
+    struct arena_stats after;
+    arena_get_stats(&after);
+    for (int i = 0; i < ARENA_NUM_BACKINGS; i++) {
+        if (after.bytes[i] != before.bytes[i]) {
+            printf("FAIL: %zu bytes of %s leaked\n", after.bytes[i] - before.bytes[i],
+                   arena_backing_name(i));
+            failures++;
+        }
+    }
+
+    if (failures == 0) {
+        printf("PASS: Arena allocations are zeroed, aligned and backed as expected.\n");
+    }
+
+    struct arena_options bound = {.huge_pages = true, .numa_node = 0};
+    arena_set_options(&bound);
+    void *p = arena_alloc(3 << 20);
+    if (!p) {
+        printf("Binding to NUMA node 0 not supported, skipping\n");
+    } else {
+        memset(p, 1, 3 << 20);
+        printf("PASS: Allocation bound to NUMA node 0.\n");
+        arena_free(p);
+    }
+    arena_set_options(&saved);
+
+    printf("Arena allocator test complete.\n\n");
+}
+
 int main(void) {
     test_bloom(1000);
+    test_blocked_bloom(1000);
+    test_cuckoo_filter(1000);
     test_counting_bloom(100);
+    test_frequency_sketch(100);
+    test_sketch_reset(1000);
     test_tinylfu(100);
+    test_tinylfu_file(100000);
+    test_topk(1000000);
+    test_sketch_templates(1000);
+    test_tinylfu_sizing();
+    test_wtinylfu(1000);
+    test_sim(1000);
+    test_sim_admit_range(1000);
+    test_trace(100001);
+    test_arena();
+    test_workload(100000);
+    test_mrc(100000);
+    test_opt(100000);
+    test_hashes_batch(1001);
+    test_batch(1000);
+    test_incremental_aging(100000);
+    test_incremental_aging_cuckoo(1 << 14);
+    test_concurrent_tinylfu_single(1000);
+    test_concurrent_tinylfu(8, 100000);
     return 0;
 }
@@ -0,0 +1,254 @@
+#include "mrc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define NO_DISTANCE UINT64_MAX
+
+// Local times, page ids and Fenwick counts are 32-bit
+#define MAX_REFS (UINT32_MAX / 2)
+
+/*
+ * One time segment of the trace, with the LRU stack of its references and of
+ * the references replayed after it.
+ */
+struct segment {
+    const uint32_t *ids;
+    size_t len;
+    // Local time (from 1) of the last reference to every page, 0 if none
+    uint32_t *last;
+    // Fenwick tree over local times, with a mark at every last reference
+    int32_t *tree;
+    uint32_t capacity;
+    uint32_t now;
+    uint32_t marks;
+    // Distinct pages of the segment, in order of first reference
+    uint32_t *firsts;
+    size_t num_firsts;
+    // Distances resolved within the segment, below its distinct pages
+    uint64_t *hist;
+};
+
+static inline void fenwick_add(int32_t *tree, uint32_t capacity, uint32_t i, int32_t delta)
+{
+    for (; i <= capacity; i += i & -i) {
+        tree[i] += delta;
+    }
+}
+
+static inline uint32_t fenwick_prefix(const int32_t *tree, uint32_t i)
+{
+    int32_t sum = 0;
+    for (; i > 0; i -= i & -i) {
+        sum += tree[i];
+    }
+    return (uint32_t) sum;
+}
+
+/*
+ * References page id after everything referenced so far. Returns its stack
+ * distance, or NO_DISTANCE if the segment has not referenced it yet.
+ */
+static inline uint64_t segment_access(struct segment *s, uint32_t id)
+{
+    uint32_t now = ++s->now;
+    uint32_t prev = s->last[id];
+    uint64_t distance = NO_DISTANCE;
+
+    if (prev) {
+        distance = s->marks - fenwick_prefix(s->tree, prev);
+        fenwick_add(s->tree, s->capacity, prev, -1);
+    } else {
+        s->marks++;
+    }
+    fenwick_add(s->tree, s->capacity, now, 1);
+    s->last[id] = now;
+    return distance;
+}
+
+static void *segment_worker(void *arg)
+{
+    struct segment *s = (struct segment*) arg;
+
+    for (size_t i = 0; i < s->len; i++) {
+        uint64_t distance = segment_access(s, s->ids[i]);
+
+        if (distance == NO_DISTANCE) {
+            s->firsts[s->num_firsts++] = s->ids[i];
+        } else {
+            s->hist[distance]++;
+        }
+    }
+    return NULL;
+}
+
+static void segment_free(struct segment *s)
+{
+    free(s->last);
+    free(s->tree);
+    free(s->firsts);
+    free(s->hist);
+}
+
+/*
+ * Replays carry, the distinct pages referenced after segment s up to some
+ * reference, at the end of s. Distances of pages s referenced go to hist; the
+ * others, still unresolved, are appended to the distinct pages of s in next.
+ * Returns the length of next.
+ */
+static size_t reconcile(struct segment *s, const uint32_t *carry, size_t num_carry,
+                        uint32_t *next, uint64_t *hist)
+{
+    size_t n = s->num_firsts;
+
+    memcpy(next, s->firsts, s->num_firsts * sizeof(uint32_t));
+    for (size_t i = 0; i < num_carry; i++) {
+        uint64_t distance = segment_access(s, carry[i]);
+
+        if (distance == NO_DISTANCE) {
+            next[n++] = carry[i];
+        } else {
+            hist[distance]++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Builds the curve of n references to the pages ids[i] < num_pages.
+ */
+static int build(const uint32_t *ids, size_t n, uint64_t num_pages, int num_threads,
+                 struct mrc *mrc)
+{
+    uint32_t *carry = NULL, *next = NULL;
+    struct segment *segs = NULL;
+    pthread_t *threads = NULL;
+    int ret = -1;
+
+    if (num_threads < 1) num_threads = 1;
+    if ((size_t) num_threads > n) num_threads = n ? n : 1;
+
+    mrc->accesses  = n;
+    mrc->num_pages = num_pages;
+    mrc->hist      = (uint64_t*) calloc(num_pages + 1, sizeof(uint64_t));
+    mrc->misses    = (uint64_t*) calloc(num_pages + 1, sizeof(uint64_t));
+    segs    = (struct segment*) calloc(num_threads, sizeof(struct segment));
+    threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    carry   = (uint32_t*) malloc((num_pages + 1) * sizeof(uint32_t));
+    next    = (uint32_t*) malloc((num_pages + 1) * sizeof(uint32_t));
+    if (!mrc->hist || !mrc->misses || !segs || !threads || !carry || !next) goto out;
+
+    for (int k = 0; k < num_threads; k++) {
+        struct segment *s = &segs[k];
+        size_t start = n * k / num_threads;
+        size_t end = n * (k + 1) / num_threads;
+        size_t distinct = end - start < num_pages ? end - start : num_pages;
+
+        s->ids      = ids + start;
+        s->len      = end - start;
+        // Room for the segment, then the distinct pages replayed after it
+        s->capacity = (uint32_t) (s->len + num_pages);
+        s->last     = (uint32_t*) calloc(num_pages + 1, sizeof(uint32_t));
+        s->tree     = (int32_t*) calloc((size_t) s->capacity + 1, sizeof(int32_t));
+        s->firsts   = (uint32_t*) malloc((distinct + 1) * sizeof(uint32_t));
+        s->hist     = (uint64_t*) calloc(distinct + 1, sizeof(uint64_t));
+        if (!s->last || !s->tree || !s->firsts || !s->hist) goto out;
+    }
+
+    for (int k = 0; k < num_threads; k++) {
+        if (pthread_create(&threads[k], NULL, segment_worker, &segs[k]) != 0) {
+            for (int j = 0; j < k; j++) {
+                pthread_join(threads[j], NULL);
+            }
+            goto out;
+        }
+    }
+    for (int k = 0; k < num_threads; k++) {
+        pthread_join(threads[k], NULL);
+    }
+
+    // The first references of each segment are resolved by the segments
+    // before it, from the last: what is unresolved in one segment carries
+    // over, after its own distinct pages, to the one before
+    size_t num_carry = segs[num_threads - 1].num_firsts;
+    memcpy(carry, segs[num_threads - 1].firsts, num_carry * sizeof(uint32_t));
+    for (int k = num_threads - 1; k > 0; k--) {
+        num_carry = reconcile(&segs[k - 1], carry, num_carry, next, mrc->hist);
+
+        uint32_t *tmp = carry;
+        carry = next;
+        next  = tmp;
+    }
+
+    for (int k = 0; k < num_threads; k++) {
+        struct segment *s = &segs[k];
+        for (size_t d = 0; d < s->num_firsts; d++) {
+            mrc->hist[d] += s->hist[d];
+        }
+    }
+
+    // Every page is left unresolved once, at its first reference
+    mrc->misses[num_pages] = num_carry;
+    for (uint64_t c = num_pages; c > 0; c--) {
+        mrc->misses[c - 1] = mrc->misses[c] + mrc->hist[c - 1];
+    }
+    ret = 0;
+
+out:
+    if (segs) {
+        for (int k = 0; k < num_threads; k++) {
+            segment_free(&segs[k]);
+        }
+    }
+    free(segs);
+    free(threads);
+    free(carry);
+    free(next);
+    return ret;
+}
+
+int mrc_build(const struct sim_trace *trace, int num_threads, struct mrc *mrc)
+{
+    size_t n = trace->num_refs;
+    uint64_t num_pages = 0;
+    int ret = -1;
+
+    memset(mrc, 0, sizeof(*mrc));
+    if (n >= MAX_REFS) return -1;
+
+    uint32_t *ids = (uint32_t*) malloc((n ? n : 1) * sizeof(uint32_t));
+    if (ids && sim_trace_page_ids(trace, ids, &num_pages) == 0) {
+        ret = build(ids, n, num_pages, num_threads, mrc);
+    }
+
+    free(ids);
+    if (ret != 0) mrc_free(mrc);
+    return ret;
+}
+
+int mrc_build_stream(const struct sim_trace_stream *s, int num_threads, struct mrc *mrc)
+{
+    size_t n = s->num_refs;
+    uint64_t num_pages = 0;
+    int ret = -1;
+
+    memset(mrc, 0, sizeof(*mrc));
+    if (n >= MAX_REFS) return -1;
+
+    uint32_t *ids = (uint32_t*) malloc((n ? n : 1) * sizeof(uint32_t));
+    if (ids && sim_trace_stream_page_ids(s, ids, &num_pages) == 0) {
+        ret = build(ids, n, num_pages, num_threads, mrc);
+    }
+
+    free(ids);
+    if (ret != 0) mrc_free(mrc);
+    return ret;
+}
+
+void mrc_free(struct mrc *mrc)
+{
+    free(mrc->hist);
+    free(mrc->misses);
+    mrc->hist   = NULL;
+    mrc->misses = NULL;
+}
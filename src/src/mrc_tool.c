@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "mrc.h"
+
+/*
+ * Exact LRU miss-ratio curve of a page reference trace, in one pass. Rows
+ * have the columns of the simulator's, with policy "lru", so that both plot
+ * together (bench_plot_lib.plot_miss_ratio_curves()).
+ */
+
+#define MAX_SIZES 256
+
+static const char *USAGE =
+    "Usage: %s -t <trace> [-s <pages>[,<pages>...] | -r <min>:<max>:<count>]\n"
+    "          [-j <threads>]\n"
+    "\n"
+    "-t        text or binary trace, as read by the simulator.\n"
+    "-s, -r    cache sizes, listed or <count> spaced geometrically in\n"
+    "          [min, max] (default: 256 sizes up to the distinct pages).\n"
+    "-j        threads, one time segment of the trace each (default: online\n"
+    "          CPUs).\n";
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t parse_sizes(char *list, size_t *sizes)
+{
+    size_t n = 0;
+
+    for (char *item = strtok(list, ","); item && n < MAX_SIZES; item = strtok(NULL, ",")) {
+        sizes[n++] = strtoull(item, NULL, 10);
+    }
+    return n;
+}
+
+static size_t range_sizes(size_t min, size_t max, size_t count, size_t *sizes)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        double t = count > 1 ? (double) i / (count - 1) : 0;
+        size_t size = (size_t) llround(min * pow((double) max / min, t));
+
+        // Small ranges round several steps to the same size
+        if (n == 0 || size != sizes[n - 1]) {
+            sizes[n++] = size;
+        }
+    }
+    return n;
+}
+
+static size_t parse_range(const char *range, size_t *sizes)
+{
+    unsigned long long min, max, count;
+    if (sscanf(range, "%llu:%llu:%llu", &min, &max, &count) != 3
+        || min == 0 || max < min || count == 0 || count > MAX_SIZES) {
+        return 0;
+    }
+    return range_sizes(min, max, count, sizes);
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = NULL;
+    size_t sizes[MAX_SIZES];
+    size_t num_sizes = 0;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:r:j:h")) != -1) {
+        switch (opt) {
+        case 't':
+            trace_path = optarg;
+            break;
+        case 's':
+            num_sizes = parse_sizes(optarg, sizes);
+            if (num_sizes == 0) num_sizes = SIZE_MAX;
+            break;
+        case 'r':
+            num_sizes = parse_range(optarg, sizes);
+            if (num_sizes == 0) num_sizes = SIZE_MAX;
+            break;
+        case 'j':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!trace_path || num_sizes == SIZE_MAX) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    struct sim_trace_stream trace;
+    if (sim_trace_stream_open(trace_path, &trace) != 0) {
+        fprintf(stderr, "Failed to open trace %s\n", trace_path);
+        return 1;
+    }
+    fprintf(stderr, "Opened %zu references from %s\n", trace.num_refs, trace_path);
+
+    struct mrc mrc;
+    double start = now_seconds();
+    if (mrc_build_stream(&trace, (int) num_threads, &mrc) != 0) {
+        fprintf(stderr, "Failed to profile %s\n", trace_path);
+        sim_trace_stream_close(&trace);
+        return 1;
+    }
+    double seconds = now_seconds() - start;
+    fprintf(stderr, "Profiled %" PRIu64 " distinct pages in %.3f s on %ld threads\n",
+            mrc.num_pages, seconds, num_threads);
+
+    if (num_sizes == 0 && mrc.num_pages > 0) {
+        num_sizes = range_sizes(1, mrc.num_pages, MAX_SIZES, sizes);
+    }
+
+    printf("policy,cache_pages,accesses,hits,misses,hit_ratio,evictions,"
+           "rejections,failed_evictions,seconds\n");
+    for (size_t i = 0; i < num_sizes; i++) {
+        uint64_t misses = mrc_misses(&mrc, sizes[i]);
+        uint64_t hits = mrc.accesses - misses;
+        // Every miss fills the cache, which evicts once full
+        uint64_t resident = sizes[i] < mrc.num_pages ? sizes[i] : mrc.num_pages;
+
+        printf("lru,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f,%" PRIu64 ",0,0,%.3f\n",
+               sizes[i], mrc.accesses, hits, misses,
+               mrc.accesses ? (double) hits / mrc.accesses : 0, misses - resident, seconds);
+    }
+
+    mrc_free(&mrc);
+    sim_trace_stream_close(&trace);
+    return 0;
+}
@@ -0,0 +1,504 @@
+#include "opt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define NO_PAGE UINT32_MAX
+
+// Page ids are 32-bit
+#define MAX_REFS UINT32_MAX
+
+static const char *MODEL_NAMES[OPT_NUM_MODELS] = { "min", "lru", "s3fifo" };
+
+const char* opt_model_name(enum opt_model model)
+{
+    return model < OPT_NUM_MODELS ? MODEL_NAMES[model] : "unknown";
+}
+
+int opt_model_parse(const char *name, enum opt_model *model)
+{
+    for (int m = 0; m < OPT_NUM_MODELS; m++) {
+        if (strcmp(name, MODEL_NAMES[m]) == 0) {
+            *model = (enum opt_model) m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Annotation. Each thread scans its segment backwards, linking references
+ * within it and leaving in seen the first reference of every page in the
+ * segment. seen then becomes, from the last segment to the first, the first
+ * reference at or after each segment, which the threads use to link the
+ * last reference of every page in their segment.
+ */
+
+struct segment {
+    struct opt_trace *t;
+    size_t start;
+    size_t end;
+    uint64_t *seen;
+    // seen of the next segment, or NULL for the last one
+    const uint64_t *after;
+};
+
+static void *scan_worker(void *arg)
+{
+    struct segment *s = (struct segment*) arg;
+    const uint32_t *ids = s->t->ids;
+    uint64_t *next = s->t->next;
+
+    for (size_t i = s->end; i-- > s->start;) {
+        next[i] = s->seen[ids[i]];
+        s->seen[ids[i]] = i;
+    }
+    return NULL;
+}
+
+static void *link_worker(void *arg)
+{
+    struct segment *s = (struct segment*) arg;
+    const uint32_t *ids = s->t->ids;
+    uint64_t *next = s->t->next;
+
+    for (size_t i = s->start; i < s->end; i++) {
+        if (next[i] == OPT_NEVER) {
+            next[i] = s->after[ids[i]];
+        }
+    }
+    return NULL;
+}
+
+static int run_workers(struct segment *segs, int num_threads, void *(*fn)(void *))
+{
+    pthread_t *threads = (pthread_t*) malloc((num_threads + 1) * sizeof(pthread_t));
+    int started = 0;
+
+    if (!threads) return -1;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, fn, &segs[started]) != 0) break;
+    }
+    for (int k = 0; k < started; k++) {
+        pthread_join(threads[k], NULL);
+    }
+    free(threads);
+    return started == num_threads ? 0 : -1;
+}
+
+static int annotate(struct opt_trace *t, int num_threads)
+{
+    size_t n = t->trace->num_refs;
+    struct segment *segs = (struct segment*) calloc(num_threads, sizeof(struct segment));
+    int ret = -1;
+
+    if (!segs) return -1;
+
+    for (int k = 0; k < num_threads; k++) {
+        segs[k].t     = t;
+        segs[k].start = n * k / num_threads;
+        segs[k].end   = n * (k + 1) / num_threads;
+        segs[k].seen  = (uint64_t*) malloc((t->num_pages + 1) * sizeof(uint64_t));
+        if (!segs[k].seen) goto out;
+        memset(segs[k].seen, 0xff, (t->num_pages + 1) * sizeof(uint64_t));
+    }
+
+    if (run_workers(segs, num_threads, scan_worker) != 0) goto out;
+
+    for (int k = num_threads - 2; k >= 0; k--) {
+        uint64_t *seen = segs[k].seen;
+        const uint64_t *after = segs[k + 1].seen;
+
+        segs[k].after = after;
+        for (uint64_t id = 0; id < t->num_pages; id++) {
+            if (seen[id] == OPT_NEVER) {
+                seen[id] = after[id];
+            }
+        }
+    }
+
+    // The last segment has nothing after it
+    ret = run_workers(segs, num_threads - 1, link_worker);
+
+out:
+    for (int k = 0; k < num_threads; k++) {
+        free(segs[k].seen);
+    }
+    free(segs);
+    return ret;
+}
+
+struct opt_trace* opt_trace_init(const struct sim_trace *trace, int num_threads)
+{
+    size_t n = trace->num_refs;
+    if (n >= MAX_REFS) return NULL;
+
+    struct opt_trace *t = (struct opt_trace*) calloc(1, sizeof(struct opt_trace));
+    if (!t) return NULL;
+
+    if (num_threads < 1) num_threads = 1;
+    if ((size_t) num_threads > n) num_threads = n ? n : 1;
+
+    t->trace = trace;
+    t->ids   = (uint32_t*) malloc((n ? n : 1) * sizeof(uint32_t));
+    t->next  = (uint64_t*) malloc((n ? n : 1) * sizeof(uint64_t));
+    if (!t->ids || !t->next
+        || sim_trace_page_ids(trace, t->ids, &t->num_pages) != 0
+        || annotate(t, num_threads) != 0) {
+        opt_trace_free(&t);
+        return NULL;
+    }
+    return t;
+}
+
+void opt_trace_free(struct opt_trace **t)
+{
+    if (t && *t) {
+        free((*t)->ids);
+        free((*t)->next);
+        free(*t);
+        *t = NULL;
+    }
+}
+
+/*
+ * Max-heap of cached pages by next reference, indexed by page.
+ */
+struct heap {
+    uint32_t *pages;
+    uint64_t *keys;
+    // Slot of every page, NO_PAGE if not in the heap
+    uint32_t *slots;
+    size_t size;
+};
+
+static inline void heap_set(struct heap *h, size_t slot, uint32_t page, uint64_t key)
+{
+    h->pages[slot] = page;
+    h->keys[slot]  = key;
+    h->slots[page] = (uint32_t) slot;
+}
+
+static void heap_sift(struct heap *h, size_t slot)
+{
+    uint32_t page = h->pages[slot];
+    uint64_t key = h->keys[slot];
+
+    while (slot > 0 && h->keys[(slot - 1) / 2] < key) {
+        size_t parent = (slot - 1) / 2;
+        heap_set(h, slot, h->pages[parent], h->keys[parent]);
+        slot = parent;
+    }
+    for (;;) {
+        size_t child = 2 * slot + 1;
+        if (child >= h->size) break;
+        if (child + 1 < h->size && h->keys[child + 1] > h->keys[child]) child++;
+        if (h->keys[child] <= key) break;
+
+        heap_set(h, slot, h->pages[child], h->keys[child]);
+        slot = child;
+    }
+    heap_set(h, slot, page, key);
+}
+
+static inline bool heap_contains(const struct heap *h, uint32_t page)
+{
+    return h->slots[page] != NO_PAGE;
+}
+
+static inline uint64_t heap_key(const struct heap *h, uint32_t page)
+{
+    return h->keys[h->slots[page]];
+}
+
+static void heap_push(struct heap *h, uint32_t page, uint64_t key)
+{
+    heap_set(h, h->size++, page, key);
+    heap_sift(h, h->size - 1);
+}
+
+static void heap_update(struct heap *h, uint32_t page, uint64_t key)
+{
+    size_t slot = h->slots[page];
+
+    h->keys[slot] = key;
+    heap_sift(h, slot);
+}
+
+static void heap_remove(struct heap *h, uint32_t page)
+{
+    size_t slot = h->slots[page];
+
+    h->slots[page] = NO_PAGE;
+    if (slot != --h->size) {
+        heap_set(h, slot, h->pages[h->size], h->keys[h->size]);
+        heap_sift(h, slot);
+    }
+}
+
+/*
+ * Policy models, over FIFO queues of pages linked by page id. Queue 0 holds
+ * the LRU order or the small FIFO of S3-FIFO, queue 1 its main FIFO. Heads
+ * are the most recent insertions.
+ */
+
+#define QUEUE_NONE 0xff
+#define QUEUE_SMALL 0
+#define QUEUE_MAIN 1
+
+struct queue {
+    uint32_t head;
+    uint32_t tail;
+    size_t size;
+};
+
+struct model {
+    enum opt_model kind;
+    size_t capacity;
+    uint32_t *prev;
+    uint32_t *next;
+    uint8_t *queue;
+    uint8_t *freq;
+    struct queue queues[2];
+    size_t small_capacity;
+    // Pages are in the ghost FIFO while fewer than ghost_capacity pages
+    // were inserted after them: ghost_stamps holds their insertion number,
+    // from 1, or 0 for none
+    uint64_t *ghost_stamps;
+    uint64_t ghost_inserts;
+    uint64_t ghost_capacity;
+};
+
+static void queue_push(struct model *m, uint8_t q, uint32_t page)
+{
+    struct queue *queue = &m->queues[q];
+
+    m->queue[page] = q;
+    m->prev[page]  = NO_PAGE;
+    m->next[page]  = queue->head;
+    if (queue->head != NO_PAGE) {
+        m->prev[queue->head] = page;
+    } else {
+        queue->tail = page;
+    }
+    queue->head = page;
+    queue->size++;
+}
+
+static void queue_remove(struct model *m, uint32_t page)
+{
+    struct queue *queue = &m->queues[m->queue[page]];
+
+    if (m->prev[page] != NO_PAGE) {
+        m->next[m->prev[page]] = m->next[page];
+    } else {
+        queue->head = m->next[page];
+    }
+    if (m->next[page] != NO_PAGE) {
+        m->prev[m->next[page]] = m->prev[page];
+    } else {
+        queue->tail = m->prev[page];
+    }
+    m->queue[page] = QUEUE_NONE;
+    queue->size--;
+}
+
+static void model_free(struct model *m)
+{
+    free(m->prev);
+    free(m->next);
+    free(m->queue);
+    free(m->freq);
+    free(m->ghost_stamps);
+}
+
+static int model_init(struct model *m, enum opt_model kind, size_t capacity, uint64_t num_pages)
+{
+    memset(m, 0, sizeof(*m));
+    m->kind     = kind;
+    m->capacity = capacity;
+    m->prev     = (uint32_t*) malloc((num_pages + 1) * sizeof(uint32_t));
+    m->next     = (uint32_t*) malloc((num_pages + 1) * sizeof(uint32_t));
+    m->queue    = (uint8_t*) malloc(num_pages + 1);
+    m->freq     = (uint8_t*) calloc(num_pages + 1, 1);
+    m->ghost_stamps = (uint64_t*) calloc(num_pages + 1, sizeof(uint64_t));
+    if (!m->prev || !m->next || !m->queue || !m->freq || !m->ghost_stamps) {
+        model_free(m);
+        return -1;
+    }
+    memset(m->queue, QUEUE_NONE, num_pages + 1);
+
+    for (int q = 0; q < 2; q++) {
+        m->queues[q].head = NO_PAGE;
+        m->queues[q].tail = NO_PAGE;
+    }
+    m->small_capacity = capacity / 10 ? capacity / 10 : 1;
+    m->ghost_capacity = capacity - m->small_capacity;
+    return 0;
+}
+
+static inline size_t model_size(const struct model *m)
+{
+    return m->queues[QUEUE_SMALL].size + m->queues[QUEUE_MAIN].size;
+}
+
+static void model_hit(struct model *m, uint32_t page)
+{
+    if (m->kind == OPT_MODEL_LRU) {
+        queue_remove(m, page);
+        queue_push(m, QUEUE_SMALL, page);
+    } else if (m->freq[page] < 3) {
+        m->freq[page]++;
+    }
+}
+
+/*
+ * S3-FIFO eviction: pages leave the small FIFO for the main one if
+ * referenced more than once, and get a further pass through main per
+ * remaining reference.
+ */
+static uint32_t s3fifo_evict(struct model *m)
+{
+    for (;;) {
+        struct queue *small = &m->queues[QUEUE_SMALL];
+
+        if (small->size >= m->small_capacity || m->queues[QUEUE_MAIN].size == 0) {
+            uint32_t page = small->tail;
+
+            queue_remove(m, page);
+            if (m->freq[page] > 1) {
+                queue_push(m, QUEUE_MAIN, page);
+                continue;
+            }
+            m->ghost_stamps[page] = ++m->ghost_inserts;
+            return page;
+        }
+
+        uint32_t page = m->queues[QUEUE_MAIN].tail;
+        queue_remove(m, page);
+        if (m->freq[page] > 0) {
+            m->freq[page]--;
+            queue_push(m, QUEUE_MAIN, page);
+            continue;
+        }
+        return page;
+    }
+}
+
+static uint32_t model_evict(struct model *m)
+{
+    if (m->kind == OPT_MODEL_LRU) {
+        uint32_t page = m->queues[QUEUE_SMALL].tail;
+        queue_remove(m, page);
+        return page;
+    }
+    return s3fifo_evict(m);
+}
+
+static void model_insert(struct model *m, uint32_t page)
+{
+    uint64_t stamp = m->ghost_stamps[page];
+
+    m->freq[page] = 0;
+    if (m->kind == OPT_MODEL_S3FIFO && stamp && m->ghost_inserts - stamp < m->ghost_capacity) {
+        m->ghost_stamps[page] = 0;
+        queue_push(m, QUEUE_MAIN, page);
+    } else {
+        queue_push(m, QUEUE_SMALL, page);
+    }
+}
+
+static void replay_min(const struct opt_trace *t, size_t capacity, struct heap *h,
+                       struct opt_stats *stats)
+{
+    for (size_t i = 0; i < t->trace->num_refs; i++) {
+        uint32_t page = t->ids[i];
+        uint64_t key = t->next[i];
+
+        if (heap_contains(h, page)) {
+            stats->hits++;
+            heap_update(h, page, key);
+            continue;
+        }
+
+        stats->misses++;
+        if (h->size < capacity) {
+            heap_push(h, page, key);
+        } else if (key >= h->keys[0]) {
+            stats->bypasses++;
+        } else {
+            stats->evictions++;
+            heap_remove(h, h->pages[0]);
+            heap_push(h, page, key);
+        }
+    }
+}
+
+static void replay_model(const struct opt_trace *t, struct model *m, struct heap *h,
+                         struct opt_stats *stats)
+{
+    for (size_t i = 0; i < t->trace->num_refs; i++) {
+        uint32_t page = t->ids[i];
+        uint64_t key = t->next[i];
+
+        if (m->queue[page] != QUEUE_NONE) {
+            stats->hits++;
+            model_hit(m, page);
+            heap_update(h, page, key);
+            continue;
+        }
+
+        stats->misses++;
+        if (model_size(m) == m->capacity) {
+            uint32_t victim = model_evict(m);
+            uint64_t victim_key = heap_key(h, victim);
+
+            // MIN would evict the page of the top of the heap, or reject
+            // the incoming page if it is referenced later than the victim
+            stats->evictions++;
+            if (victim_key < h->keys[0]) {
+                stats->victim_disagreements++;
+            }
+            if (key > victim_key) {
+                stats->admission_disagreements++;
+            }
+            heap_remove(h, victim);
+        }
+        model_insert(m, page);
+        heap_push(h, page, key);
+    }
+}
+
+int opt_replay(const struct opt_trace *t, enum opt_model model, size_t capacity,
+               struct opt_stats *stats)
+{
+    size_t slots = capacity < t->num_pages ? capacity : t->num_pages;
+    struct heap h = {
+        .pages = (uint32_t*) malloc((slots + 1) * sizeof(uint32_t)),
+        .keys  = (uint64_t*) malloc((slots + 1) * sizeof(uint64_t)),
+        .slots = (uint32_t*) malloc((t->num_pages + 1) * sizeof(uint32_t)),
+    };
+    struct model m;
+    int ret = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->accesses = t->trace->num_refs;
+
+    if (capacity == 0 || model >= OPT_NUM_MODELS || !h.pages || !h.keys || !h.slots) goto out;
+    memset(h.slots, 0xff, (t->num_pages + 1) * sizeof(uint32_t));
+
+    if (model == OPT_MODEL_MIN) {
+        replay_min(t, capacity, &h, stats);
+    } else {
+        if (model_init(&m, model, capacity, t->num_pages) != 0) goto out;
+        replay_model(t, &m, &h, stats);
+        model_free(&m);
+    }
+    ret = 0;
+
+out:
+    free(h.pages);
+    free(h.keys);
+    free(h.slots);
+    return ret;
+}
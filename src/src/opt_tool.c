@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "opt.h"
+
+/*
+ * Belady's MIN oracle: annotates a trace with next references, then replays
+ * MIN and the LRU and S3-FIFO models at every cache size, one (model, size)
+ * pair per thread. Rows have the columns of the simulator's, then the
+ * fractions of evictions whose victim or admission disagrees with MIN.
+ * Traces are loaded whole, as MIN looks ahead at random positions (opt.h).
+ */
+
+#define MAX_MODELS OPT_NUM_MODELS
+#define MAX_SIZES 256
+
+static const char *USAGE =
+    "Usage: %s -t <trace> (-s <pages>[,<pages>...] | -r <min>:<max>:<count>)\n"
+    "          [-m <model>[,<model>...]] [-a <annotated trace>] [-j <threads>]\n"
+    "\n"
+    "-m        min, lru or s3fifo (default: all).\n"
+    "-r        sweeps <count> cache sizes spaced geometrically in [min, max].\n"
+    "-a        writes the trace as \"<ino> <index> <scan> <next>\" lines, next\n"
+    "          being the position of the next reference to the page, or the\n"
+    "          number of references if there is none.\n"
+    "-j        threads (default: online CPUs).\n";
+
+struct job {
+    enum opt_model model;
+    size_t capacity;
+    struct opt_stats stats;
+    double seconds;
+    int error;
+};
+
+struct sweep {
+    const struct opt_trace *trace;
+    struct job *jobs;
+    size_t num_jobs;
+    // Next job to run
+    size_t next;
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *worker(void *arg)
+{
+    struct sweep *s = (struct sweep*) arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+        if (i >= s->num_jobs) break;
+
+        struct job *job = &s->jobs[i];
+        double start = now_seconds();
+        job->error   = opt_replay(s->trace, job->model, job->capacity, &job->stats);
+        job->seconds = now_seconds() - start;
+    }
+    return NULL;
+}
+
+static size_t parse_sizes(char *list, size_t *sizes)
+{
+    size_t n = 0;
+
+    for (char *item = strtok(list, ","); item && n < MAX_SIZES; item = strtok(NULL, ",")) {
+        sizes[n++] = strtoull(item, NULL, 10);
+    }
+    return n;
+}
+
+static size_t parse_range(const char *range, size_t *sizes)
+{
+    unsigned long long min, max, count;
+    if (sscanf(range, "%llu:%llu:%llu", &min, &max, &count) != 3
+        || min == 0 || max < min || count == 0 || count > MAX_SIZES) {
+        return 0;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        double t = count > 1 ? (double) i / (count - 1) : 0;
+        size_t size = (size_t) llround(min * pow((double) max / min, t));
+
+        // Small ranges round several steps to the same size
+        if (n == 0 || size != sizes[n - 1]) {
+            sizes[n++] = size;
+        }
+    }
+    return n;
+}
+
+static size_t parse_models(char *list, enum opt_model *models)
+{
+    size_t n = 0;
+
+    for (char *item = strtok(list, ","); item && n < MAX_MODELS; item = strtok(NULL, ",")) {
+        if (opt_model_parse(item, &models[n]) != 0) {
+            fprintf(stderr, "Unknown model: %s\n", item);
+            return 0;
+        }
+        n++;
+    }
+    return n;
+}
+
+static int write_annotated(const struct opt_trace *t, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+
+    const struct sim_trace *trace = t->trace;
+    for (size_t i = 0; i < trace->num_refs; i++) {
+        const struct sim_ref *ref = &trace->refs[i];
+        uint64_t next = t->next[i] == OPT_NEVER ? trace->num_refs : t->next[i];
+
+        fprintf(f, "%" PRIu64 " %" PRIu64 " %d %" PRIu64 "\n", ref->ino, ref->index,
+                ref->flags & SIM_REF_SCAN ? 1 : 0, next);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static double fraction(uint64_t n, uint64_t total)
+{
+    return total ? (double) n / total : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = NULL;
+    const char *annotated_path = NULL;
+    enum opt_model models[MAX_MODELS] = { OPT_MODEL_MIN, OPT_MODEL_LRU, OPT_MODEL_S3FIFO };
+    size_t num_models = OPT_NUM_MODELS;
+    size_t sizes[MAX_SIZES];
+    size_t num_sizes = 0;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:m:s:r:a:j:h")) != -1) {
+        switch (opt) {
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'm':
+            num_models = parse_models(optarg, models);
+            break;
+        case 's':
+            num_sizes = parse_sizes(optarg, sizes);
+            break;
+        case 'r':
+            num_sizes = parse_range(optarg, sizes);
+            break;
+        case 'a':
+            annotated_path = optarg;
+            break;
+        case 'j':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!trace_path || num_models == 0 || num_sizes == 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+    for (size_t i = 0; i < num_sizes; i++) {
+        if (sizes[i] == 0) {
+            fprintf(stderr, "Cache sizes must be positive\n");
+            return 1;
+        }
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    struct sim_trace trace;
+    if (sim_trace_load(trace_path, &trace) != 0) {
+        fprintf(stderr, "Failed to load trace %s\n", trace_path);
+        return 1;
+    }
+    fprintf(stderr, "Loaded %zu references from %s\n", trace.num_refs, trace_path);
+
+    double start = now_seconds();
+    struct opt_trace *t = opt_trace_init(&trace, (int) num_threads);
+    if (!t) {
+        fprintf(stderr, "Failed to annotate %s\n", trace_path);
+        sim_trace_free(&trace);
+        return 1;
+    }
+    fprintf(stderr, "Annotated %" PRIu64 " distinct pages in %.3f s on %ld threads\n",
+            t->num_pages, now_seconds() - start, num_threads);
+
+    if (annotated_path && write_annotated(t, annotated_path) != 0) {
+        fprintf(stderr, "Failed to write %s\n", annotated_path);
+        opt_trace_free(&t);
+        sim_trace_free(&trace);
+        return 1;
+    }
+
+    struct sweep s = {
+        .trace    = t,
+        .num_jobs = num_models * num_sizes,
+    };
+    s.jobs = (struct job*) calloc(s.num_jobs, sizeof(struct job));
+
+    if ((size_t) num_threads > s.num_jobs) {
+        num_threads = s.num_jobs;
+    }
+    pthread_t *threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+
+    if (!s.jobs || !threads) {
+        fprintf(stderr, "Failed to allocate %zu jobs\n", s.num_jobs);
+        free(s.jobs);
+        opt_trace_free(&t);
+        sim_trace_free(&trace);
+        return 1;
+    }
+
+    for (size_t m = 0; m < num_models; m++) {
+        for (size_t i = 0; i < num_sizes; i++) {
+            s.jobs[m * num_sizes + i].model    = models[m];
+            s.jobs[m * num_sizes + i].capacity = sizes[i];
+        }
+    }
+
+    for (long i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, worker, &s);
+    }
+    for (long i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int status = 0;
+    printf("policy,cache_pages,accesses,hits,misses,hit_ratio,evictions,"
+           "rejections,failed_evictions,seconds,victim_disagreement,"
+           "admission_disagreement\n");
+    for (size_t i = 0; i < s.num_jobs; i++) {
+        struct job *job = &s.jobs[i];
+        const struct opt_stats *st = &job->stats;
+
+        if (job->error) {
+            fprintf(stderr, "Failed to replay %s with %zu pages\n",
+                    opt_model_name(job->model), job->capacity);
+            status = 1;
+            continue;
+        }
+
+        printf("%s,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f,%" PRIu64 ",%" PRIu64
+               ",0,%.3f,%.6f,%.6f\n",
+               opt_model_name(job->model), job->capacity, st->accesses, st->hits,
+               st->misses, fraction(st->hits, st->accesses), st->evictions, st->bypasses,
+               job->seconds, fraction(st->victim_disagreements, st->evictions),
+               fraction(st->admission_disagreements, st->evictions));
+    }
+
+    free(threads);
+    free(s.jobs);
+    opt_trace_free(&t);
+    sim_trace_free(&trace);
+    return status;
+}
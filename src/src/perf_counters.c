@@ -0,0 +1,90 @@
+#include "perf_counters.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *NAMES[PERF_NUM_COUNTERS] = {
+    "cycles", "instructions", "llc_misses", "dtlb_misses",
+};
+
+const char* perf_counter_name(enum perf_counter counter)
+{
+    return NAMES[counter];
+}
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int perf_counters_open(struct perf_counters *pc)
+{
+    pc->fds[PERF_CYCLES]       = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    pc->fds[PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    pc->fds[PERF_LLC_MISSES]   = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    pc->fds[PERF_DTLB_MISSES]  = open_counter(
+        PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    );
+
+    int available = 0;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        pc->values[i] = 0;
+        available += pc->fds[i] >= 0;
+    }
+    return available;
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (pc->fds[i] >= 0) {
+            close(pc->fds[i]);
+            pc->fds[i] = -1;
+        }
+    }
+}
+
+void perf_counters_start(struct perf_counters *pc)
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (pc->fds[i] < 0) continue;
+
+        ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_counters_stop(struct perf_counters *pc)
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (pc->fds[i] >= 0) {
+            ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        // value, time enabled, time running
+        uint64_t data[3];
+
+        pc->values[i] = 0;
+        if (pc->fds[i] < 0 || read(pc->fds[i], data, sizeof(data)) != sizeof(data)) {
+            continue;
+        }
+        pc->values[i] = data[2] ? (uint64_t) ((double) data[0] * data[1] / data[2]) : 0;
+    }
+}
@@ -0,0 +1,1150 @@
+#include "sim.h"
+#include "hash.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_GHOST_NIL UINT32_MAX
+#define SIM_NO_PAGE_ID UINT32_MAX
+
+static inline uint64_t page_hash(uint64_t ino, uint64_t index)
+{
+    return hash_64(ino * 0x9E3779B97F4A7C15ULL ^ index);
+}
+
+static inline struct sim_folio* folio_at(struct sim_cache *c, size_t i)
+{
+    return (struct sim_folio*) (c->arena + i * c->stride);
+}
+
+/*
+ * Index of cached folios: linear probing with backward-shift deletion, as in
+ * wtinylfu.c.
+ */
+
+static struct sim_folio* index_find(struct sim_cache *c, uint64_t ino, uint64_t index)
+{
+    for (size_t pos = page_hash(ino, index) & c->index_mask;;
+         pos = (pos + 1) & c->index_mask) {
+        struct sim_folio *folio = c->index[pos];
+
+        if (!folio || (folio->ino == ino && folio->index == index)) {
+            return folio;
+        }
+    }
+}
+
+static void index_insert(struct sim_cache *c, struct sim_folio *folio)
+{
+    size_t pos = page_hash(folio->ino, folio->index) & c->index_mask;
+
+    while (c->index[pos]) {
+        pos = (pos + 1) & c->index_mask;
+    }
+    c->index[pos] = folio;
+}
+
+static void index_remove(struct sim_cache *c, struct sim_folio *folio)
+{
+    size_t hole = page_hash(folio->ino, folio->index) & c->index_mask;
+
+    while (c->index[hole] != folio) {
+        hole = (hole + 1) & c->index_mask;
+    }
+
+    for (size_t next = (hole + 1) & c->index_mask; c->index[next];
+         next = (next + 1) & c->index_mask) {
+        struct sim_folio *moved = c->index[next];
+        size_t home = page_hash(moved->ino, moved->index) & c->index_mask;
+
+        if (((next - home) & c->index_mask) >= ((next - hole) & c->index_mask)) {
+            c->index[hole] = moved;
+            hole = next;
+        }
+    }
+
+    c->index[hole] = NULL;
+}
+
+/*
+ * Lists
+ */
+
+uint8_t sim_list_new(struct sim_cache *c)
+{
+    if (c->num_lists == SIM_MAX_LISTS) return SIM_LIST_NONE;
+
+    return ++c->num_lists;
+}
+
+static void list_unlink(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct sim_list *l = &c->lists[folio->list];
+
+    if (folio->prev) {
+        folio->prev->next = folio->next;
+    } else {
+        l->head = folio->next;
+    }
+
+    if (folio->next) {
+        folio->next->prev = folio->prev;
+    } else {
+        l->tail = folio->prev;
+    }
+
+    l->size--;
+    folio->list = SIM_LIST_NONE;
+}
+
+static void list_link(struct sim_cache *c, uint8_t list, struct sim_folio *folio,
+                      bool tail)
+{
+    struct sim_list *l = &c->lists[list];
+
+    folio->list = list;
+    if (tail) {
+        folio->prev = l->tail;
+        folio->next = NULL;
+        if (l->tail) {
+            l->tail->next = folio;
+        } else {
+            l->head = folio;
+        }
+        l->tail = folio;
+    } else {
+        folio->prev = NULL;
+        folio->next = l->head;
+        if (l->head) {
+            l->head->prev = folio;
+        } else {
+            l->tail = folio;
+        }
+        l->head = folio;
+    }
+    l->size++;
+}
+
+static inline bool list_valid(struct sim_cache *c, uint8_t list)
+{
+    return list != SIM_LIST_NONE && list <= c->num_lists;
+}
+
+int sim_list_add(struct sim_cache *c, uint8_t list, struct sim_folio *folio)
+{
+    if (!list_valid(c, list) || folio->list != SIM_LIST_NONE) return -1;
+
+    list_link(c, list, folio, false);
+    return 0;
+}
+
+int sim_list_add_tail(struct sim_cache *c, uint8_t list, struct sim_folio *folio)
+{
+    if (!list_valid(c, list) || folio->list != SIM_LIST_NONE) return -1;
+
+    list_link(c, list, folio, true);
+    return 0;
+}
+
+int sim_list_del(struct sim_cache *c, struct sim_folio *folio)
+{
+    if (folio->list == SIM_LIST_NONE) return -1;
+
+    list_unlink(c, folio);
+    return 0;
+}
+
+int sim_list_move(struct sim_cache *c, uint8_t list, struct sim_folio *folio, bool tail)
+{
+    if (!list_valid(c, list) || folio->list == SIM_LIST_NONE) return -1;
+
+    list_unlink(c, folio);
+    list_link(c, list, folio, tail);
+    return 0;
+}
+
+static void select_folio(struct sim_eviction_ctx *ctx, struct sim_folio *folio,
+                         int64_t score)
+{
+    folio->flags |= SIM_FOLIO_SELECTED;
+    ctx->scores[ctx->nr_folios_to_evict] = score;
+    ctx->folios_to_evict[ctx->nr_folios_to_evict++] = folio;
+}
+
+static int list_iterate(struct sim_cache *c, uint8_t list,
+                        int (*iter_fn)(struct sim_cache *c, int idx, struct sim_folio *folio),
+                        struct sim_iterate_opts *opts, struct sim_eviction_ctx *ctx)
+{
+    if (!list_valid(c, list)) return -1;
+
+    if (opts) {
+        opts->nr_folios_continue = 0;
+    }
+
+    // Folios moved to the tail of the list are not visited again
+    size_t budget = c->lists[list].size;
+    struct sim_folio *folio = c->lists[list].head;
+    int idx = 0;
+
+    while (folio && budget-- > 0
+           && ctx->nr_folios_to_evict < ctx->request_nr_folios_to_evict) {
+        struct sim_folio *next = folio->next;
+
+        if (!(folio->flags & SIM_FOLIO_SELECTED)) {
+            int ret = iter_fn(c, idx++, folio);
+
+            if (ret == SIM_STOP_ITER) break;
+
+            if (ret == SIM_EVICT_NODE) {
+                select_folio(ctx, folio, 0);
+                if (opts) {
+                    uint8_t dst = opts->evict_list == SIM_ITERATE_SELF ? list
+                                                                      : opts->evict_list;
+                    sim_list_move(c, dst, folio, opts->evict_mode == SIM_ITERATE_TAIL);
+                }
+            } else if (opts) {
+                uint8_t dst = opts->continue_list == SIM_ITERATE_SELF ? list
+                                                                      : opts->continue_list;
+                sim_list_move(c, dst, folio, opts->continue_mode == SIM_ITERATE_TAIL);
+                opts->nr_folios_continue++;
+            }
+        }
+        folio = next;
+    }
+
+    return 0;
+}
+
+int sim_list_iterate(struct sim_cache *c, uint8_t list,
+                     int (*iter_fn)(struct sim_cache *c, int idx, struct sim_folio *folio),
+                     struct sim_eviction_ctx *ctx)
+{
+    return list_iterate(c, list, iter_fn, NULL, ctx);
+}
+
+int sim_list_iterate_extended(struct sim_cache *c, uint8_t list,
+                              int (*iter_fn)(struct sim_cache *c, int idx,
+                                             struct sim_folio *folio),
+                              struct sim_iterate_opts *opts,
+                              struct sim_eviction_ctx *ctx)
+{
+    return list_iterate(c, list, iter_fn, opts, ctx);
+}
+
+int sim_list_sample(struct sim_cache *c, uint8_t list,
+                    int64_t (*score_fn)(struct sim_cache *c, struct sim_folio *folio),
+                    size_t sample_size, struct sim_eviction_ctx *ctx)
+{
+    if (!list_valid(c, list)) return -1;
+
+    size_t need = ctx->request_nr_folios_to_evict - ctx->nr_folios_to_evict;
+    size_t budget = c->lists[list].size;
+    size_t samples = need * sample_size;
+
+    // Lowest scores so far, in increasing order
+    struct sim_folio *best[SIM_EVICT_BATCH];
+    int64_t best_scores[SIM_EVICT_BATCH];
+    size_t num_best = 0;
+
+    struct sim_folio *folio = c->lists[list].head;
+    while (folio && budget-- > 0 && samples > 0) {
+        struct sim_folio *next = folio->next;
+
+        if (!(folio->flags & SIM_FOLIO_SELECTED)) {
+            int64_t score = score_fn(c, folio);
+            size_t pos = num_best < need ? num_best++ : need;
+
+            while (pos > 0 && best_scores[pos - 1] > score) {
+                if (pos < need) {
+                    best[pos] = best[pos - 1];
+                    best_scores[pos] = best_scores[pos - 1];
+                }
+                pos--;
+            }
+            if (pos < need) {
+                best[pos] = folio;
+                best_scores[pos] = score;
+            }
+
+            sim_list_move(c, list, folio, true);
+            samples--;
+        }
+        folio = next;
+    }
+
+    for (size_t i = 0; i < num_best; i++) {
+        select_folio(ctx, best[i], best_scores[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * Kernel LRU order of all cached folios. The kernel reclaims in this order
+ * when a policy selects too few folios.
+ */
+
+static void lru_unlink(struct sim_cache *c, struct sim_folio *folio)
+{
+    if (folio->lru_prev) {
+        folio->lru_prev->lru_next = folio->lru_next;
+    } else {
+        c->lru_head = folio->lru_next;
+    }
+
+    if (folio->lru_next) {
+        folio->lru_next->lru_prev = folio->lru_prev;
+    } else {
+        c->lru_tail = folio->lru_prev;
+    }
+}
+
+static void lru_push_head(struct sim_cache *c, struct sim_folio *folio)
+{
+    folio->lru_prev = NULL;
+    folio->lru_next = c->lru_head;
+
+    if (c->lru_head) {
+        c->lru_head->lru_prev = folio;
+    } else {
+        c->lru_tail = folio;
+    }
+    c->lru_head = folio;
+}
+
+/*
+ * Cache
+ */
+
+struct sim_cache* sim_cache_init(const struct sim_policy_ops *ops, size_t capacity,
+                                 size_t batch, bool tinylfu)
+{
+    if (!ops || capacity == 0) return NULL;
+
+    struct sim_cache *c = (struct sim_cache*) calloc(1, sizeof(struct sim_cache));
+    if (!c) return NULL;
+
+    c->ops      = ops;
+    c->capacity = capacity;
+    c->batch    = batch == 0 ? 1 : batch > SIM_EVICT_BATCH ? SIM_EVICT_BATCH : batch;
+
+    c->stride = sizeof(struct sim_folio)
+                + ((ops->folio_meta_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1));
+    c->arena  = (uint8_t*) calloc(capacity, c->stride);
+
+    // At most half full
+    size_t index_size = 1;
+    while (index_size < 2 * capacity) {
+        index_size <<= 1;
+    }
+    c->index_mask = index_size - 1;
+    c->index      = (struct sim_folio**) calloc(index_size, sizeof(struct sim_folio*));
+
+    if (tinylfu) {
+        c->tinylfu = sim_tinylfu_init(capacity);
+    }
+
+    if (!c->arena || !c->index || (tinylfu && !c->tinylfu)) {
+        sim_cache_free(&c);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        folio_at(c, i)->next = i + 1 < capacity ? folio_at(c, i + 1) : NULL;
+    }
+    c->free_folios = folio_at(c, 0);
+
+    if (ops->init(c) != 0) {
+        // Nothing to undo in the policy
+        c->ops = NULL;
+        sim_cache_free(&c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void sim_cache_free(struct sim_cache **c)
+{
+    if (c && *c) {
+        if ((*c)->ops && (*c)->ops->exit) {
+            (*c)->ops->exit(*c);
+        }
+        sim_tinylfu_free(&(*c)->tinylfu);
+        free((*c)->arena);
+        free((*c)->index);
+        free(*c);
+        *c = NULL;
+    }
+}
+
+static void clear_selected(struct sim_eviction_ctx *ctx)
+{
+    for (size_t i = 0; i < ctx->nr_folios_to_evict; i++) {
+        ctx->folios_to_evict[i]->flags &= ~SIM_FOLIO_SELECTED;
+    }
+}
+
+static void evict_folio(struct sim_cache *c, struct sim_folio *folio)
+{
+    if (c->ops->folio_evicted) {
+        c->ops->folio_evicted(c, folio);
+    }
+
+    // The framework unlinks evicted folios the policy left on a list
+    sim_list_del(c, folio);
+    lru_unlink(c, folio);
+    index_remove(c, folio);
+
+    folio->flags = 0;
+    folio->next  = c->free_folios;
+    c->free_folios = folio;
+
+    c->nr_folios--;
+    c->stats.evictions++;
+}
+
+static void evict(struct sim_cache *c)
+{
+    struct sim_eviction_ctx ctx = {
+        .request_nr_folios_to_evict = c->batch < c->nr_folios ? c->batch : c->nr_folios,
+    };
+
+    c->ops->evict_folios(c, &ctx);
+    c->stats.failed_evictions += ctx.request_nr_folios_to_evict - ctx.nr_folios_to_evict;
+
+    for (size_t i = 0; i < ctx.nr_folios_to_evict; i++) {
+        evict_folio(c, ctx.folios_to_evict[i]);
+    }
+
+    while (c->nr_folios >= c->capacity) {
+        evict_folio(c, c->lru_tail);
+    }
+}
+
+/*
+ * Asks the policy for a victim of ctx without evicting it, as
+ * filemap_get_pages() does before admission.
+ */
+static void admission_victim(struct sim_cache *c, struct sim_admission_ctx *ctx)
+{
+    struct sim_eviction_ctx probe = {
+        .request_nr_folios_to_evict = 1,
+    };
+
+    if (c->nr_folios > 0) {
+        c->ops->evict_folios(c, &probe);
+    }
+    if (probe.nr_folios_to_evict > 0) {
+        ctx->victim_ino   = probe.folios_to_evict[0]->ino;
+        ctx->victim_index = probe.folios_to_evict[0]->index;
+    }
+    clear_selected(&probe);
+}
+
+/*
+ * Lets TinyLFU compare the missing page with the policy's victim.
+ */
+static bool admit(struct sim_cache *c, const struct sim_ref *ref)
+{
+    struct sim_admission_ctx ctx = {
+        .ino   = ref->ino,
+        .index = ref->index,
+    };
+
+    admission_victim(c, &ctx);
+    return !sim_tinylfu_reject(c->tinylfu, &ctx);
+}
+
+static void hit(struct sim_cache *c, struct sim_folio *folio)
+{
+    c->stats.hits++;
+    lru_unlink(c, folio);
+    lru_push_head(c, folio);
+    if (c->tinylfu) {
+        sim_tinylfu_accessed(c->tinylfu, folio);
+    }
+    if (c->ops->folio_accessed) {
+        c->ops->folio_accessed(c, folio);
+    }
+}
+
+static void insert(struct sim_cache *c, const struct sim_ref *ref)
+{
+    if (c->nr_folios >= c->capacity) {
+        evict(c);
+    }
+
+    struct sim_folio *folio = c->free_folios;
+    c->free_folios = folio->next;
+
+    memset(folio, 0, c->stride);
+    folio->ino   = ref->ino;
+    folio->index = ref->index;
+    folio->flags = ref->flags & ~SIM_FOLIO_SELECTED;
+    index_insert(c, folio);
+    lru_push_head(c, folio);
+    c->nr_folios++;
+
+    c->ops->folio_added(c, folio);
+
+    // The read that brought the page in marks it accessed, as in filemap_read()
+    if (c->tinylfu) {
+        sim_tinylfu_accessed(c->tinylfu, folio);
+    }
+    if (c->ops->folio_accessed) {
+        c->ops->folio_accessed(c, folio);
+    }
+}
+
+bool sim_cache_access(struct sim_cache *c, const struct sim_ref *ref)
+{
+    if (!c) return false;
+
+    c->stats.accesses++;
+    c->ref_flags = ref->flags;
+
+    struct sim_folio *folio = index_find(c, ref->ino, ref->index);
+    if (folio) {
+        hit(c, folio);
+        return true;
+    }
+
+    c->stats.misses++;
+
+    if (c->tinylfu && !admit(c, ref)) {
+        c->stats.rejections++;
+        return false;
+    }
+
+    insert(c, ref);
+    return false;
+}
+
+/*
+ * Bitmap of the pages to bypass the cache from the missing page ref, for the
+ * nr_pages left of its read.
+ */
+static uint64_t admit_range(struct sim_cache *c, const struct sim_ref *ref, size_t nr_pages)
+{
+    struct sim_admission_ctx ctx = {
+        .ino      = ref->ino,
+        .index    = ref->index,
+        .nr_pages = nr_pages,
+    };
+
+    admission_victim(c, &ctx);
+    return sim_tinylfu_admit_range(c->tinylfu, &ctx);
+}
+
+size_t sim_cache_read(struct sim_cache *c, const struct sim_ref *ref, size_t nr_pages)
+{
+    if (!c) return 0;
+
+    struct sim_ref page = *ref;
+    uint64_t end  = ref->index + nr_pages;
+    size_t hits   = 0;
+    // Decision and pages left of the run being served
+    bool reject   = false;
+    uint64_t run  = 0;
+
+    c->ref_flags = ref->flags;
+
+    for (; page.index < end; page.index++) {
+        c->stats.accesses++;
+
+        struct sim_folio *folio = index_find(c, page.ino, page.index);
+        if (folio) {
+            hit(c, folio);
+            hits++;
+            run -= run > 0;
+            continue;
+        }
+
+        c->stats.misses++;
+
+        if (run == 0) {
+            uint64_t bypass  = c->tinylfu ? admit_range(c, &page, end - page.index) : 0;
+            uint64_t run_end;
+
+            reject  = bypass & 1;
+            run_end = reject ? ~bypass : bypass;
+            run     = run_end ? (uint64_t) __builtin_ctzll(run_end) : SIM_ADMISSION_MAX_PAGES;
+        }
+        run--;
+
+        if (reject) {
+            c->stats.rejections++;
+        } else {
+            insert(c, &page);
+        }
+    }
+
+    return hits;
+}
+
+/*
+ * Ghost map
+ */
+
+struct sim_ghost* sim_ghost_init(size_t capacity)
+{
+    if (capacity == 0 || capacity >= SIM_GHOST_NIL) return NULL;
+
+    struct sim_ghost *g = (struct sim_ghost*) calloc(1, sizeof(struct sim_ghost));
+    if (!g) return NULL;
+
+    g->capacity = capacity;
+    g->head     = SIM_GHOST_NIL;
+    g->tail     = SIM_GHOST_NIL;
+    g->entries  = (struct sim_ghost_entry*) malloc(capacity * sizeof(struct sim_ghost_entry));
+
+    size_t index_size = 1;
+    while (index_size < 2 * capacity) {
+        index_size <<= 1;
+    }
+    g->index_mask = index_size - 1;
+    g->index      = (uint32_t*) malloc(index_size * sizeof(uint32_t));
+
+    if (!g->entries || !g->index) {
+        sim_ghost_free(&g);
+        return NULL;
+    }
+    memset(g->index, 0xff, index_size * sizeof(uint32_t));
+
+    return g;
+}
+
+void sim_ghost_free(struct sim_ghost **g)
+{
+    if (g && *g) {
+        free((*g)->entries);
+        free((*g)->index);
+        free(*g);
+        *g = NULL;
+    }
+}
+
+static inline size_t ghost_home(struct sim_ghost *g, uint32_t e)
+{
+    return page_hash(g->entries[e].ino, g->entries[e].index) & g->index_mask;
+}
+
+// Position of the page in the index, or of the empty slot ending its probe
+static size_t ghost_find(struct sim_ghost *g, uint64_t ino, uint64_t index)
+{
+    for (size_t pos = page_hash(ino, index) & g->index_mask;;
+         pos = (pos + 1) & g->index_mask) {
+        uint32_t e = g->index[pos];
+
+        if (e == SIM_GHOST_NIL
+            || (g->entries[e].ino == ino && g->entries[e].index == index)) {
+            return pos;
+        }
+    }
+}
+
+static void ghost_unlink(struct sim_ghost *g, uint32_t e)
+{
+    struct sim_ghost_entry *entry = &g->entries[e];
+
+    if (entry->prev != SIM_GHOST_NIL) {
+        g->entries[entry->prev].next = entry->next;
+    } else {
+        g->head = entry->next;
+    }
+
+    if (entry->next != SIM_GHOST_NIL) {
+        g->entries[entry->next].prev = entry->prev;
+    } else {
+        g->tail = entry->prev;
+    }
+}
+
+static void ghost_push_head(struct sim_ghost *g, uint32_t e)
+{
+    g->entries[e].prev = SIM_GHOST_NIL;
+    g->entries[e].next = g->head;
+
+    if (g->head != SIM_GHOST_NIL) {
+        g->entries[g->head].prev = e;
+    } else {
+        g->tail = e;
+    }
+    g->head = e;
+}
+
+// Removes the entry at pos of the index, returning its arena slot
+static uint32_t ghost_remove_at(struct sim_ghost *g, size_t hole)
+{
+    uint32_t e = g->index[hole];
+
+    for (size_t next = (hole + 1) & g->index_mask; g->index[next] != SIM_GHOST_NIL;
+         next = (next + 1) & g->index_mask) {
+        size_t home = ghost_home(g, g->index[next]);
+
+        if (((next - home) & g->index_mask) >= ((next - hole) & g->index_mask)) {
+            g->index[hole] = g->index[next];
+            hole = next;
+        }
+    }
+    g->index[hole] = SIM_GHOST_NIL;
+
+    ghost_unlink(g, e);
+    g->size--;
+
+    return e;
+}
+
+void sim_ghost_put(struct sim_ghost *g, uint64_t ino, uint64_t index, uint8_t value)
+{
+    if (!g) return;
+
+    size_t pos = ghost_find(g, ino, index);
+    uint32_t e = g->index[pos];
+
+    if (e != SIM_GHOST_NIL) {
+        g->entries[e].value = value;
+        ghost_unlink(g, e);
+        ghost_push_head(g, e);
+        return;
+    }
+
+    if (g->size == g->capacity) {
+        struct sim_ghost_entry *lru = &g->entries[g->tail];
+        e = ghost_remove_at(g, ghost_find(g, lru->ino, lru->index));
+        // The removal may have shifted the slot found for the new entry
+        pos = ghost_find(g, ino, index);
+    } else {
+        e = g->size;
+    }
+
+    g->entries[e].ino   = ino;
+    g->entries[e].index = index;
+    g->entries[e].value = value;
+    ghost_push_head(g, e);
+    g->index[pos] = e;
+    g->size++;
+}
+
+bool sim_ghost_take(struct sim_ghost *g, uint64_t ino, uint64_t index, uint8_t *value)
+{
+    if (!g) return false;
+
+    size_t pos = ghost_find(g, ino, index);
+    if (g->index[pos] == SIM_GHOST_NIL) return false;
+
+    uint32_t e = ghost_remove_at(g, pos);
+    *value = g->entries[e].value;
+
+    // Keep the arena dense: move the last entry into the freed slot
+    uint32_t last = g->size;
+    if (e != last) {
+        g->entries[e] = g->entries[last];
+        g->index[ghost_find(g, g->entries[e].ino, g->entries[e].index)] = e;
+
+        if (g->entries[e].prev != SIM_GHOST_NIL) {
+            g->entries[g->entries[e].prev].next = e;
+        } else {
+            g->head = e;
+        }
+        if (g->entries[e].next != SIM_GHOST_NIL) {
+            g->entries[g->entries[e].next].prev = e;
+        } else {
+            g->tail = e;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Policies
+ */
+
+static const struct sim_policy_ops *policies[] = {
+    &sim_fifo_ops,
+    &sim_mru_ops,
+    &sim_s3fifo_ops,
+    &sim_mglru_ops,
+    &sim_lhd_ops,
+    &sim_sampling_ops,
+    &sim_get_scan_ops,
+};
+
+#define TINYLFU_PREFIX "tinylfu_"
+
+const struct sim_policy_ops* sim_policy_find(const char *name, bool *tinylfu)
+{
+    *tinylfu = false;
+
+    // Like cache_ext_tinylfu.bpf.c, the default backend is MRU
+    if (strcmp(name, "tinylfu") == 0) {
+        *tinylfu = true;
+        return &sim_mru_ops;
+    }
+    if (strncmp(name, TINYLFU_PREFIX, strlen(TINYLFU_PREFIX)) == 0) {
+        *tinylfu = true;
+        name += strlen(TINYLFU_PREFIX);
+    }
+
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i]->name) == 0) {
+            return policies[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Traces
+ */
+
+struct last_page {
+    uint64_t ino;
+    uint64_t index;
+};
+
+/*
+ * Flags the references to the last page of each file. Files are found by
+ * open addressing on their inode number.
+ */
+static int mark_last_pages(struct sim_trace *trace)
+{
+    size_t size = 16;
+    size_t used = 0;
+    struct last_page *files = (struct last_page*) calloc(size, sizeof(struct last_page));
+    if (!files) return -1;
+
+    // Inode 0 marks empty slots, so it is stored shifted by one
+    for (size_t i = 0; i < trace->num_refs; i++) {
+        uint64_t ino = trace->refs[i].ino + 1;
+
+        if (2 * (used + 1) > size) {
+            struct last_page *grown = (struct last_page*) calloc(2 * size, sizeof(struct last_page));
+            if (!grown) {
+                free(files);
+                return -1;
+            }
+            for (size_t j = 0; j < size; j++) {
+                if (!files[j].ino) continue;
+
+                size_t pos = hash_64(files[j].ino) & (2 * size - 1);
+                while (grown[pos].ino) {
+                    pos = (pos + 1) & (2 * size - 1);
+                }
+                grown[pos] = files[j];
+            }
+            free(files);
+            files = grown;
+            size *= 2;
+        }
+
+        size_t pos = hash_64(ino) & (size - 1);
+        while (files[pos].ino && files[pos].ino != ino) {
+            pos = (pos + 1) & (size - 1);
+        }
+        if (!files[pos].ino) {
+            files[pos].ino   = ino;
+            files[pos].index = trace->refs[i].index;
+            used++;
+        } else if (trace->refs[i].index > files[pos].index) {
+            files[pos].index = trace->refs[i].index;
+        }
+    }
+
+    for (size_t i = 0; i < trace->num_refs; i++) {
+        uint64_t ino = trace->refs[i].ino + 1;
+        size_t pos = hash_64(ino) & (size - 1);
+
+        while (files[pos].ino != ino) {
+            pos = (pos + 1) & (size - 1);
+        }
+        if (files[pos].index == trace->refs[i].index) {
+            trace->refs[i].flags |= SIM_REF_LAST_PAGE;
+        }
+    }
+
+    free(files);
+    return 0;
+}
+
+/*
+ * Loads a binary trace, one page of file 1 per key.
+ */
+static int load_binary(const char *path, struct sim_trace *trace)
+{
+    struct sim_trace_stream s;
+    if (sim_trace_stream_open(path, &s) != 0) return -1;
+
+    struct sim_trace_cursor cur;
+    trace->num_refs = 0;
+    trace->refs = (struct sim_ref*) malloc((s.num_refs ? s.num_refs : 1) * sizeof(struct sim_ref));
+    if (!trace->refs || sim_trace_cursor_init(&cur, &s) != 0) {
+        free(trace->refs);
+        trace->refs = NULL;
+        sim_trace_stream_close(&s);
+        return -1;
+    }
+
+    const struct sim_ref *ref;
+    while ((ref = sim_trace_cursor_next(&cur))) {
+        trace->refs[trace->num_refs++] = *ref;
+    }
+
+    int err = trace->num_refs == s.num_refs ? 0 : -1;
+    sim_trace_cursor_free(&cur);
+    sim_trace_stream_close(&s);
+    return err;
+}
+
+int sim_trace_load(const char *path, struct sim_trace *trace)
+{
+    if (trace_is_binary(path)) {
+        if (load_binary(path, trace) != 0) {
+            sim_trace_free(trace);
+            return -1;
+        }
+        return 0;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    size_t capacity = 1 << 16;
+    trace->num_refs = 0;
+    trace->refs = (struct sim_ref*) malloc(capacity * sizeof(struct sim_ref));
+
+    char line[256];
+    while (trace->refs && fgets(line, sizeof(line), f)) {
+        unsigned long long fields[3];
+        int n = sscanf(line, "%llu %llu %llu", &fields[0], &fields[1], &fields[2]);
+        if (n < 1) continue;
+
+        if (trace->num_refs == capacity) {
+            capacity *= 2;
+            struct sim_ref *grown = (struct sim_ref*) realloc(
+                trace->refs, capacity * sizeof(struct sim_ref)
+            );
+            if (!grown) {
+                free(trace->refs);
+                trace->refs = NULL;
+                break;
+            }
+            trace->refs = grown;
+        }
+
+        struct sim_ref *ref = &trace->refs[trace->num_refs++];
+        ref->ino   = n == 1 ? 1 : fields[0];
+        ref->index = n == 1 ? fields[0] : fields[1];
+        ref->flags = n == 3 && fields[2] ? SIM_REF_SCAN : 0;
+    }
+    fclose(f);
+
+    if (!trace->refs || mark_last_pages(trace) != 0) {
+        sim_trace_free(trace);
+        return -1;
+    }
+
+    return 0;
+}
+
+void sim_trace_free(struct sim_trace *trace)
+{
+    if (!trace) return;
+
+    free(trace->refs);
+    trace->refs = NULL;
+    trace->num_refs = 0;
+}
+
+/*
+ * Finds the last page of a binary trace, its highest key, in one pass over
+ * the chunks. Every chunk is decoded once here, so that a corrupt one fails
+ * the open rather than cutting a replay short.
+ */
+static int binary_last_page(const struct trace_reader *r, uint64_t *last_index)
+{
+    struct trace_cursor cur;
+    if (trace_cursor_init(&cur, r, 0, trace_num_chunks(r)) != 0) return -1;
+
+    const struct trace_record *record;
+    uint64_t n = 0;
+    *last_index = 0;
+    while ((record = trace_cursor_next(&cur))) {
+        if (record->key > *last_index) {
+            *last_index = record->key;
+        }
+        n++;
+    }
+
+    trace_cursor_free(&cur);
+    return n == trace_num_records(r) ? 0 : -1;
+}
+
+int sim_trace_stream_open(const char *path, struct sim_trace_stream *s)
+{
+    memset(s, 0, sizeof(*s));
+
+    if (!trace_is_binary(path)) {
+        if (sim_trace_load(path, &s->trace) != 0) return -1;
+        s->num_refs = s->trace.num_refs;
+        return 0;
+    }
+
+    s->reader = trace_reader_open(path);
+    if (!s->reader || binary_last_page(s->reader, &s->last_index) != 0) {
+        sim_trace_stream_close(s);
+        return -1;
+    }
+    s->num_refs = trace_num_records(s->reader);
+    return 0;
+}
+
+void sim_trace_stream_close(struct sim_trace_stream *s)
+{
+    if (!s) return;
+
+    trace_reader_free(&s->reader);
+    sim_trace_free(&s->trace);
+    s->num_refs = 0;
+}
+
+int sim_trace_cursor_init(struct sim_trace_cursor *cur, const struct sim_trace_stream *s)
+{
+    memset(cur, 0, sizeof(*cur));
+    cur->stream = s;
+
+    if (!s->reader) return 0;
+    return trace_cursor_init(&cur->records, s->reader, 0, trace_num_chunks(s->reader));
+}
+
+void sim_trace_cursor_free(struct sim_trace_cursor *cur)
+{
+    if (!cur) return;
+
+    trace_cursor_free(&cur->records);
+}
+
+/*
+ * Page ids, in order of first reference: an open-addressing table of ids,
+ * each the position of its first reference in the trace.
+ */
+struct page_table {
+    const struct sim_trace *trace;
+    uint32_t *slots;
+    size_t mask;
+    uint64_t *first_refs;
+    uint64_t num_pages;
+    uint64_t capacity;
+};
+
+static int page_table_grow(struct page_table *t)
+{
+    size_t size = 2 * (t->mask + 1);
+    uint32_t *slots = (uint32_t*) malloc(size * sizeof(uint32_t));
+    uint64_t *first_refs = (uint64_t*) realloc(t->first_refs, size / 2 * sizeof(uint64_t));
+    if (!slots || !first_refs) {
+        free(slots);
+        if (first_refs) t->first_refs = first_refs;
+        return -1;
+    }
+    memset(slots, 0xff, size * sizeof(uint32_t));
+
+    for (uint64_t id = 0; id < t->num_pages; id++) {
+        const struct sim_ref *ref = &t->trace->refs[first_refs[id]];
+        size_t pos = page_hash(ref->ino, ref->index) & (size - 1);
+
+        while (slots[pos] != SIM_NO_PAGE_ID) {
+            pos = (pos + 1) & (size - 1);
+        }
+        slots[pos] = (uint32_t) id;
+    }
+
+    free(t->slots);
+    t->slots      = slots;
+    t->mask       = size - 1;
+    t->first_refs = first_refs;
+    t->capacity   = size / 2;
+    return 0;
+}
+
+int sim_trace_page_ids(const struct sim_trace *trace, uint32_t *ids, uint64_t *num_pages)
+{
+    struct page_table t = { .trace = trace, .mask = 1023 };
+    int ret = 0;
+
+    if (page_table_grow(&t) != 0) {
+        ret = -1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < trace->num_refs; i++) {
+        const struct sim_ref *ref = &trace->refs[i];
+        size_t pos = page_hash(ref->ino, ref->index) & t.mask;
+        uint32_t id;
+
+        while ((id = t.slots[pos]) != SIM_NO_PAGE_ID) {
+            const struct sim_ref *first = &trace->refs[t.first_refs[id]];
+            if (first->ino == ref->ino && first->index == ref->index) break;
+            pos = (pos + 1) & t.mask;
+        }
+
+        if (id == SIM_NO_PAGE_ID) {
+            id = (uint32_t) t.num_pages++;
+            t.slots[pos] = id;
+            t.first_refs[id] = i;
+
+            if (t.num_pages == t.capacity && page_table_grow(&t) != 0) {
+                ret = -1;
+                goto out;
+            }
+        }
+        ids[i] = id;
+    }
+    *num_pages = t.num_pages;
+
+out:
+    free(t.slots);
+    free(t.first_refs);
+    return ret;
+}
+
+int sim_trace_stream_page_ids(const struct sim_trace_stream *s, uint32_t *ids,
+                              uint64_t *num_pages)
+{
+    if (!s->reader) return sim_trace_page_ids(&s->trace, ids, num_pages);
+
+    uint64_t num_keys = s->reader->footer->num_keys;
+    uint32_t *key_ids = (uint32_t*) malloc((num_keys ? num_keys : 1) * sizeof(uint32_t));
+    struct trace_cursor cur;
+    if (!key_ids) return -1;
+    if (trace_cursor_init(&cur, s->reader, 0, trace_num_chunks(s->reader)) != 0) {
+        free(key_ids);
+        return -1;
+    }
+    memset(key_ids, 0xff, num_keys * sizeof(uint32_t));
+
+    const struct trace_record *record;
+    uint64_t pages = 0;
+    size_t n = 0;
+    int ret = 0;
+    while ((record = trace_cursor_next(&cur))) {
+        if (record->key >= num_keys) {
+            ret = -1;
+            break;
+        }
+
+        uint32_t *id = &key_ids[record->key];
+        if (*id == SIM_NO_PAGE_ID) {
+            *id = (uint32_t) pages++;
+        }
+        ids[n++] = *id;
+    }
+    if (n != s->num_refs) ret = -1;
+    *num_pages = pages;
+
+    trace_cursor_free(&cur);
+    free(key_ids);
+    return ret;
+}
@@ -0,0 +1,58 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_fifo.bpf.c: folios are added at the tail and
+ * evicted from the head, accesses are ignored.
+ */
+
+struct fifo {
+    uint8_t main_list;
+};
+
+static int fifo_init(struct sim_cache *c)
+{
+    struct fifo *p = (struct fifo*) calloc(1, sizeof(struct fifo));
+    if (!p) return -1;
+
+    p->main_list = sim_list_new(c);
+    c->policy = p;
+
+    return 0;
+}
+
+static void fifo_exit(struct sim_cache *c)
+{
+    free(c->policy);
+}
+
+static int fifo_evict_cb(struct sim_cache *c, int idx, struct sim_folio *folio)
+{
+    (void) c;
+    (void) idx;
+    (void) folio;
+
+    // Folios are always up to date and clean
+    return SIM_EVICT_NODE;
+}
+
+static void fifo_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct fifo *p = (struct fifo*) c->policy;
+
+    sim_list_iterate(c, p->main_list, fifo_evict_cb, ctx);
+}
+
+static void fifo_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct fifo *p = (struct fifo*) c->policy;
+
+    sim_list_add_tail(c, p->main_list, folio);
+}
+
+const struct sim_policy_ops sim_fifo_ops = {
+    .name         = "fifo",
+    .init         = fifo_init,
+    .exit         = fifo_exit,
+    .evict_folios = fifo_evict_folios,
+    .folio_added  = fifo_folio_added,
+};
@@ -0,0 +1,123 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_get_scan.bpf.c: sampled LFU over two lists,
+ * one for folios brought in by scanning threads and one for the others.
+ * Eviction drains the scan list while it holds enough folios to sample from.
+ * The last page of a file, where LevelDB keeps its index block, scores high.
+ */
+
+#define SAMPLING_RATE 5
+
+enum list_type {
+    LIST_GENERAL,
+    LIST_FOR_SCANS,
+    NUM_LISTS,
+};
+
+struct get_scan_meta {
+    uint64_t accesses;
+    uint64_t last_access_time;
+    bool touched_by_scan;
+};
+
+struct get_scan {
+    uint8_t sampling_lists[NUM_LISTS];
+    int64_t scan_pages;
+    // Stands in for bpf_ktime_get_ns(), in references
+    uint64_t now;
+};
+
+static int mixed_init(struct sim_cache *c)
+{
+    struct get_scan *p = (struct get_scan*) calloc(1, sizeof(struct get_scan));
+    if (!p) return -1;
+
+    for (int list_type = 0; list_type < NUM_LISTS; list_type++) {
+        p->sampling_lists[list_type] = sim_list_new(c);
+    }
+    c->policy = p;
+
+    return 0;
+}
+
+static void mixed_exit(struct sim_cache *c)
+{
+    free(c->policy);
+}
+
+static void mixed_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct get_scan *p = (struct get_scan*) c->policy;
+    struct get_scan_meta *meta = (struct get_scan_meta*) sim_folio_meta(folio);
+    bool touched_by_scan = c->ref_flags & SIM_REF_SCAN;
+
+    sim_list_add_tail(c, p->sampling_lists[touched_by_scan ? LIST_FOR_SCANS : LIST_GENERAL],
+                      folio);
+    if (touched_by_scan) {
+        p->scan_pages++;
+    }
+
+    meta->accesses         = 1;
+    meta->touched_by_scan  = touched_by_scan;
+    meta->last_access_time = ++p->now;
+}
+
+static void mixed_folio_accessed(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct get_scan *p = (struct get_scan*) c->policy;
+    struct get_scan_meta *meta = (struct get_scan_meta*) sim_folio_meta(folio);
+
+    meta->accesses++;
+    meta->last_access_time = ++p->now;
+}
+
+static void mixed_folio_evicted(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct get_scan *p = (struct get_scan*) c->policy;
+    struct get_scan_meta *meta = (struct get_scan_meta*) sim_folio_meta(folio);
+
+    sim_list_del(c, folio);
+    if (meta->touched_by_scan) {
+        p->scan_pages--;
+    }
+}
+
+static int64_t lfu_score_fn(struct sim_cache *c, struct sim_folio *folio)
+{
+    (void) c;
+
+    int64_t score = ((struct get_scan_meta*) sim_folio_meta(folio))->accesses;
+
+    // In LevelDB, the index block is at the end of the file
+    if (folio->flags & SIM_REF_LAST_PAGE) {
+        score += 100000;
+    }
+    return score;
+}
+
+static void mixed_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct get_scan *p = (struct get_scan*) c->policy;
+
+    // Left to the kernel's reclaim, as the BPF version does
+    if (p->scan_pages == 0) return;
+
+    enum list_type list_type = LIST_FOR_SCANS;
+    if (p->scan_pages < 1000 * SAMPLING_RATE) {
+        list_type = LIST_GENERAL;
+    }
+
+    sim_list_sample(c, p->sampling_lists[list_type], lfu_score_fn, SAMPLING_RATE, ctx);
+}
+
+const struct sim_policy_ops sim_get_scan_ops = {
+    .name            = "get_scan",
+    .folio_meta_size = sizeof(struct get_scan_meta),
+    .init            = mixed_init,
+    .exit            = mixed_exit,
+    .evict_folios    = mixed_evict_folios,
+    .folio_added     = mixed_folio_added,
+    .folio_accessed  = mixed_folio_accessed,
+    .folio_evicted   = mixed_folio_evicted,
+};
@@ -0,0 +1,365 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_lhd.bpf.c, Least Hit Density (Beckmann et al.,
+ * NSDI '18): folios are sampled and the one with the lowest expected hits
+ * per unit of cache space and time, learnt per class of past reuse distances,
+ * is evicted. The loader runs the reconfiguration the BPF program requests
+ * every REQS_PER_RECONFIG events; the simulator runs it synchronously.
+ */
+
+#define HIT_AGE_CLASSES 16
+#define APP_CLASSES 16
+#define NUM_CLASSES ((HIT_AGE_CLASSES) * (APP_CLASSES))
+#define NUM_CLASSES_MASK (NUM_CLASSES - 1)
+#define INITIAL_AGE_COARSENING_SHIFT 10
+#define REQS_PER_RECONFIG (1 << 20)
+#define MAX_AGE (1 << 14)
+#define MAX_AGE_MASK (MAX_AGE - 1)
+#define DEFAULT_APP_ID 1
+
+#define HIT_SCALING_FACTOR (1 << 20)
+#define HIT_DENSITY_SCALING_FACTOR (1 << 20)
+#define NUM_OBJECTS_SCALING_FACTOR (1 << 20)
+
+#define TOTAL_EVENTS_THRESH (HIT_SCALING_FACTOR / 100000)
+#define AGE_COARSENING_ERROR_TOLERANCE 100
+
+struct lhd_meta {
+    uint64_t last_access_time;
+    uint64_t last_hit_age;
+    uint64_t last_last_hit_age;
+    uint32_t app;
+};
+
+struct lhd_class {
+    uint64_t total_hits;
+    uint64_t total_evictions;
+
+    uint64_t hits[MAX_AGE];
+    uint64_t evictions[MAX_AGE];
+    uint64_t hit_densities[MAX_AGE];
+};
+
+/*
+ * Every folio belongs to DEFAULT_APP_ID, so only its HIT_AGE_CLASSES classes
+ * of the NUM_CLASSES are ever read; the others are not allocated.
+ */
+struct lhd {
+    uint8_t lhd_list;
+
+    uint64_t next_reconfiguration;
+    uint32_t num_reconfigurations;
+
+    uint64_t age_coarsening_shift;
+    uint64_t ewma_num_objects;
+    uint64_t ewma_num_objects_mass;
+    uint64_t ewma_victim_hit_density;
+
+    // Current number of requests
+    uint64_t timestamp;
+    uint64_t overflows;
+    uint64_t num_objects;
+
+    struct lhd_class classes[HIT_AGE_CLASSES];
+};
+
+static inline uint64_t ewma_decay(uint64_t val)
+{
+    return (val * 9) / 10;
+}
+
+static inline uint64_t rem_ewma_decay(uint64_t val)
+{
+    return val / 10;
+}
+
+static inline uint32_t hit_age_to_class(uint64_t hit_age)
+{
+    uint32_t class = 0;
+
+    if (hit_age == 0) return 0;
+
+    // Approximates log(MAX_AGE - hit_age)
+    while (hit_age < MAX_AGE && class < HIT_AGE_CLASSES - 1) {
+        hit_age <<= 1;
+        class++;
+    }
+
+    return class;
+}
+
+static inline uint32_t get_class_id(struct lhd_meta *data)
+{
+    uint32_t hit_age_id = hit_age_to_class(data->last_hit_age + data->last_last_hit_age);
+    return data->app * HIT_AGE_CLASSES + hit_age_id;
+}
+
+static inline struct lhd_class* get_class(struct lhd *p, struct lhd_meta *data)
+{
+    uint32_t class_id = get_class_id(data) & NUM_CLASSES_MASK;
+    return &p->classes[class_id - DEFAULT_APP_ID * HIT_AGE_CLASSES];
+}
+
+static inline uint64_t get_age(struct lhd *p, struct lhd_meta *data)
+{
+    uint64_t age = (p->timestamp - data->last_access_time) >> p->age_coarsening_shift;
+
+    if (age >= MAX_AGE) {
+        p->overflows++;
+        return MAX_AGE - 1;
+    }
+
+    return age;
+}
+
+static inline uint64_t get_hit_density(struct lhd *p, struct lhd_meta *data)
+{
+    uint64_t age = get_age(p, data);
+    if (age == MAX_AGE - 1) return 0;
+
+    return get_class(p, data)->hit_densities[age];
+}
+
+static void update_class(struct lhd_class *cls)
+{
+    cls->total_hits = 0;
+    cls->total_evictions = 0;
+
+    for (int i = 0; i < MAX_AGE; i++) {
+        cls->hits[i]      = ewma_decay(cls->hits[i]);
+        cls->evictions[i] = ewma_decay(cls->evictions[i]);
+
+        cls->total_hits      += cls->hits[i];
+        cls->total_evictions += cls->evictions[i];
+    }
+}
+
+static void stretch_distribution(struct lhd *p, int32_t delta)
+{
+    for (int i = 0; i < HIT_AGE_CLASSES; i++) {
+        struct lhd_class *cls = &p->classes[i];
+        int init_age = MAX_AGE >> (-delta);
+
+        for (uint32_t j = init_age; j < MAX_AGE - 1; j++) {
+            cls->hits[MAX_AGE - 1] += cls->hits[j];
+            cls->evictions[MAX_AGE - 1] = cls->evictions[j];
+        }
+        // MAX_AGE - 2 down to 0
+        for (uint32_t j = 2; j < MAX_AGE + 1; j++) {
+            uint32_t index = MAX_AGE - j;
+
+            cls->hits[index & MAX_AGE_MASK] =
+                cls->hits[(j >> (-delta)) & MAX_AGE_MASK] / (1 << (-delta));
+            cls->evictions[index & MAX_AGE_MASK] =
+                cls->evictions[(j >> (-delta)) & MAX_AGE_MASK] / (1 << (-delta));
+        }
+    }
+}
+
+static void compress_distribution(struct lhd *p, int32_t delta)
+{
+    for (int i = 0; i < HIT_AGE_CLASSES; i++) {
+        struct lhd_class *cls = &p->classes[i];
+
+        for (uint32_t j = 0; j < (uint32_t) (MAX_AGE >> delta); j++) {
+            cls->hits[j & MAX_AGE_MASK]      = cls->hits[(j << delta) & MAX_AGE_MASK];
+            cls->evictions[j & MAX_AGE_MASK] = cls->evictions[(j << delta) & MAX_AGE_MASK];
+            for (int k = 1; k < (1 << delta); k++) {
+                cls->hits[j & MAX_AGE_MASK] +=
+                    cls->hits[((j << delta) + k) & MAX_AGE_MASK];
+                cls->evictions[j & MAX_AGE_MASK] +=
+                    cls->evictions[((j << delta) + k) & MAX_AGE_MASK];
+            }
+        }
+
+        for (uint32_t j = MAX_AGE >> delta; j < MAX_AGE - 1; j++) {
+            cls->hits[j & MAX_AGE_MASK]      = 0;
+            cls->evictions[j & MAX_AGE_MASK] = 0;
+        }
+    }
+}
+
+static void adapt_age_coarsening(struct lhd *p)
+{
+    p->ewma_num_objects      = ewma_decay(p->ewma_num_objects);
+    p->ewma_num_objects_mass = ewma_decay(p->ewma_num_objects_mass);
+
+    p->ewma_num_objects      += p->num_objects * NUM_OBJECTS_SCALING_FACTOR;
+    p->ewma_num_objects_mass += 1;
+
+    uint64_t num_objects_coarsening = p->ewma_num_objects / p->ewma_num_objects_mass;
+    uint64_t optimal_age_coarsening =
+        1 * num_objects_coarsening * AGE_COARSENING_ERROR_TOLERANCE / MAX_AGE;
+
+    if (p->num_reconfigurations == 5 || p->num_reconfigurations == 25) {
+        uint32_t optimal_age_coarsening_log2 = 1;
+
+        // In 64 bits, where the BPF version overflows an int past 2^31
+        while ((1ULL << optimal_age_coarsening_log2) * NUM_OBJECTS_SCALING_FACTOR
+               < optimal_age_coarsening) {
+            optimal_age_coarsening_log2++;
+        }
+
+        int32_t delta = optimal_age_coarsening_log2 - p->age_coarsening_shift;
+        p->age_coarsening_shift = optimal_age_coarsening_log2;
+
+        p->ewma_num_objects      *= 8;
+        p->ewma_num_objects_mass *= 8;
+
+        if (delta < 0) {
+            stretch_distribution(p, delta);
+        } else if (delta > 0) {
+            compress_distribution(p, delta);
+        }
+    }
+}
+
+static void model_hit_density(struct lhd *p)
+{
+    for (int i = 0; i < HIT_AGE_CLASSES; i++) {
+        struct lhd_class *cls = &p->classes[i];
+        uint64_t total_hits = cls->hits[MAX_AGE - 1];
+        uint64_t total_events = total_hits + cls->evictions[MAX_AGE - 1];
+        uint64_t lifetime_unconditioned = total_events;
+
+        for (int j = 2; j < MAX_AGE + 1; j++) {
+            uint32_t index = MAX_AGE - j;
+
+            total_hits   += cls->hits[index & MAX_AGE_MASK];
+            total_events += cls->evictions[index & MAX_AGE_MASK];
+            lifetime_unconditioned += total_events;
+
+            if (total_events > TOTAL_EVENTS_THRESH) {
+                cls->hit_densities[index & MAX_AGE_MASK] =
+                    total_hits * HIT_DENSITY_SCALING_FACTOR / lifetime_unconditioned;
+            } else {
+                cls->hit_densities[index & MAX_AGE_MASK] = 0;
+            }
+        }
+    }
+}
+
+static void reconfigure(struct lhd *p)
+{
+    for (int i = 0; i < HIT_AGE_CLASSES; i++) {
+        update_class(&p->classes[i]);
+    }
+
+    adapt_age_coarsening(p);
+    model_hit_density(p);
+
+    p->overflows = 0;
+}
+
+static void count_request(struct lhd *p)
+{
+    p->timestamp++;
+
+    if (--p->next_reconfiguration == 0) {
+        p->next_reconfiguration = REQS_PER_RECONFIG;
+        p->num_reconfigurations++;
+        reconfigure(p);
+    }
+}
+
+static int lhd_init(struct sim_cache *c)
+{
+    struct lhd *p = (struct lhd*) calloc(1, sizeof(struct lhd));
+    if (!p) return -1;
+
+    p->lhd_list = sim_list_new(c);
+    p->next_reconfiguration = REQS_PER_RECONFIG;
+    p->age_coarsening_shift = INITIAL_AGE_COARSENING_SHIFT;
+
+    // Hit densities start as GDSF
+    for (int i = 0; i < HIT_AGE_CLASSES; i++) {
+        uint64_t class_id = DEFAULT_APP_ID * HIT_AGE_CLASSES + i;
+
+        for (int j = 0; j < MAX_AGE; j++) {
+            p->classes[i].hit_densities[j] =
+                1ULL * HIT_DENSITY_SCALING_FACTOR * (class_id + 1) / (j + 1);
+        }
+    }
+    c->policy = p;
+
+    return 0;
+}
+
+static void lhd_exit(struct sim_cache *c)
+{
+    free(c->policy);
+}
+
+static int64_t lhd_score_fn(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct lhd *p = (struct lhd*) c->policy;
+
+    return (int64_t) get_hit_density(p, (struct lhd_meta*) sim_folio_meta(folio));
+}
+
+static void lhd_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct lhd *p = (struct lhd*) c->policy;
+
+    sim_list_sample(c, p->lhd_list, lhd_score_fn, 16, ctx);
+}
+
+static void lhd_folio_accessed(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct lhd *p = (struct lhd*) c->policy;
+    struct lhd_meta *data = (struct lhd_meta*) sim_folio_meta(folio);
+
+    uint64_t age = get_age(p, data);
+    struct lhd_class *cls = get_class(p, data);
+
+    data->last_last_hit_age = data->last_hit_age;
+    data->last_hit_age      = age;
+    data->last_access_time  = p->timestamp;
+
+    cls->hits[age] += 1 * HIT_SCALING_FACTOR;
+
+    count_request(p);
+}
+
+static void lhd_folio_evicted(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct lhd *p = (struct lhd*) c->policy;
+    struct lhd_meta *data = (struct lhd_meta*) sim_folio_meta(folio);
+
+    uint64_t age = get_age(p, data);
+    struct lhd_class *cls = get_class(p, data);
+
+    cls->evictions[age] += 1 * HIT_SCALING_FACTOR;
+    p->num_objects--;
+
+    p->ewma_victim_hit_density = ewma_decay(p->ewma_victim_hit_density)
+                                 + rem_ewma_decay(cls->hit_densities[age]);
+}
+
+static void lhd_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct lhd *p = (struct lhd*) c->policy;
+    struct lhd_meta *data = (struct lhd_meta*) sim_folio_meta(folio);
+
+    sim_list_add_tail(c, p->lhd_list, folio);
+
+    data->last_access_time  = p->timestamp;
+    data->last_hit_age      = 0;
+    data->last_last_hit_age = MAX_AGE;
+    data->app               = DEFAULT_APP_ID % APP_CLASSES;
+
+    p->num_objects++;
+    count_request(p);
+}
+
+const struct sim_policy_ops sim_lhd_ops = {
+    .name            = "lhd",
+    .folio_meta_size = sizeof(struct lhd_meta),
+    .init            = lhd_init,
+    .exit            = lhd_exit,
+    .evict_folios    = lhd_evict_folios,
+    .folio_added     = lhd_folio_added,
+    .folio_accessed  = lhd_folio_accessed,
+    .folio_evicted   = lhd_folio_evicted,
+};
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sim.h"
+
+/*
+ * Trace-driven simulator: replays a page reference trace against every
+ * (policy, cache size) pair, one pair per thread, and prints one CSV row per
+ * pair. Each thread replays binary traces through its own cursor over the
+ * mapping, so they are never loaded.
+ */
+
+#define MAX_POLICIES 32
+#define MAX_SIZES 256
+
+static const char *USAGE =
+    "Usage: %s -t <trace> -p <policy>[,<policy>...]\n"
+    "          (-s <pages>[,<pages>...] | -r <min>:<max>:<count>)\n"
+    "          [-b <batch>] [-j <threads>]\n"
+    "\n"
+    "Policies: fifo, mru, s3fifo, mglru, lhd, sampling, get_scan, and\n"
+    "          tinylfu_<policy> for TinyLFU admission in front of <policy>\n"
+    "          (tinylfu alone is tinylfu_mru).\n"
+    "-r        sweeps <count> cache sizes spaced geometrically in [min, max].\n"
+    "-b        folios selected per eviction, at most 32 (default 32).\n"
+    "-j        threads, one cache size per thread (default: online CPUs).\n";
+
+struct job {
+    const char *policy;
+    size_t capacity;
+    struct sim_stats stats;
+    double seconds;
+    int error;
+};
+
+struct sweep {
+    const struct sim_trace_stream *trace;
+    struct job *jobs;
+    size_t num_jobs;
+    size_t batch;
+    // Next job to run
+    size_t next;
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_job(struct sweep *s, struct job *job)
+{
+    bool tinylfu;
+    const struct sim_policy_ops *ops = sim_policy_find(job->policy, &tinylfu);
+    struct sim_cache *c = sim_cache_init(ops, job->capacity, s->batch, tinylfu);
+    struct sim_trace_cursor cur;
+    if (!c || sim_trace_cursor_init(&cur, s->trace) != 0) {
+        sim_cache_free(&c);
+        job->error = 1;
+        return;
+    }
+
+    double start = now_seconds();
+    const struct sim_ref *ref;
+    while ((ref = sim_trace_cursor_next(&cur))) {
+        sim_cache_access(c, ref);
+    }
+    job->seconds = now_seconds() - start;
+    job->stats = c->stats;
+
+    sim_trace_cursor_free(&cur);
+    sim_cache_free(&c);
+}
+
+static void *worker(void *arg)
+{
+    struct sweep *s = (struct sweep*) arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+        if (i >= s->num_jobs) break;
+
+        run_job(s, &s->jobs[i]);
+    }
+    return NULL;
+}
+
+static size_t split(char *list, char **items, size_t max)
+{
+    size_t n = 0;
+
+    for (char *item = strtok(list, ","); item && n < max; item = strtok(NULL, ",")) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+static size_t parse_sizes(char *list, size_t *sizes)
+{
+    char *items[MAX_SIZES];
+    size_t n = split(list, items, MAX_SIZES);
+
+    for (size_t i = 0; i < n; i++) {
+        sizes[i] = strtoull(items[i], NULL, 10);
+    }
+    return n;
+}
+
+static size_t parse_range(const char *range, size_t *sizes)
+{
+    unsigned long long min, max, count;
+    if (sscanf(range, "%llu:%llu:%llu", &min, &max, &count) != 3
+        || min == 0 || max < min || count == 0 || count > MAX_SIZES) {
+        return 0;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        double t = count > 1 ? (double) i / (count - 1) : 0;
+        size_t size = (size_t) llround(min * pow((double) max / min, t));
+
+        // Small ranges round several steps to the same size
+        if (n == 0 || size != sizes[n - 1]) {
+            sizes[n++] = size;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = NULL;
+    char *policy_list = NULL;
+    char *policies[MAX_POLICIES];
+    size_t sizes[MAX_SIZES];
+    size_t num_policies = 0;
+    size_t num_sizes = 0;
+    size_t batch = SIM_EVICT_BATCH;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:p:s:r:b:j:h")) != -1) {
+        switch (opt) {
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'p':
+            policy_list = optarg;
+            break;
+        case 's':
+            num_sizes = parse_sizes(optarg, sizes);
+            break;
+        case 'r':
+            num_sizes = parse_range(optarg, sizes);
+            break;
+        case 'b':
+            batch = strtoull(optarg, NULL, 10);
+            break;
+        case 'j':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!trace_path || !policy_list || num_sizes == 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    num_policies = split(policy_list, policies, MAX_POLICIES);
+    for (size_t i = 0; i < num_policies; i++) {
+        bool tinylfu;
+        if (!sim_policy_find(policies[i], &tinylfu)) {
+            fprintf(stderr, "Unknown policy: %s\n", policies[i]);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < num_sizes; i++) {
+        if (sizes[i] == 0) {
+            fprintf(stderr, "Cache sizes must be positive\n");
+            return 1;
+        }
+    }
+
+    struct sim_trace_stream trace;
+    if (sim_trace_stream_open(trace_path, &trace) != 0) {
+        fprintf(stderr, "Failed to open trace %s\n", trace_path);
+        return 1;
+    }
+    fprintf(stderr, "Opened %zu references from %s\n", trace.num_refs, trace_path);
+
+    struct sweep s = {
+        .trace    = &trace,
+        .num_jobs = num_policies * num_sizes,
+        .batch    = batch,
+    };
+    s.jobs = (struct job*) calloc(s.num_jobs, sizeof(struct job));
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if ((size_t) num_threads > s.num_jobs) {
+        num_threads = s.num_jobs;
+    }
+    pthread_t *threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+
+    if (!s.jobs || !threads) {
+        fprintf(stderr, "Failed to allocate %zu jobs\n", s.num_jobs);
+        sim_trace_stream_close(&trace);
+        return 1;
+    }
+
+    for (size_t p = 0; p < num_policies; p++) {
+        for (size_t i = 0; i < num_sizes; i++) {
+            s.jobs[p * num_sizes + i].policy   = policies[p];
+            s.jobs[p * num_sizes + i].capacity = sizes[i];
+        }
+    }
+
+    for (long t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t], NULL, worker, &s);
+    }
+    for (long t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    int status = 0;
+    printf("policy,cache_pages,accesses,hits,misses,hit_ratio,evictions,"
+           "rejections,failed_evictions,seconds\n");
+    for (size_t i = 0; i < s.num_jobs; i++) {
+        struct job *job = &s.jobs[i];
+
+        if (job->error) {
+            fprintf(stderr, "Failed to simulate %s with %zu pages\n",
+                    job->policy, job->capacity);
+            status = 1;
+            continue;
+        }
+
+        printf("%s,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f,%" PRIu64 ",%" PRIu64
+               ",%" PRIu64 ",%.3f\n",
+               job->policy, job->capacity, job->stats.accesses, job->stats.hits,
+               job->stats.misses,
+               job->stats.accesses ? (double) job->stats.hits / job->stats.accesses : 0,
+               job->stats.evictions, job->stats.rejections, job->stats.failed_evictions,
+               job->seconds);
+    }
+
+    free(threads);
+    free(s.jobs);
+    sim_trace_stream_close(&trace);
+    return status;
+}
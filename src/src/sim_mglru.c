@@ -0,0 +1,412 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_mglru.bpf.c, itself a port of the kernel's
+ * multi-generational LRU: folios are added to one of up to MAX_NR_GENS
+ * generation lists and evicted from the oldest one, except for those whose
+ * tier (log2 of their accesses) the PID controller on refaults protects,
+ * which move to the next generation.
+ */
+
+#define MAX_NR_GHOST_ENTRIES 400000
+
+#define MAX_NR_TIERS 4
+#define MIN_NR_GENS 2
+#define MAX_NR_GENS 4
+#define NR_HIST_GENS 1
+#define MIN_LRU_BATCH 64
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct mglru_meta {
+    int64_t accesses;
+    int64_t gen;
+};
+
+struct mglru_global_metadata {
+    unsigned long max_seq;
+    unsigned long min_seq;
+    int64_t evicted[MAX_NR_TIERS];
+    int64_t refaulted[MAX_NR_TIERS];
+    int64_t tier_selected[MAX_NR_TIERS];
+    int64_t success_evicted;
+    int64_t failed_evicted;
+    unsigned long avg_refaulted[MAX_NR_TIERS];
+    unsigned long avg_total[MAX_NR_TIERS];
+    unsigned long protected[MAX_NR_TIERS - 1];
+    long nr_pages[MAX_NR_GENS];
+};
+
+struct eviction_metadata {
+    uint64_t curr_gen;
+    uint64_t next_gen;
+    uint64_t iter_reached;
+    uint64_t tier_threshold;
+};
+
+struct mglru {
+    struct mglru_global_metadata lrugen;
+    struct eviction_metadata eviction_meta;
+    uint8_t mglru_lists[MAX_NR_GENS];
+    struct sim_ghost *ghost;
+};
+
+static inline int64_t read_refaulted_stat(struct mglru_global_metadata *lrugen, int tier)
+{
+    return max(0, lrugen->refaulted[tier]);
+}
+
+static inline int64_t read_evicted_stat(struct mglru_global_metadata *lrugen, int tier)
+{
+    return max(0, lrugen->evicted[tier]);
+}
+
+static inline int64_t read_nr_pages_stat(struct mglru_global_metadata *lrugen, unsigned int gen)
+{
+    return max(0, lrugen->nr_pages[gen]);
+}
+
+/*
+ * PID controller
+ */
+
+struct ctrl_pos {
+    unsigned long refaulted;
+    unsigned long total;
+    int gain;
+};
+
+static void read_ctrl_pos(struct mglru_global_metadata *lrugen, int tier, int gain,
+                          struct ctrl_pos *pos)
+{
+    pos->refaulted = lrugen->avg_refaulted[tier] + lrugen->refaulted[tier];
+    pos->total     = lrugen->avg_total[tier] + lrugen->evicted[tier];
+    if (tier) {
+        pos->total += lrugen->protected[tier - 1];
+    }
+    pos->gain = gain;
+}
+
+static void reset_ctrl_pos(struct mglru_global_metadata *lrugen, bool carryover)
+{
+    bool clear = carryover ? NR_HIST_GENS == 1 : NR_HIST_GENS > 1;
+
+    if (!carryover && !clear) return;
+
+    for (int tier = 0; tier < MAX_NR_TIERS; tier++) {
+        if (carryover) {
+            unsigned long sum;
+
+            sum = lrugen->avg_refaulted[tier] + lrugen->refaulted[tier];
+            lrugen->avg_refaulted[tier] = sum / 2;
+
+            sum = lrugen->avg_total[tier] + lrugen->evicted[tier];
+            if (tier) {
+                sum += lrugen->protected[tier - 1];
+            }
+            lrugen->avg_total[tier] = sum / 2;
+        }
+
+        if (clear) {
+            lrugen->refaulted[tier] = 0;
+            lrugen->evicted[tier]   = 0;
+            if (tier) {
+                lrugen->protected[tier - 1] = 0;
+            }
+        }
+    }
+}
+
+static bool positive_ctrl_err(struct ctrl_pos *sp, struct ctrl_pos *pv)
+{
+    // The PV has a limited number of refaults or a lower refaulted/total
+    // than the SP
+    return pv->refaulted < MIN_LRU_BATCH
+           || pv->refaulted * (sp->total + MIN_LRU_BATCH) * sp->gain
+                  <= (sp->refaulted + 1) * pv->total * pv->gain;
+}
+
+static int get_tier_idx(struct mglru_global_metadata *lrugen)
+{
+    struct ctrl_pos sp, pv;
+    int tier;
+
+    // Larger gain factor (1:2) for the other tiers, as a margin
+    read_ctrl_pos(lrugen, 0, 1, &sp);
+    for (tier = 1; tier < MAX_NR_TIERS; tier++) {
+        read_ctrl_pos(lrugen, tier, 2, &pv);
+        if (!positive_ctrl_err(&sp, &pv)) break;
+    }
+
+    return tier - 1;
+}
+
+/*
+ * Generations
+ */
+
+static inline unsigned int lru_gen_from_seq(unsigned long seq)
+{
+    return seq % MAX_NR_GENS;
+}
+
+// Only counts up to 3
+static inline int order_base_2(int n)
+{
+    if (n <= 1) {
+        return 0;
+    } else if (n <= 3) {
+        return 1;
+    } else if (n <= 7) {
+        return 2;
+    }
+    return 3;
+}
+
+// Without the kernel's + 1, as in the BPF version
+static inline int lru_tier_from_refs(int refs)
+{
+    return order_base_2(refs);
+}
+
+static inline bool folio_test_active(struct sim_folio *folio)
+{
+    return ((struct mglru_meta*) sim_folio_meta(folio))->accesses >= 2;
+}
+
+static inline int get_nr_gens(struct mglru_global_metadata *lrugen)
+{
+    return lrugen->max_seq - lrugen->min_seq + 1;
+}
+
+static inline bool gen_almost_empty(struct mglru_global_metadata *lrugen, int min_seq)
+{
+    return read_nr_pages_stat(lrugen, lru_gen_from_seq(min_seq)) <= 4;
+}
+
+static void lru_gen_add_folio(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct mglru *p = (struct mglru*) c->policy;
+    struct mglru_global_metadata *lrugen = &p->lrugen;
+    struct mglru_meta *meta = (struct mglru_meta*) sim_folio_meta(folio);
+    unsigned long min_seq = lrugen->min_seq;
+    unsigned long max_seq = lrugen->max_seq;
+    unsigned long seq;
+
+    // Folios are never pending writeback here, so cases 1, 3 and 4 of the
+    // kernel apply
+    if (folio_test_active(folio)) {
+        seq = max_seq;
+    } else if (min_seq + MIN_NR_GENS >= max_seq) {
+        seq = min_seq;
+    } else {
+        seq = min_seq + 1;
+    }
+
+    unsigned int gen = lru_gen_from_seq(seq);
+
+    meta->accesses = 1;
+    meta->gen      = gen;
+    lrugen->nr_pages[gen]++;
+
+    uint8_t tier;
+    if (sim_ghost_take(p->ghost, folio->ino, folio->index, &tier)) {
+        lrugen->refaulted[tier]++;
+    }
+
+    sim_list_add(c, p->mglru_lists[gen], folio);
+}
+
+static bool should_run_aging(struct mglru_global_metadata *lrugen, unsigned long max_seq)
+{
+    unsigned long min_seq = lrugen->min_seq;
+    unsigned long old = 0;
+    unsigned long young = 0;
+    unsigned long total = 0;
+
+    // Completely out of cold folios
+    if (min_seq + MIN_NR_GENS > max_seq) return true;
+
+    int max_iter = min(MAX_NR_GENS, max_seq - min_seq);
+    for (int i = 0; i < max_iter; i++) {
+        unsigned long seq  = min_seq + i;
+        unsigned long size = read_nr_pages_stat(lrugen, lru_gen_from_seq(seq));
+
+        total += size;
+        if (seq == max_seq) {
+            young += size;
+        } else if (seq + MIN_NR_GENS == max_seq) {
+            old += size;
+        }
+    }
+
+    // The ideal number of generations is MIN_NR_GENS + 1
+    if (min_seq + MIN_NR_GENS < max_seq) return false;
+
+    // Spread pages evenly: between 1/(MIN_NR_GENS + 2) and 1/MIN_NR_GENS per
+    // generation
+    if (young * MIN_NR_GENS > total) return true;
+    if (old * (MIN_NR_GENS + 2) < total) return true;
+
+    return false;
+}
+
+static bool try_to_inc_min_seq(struct mglru_global_metadata *lrugen)
+{
+    if (!gen_almost_empty(lrugen, lrugen->min_seq)) return false;
+
+    lrugen->min_seq++;
+    reset_ctrl_pos(lrugen, true);
+    return true;
+}
+
+static bool try_to_inc_max_seq(struct mglru_global_metadata *lrugen)
+{
+    if (get_nr_gens(lrugen) == MAX_NR_GENS && !try_to_inc_min_seq(lrugen)) {
+        return false;
+    }
+
+    reset_ctrl_pos(lrugen, false);
+    lrugen->max_seq++;
+    return true;
+}
+
+/*
+ * Policy
+ */
+
+static int mglru_init(struct sim_cache *c)
+{
+    struct mglru *p = (struct mglru*) calloc(1, sizeof(struct mglru));
+    if (!p) return -1;
+
+    p->lrugen.max_seq = MIN_NR_GENS + 1;
+    for (int i = 0; i < MAX_NR_GENS; i++) {
+        p->mglru_lists[i] = sim_list_new(c);
+    }
+    p->ghost = sim_ghost_init(MAX_NR_GHOST_ENTRIES);
+    if (!p->ghost) {
+        free(p);
+        return -1;
+    }
+    c->policy = p;
+
+    return 0;
+}
+
+static void mglru_exit(struct sim_cache *c)
+{
+    struct mglru *p = (struct mglru*) c->policy;
+
+    sim_ghost_free(&p->ghost);
+    free(p);
+}
+
+// Ported from sort_folio()
+static int mglru_iter_fn(struct sim_cache *c, int idx, struct sim_folio *folio)
+{
+    struct mglru *p = (struct mglru*) c->policy;
+    struct mglru_global_metadata *lrugen = &p->lrugen;
+    struct eviction_metadata *eviction_meta = &p->eviction_meta;
+    struct mglru_meta *meta = (struct mglru_meta*) sim_folio_meta(folio);
+
+    eviction_meta->iter_reached = idx;
+
+    int tier = lru_tier_from_refs(meta->accesses);
+
+    // Protected: promote to the next generation
+    if (tier > (int) eviction_meta->tier_threshold) {
+        lrugen->protected[tier - 1]++;
+        lrugen->nr_pages[eviction_meta->curr_gen]--;
+        lrugen->nr_pages[eviction_meta->next_gen]++;
+        meta->gen = eviction_meta->next_gen;
+        return SIM_CONTINUE_ITER;
+    }
+
+    return SIM_EVICT_NODE;
+}
+
+static void iterate_oldest_gen(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct mglru *p = (struct mglru*) c->policy;
+    unsigned int oldest_gen = lru_gen_from_seq(p->lrugen.min_seq);
+    unsigned int next_gen   = (oldest_gen + 1) % MAX_NR_GENS;
+    struct sim_iterate_opts opts = {
+        .continue_list = p->mglru_lists[next_gen],
+        .continue_mode = SIM_ITERATE_TAIL,
+        .evict_list    = SIM_ITERATE_SELF,
+        .evict_mode    = SIM_ITERATE_TAIL,
+    };
+
+    sim_list_iterate_extended(c, p->mglru_lists[oldest_gen], mglru_iter_fn, &opts, ctx);
+}
+
+static void mglru_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct mglru *p = (struct mglru*) c->policy;
+    struct mglru_global_metadata *lrugen = &p->lrugen;
+    unsigned long min_seq = lrugen->min_seq;
+    unsigned long max_seq = lrugen->max_seq;
+
+    if (should_run_aging(lrugen, max_seq)) {
+        try_to_inc_max_seq(lrugen);
+    }
+    if (max_seq - min_seq > MIN_NR_GENS) {
+        try_to_inc_min_seq(lrugen);
+    }
+
+    unsigned int oldest_gen = lru_gen_from_seq(lrugen->min_seq);
+    int tier_threshold = get_tier_idx(lrugen);
+    lrugen->tier_selected[tier_threshold]++;
+
+    p->eviction_meta = (struct eviction_metadata) {
+        .curr_gen       = oldest_gen,
+        .next_gen       = (oldest_gen + 1) % MAX_NR_GENS,
+        .tier_threshold = tier_threshold,
+    };
+
+    iterate_oldest_gen(c, ctx);
+    if (ctx->nr_folios_to_evict < ctx->request_nr_folios_to_evict) {
+        iterate_oldest_gen(c, ctx);
+    }
+
+    lrugen->success_evicted += ctx->nr_folios_to_evict;
+    lrugen->failed_evicted  += ctx->request_nr_folios_to_evict - ctx->nr_folios_to_evict;
+}
+
+static void mglru_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    lru_gen_add_folio(c, folio);
+}
+
+static void mglru_folio_accessed(struct sim_cache *c, struct sim_folio *folio)
+{
+    (void) c;
+
+    ((struct mglru_meta*) sim_folio_meta(folio))->accesses++;
+}
+
+static void mglru_folio_evicted(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct mglru *p = (struct mglru*) c->policy;
+    struct mglru_meta *meta = (struct mglru_meta*) sim_folio_meta(folio);
+
+    // Ghost entry for refault detection
+    int tier = lru_tier_from_refs(meta->accesses);
+    sim_ghost_put(p->ghost, folio->ino, folio->index, tier);
+
+    p->lrugen.evicted[tier]++;
+    p->lrugen.nr_pages[meta->gen]--;
+}
+
+const struct sim_policy_ops sim_mglru_ops = {
+    .name            = "mglru",
+    .folio_meta_size = sizeof(struct mglru_meta),
+    .init            = mglru_init,
+    .exit            = mglru_exit,
+    .evict_folios    = mglru_evict_folios,
+    .folio_added     = mglru_folio_added,
+    .folio_accessed  = mglru_folio_accessed,
+    .folio_evicted   = mglru_folio_evicted,
+};
@@ -0,0 +1,73 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_mru.bpf.c: folios are added and moved to the
+ * head on access, and evicted from the head.
+ */
+
+struct mru {
+    uint8_t mru_list;
+};
+
+static int mru_init(struct sim_cache *c)
+{
+    struct mru *p = (struct mru*) calloc(1, sizeof(struct mru));
+    if (!p) return -1;
+
+    p->mru_list = sim_list_new(c);
+    c->policy = p;
+
+    return 0;
+}
+
+static void mru_exit(struct sim_cache *c)
+{
+    free(c->policy);
+}
+
+static void mru_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct mru *p = (struct mru*) c->policy;
+
+    sim_list_add(c, p->mru_list, folio);
+}
+
+static void mru_folio_accessed(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct mru *p = (struct mru*) c->policy;
+
+    sim_list_move(c, p->mru_list, folio, false);
+}
+
+static void mru_folio_evicted(struct sim_cache *c, struct sim_folio *folio)
+{
+    sim_list_del(c, folio);
+}
+
+static int iterate_mru(struct sim_cache *c, int idx, struct sim_folio *folio)
+{
+    (void) c;
+    (void) idx;
+    (void) folio;
+
+    // The first 200 folios are only skipped if not up to date, which they
+    // always are here
+    return SIM_EVICT_NODE;
+}
+
+static void mru_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct mru *p = (struct mru*) c->policy;
+
+    sim_list_iterate(c, p->mru_list, iterate_mru, ctx);
+}
+
+const struct sim_policy_ops sim_mru_ops = {
+    .name           = "mru",
+    .init           = mru_init,
+    .exit           = mru_exit,
+    .evict_folios   = mru_evict_folios,
+    .folio_added    = mru_folio_added,
+    .folio_accessed = mru_folio_accessed,
+    .folio_evicted  = mru_folio_evicted,
+};
@@ -0,0 +1,196 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_s3fifo.bpf.c. New folios enter the small FIFO,
+ * or the main FIFO if the ghost map remembers them. Folios leaving the small
+ * FIFO move to main if accessed more than once, and main is scanned in up to
+ * four passes that decrement frequencies, each pass evicting below a higher
+ * threshold.
+ */
+
+struct s3fifo_meta {
+    int64_t freq;
+    bool in_main;
+};
+
+struct s3fifo {
+    uint8_t main_list;
+    uint8_t small_list;
+    struct sim_ghost *ghost;
+    size_t cache_size;
+
+    // Approximate, based on what is chosen for eviction
+    int64_t small_list_size;
+    int64_t main_list_size;
+
+    // Threshold of the current main pass, MAIN_ITER_FN(id)
+    int64_t main_threshold;
+};
+
+static int s3fifo_init(struct sim_cache *c)
+{
+    struct s3fifo *p = (struct s3fifo*) calloc(1, sizeof(struct s3fifo));
+    if (!p) return -1;
+
+    p->main_list  = sim_list_new(c);
+    p->small_list = sim_list_new(c);
+    p->cache_size = c->capacity;
+    // The loader sizes the ghost map to the cache
+    p->ghost = sim_ghost_init(c->capacity);
+    if (!p->ghost) {
+        free(p);
+        return -1;
+    }
+    c->policy = p;
+
+    return 0;
+}
+
+static void s3fifo_exit(struct sim_cache *c)
+{
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+
+    sim_ghost_free(&p->ghost);
+    free(p);
+}
+
+static int s3fifo_score_small_fn(struct sim_cache *c, int idx, struct sim_folio *folio)
+{
+    (void) c;
+    (void) idx;
+
+    struct s3fifo_meta *data = (struct s3fifo_meta*) sim_folio_meta(folio);
+
+    if (data->freq > 1) {
+        data->in_main = true;
+        return SIM_CONTINUE_ITER;
+    }
+
+    return SIM_EVICT_NODE;
+}
+
+static int s3fifo_score_main_iter_fn(struct sim_cache *c, int idx, struct sim_folio *folio)
+{
+    (void) idx;
+
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+    struct s3fifo_meta *data = (struct s3fifo_meta*) sim_folio_meta(folio);
+
+    if (--data->freq < p->main_threshold) {
+        return SIM_EVICT_NODE;
+    }
+
+    return SIM_CONTINUE_ITER;
+}
+
+static void evict_main_iter(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+    struct sim_iterate_opts opts = {
+        .continue_list = SIM_ITERATE_SELF,
+        .continue_mode = SIM_ITERATE_TAIL,
+        .evict_list    = SIM_ITERATE_SELF,
+        .evict_mode    = SIM_ITERATE_TAIL,
+    };
+
+    for (p->main_threshold = 0;
+         p->main_threshold <= 3
+         && ctx->nr_folios_to_evict < ctx->request_nr_folios_to_evict;
+         p->main_threshold++) {
+        sim_list_iterate_extended(c, p->main_list, s3fifo_score_main_iter_fn, &opts, ctx);
+    }
+}
+
+static void evict_small(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+    struct sim_iterate_opts opts = {
+        .continue_list = p->main_list,
+        .continue_mode = SIM_ITERATE_TAIL,
+        .evict_list    = SIM_ITERATE_SELF,
+        .evict_mode    = SIM_ITERATE_TAIL,
+    };
+
+    sim_list_iterate_extended(c, p->small_list, s3fifo_score_small_fn, &opts, ctx);
+
+    int64_t moved = (int64_t) opts.nr_folios_continue;
+
+    // As the BPF version, which checks the values before the update
+    if (p->small_list_size < 0) {
+        p->small_list_size = 0;
+    } else {
+        p->small_list_size -= moved;
+    }
+
+    if (p->main_list_size < 0) {
+        p->main_list_size = moved;
+    } else {
+        p->main_list_size += moved;
+    }
+}
+
+static void s3fifo_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+
+    if (p->small_list_size >= (int64_t) (p->cache_size / 15)
+        || p->main_list_size <= 2 * p->small_list_size) {
+        evict_small(c, ctx);
+    } else {
+        evict_main_iter(c, ctx);
+    }
+}
+
+static void s3fifo_folio_accessed(struct sim_cache *c, struct sim_folio *folio)
+{
+    (void) c;
+
+    struct s3fifo_meta *data = (struct s3fifo_meta*) sim_folio_meta(folio);
+
+    if (++data->freq > 3) {
+        data->freq = 3;
+    }
+}
+
+static void s3fifo_folio_evicted(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+    struct s3fifo_meta *data = (struct s3fifo_meta*) sim_folio_meta(folio);
+
+    sim_ghost_put(p->ghost, folio->ino, folio->index, 0);
+
+    if (data->in_main) {
+        p->main_list_size--;
+    } else {
+        p->small_list_size--;
+    }
+}
+
+static void s3fifo_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct s3fifo *p = (struct s3fifo*) c->policy;
+    struct s3fifo_meta *data = (struct s3fifo_meta*) sim_folio_meta(folio);
+    uint8_t ghost_val;
+
+    data->freq = 0;
+    if (sim_ghost_take(p->ghost, folio->ino, folio->index, &ghost_val)) {
+        data->in_main = true;
+        p->main_list_size++;
+        sim_list_add_tail(c, p->main_list, folio);
+    } else {
+        data->in_main = false;
+        p->small_list_size++;
+        sim_list_add_tail(c, p->small_list, folio);
+    }
+}
+
+const struct sim_policy_ops sim_s3fifo_ops = {
+    .name            = "s3fifo",
+    .folio_meta_size = sizeof(struct s3fifo_meta),
+    .init            = s3fifo_init,
+    .exit            = s3fifo_exit,
+    .evict_folios    = s3fifo_evict_folios,
+    .folio_added     = s3fifo_folio_added,
+    .folio_accessed  = s3fifo_folio_accessed,
+    .folio_evicted   = s3fifo_folio_evicted,
+};
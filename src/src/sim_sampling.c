@@ -0,0 +1,72 @@
+#include "sim.h"
+
+/*
+ * Port of policies/cache_ext_sampling.bpf.c: sampled LFU, evicting the least
+ * accessed of 20 sampled folios per requested folio.
+ */
+
+#define SAMPLE_SIZE 20
+
+struct sampling_meta {
+    uint64_t accesses;
+};
+
+struct sampling {
+    uint8_t sampling_list;
+};
+
+static int sampling_init(struct sim_cache *c)
+{
+    struct sampling *p = (struct sampling*) calloc(1, sizeof(struct sampling));
+    if (!p) return -1;
+
+    p->sampling_list = sim_list_new(c);
+    c->policy = p;
+
+    return 0;
+}
+
+static void sampling_exit(struct sim_cache *c)
+{
+    free(c->policy);
+}
+
+static void sampling_folio_added(struct sim_cache *c, struct sim_folio *folio)
+{
+    struct sampling *p = (struct sampling*) c->policy;
+
+    sim_list_add_tail(c, p->sampling_list, folio);
+    ((struct sampling_meta*) sim_folio_meta(folio))->accesses = 1;
+}
+
+static void sampling_folio_accessed(struct sim_cache *c, struct sim_folio *folio)
+{
+    (void) c;
+
+    ((struct sampling_meta*) sim_folio_meta(folio))->accesses++;
+}
+
+// APP_TYPE is GENERIC_APP, so the last page of a file gets no bonus
+static int64_t lfu_score_fn(struct sim_cache *c, struct sim_folio *folio)
+{
+    (void) c;
+
+    return (int64_t) ((struct sampling_meta*) sim_folio_meta(folio))->accesses;
+}
+
+static void sampling_evict_folios(struct sim_cache *c, struct sim_eviction_ctx *ctx)
+{
+    struct sampling *p = (struct sampling*) c->policy;
+
+    sim_list_sample(c, p->sampling_list, lfu_score_fn, SAMPLE_SIZE, ctx);
+}
+
+const struct sim_policy_ops sim_sampling_ops = {
+    .name            = "sampling",
+    .folio_meta_size = sizeof(struct sampling_meta),
+    .init            = sampling_init,
+    .exit            = sampling_exit,
+    .evict_folios    = sampling_evict_folios,
+    .folio_added     = sampling_folio_added,
+    .folio_accessed  = sampling_folio_accessed,
+};
@@ -0,0 +1,301 @@
+#include "sim.h"
+#include "hash.h"
+
+/*
+ * Port of the admission side of policies/cache_ext_tinylfu.bpf.c: a
+ * doorkeeper bloom filter and a counting bloom filter of 4-bit counters,
+ * both of 2^CACHE_SIZE_BITS entries, halved after 2^(CACHE_SIZE_BITS + 4)
+ * insertions. The BPF build fixes CACHE_SIZE_BITS; here it is the smallest
+ * power of two covering the cache.
+ */
+
+#define BPF_BITS_PER_COUNTER 4
+
+// Default hash family of the BPF build (TINYLFU_HASH_MURMUR3)
+#define BPF_HASH_FAMILY HASH_MURMUR3
+#define COUNTER_MASK ((1 << BPF_BITS_PER_COUNTER) - 1)
+#define COUNTERS_PER_WORD (NUM_BITS(uint64_t) / BPF_BITS_PER_COUNTER)
+
+// Rest of the last range scored, as admission_range_map
+struct sim_admission_range {
+    uint64_t ino;
+    // Page the next request of the read starts at, bit 0 of bypass
+    uint64_t next;
+    // End of the pages scored, 0 once all served, and of the read
+    uint64_t end;
+    uint64_t read_end;
+    uint64_t bypass;
+};
+
+struct sim_tinylfu {
+    uint64_t *doorkeeper;
+    uint64_t *cbf;
+    size_t doorkeeper_words;
+    size_t cbf_words;
+    uint32_t size;
+    uint64_t global_counter;
+    uint64_t sample_size;
+    struct sim_admission_range last_range;
+};
+
+static inline uint64_t get_folio_id(uint64_t ino, uint64_t index)
+{
+    return ino ^ ((index << 29) | (index >> 35));
+}
+
+struct sim_tinylfu* sim_tinylfu_init(size_t capacity)
+{
+    unsigned cache_size_bits = 0;
+    while (cache_size_bits < 31 && (1ULL << cache_size_bits) < capacity) {
+        cache_size_bits++;
+    }
+
+    struct sim_tinylfu *t = (struct sim_tinylfu*) calloc(1, sizeof(struct sim_tinylfu));
+    if (!t) return NULL;
+
+    t->size             = 1U << cache_size_bits;
+    t->sample_size      = 1ULL << (BPF_BITS_PER_COUNTER + cache_size_bits);
+    t->doorkeeper_words = t->size / NUM_BITS(uint64_t) + 1;
+    t->cbf_words        = t->size / COUNTERS_PER_WORD + 1;
+    t->doorkeeper       = (uint64_t*) calloc(t->doorkeeper_words, sizeof(uint64_t));
+    t->cbf              = (uint64_t*) calloc(t->cbf_words, sizeof(uint64_t));
+
+    if (!t->doorkeeper || !t->cbf) {
+        sim_tinylfu_free(&t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void sim_tinylfu_free(struct sim_tinylfu **t)
+{
+    if (t && *t) {
+        free((*t)->doorkeeper);
+        free((*t)->cbf);
+        free(*t);
+        *t = NULL;
+    }
+}
+
+static bool doorkeeper_contains(struct sim_tinylfu *t, struct hashes *hs)
+{
+    for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        uint64_t idx = hs->h[i] % t->size;
+
+        if (!(t->doorkeeper[idx / NUM_BITS(uint64_t)] & (1ULL << (idx % NUM_BITS(uint64_t))))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void doorkeeper_add(struct sim_tinylfu *t, struct hashes *hs)
+{
+    for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        uint64_t idx = hs->h[i] % t->size;
+
+        t->doorkeeper[idx / NUM_BITS(uint64_t)] |= 1ULL << (idx % NUM_BITS(uint64_t));
+    }
+}
+
+static void cbf_reset(struct sim_tinylfu *t)
+{
+    for (size_t w = 0; w < t->cbf_words; w++) {
+        uint64_t v = t->cbf[w];
+        uint64_t new_val = 0;
+
+        for (unsigned i = 0; i < COUNTERS_PER_WORD; i++) {
+            unsigned shift = i * BPF_BITS_PER_COUNTER;
+            new_val |= (((v >> shift) & COUNTER_MASK) >> 1) << shift;
+        }
+        t->cbf[w] = new_val;
+    }
+
+    for (size_t w = 0; w < t->doorkeeper_words; w++) {
+        t->doorkeeper[w] = 0;
+    }
+}
+
+static inline uint32_t cbf_counter(struct sim_tinylfu *t, uint64_t h, size_t *word,
+                                   unsigned *shift)
+{
+    uint64_t idx = h % t->size;
+
+    *word  = idx / COUNTERS_PER_WORD;
+    *shift = (idx % COUNTERS_PER_WORD) * BPF_BITS_PER_COUNTER;
+
+    return (t->cbf[*word] >> *shift) & COUNTER_MASK;
+}
+
+static void cbf_add(struct sim_tinylfu *t, struct hashes *hs)
+{
+    uint32_t min_val = UINT32_MAX;
+    uint32_t vals[NUM_HASH_FUNCTIONS];
+    size_t word;
+    unsigned shift;
+
+    for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        vals[i] = cbf_counter(t, hs->h[i], &word, &shift);
+        if (vals[i] < min_val) {
+            min_val = vals[i];
+        }
+    }
+
+    uint32_t new_min = min_val + 1;
+    if (new_min > COUNTER_MASK) {
+        new_min = COUNTER_MASK;
+    }
+
+    // Counters hashed twice are incremented twice and may carry into their
+    // neighbour, as in the BPF version
+    for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        if (vals[i] < new_min) {
+            cbf_counter(t, hs->h[i], &word, &shift);
+            t->cbf[word] += 1ULL << shift;
+        }
+    }
+
+    if (++t->global_counter >= t->sample_size) {
+        t->global_counter = 0;
+        cbf_reset(t);
+    }
+}
+
+static uint32_t cbf_estimate(struct sim_tinylfu *t, struct hashes *hs)
+{
+    uint32_t min_val = UINT32_MAX;
+    size_t word;
+    unsigned shift;
+
+    for (int i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+        uint32_t val = cbf_counter(t, hs->h[i], &word, &shift);
+        if (val < min_val) {
+            min_val = val;
+        }
+    }
+    return min_val;
+}
+
+static uint32_t tinylfu_estimate(struct sim_tinylfu *t, uint64_t id)
+{
+    struct hashes hs;
+    get_hashes_with(BPF_HASH_FAMILY, id, &hs);
+
+    return cbf_estimate(t, &hs) + doorkeeper_contains(t, &hs);
+}
+
+static void tinylfu_record(struct sim_tinylfu *t, uint64_t id)
+{
+    struct hashes hs;
+    get_hashes_with(BPF_HASH_FAMILY, id, &hs);
+
+    if (!doorkeeper_contains(t, &hs)) {
+        doorkeeper_add(t, &hs);
+    } else {
+        cbf_add(t, &hs);
+    }
+}
+
+void sim_tinylfu_accessed(struct sim_tinylfu *t, struct sim_folio *folio)
+{
+    if (!t) return;
+
+    tinylfu_record(t, get_folio_id(folio->ino, folio->index));
+}
+
+bool sim_tinylfu_reject(struct sim_tinylfu *t, struct sim_admission_ctx *ctx)
+{
+    if (!t) return false;
+
+    uint64_t new_id    = get_folio_id(ctx->ino, ctx->index);
+    uint64_t victim_id = get_folio_id(ctx->victim_ino, ctx->victim_index);
+
+    // No victim, the cache is likely not full
+    if (victim_id == 0) return false;
+
+    tinylfu_record(t, new_id);
+
+    return tinylfu_estimate(t, new_id) < tinylfu_estimate(t, victim_id);
+}
+
+uint32_t sim_tinylfu_estimate(struct sim_tinylfu *t, uint64_t ino, uint64_t index)
+{
+    if (!t) return 0;
+
+    return tinylfu_estimate(t, get_folio_id(ino, index));
+}
+
+/*
+ * Bitmap of the pages of last from last->next on, whose leading run of pages
+ * with the same decision is consumed. Past the pages scored, the bits are set
+ * against the last one, so that the run stops there.
+ */
+static uint64_t admission_range_take(struct sim_admission_range *last)
+{
+    uint64_t n      = last->end - last->next;
+    uint64_t bypass = last->bypass;
+
+    if (n < SIM_ADMISSION_MAX_PAGES) {
+        uint64_t mask = (1ULL << n) - 1;
+
+        bypass &= mask;
+        if (!((bypass >> (n - 1)) & 1)) {
+            bypass |= ~mask;
+        }
+    }
+
+    uint64_t run_end = (bypass & 1) ? ~bypass : bypass;
+    uint64_t run     = run_end ? (uint64_t) __builtin_ctzll(run_end) : SIM_ADMISSION_MAX_PAGES;
+    if (run > n) {
+        run = n;
+    }
+
+    last->next += run;
+    if (last->next >= last->end) {
+        last->end = 0;
+    } else {
+        last->bypass >>= run;
+    }
+    return bypass;
+}
+
+uint64_t sim_tinylfu_admit_range(struct sim_tinylfu *t, struct sim_admission_ctx *ctx)
+{
+    if (!t || ctx->nr_pages == 0) return 0;
+
+    struct sim_admission_range *last = &t->last_range;
+    uint64_t read_end = ctx->index + ctx->nr_pages;
+
+    if (last->end && last->ino == ctx->ino && last->next == ctx->index
+        && last->read_end == read_end) {
+        return admission_range_take(last);
+    }
+    last->end = 0;
+
+    uint64_t victim_id = get_folio_id(ctx->victim_ino, ctx->victim_index);
+
+    // No victim, the cache is likely not full
+    if (victim_id == 0) return 0;
+
+    uint32_t victim_est = tinylfu_estimate(t, victim_id);
+    uint64_t nr_pages   = ctx->nr_pages < SIM_ADMISSION_MAX_PAGES
+                              ? ctx->nr_pages : SIM_ADMISSION_MAX_PAGES;
+    uint64_t bypass     = 0;
+
+    for (uint64_t i = 0; i < nr_pages; i++) {
+        uint64_t id = get_folio_id(ctx->ino, ctx->index + i);
+
+        tinylfu_record(t, id);
+        if (tinylfu_estimate(t, id) < victim_est) {
+            bypass |= 1ULL << i;
+        }
+    }
+
+    last->ino      = ctx->ino;
+    last->next     = ctx->index;
+    last->end      = ctx->index + nr_pages;
+    last->read_end = read_end;
+    last->bypass   = bypass;
+    return admission_range_take(last);
+}
@@ -1,23 +1,110 @@
 #include "tinylfu.h"
+#include "tinylfu_file.h"
+#include "arena.h"
+#include <math.h>
 #include <string.h>
 
 #define DOORKEEPER_SIZE 10240
-#define CBF_SIZE 10240
+#define SKETCH_SIZE 10240
+#define FP_RATE 0.01
+
+/*
+ * Optimal number of bits of a bloom filter holding n entries with a false
+ * positive rate p: m = -n ln(p) / ln(2)^2.
+ */
+static size_t bloom_bits_for(size_t n, double p) {
+    return (size_t) ceil(-(double) n * log(p) / (M_LN2 * M_LN2));
+}
+
+static void tinylfu_age_doorkeeper_word(void *arg, size_t word);
+
+struct tinylfu* tinylfu_init(const struct tinylfu_config *config) {
+    struct tinylfu_config defaults = {
+        .aging           = TINYLFU_AGING_INCREMENTAL,
+        .doorkeeper_type = DOORKEEPER_BLOOM,
+    };
+    if (!config) config = &defaults;
+
+    size_t doorkeeper_size = config->doorkeeper_size;
+    size_t sketch_size     = config->sketch_size;
+
+    if (config->expected_entries) {
+        double fp_rate = config->fp_rate > 0 && config->fp_rate < 1
+                             ? config->fp_rate : FP_RATE;
+
+        // The false positive rate of a cuckoo filter is set by its
+        // fingerprints, not its size
+        if (!doorkeeper_size && config->doorkeeper_type == DOORKEEPER_CUCKOO) {
+            doorkeeper_size = cuckoo_filter_bits_for(config->expected_entries);
+        } else if (!doorkeeper_size) {
+            doorkeeper_size = bloom_bits_for(config->expected_entries, fp_rate);
+        }
+        if (!sketch_size) {
+            sketch_size = config->expected_entries;
+        }
+    }
+
+    if (!doorkeeper_size) doorkeeper_size = DOORKEEPER_SIZE;
+    if (!sketch_size) sketch_size = SKETCH_SIZE;
 
-struct tinylfu* tinylfu_init() {
     struct tinylfu *tfu = (struct tinylfu*) malloc(sizeof(struct tinylfu));
     if (!tfu) return NULL;
 
-    tfu->doorkeeper = bloom_init(DOORKEEPER_SIZE);
-    if (!tfu->doorkeeper) {
+    tfu->file = NULL;
+    tfu->topk = NULL;
+    if (config->topk_size) {
+        tfu->topk = topk_init(config->topk_size);
+        if (!tfu->topk) {
+            free(tfu);
+            return NULL;
+        }
+    }
+
+    if (config->path) {
+        struct tinylfu_file_header layout;
+        tinylfu_file_layout(&layout, config->doorkeeper_type, doorkeeper_size, sketch_size);
+
+        // Maps the tables allocated below from the file
+        tfu->file = tinylfu_file_open(config->path, &layout);
+        if (!tfu->file) {
+            topk_free(&tfu->topk);
+            free(tfu);
+            return NULL;
+        }
+    }
+
+    tfu->doorkeeper = doorkeeper_init(config->doorkeeper_type, doorkeeper_size);
+    tfu->sketch     = tfu->doorkeeper ? tinylfu_sketch_init(sketch_size) : NULL;
+    if (tfu->file) {
+        arena_set_file(-1, 0);
+    }
+
+    if (!tfu->sketch) {
+        tinylfu_file_close(&tfu->file, NULL);
+        doorkeeper_free(&tfu->doorkeeper);
+        topk_free(&tfu->topk);
         free(tfu);
         return NULL;
     }
 
-    tfu->cbf = counting_bloom_init(CBF_SIZE);
-    if (!tfu->cbf) {
-        bloom_free(&tfu->doorkeeper);
-        free(tfu);
+    tfu->aging            = config->aging;
+    tfu->sample_size      = config->sample_size;
+    tfu->accesses         = 0;
+    tfu->resets           = 0;
+    tfu->doorkeeper_size  = doorkeeper_size;
+    tfu->sketch_size      = sketch_size;
+    tfu->doorkeeper_aging = aging_init(doorkeeper_num_words(tfu->doorkeeper));
+    tfu->sketch_aging     = aging_init(tinylfu_sketch_num_words(tfu->sketch));
+    if (!tfu->doorkeeper_aging || !tfu->sketch_aging) {
+        tinylfu_file_close(&tfu->file, NULL);
+        tinylfu_free(&tfu);
+        return NULL;
+    }
+    doorkeeper_set_before_use(tfu->doorkeeper, tinylfu_age_doorkeeper_word, tfu);
+
+    if (tfu->file && tinylfu_file_attach(tfu->file, tfu) != 0) {
+        tinylfu_file_close(&tfu->file, NULL);
+        tinylfu_free(&tfu);
         return NULL;
     }
 
@@ -26,49 +113,226 @@ struct tinylfu* tinylfu_init() {
 
 void tinylfu_free(struct tinylfu **tfu) {
     if (tfu && *tfu) {
-        bloom_free(&(*tfu)->doorkeeper);
-        counting_bloom_free(&(*tfu)->cbf);
+        // Syncs the tables before unmapping them
+        tinylfu_file_close(&(*tfu)->file, *tfu);
+        doorkeeper_free(&(*tfu)->doorkeeper);
+        tinylfu_sketch_free(&(*tfu)->sketch);
+        aging_free(&(*tfu)->doorkeeper_aging);
+        aging_free(&(*tfu)->sketch_aging);
+        topk_free(&(*tfu)->topk);
 
         free(*tfu);
         *tfu = NULL;
     }
 }
 
-void tinylfu_access(struct tinylfu *tfu, uint64_t addr) {
-    if (!tfu) return;
+static void tinylfu_age_doorkeeper_chunk(struct tinylfu *tfu, size_t chunk) {
+    size_t first_word, num_words;
 
-    struct hashes hs;
-    get_hashes(addr, &hs);
+    aging_chunk_range(tfu->doorkeeper_aging, chunk, &first_word, &num_words);
+    doorkeeper_clear_range(tfu->doorkeeper, first_word, num_words);
+    aging_mark_done(tfu->doorkeeper_aging, chunk);
+}
 
-    if (!bloom_contains_with_hashes(tfu->doorkeeper, &hs)) {
-        bloom_add_with_hashes(tfu->doorkeeper, &hs);
-    } else {
-        if (counting_bloom_add_with_hashes(tfu->cbf, &hs)) {
-            /* Reset and clear the doorkeeper */
-            counting_bloom_reset(tfu->cbf);
+/*
+ * Brings the chunk of a doorkeeper word up to date before a cuckoo doorkeeper
+ * moves a fingerprint into it, or out of it, on behalf of another key: a
+ * relocated fingerprint may not carry a key across the reset either way.
+ */
+static void tinylfu_age_doorkeeper_word(void *arg, size_t word) {
+    struct tinylfu *tfu = arg;
+    size_t chunk = aging_chunk_of(word);
+
+    if (aging_in_progress(tfu->doorkeeper_aging)
+        && aging_is_stale(tfu->doorkeeper_aging, chunk)) {
+        tinylfu_age_doorkeeper_chunk(tfu, chunk);
+    }
+}
+
+static void tinylfu_age_sketch_chunk(struct tinylfu *tfu, size_t chunk) {
+    size_t first_word, num_words;
+
+    aging_chunk_range(tfu->sketch_aging, chunk, &first_word, &num_words);
+    tinylfu_sketch_reset_range(tfu->sketch, first_word, num_words);
+    aging_mark_done(tfu->sketch_aging, chunk);
+}
+
+/*
+ * Brings the chunks holding the bits and counters of the key hashed to hs
+ * up to date, so that the key is never seen half reset.
+ */
+static inline void tinylfu_age_touched(struct tinylfu *tfu, struct hashes *hs) {
+    if (aging_in_progress(tfu->doorkeeper_aging)) {
+        for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+            size_t chunk = aging_chunk_of(
+                doorkeeper_word_with_hashes(tfu->doorkeeper, hs, i)
+            );
+            if (aging_is_stale(tfu->doorkeeper_aging, chunk)) {
+                tinylfu_age_doorkeeper_chunk(tfu, chunk);
+            }
+        }
+    }
 
-            if (tfu->doorkeeper && tfu->doorkeeper->vector) {
-                bloom_clear(tfu->doorkeeper);
+    if (aging_in_progress(tfu->sketch_aging)) {
+        for (size_t i = 0; i < NUM_HASH_FUNCTIONS; i++) {
+            size_t chunk = aging_chunk_of(
+                tinylfu_sketch_word_with_hashes(tfu->sketch, hs, i)
+            );
+            if (aging_is_stale(tfu->sketch_aging, chunk)) {
+                tinylfu_age_sketch_chunk(tfu, chunk);
             }
         }
     }
 }
 
-uint64_t tinylfu_estimate(struct tinylfu *tfu, uint64_t addr) {
+/*
+ * Advances the background sweep by a bounded number of chunks.
+ */
+static inline void tinylfu_age_step(struct tinylfu *tfu) {
+    size_t chunk;
+
+    for (size_t i = 0; i < AGING_CHUNKS_PER_ACCESS; i++) {
+        if (aging_next_stale(tfu->doorkeeper_aging, &chunk)) {
+            tinylfu_age_doorkeeper_chunk(tfu, chunk);
+        }
+        if (aging_next_stale(tfu->sketch_aging, &chunk)) {
+            tinylfu_age_sketch_chunk(tfu, chunk);
+        }
+    }
+}
+
+size_t tinylfu_topk(struct tinylfu *tfu, struct topk_item *items, size_t n) {
     if (!tfu) return 0;
 
+    return topk_snapshot(tfu->topk, items, n);
+}
+
+void tinylfu_finish_aging(struct tinylfu *tfu) {
+    if (!tfu) return;
+
+    size_t chunk;
+    while (aging_next_stale(tfu->doorkeeper_aging, &chunk)) {
+        tinylfu_age_doorkeeper_chunk(tfu, chunk);
+    }
+    while (aging_next_stale(tfu->sketch_aging, &chunk)) {
+        tinylfu_age_sketch_chunk(tfu, chunk);
+    }
+}
+
+static void tinylfu_reset(struct tinylfu *tfu) {
+    if (tfu->aging == TINYLFU_AGING_STOP_THE_WORLD) {
+        tfu->resets++;
+        topk_halve(tfu->topk);
+        /* Reset and clear the doorkeeper */
+        tinylfu_sketch_reset(tfu->sketch);
+
+        doorkeeper_clear(tfu->doorkeeper);
+        return;
+    }
+
+    /*
+     * A counter saturating again before the previous reset is complete
+     * does not start a new one: the pending one already halves everything
+     * that has not been touched since.
+     */
+    if (aging_in_progress(tfu->doorkeeper_aging)
+        || aging_in_progress(tfu->sketch_aging)) {
+        return;
+    }
+
+    tfu->resets++;
+    topk_halve(tfu->topk);
+    aging_start(tfu->doorkeeper_aging);
+    aging_start(tfu->sketch_aging);
+}
+
+static void tinylfu_access_with_hashes(struct tinylfu *tfu, struct hashes *hs) {
+    tinylfu_age_touched(tfu, hs);
+
+    bool reset;
+    if (!doorkeeper_contains_with_hashes(tfu->doorkeeper, hs)) {
+        // A full cuckoo doorkeeper holds a whole sample already
+        reset = !doorkeeper_add_with_hashes(tfu->doorkeeper, hs);
+    } else {
+        // Saturated counters stay saturated until the end of the sample
+        reset = tinylfu_sketch_add_with_hashes(tfu->sketch, hs) && !tfu->sample_size;
+    }
+
+    if (tfu->sample_size && ++tfu->accesses >= tfu->sample_size) {
+        tfu->accesses = 0;
+        reset = true;
+    }
+    if (reset) {
+        tinylfu_reset(tfu);
+    }
+
+    tinylfu_age_step(tfu);
+}
+
+void tinylfu_access(struct tinylfu *tfu, uint64_t addr) {
+    if (!tfu) return;
+
     struct hashes hs;
     get_hashes(addr, &hs);
+    tinylfu_access_with_hashes(tfu, &hs);
+    topk_add(tfu->topk, addr);
+}
+
+static inline void tinylfu_prefetch_with_hashes(struct tinylfu *tfu,
+                                                struct hashes *hs) {
+    doorkeeper_prefetch_with_hashes(tfu->doorkeeper, hs);
+    tinylfu_sketch_prefetch_with_hashes(tfu->sketch, hs);
+}
+
+void tinylfu_access_batch(struct tinylfu *tfu, const uint64_t *addrs, size_t n) {
+    if (!tfu || !addrs) return;
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  tinylfu_prefetch_with_hashes(tfu, hs),
+                  (tinylfu_access_with_hashes(tfu, hs),
+                   topk_add(tfu->topk, addrs[idx])));
+}
 
-    uint64_t estimate = counting_bloom_estimate_with_hashes(tfu->cbf, &hs);
+static uint64_t tinylfu_estimate_with_hashes(struct tinylfu *tfu,
+                                             struct hashes *hs) {
+    tinylfu_age_touched(tfu, hs);
 
-    if (!bloom_contains_with_hashes(tfu->doorkeeper, &hs)) {
+    uint64_t estimate = tinylfu_sketch_estimate_with_hashes(tfu->sketch, hs);
+
+    if (!doorkeeper_contains_with_hashes(tfu->doorkeeper, hs)) {
         return estimate;
     }
 
     return estimate + 1;
 }
 
+uint64_t tinylfu_estimate(struct tinylfu *tfu, uint64_t addr) {
+    if (!tfu) return 0;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+    return tinylfu_estimate_with_hashes(tfu, &hs);
+}
+
+void tinylfu_estimate_batch(struct tinylfu *tfu, const uint64_t *addrs, size_t n,
+                            uint64_t *out) {
+    if (!tfu || !addrs || !out) return;
+
+    HASH_PIPELINE(addrs, n, hs, idx,
+                  tinylfu_prefetch_with_hashes(tfu, hs),
+                  out[idx] = tinylfu_estimate_with_hashes(tfu, hs));
+}
+
+void tinylfu_evict(struct tinylfu *tfu, uint64_t addr) {
+    if (!tfu) return;
+
+    struct hashes hs;
+    get_hashes(addr, &hs);
+
+    tinylfu_age_touched(tfu, &hs);
+    doorkeeper_delete_with_hashes(tfu->doorkeeper, &hs);
+}
+
 bool tinylfu_admit(struct tinylfu *tfu, uint64_t new,
                    uint64_t victim_candidate) {
     if (!tfu) return true;
@@ -0,0 +1,384 @@
+#include "tinylfu_file.h"
+#include "arena.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef TINYLFU_FREQUENCY_SKETCH
+#define SKETCH_TYPE 1
+#else
+#define SKETCH_TYPE 0
+#endif
+
+#define PAGE_SIZE_4K (4096UL)
+
+static size_t round_up(size_t bytes, size_t page_size)
+{
+    return (bytes + page_size - 1) / page_size * page_size;
+}
+
+/*
+ * Position dependent, so that swapped or shifted words are caught too.
+ */
+static uint64_t checksum_words(const uint64_t *words, size_t n, uint64_t seed)
+{
+    uint64_t sum = seed;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += hash_fmix64(words[i] ^ (seed + i * HASH_STEP_SEED));
+    }
+    return sum;
+}
+
+static uint64_t header_checksum(const struct tinylfu_file_header *h)
+{
+    return checksum_words((const uint64_t*) h,
+                          offsetof(struct tinylfu_file_header, checksum) / sizeof(uint64_t),
+                          TINYLFU_FILE_MAGIC);
+}
+
+static uint64_t tables_checksum(const uint64_t *doorkeeper, size_t doorkeeper_words,
+                                const uint64_t *sketch, size_t sketch_words)
+{
+    return checksum_words(doorkeeper, doorkeeper_words, 1)
+         ^ checksum_words(sketch, sketch_words, 2);
+}
+
+/*
+ * Offsets of the tables of a file with the given header.
+ */
+static size_t doorkeeper_offset(const struct tinylfu_file_header *h)
+{
+    (void) h;
+    return TINYLFU_FILE_HEADER_SIZE;
+}
+
+static size_t sketch_offset(const struct tinylfu_file_header *h)
+{
+    return doorkeeper_offset(h) + round_up(h->doorkeeper_words * sizeof(uint64_t),
+                                           PAGE_SIZE_4K);
+}
+
+static size_t file_size(const struct tinylfu_file_header *h)
+{
+    return sketch_offset(h) + round_up(h->sketch_words * sizeof(uint64_t), PAGE_SIZE_4K);
+}
+
+static bool header_valid(const struct tinylfu_file_header *h)
+{
+    return h->magic == TINYLFU_FILE_MAGIC && h->version == TINYLFU_FILE_VERSION
+        && h->state == TINYLFU_FILE_CLEAN && h->checksum == header_checksum(h);
+}
+
+static bool same_parameters(const struct tinylfu_file_header *a,
+                            const struct tinylfu_file_header *b)
+{
+    return a->hash_family == b->hash_family
+        && a->num_hash_functions == b->num_hash_functions
+        && a->doorkeeper_type == b->doorkeeper_type
+        && a->fingerprint_bits == b->fingerprint_bits
+        && a->sketch_type == b->sketch_type
+        && a->bits_per_counter == b->bits_per_counter;
+}
+
+void tinylfu_file_layout(struct tinylfu_file_header *h, enum doorkeeper_type type,
+                         size_t doorkeeper_size, size_t sketch_size)
+{
+    memset(h, 0, sizeof(*h));
+    h->magic              = TINYLFU_FILE_MAGIC;
+    h->version            = TINYLFU_FILE_VERSION;
+    h->state              = TINYLFU_FILE_EMPTY;
+    h->hash_family        = HASH_FAMILY;
+    h->num_hash_functions = NUM_HASH_FUNCTIONS;
+    h->doorkeeper_type    = type;
+    h->fingerprint_bits   = type == DOORKEEPER_CUCKOO ? CUCKOO_FINGERPRINT_BITS : 0;
+    h->sketch_type        = SKETCH_TYPE;
+    h->bits_per_counter   = TINYLFU_SKETCH_BITS_PER_COUNTER;
+    h->doorkeeper_size    = doorkeeper_size;
+    h->sketch_size        = sketch_size;
+}
+
+/*
+ * Fills the header of tfu's current state.
+ */
+static void save_state(struct tinylfu_file_header *h, struct tinylfu *tfu)
+{
+    h->doorkeeper_words = doorkeeper_num_words(tfu->doorkeeper);
+    h->sketch_words     = tinylfu_sketch_num_words(tfu->sketch);
+    h->epoch            = tfu->resets;
+    h->accesses         = tfu->accesses;
+
+    if (tfu->doorkeeper->type == DOORKEEPER_CUCKOO) {
+        struct cuckoo_filter *cf = tfu->doorkeeper->cuckoo;
+        h->cuckoo_items              = cf->num_items;
+        h->cuckoo_victim_fingerprint = cf->victim_fingerprint;
+        h->cuckoo_victim_bucket      = cf->victim_bucket;
+        h->cuckoo_rng                = cf->rng;
+    }
+}
+
+static void load_state(const struct tinylfu_file_header *h, struct tinylfu *tfu)
+{
+    tfu->resets   = h->epoch;
+    tfu->accesses = h->accesses;
+
+    if (tfu->doorkeeper->type == DOORKEEPER_CUCKOO) {
+        struct cuckoo_filter *cf = tfu->doorkeeper->cuckoo;
+        cf->num_items          = h->cuckoo_items;
+        cf->victim_fingerprint = h->cuckoo_victim_fingerprint;
+        cf->victim_bucket      = h->cuckoo_victim_bucket;
+        cf->rng                = h->cuckoo_rng;
+    }
+}
+
+static int sync_header(struct tinylfu_file *f)
+{
+    f->header->checksum = header_checksum(f->header);
+    return msync(f->header, TINYLFU_FILE_HEADER_SIZE, MS_SYNC);
+}
+
+struct tinylfu_file* tinylfu_file_open(const char *path,
+                                       const struct tinylfu_file_header *layout)
+{
+    struct tinylfu_file *f = (struct tinylfu_file*) malloc(sizeof(struct tinylfu_file));
+    if (!f) return NULL;
+
+    f->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (f->fd < 0) {
+        free(f);
+        return NULL;
+    }
+
+    // A file is mapped by one TinyLFU at a time
+    if (flock(f->fd, LOCK_EX | LOCK_NB) != 0) {
+        close(f->fd);
+        free(f);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(f->fd, &st) != 0
+        || ((size_t) st.st_size < TINYLFU_FILE_HEADER_SIZE
+            && ftruncate(f->fd, TINYLFU_FILE_HEADER_SIZE) != 0)) {
+        close(f->fd);
+        free(f);
+        return NULL;
+    }
+
+    f->header = (struct tinylfu_file_header*) mmap(NULL, TINYLFU_FILE_HEADER_SIZE,
+                                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                   f->fd, 0);
+    if (f->header == MAP_FAILED) {
+        close(f->fd);
+        free(f);
+        return NULL;
+    }
+
+    f->attached = header_valid(f->header) && same_parameters(f->header, layout)
+               && f->header->doorkeeper_size == layout->doorkeeper_size
+               && f->header->sketch_size == layout->sketch_size
+               && (size_t) st.st_size >= file_size(f->header);
+
+    if (!f->attached) {
+        // Drops the tables, so that they are mapped back as zeroes
+        if (ftruncate(f->fd, TINYLFU_FILE_HEADER_SIZE) != 0) {
+            munmap(f->header, TINYLFU_FILE_HEADER_SIZE);
+            close(f->fd);
+            free(f);
+            return NULL;
+        }
+        *f->header = *layout;
+    }
+
+    arena_set_file(f->fd, TINYLFU_FILE_HEADER_SIZE);
+    return f;
+}
+
+int tinylfu_file_attach(struct tinylfu_file *f, struct tinylfu *tfu)
+{
+    if (f->attached) {
+        load_state(f->header, tfu);
+    }
+
+    save_state(f->header, tfu);
+    f->header->tables_checksum = 0;
+    f->header->state           = TINYLFU_FILE_DIRTY;
+    return sync_header(f);
+}
+
+int tinylfu_file_close(struct tinylfu_file **f, struct tinylfu *tfu)
+{
+    if (!f || !*f) return 0;
+
+    int ret = 0;
+    if (tfu) {
+        // Aging state lives on the heap, so none must be pending
+        tinylfu_finish_aging(tfu);
+        save_state((*f)->header, tfu);
+
+        if (msync(doorkeeper_words(tfu->doorkeeper),
+                  (*f)->header->doorkeeper_words * sizeof(uint64_t), MS_SYNC) != 0
+            || msync(tinylfu_sketch_words(tfu->sketch),
+                     (*f)->header->sketch_words * sizeof(uint64_t), MS_SYNC) != 0) {
+            ret = -1;
+        } else {
+            (*f)->header->state = TINYLFU_FILE_CLEAN;
+            ret = sync_header(*f);
+        }
+    }
+
+    munmap((*f)->header, TINYLFU_FILE_HEADER_SIZE);
+    close((*f)->fd);
+    free(*f);
+    *f = NULL;
+    return ret;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, size_t offset)
+{
+    const uint8_t *p = (const uint8_t*) buf;
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p      += n;
+        len    -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/*
+ * Makes a rename in the directory of path durable.
+ */
+static int sync_parent(const char *path)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    int fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+int tinylfu_snapshot(struct tinylfu *tfu, const char *path)
+{
+    if (!tfu || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    tinylfu_finish_aging(tfu);
+
+    struct tinylfu_file_header h;
+    tinylfu_file_layout(&h, tfu->doorkeeper->type, tfu->doorkeeper_size, tfu->sketch_size);
+    save_state(&h, tfu);
+
+    const uint64_t *doorkeeper = doorkeeper_words(tfu->doorkeeper);
+    const uint64_t *sketch     = tinylfu_sketch_words(tfu->sketch);
+    h.tables_checksum = tables_checksum(doorkeeper, h.doorkeeper_words,
+                                        sketch, h.sketch_words);
+    h.state           = TINYLFU_FILE_CLEAN;
+    h.checksum        = header_checksum(&h);
+
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int) sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    // Header last, so that a snapshot is never valid before its tables
+    if (ftruncate(fd, file_size(&h)) != 0
+        || pwrite_all(fd, doorkeeper, h.doorkeeper_words * sizeof(uint64_t),
+                      doorkeeper_offset(&h)) != 0
+        || pwrite_all(fd, sketch, h.sketch_words * sizeof(uint64_t),
+                      sketch_offset(&h)) != 0
+        || pwrite_all(fd, &h, sizeof(h), 0) != 0
+        || fsync(fd) != 0) {
+        int err = errno;
+        close(fd);
+        unlink(tmp_path);
+        errno = err;
+        return -1;
+    }
+
+    if (close(fd) != 0 || rename(tmp_path, path) != 0) {
+        int err = errno;
+        unlink(tmp_path);
+        errno = err;
+        return -1;
+    }
+    return sync_parent(path);
+}
+
+int tinylfu_restore(struct tinylfu *tfu, const char *path)
+{
+    if (!tfu || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct tinylfu_file_header h, layout;
+    tinylfu_file_layout(&layout, tfu->doorkeeper->type, 0, 0);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)) {
+        int err = errno;
+        close(fd);
+        errno = err ? err : EINVAL;
+        return -1;
+    }
+
+    if (!header_valid(&h) || !same_parameters(&h, &layout)
+        || h.doorkeeper_words != doorkeeper_num_words(tfu->doorkeeper)
+        || h.sketch_words != tinylfu_sketch_num_words(tfu->sketch)
+        || (size_t) st.st_size < file_size(&h)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint8_t *map = (uint8_t*) mmap(NULL, file_size(&h), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const uint64_t *doorkeeper = (const uint64_t*) (map + doorkeeper_offset(&h));
+    const uint64_t *sketch     = (const uint64_t*) (map + sketch_offset(&h));
+
+    if (tables_checksum(doorkeeper, h.doorkeeper_words, sketch, h.sketch_words)
+            != h.tables_checksum) {
+        munmap(map, file_size(&h));
+        errno = EIO;
+        return -1;
+    }
+
+    // The snapshot was taken with no reset pending
+    tinylfu_finish_aging(tfu);
+    memcpy(doorkeeper_words(tfu->doorkeeper), doorkeeper,
+           h.doorkeeper_words * sizeof(uint64_t));
+    memcpy(tinylfu_sketch_words(tfu->sketch), sketch, h.sketch_words * sizeof(uint64_t));
+    load_state(&h, tfu);
+
+    munmap(map, file_size(&h));
+    return 0;
+}
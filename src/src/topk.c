@@ -0,0 +1,278 @@
+#include "topk.h"
+
+struct topk* topk_init(size_t k)
+{
+    if (k == 0 || k >= TOPK_NONE) return NULL;
+
+    struct topk *tk = (struct topk*) calloc(1, sizeof(struct topk));
+    if (!tk) return NULL;
+
+    // At least two slots per key, so that chains stay short
+    size_t slots = 1;
+    while (slots < 2 * k) {
+        slots <<= 1;
+    }
+
+    tk->entries = (struct topk_entry*) calloc(k, sizeof(struct topk_entry));
+    tk->buckets = (struct topk_bucket*) calloc(k, sizeof(struct topk_bucket));
+    tk->index   = (uint32_t*) malloc(slots * sizeof(uint32_t));
+    if (!tk->entries || !tk->buckets || !tk->index) {
+        topk_free(&tk);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        tk->index[i] = TOPK_NONE;
+    }
+    // k buckets are enough: a key only needs a new bucket if it shares its
+    // current one
+    for (size_t i = 0; i < k; i++) {
+        tk->buckets[i].next = i + 1 < k ? i + 1 : TOPK_NONE;
+    }
+
+    tk->index_mask   = slots - 1;
+    tk->k            = k;
+    tk->min_bucket   = TOPK_NONE;
+    tk->free_buckets = 0;
+    return tk;
+}
+
+void topk_free(struct topk **tk)
+{
+    if (tk && *tk) {
+        free((*tk)->entries);
+        free((*tk)->buckets);
+        free((*tk)->index);
+        free(*tk);
+        *tk = NULL;
+    }
+}
+
+static inline uint32_t *index_slot(struct topk *tk, uint64_t key)
+{
+    return &tk->index[hash_fmix64(key) & tk->index_mask];
+}
+
+static uint32_t index_find(struct topk *tk, uint64_t key)
+{
+    uint32_t e = *index_slot(tk, key);
+
+    while (e != TOPK_NONE && tk->entries[e].key != key) {
+        e = tk->entries[e].chain;
+    }
+    return e;
+}
+
+static void index_insert(struct topk *tk, uint32_t e)
+{
+    uint32_t *slot = index_slot(tk, tk->entries[e].key);
+
+    tk->entries[e].chain = *slot;
+    *slot = e;
+}
+
+static void index_remove(struct topk *tk, uint32_t e)
+{
+    uint32_t *link = index_slot(tk, tk->entries[e].key);
+
+    while (*link != e) {
+        link = &tk->entries[*link].chain;
+    }
+    *link = tk->entries[e].chain;
+}
+
+/*
+ * Links a new bucket of the given count after the bucket after, or first if
+ * after is TOPK_NONE.
+ */
+static uint32_t bucket_insert_after(struct topk *tk, uint32_t after, uint64_t count)
+{
+    uint32_t b = tk->free_buckets;
+    struct topk_bucket *bucket = &tk->buckets[b];
+
+    tk->free_buckets = bucket->next;
+    bucket->count = count;
+    bucket->first = TOPK_NONE;
+    bucket->prev  = after;
+    bucket->next  = after == TOPK_NONE ? tk->min_bucket : tk->buckets[after].next;
+
+    if (bucket->next != TOPK_NONE) {
+        tk->buckets[bucket->next].prev = b;
+    }
+    if (after == TOPK_NONE) {
+        tk->min_bucket = b;
+    } else {
+        tk->buckets[after].next = b;
+    }
+    return b;
+}
+
+static void bucket_release(struct topk *tk, uint32_t b)
+{
+    struct topk_bucket *bucket = &tk->buckets[b];
+
+    if (bucket->prev == TOPK_NONE) {
+        tk->min_bucket = bucket->next;
+    } else {
+        tk->buckets[bucket->prev].next = bucket->next;
+    }
+    if (bucket->next != TOPK_NONE) {
+        tk->buckets[bucket->next].prev = bucket->prev;
+    }
+
+    bucket->next     = tk->free_buckets;
+    tk->free_buckets = b;
+}
+
+static void entry_link(struct topk *tk, uint32_t e, uint32_t b)
+{
+    struct topk_entry *entry = &tk->entries[e];
+    struct topk_bucket *bucket = &tk->buckets[b];
+
+    entry->bucket = b;
+    entry->prev   = TOPK_NONE;
+    entry->next   = bucket->first;
+    if (bucket->first != TOPK_NONE) {
+        tk->entries[bucket->first].prev = e;
+    }
+    bucket->first = e;
+}
+
+/*
+ * Unlinks e from its bucket, and releases the bucket if it is left empty.
+ */
+static void entry_unlink(struct topk *tk, uint32_t e)
+{
+    struct topk_entry *entry = &tk->entries[e];
+    struct topk_bucket *bucket = &tk->buckets[entry->bucket];
+
+    if (entry->prev == TOPK_NONE) {
+        bucket->first = entry->next;
+    } else {
+        tk->entries[entry->prev].next = entry->next;
+    }
+    if (entry->next != TOPK_NONE) {
+        tk->entries[entry->next].prev = entry->prev;
+    }
+
+    if (bucket->first == TOPK_NONE) {
+        bucket_release(tk, entry->bucket);
+    }
+}
+
+static void increment(struct topk *tk, uint32_t e)
+{
+    uint32_t b     = tk->entries[e].bucket;
+    uint64_t count = tk->buckets[b].count + 1;
+    uint32_t next  = tk->buckets[b].next;
+    bool next_fits = next != TOPK_NONE && tk->buckets[next].count == count;
+
+    // Alone in its bucket: the bucket moves with it
+    if (!next_fits && tk->buckets[b].first == e && tk->entries[e].next == TOPK_NONE) {
+        tk->buckets[b].count = count;
+        return;
+    }
+
+    if (!next_fits) {
+        next = bucket_insert_after(tk, b, count);
+    }
+    entry_unlink(tk, e);
+    entry_link(tk, e, next);
+}
+
+void topk_add(struct topk *tk, uint64_t key)
+{
+    if (!tk) return;
+
+    tk->accesses++;
+
+    uint32_t e = index_find(tk, key);
+    if (e != TOPK_NONE) {
+        increment(tk, e);
+        return;
+    }
+
+    if (tk->num_entries < tk->k) {
+        e = tk->num_entries++;
+        tk->entries[e].key   = key;
+        tk->entries[e].error = 0;
+        index_insert(tk, e);
+
+        // Halving may have left counts of 0 first
+        uint32_t after = TOPK_NONE;
+        uint32_t b = tk->min_bucket;
+        if (b != TOPK_NONE && tk->buckets[b].count == 0) {
+            after = b;
+            b = tk->buckets[b].next;
+        }
+        if (b == TOPK_NONE || tk->buckets[b].count != 1) {
+            b = bucket_insert_after(tk, after, 1);
+        }
+        entry_link(tk, e, b);
+        return;
+    }
+
+    // Replaces a key of the lowest count, which becomes the error
+    e = tk->buckets[tk->min_bucket].first;
+    index_remove(tk, e);
+    tk->entries[e].key   = key;
+    tk->entries[e].error = tk->buckets[tk->min_bucket].count;
+    index_insert(tk, e);
+    increment(tk, e);
+}
+
+uint64_t topk_count(struct topk *tk, uint64_t key)
+{
+    if (!tk) return 0;
+
+    uint32_t e = index_find(tk, key);
+    return e == TOPK_NONE ? 0 : tk->buckets[tk->entries[e].bucket].count;
+}
+
+void topk_halve(struct topk *tk)
+{
+    if (!tk) return;
+
+    for (uint32_t e = 0; e < tk->num_entries; e++) {
+        tk->entries[e].error >>= 1;
+    }
+
+    uint32_t b = tk->min_bucket;
+    while (b != TOPK_NONE) {
+        tk->buckets[b].count >>= 1;
+
+        // Neighbouring counts may become equal: their entries join b
+        uint32_t next = tk->buckets[b].next;
+        while (next != TOPK_NONE && tk->buckets[next].count >> 1 == tk->buckets[b].count) {
+            while (tk->buckets[next].first != TOPK_NONE) {
+                uint32_t e = tk->buckets[next].first;
+                entry_unlink(tk, e);
+                entry_link(tk, e, b);
+            }
+            next = tk->buckets[b].next;
+        }
+        b = next;
+    }
+}
+
+size_t topk_snapshot(struct topk *tk, struct topk_item *items, size_t n)
+{
+    if (!tk || !items || tk->min_bucket == TOPK_NONE) return 0;
+
+    uint32_t b = tk->min_bucket;
+    while (tk->buckets[b].next != TOPK_NONE) {
+        b = tk->buckets[b].next;
+    }
+
+    size_t copied = 0;
+    for (; b != TOPK_NONE && copied < n; b = tk->buckets[b].prev) {
+        for (uint32_t e = tk->buckets[b].first; e != TOPK_NONE && copied < n;
+             e = tk->entries[e].next) {
+            items[copied].key   = tk->entries[e].key;
+            items[copied].count = tk->buckets[b].count;
+            items[copied].error = tk->entries[e].error;
+            copied++;
+        }
+    }
+    return copied;
+}
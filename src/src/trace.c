@@ -0,0 +1,474 @@
+#include "trace.h"
+#include "hash.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *OP_NAMES[TRACE_NUM_OPS] = {
+    "get", "gets", "set", "add", "replace", "cas", "append", "prepend", "delete",
+    "incr", "decr", "unknown", "scan",
+};
+
+const char* trace_op_name(uint8_t op)
+{
+    return OP_NAMES[op < TRACE_NUM_OPS ? op : TRACE_OP_UNKNOWN];
+}
+
+/*
+ * Encoding
+ */
+
+static inline uint64_t zigzag(uint64_t delta)
+{
+    return (delta << 1) ^ (uint64_t) ((int64_t) delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t v)
+{
+    return (v >> 1) ^ -(v & 1);
+}
+
+static inline size_t put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t) v;
+    return n;
+}
+
+/*
+ * Reads a varint at *p, not past end. Returns false if it is truncated or
+ * longer than 64 bits.
+ */
+static inline bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    const uint8_t *q = *p;
+    uint64_t result = 0;
+
+    for (unsigned shift = 0; shift < 64 && q < end; shift += 7) {
+        uint8_t byte = *q++;
+
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *p = q;
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t trace_encode_chunk(const struct trace_record *records, size_t n, uint8_t *out)
+{
+    struct trace_chunk_header header = {.num_records = (uint32_t) n};
+    uint8_t *p = out + sizeof(header);
+    uint8_t *column = p;
+    uint64_t prev = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        p += put_varint(p, zigzag(records[i].key - prev));
+        prev = records[i].key;
+    }
+    header.key_bytes = (uint32_t) (p - column);
+
+    column = p;
+    prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        p += put_varint(p, zigzag(records[i].timestamp - prev));
+        prev = records[i].timestamp;
+    }
+    header.timestamp_bytes = (uint32_t) (p - column);
+
+    column = p;
+    for (size_t i = 0; i < n; i++) {
+        p += put_varint(p, records[i].size);
+    }
+    header.size_bytes = (uint32_t) (p - column);
+
+    for (size_t i = 0; i < n; i++) {
+        *p++ = records[i].op;
+    }
+
+    memcpy(out, &header, sizeof(header));
+    return p - out;
+}
+
+/*
+ * Writer
+ */
+
+struct trace_writer* trace_writer_open(const char *path, uint32_t chunk_records)
+{
+    if (chunk_records == 0) return NULL;
+
+    struct trace_writer *w = (struct trace_writer*) calloc(1, sizeof(struct trace_writer));
+    if (!w) return NULL;
+
+    w->chunk_records  = chunk_records;
+    w->index_capacity = 64;
+    w->index   = (struct trace_chunk_index*) malloc(w->index_capacity * sizeof(struct trace_chunk_index));
+    w->pending = (struct trace_record*) malloc(chunk_records * sizeof(struct trace_record));
+    w->buffer  = (uint8_t*) malloc(trace_chunk_max_bytes(chunk_records));
+    w->file    = fopen(path, "wb");
+
+    struct trace_file_header header = {
+        .magic         = TRACE_MAGIC,
+        .version       = TRACE_VERSION,
+        .chunk_records = chunk_records,
+    };
+    if (!w->index || !w->pending || !w->buffer || !w->file
+        || fwrite(&header, sizeof(header), 1, w->file) != 1) {
+        if (w->file) fclose(w->file);
+        free(w->index);
+        free(w->pending);
+        free(w->buffer);
+        free(w);
+        return NULL;
+    }
+    w->offset = sizeof(header);
+
+    return w;
+}
+
+static int write_chunk(struct trace_writer *w, const uint8_t *chunk, size_t bytes, size_t n)
+{
+    if (n == 0) return 0;
+    if (n > w->chunk_records) return -1;
+
+    if (w->num_chunks == w->index_capacity) {
+        struct trace_chunk_index *grown = (struct trace_chunk_index*) realloc(
+            w->index, 2 * w->index_capacity * sizeof(struct trace_chunk_index)
+        );
+        if (!grown) return -1;
+
+        w->index = grown;
+        w->index_capacity *= 2;
+    }
+
+    if (fwrite(chunk, 1, bytes, w->file) != bytes) return -1;
+
+    w->index[w->num_chunks].offset       = w->offset;
+    w->index[w->num_chunks].first_record = w->num_records;
+    w->num_chunks++;
+    w->offset      += bytes;
+    w->num_records += n;
+    return 0;
+}
+
+static int flush_pending(struct trace_writer *w)
+{
+    size_t bytes = trace_encode_chunk(w->pending, w->num_pending, w->buffer);
+    int err = write_chunk(w, w->buffer, bytes, w->num_pending);
+
+    w->num_pending = 0;
+    return err;
+}
+
+int trace_writer_append(struct trace_writer *w, const struct trace_record *record)
+{
+    w->pending[w->num_pending++] = *record;
+
+    if (w->num_pending == w->chunk_records) {
+        return flush_pending(w);
+    }
+    return 0;
+}
+
+int trace_writer_append_chunk(struct trace_writer *w, const uint8_t *chunk, size_t bytes,
+                              size_t n)
+{
+    if (flush_pending(w) != 0) return -1;
+
+    return write_chunk(w, chunk, bytes, n);
+}
+
+int trace_writer_close(struct trace_writer **w)
+{
+    if (!w || !*w) return -1;
+
+    struct trace_writer *tw = *w;
+    int err = flush_pending(tw);
+
+    struct trace_footer footer = {
+        .index_offset = tw->offset,
+        .num_chunks   = tw->num_chunks,
+        .num_records  = tw->num_records,
+        .num_keys     = tw->num_keys,
+        .magic        = TRACE_MAGIC,
+    };
+    if (err == 0
+        && (fwrite(tw->index, sizeof(struct trace_chunk_index), tw->num_chunks, tw->file)
+                != tw->num_chunks
+            || fwrite(&footer, sizeof(footer), 1, tw->file) != 1)) {
+        err = -1;
+    }
+    if (fclose(tw->file) != 0) {
+        err = -1;
+    }
+
+    free(tw->index);
+    free(tw->pending);
+    free(tw->buffer);
+    free(tw);
+    *w = NULL;
+    return err;
+}
+
+/*
+ * Reader
+ */
+
+bool trace_is_binary(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+
+    uint64_t magic = 0;
+    bool binary = fread(&magic, sizeof(magic), 1, f) == 1 && magic == TRACE_MAGIC;
+    fclose(f);
+    return binary;
+}
+
+static bool reader_valid(const struct trace_reader *r)
+{
+    const struct trace_file_header *header = (const struct trace_file_header*) r->data;
+    const struct trace_footer *footer = r->footer;
+
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION
+        || header->chunk_records == 0 || footer->magic != TRACE_MAGIC) {
+        return false;
+    }
+
+    size_t footer_offset = r->size - sizeof(struct trace_footer);
+    if (footer->index_offset < sizeof(*header) || footer->index_offset > footer_offset
+        || footer->num_chunks != (footer_offset - footer->index_offset)
+                                 / sizeof(struct trace_chunk_index)) {
+        return false;
+    }
+
+    // Chunks are in order and their headers lie before the index
+    uint64_t prev_offset = 0;
+    for (size_t i = 0; i < footer->num_chunks; i++) {
+        uint64_t offset = r->index[i].offset;
+
+        if (offset < sizeof(*header) || offset <= prev_offset
+            || offset + sizeof(struct trace_chunk_header) > footer->index_offset
+            || r->index[i].first_record > footer->num_records) {
+            return false;
+        }
+        prev_offset = offset;
+    }
+    return true;
+}
+
+struct trace_reader* trace_reader_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0
+        || (size_t) st.st_size < sizeof(struct trace_file_header) + sizeof(struct trace_footer)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    // Chunks are read once, in order
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    struct trace_reader *r = (struct trace_reader*) calloc(1, sizeof(struct trace_reader));
+    if (!r) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    r->data   = (const uint8_t*) data;
+    r->size   = st.st_size;
+    r->footer = (const struct trace_footer*) (r->data + r->size - sizeof(struct trace_footer));
+    r->chunk_records = ((const struct trace_file_header*) r->data)->chunk_records;
+
+    if (r->footer->index_offset <= r->size - sizeof(struct trace_footer)) {
+        r->index = (const struct trace_chunk_index*) (r->data + r->footer->index_offset);
+    }
+    if (!r->index || !reader_valid(r)) {
+        trace_reader_free(&r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void trace_reader_free(struct trace_reader **r)
+{
+    if (!r || !*r) return;
+
+    munmap((void*) (*r)->data, (*r)->size);
+    free(*r);
+    *r = NULL;
+}
+
+size_t trace_decode_chunk(const struct trace_reader *r, size_t chunk, struct trace_record *out)
+{
+    if (chunk >= trace_num_chunks(r)) return 0;
+
+    uint64_t offset = r->index[chunk].offset;
+    uint64_t end = chunk + 1 < trace_num_chunks(r) ? r->index[chunk + 1].offset
+                                                   : r->footer->index_offset;
+    struct trace_chunk_header header;
+    memcpy(&header, r->data + offset, sizeof(header));
+
+    const uint8_t *p = r->data + offset + sizeof(header);
+    const uint8_t *keys_end = p + header.key_bytes;
+    const uint8_t *timestamps_end = keys_end + header.timestamp_bytes;
+    const uint8_t *sizes_end = timestamps_end + header.size_bytes;
+    size_t n = header.num_records;
+
+    if (n == 0 || n > r->chunk_records
+        || (uint64_t) header.key_bytes + header.timestamp_bytes + header.size_bytes + n
+               != end - offset - sizeof(header)) {
+        return 0;
+    }
+
+    uint64_t prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        if (!get_varint(&p, keys_end, &v)) return 0;
+
+        prev += unzigzag(v);
+        out[i].key = prev;
+    }
+
+    prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        if (!get_varint(&p, timestamps_end, &v)) return 0;
+
+        prev += unzigzag(v);
+        out[i].timestamp = prev;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        if (!get_varint(&p, sizes_end, &v)) return 0;
+
+        out[i].size = (uint32_t) v;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        out[i].op = sizes_end[i];
+    }
+
+    return n;
+}
+
+int trace_cursor_init(struct trace_cursor *cur, const struct trace_reader *r,
+                      size_t first_chunk, size_t end_chunk)
+{
+    if (end_chunk > trace_num_chunks(r) || first_chunk > end_chunk) return -1;
+
+    cur->reader      = r;
+    cur->chunk       = first_chunk;
+    cur->end_chunk   = end_chunk;
+    cur->num_records = 0;
+    cur->pos         = 0;
+    cur->records     = (struct trace_record*) malloc(r->chunk_records * sizeof(struct trace_record));
+
+    return cur->records ? 0 : -1;
+}
+
+void trace_cursor_free(struct trace_cursor *cur)
+{
+    if (!cur) return;
+
+    free(cur->records);
+    cur->records = NULL;
+}
+
+/*
+ * Twitter text format
+ */
+
+static inline bool parse_u64(const char **p, const char *end, uint64_t *v)
+{
+    const char *q = *p;
+    uint64_t result = 0;
+
+    if (q == end || *q < '0' || *q > '9') return false;
+
+    while (q < end && *q >= '0' && *q <= '9') {
+        result = result * 10 + (*q++ - '0');
+    }
+    *p = q;
+    *v = result;
+    return true;
+}
+
+static inline bool skip_comma(const char **p, const char *end)
+{
+    if (*p == end || **p != ',') return false;
+
+    (*p)++;
+    return true;
+}
+
+static uint8_t parse_op(const char *name, size_t len)
+{
+    for (uint8_t op = 0; op < TRACE_OP_UNKNOWN; op++) {
+        if (strlen(OP_NAMES[op]) == len && memcmp(OP_NAMES[op], name, len) == 0) {
+            return op;
+        }
+    }
+    return TRACE_OP_UNKNOWN;
+}
+
+bool trace_parse_twitter(const char *line, const char *end, struct trace_record *record,
+                         uint64_t *key_hash)
+{
+    const char *nl = (const char*) memchr(line, '\n', end - line);
+    if (nl) {
+        end = nl;
+    }
+    if (end > line && end[-1] == '\r') {
+        end--;
+    }
+
+    const char *p = line;
+    uint64_t timestamp, key_size, value_size, client;
+
+    if (!parse_u64(&p, end, &timestamp) || !skip_comma(&p, end)) return false;
+
+    // FNV-1a over the key, finished with the MurmurHash3 mixer
+    const char *key = p;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (p < end && *p != ',') {
+        h = (h ^ (uint8_t) *p++) * 0x100000001b3ULL;
+    }
+    if (p == key) return false;
+
+    if (!skip_comma(&p, end) || !parse_u64(&p, end, &key_size) || !skip_comma(&p, end)
+        || !parse_u64(&p, end, &value_size) || !skip_comma(&p, end)
+        || !parse_u64(&p, end, &client) || !skip_comma(&p, end)) {
+        return false;
+    }
+
+    const char *op = p;
+    while (p < end && *p != ',') {
+        p++;
+    }
+
+    record->timestamp = timestamp;
+    record->size      = (uint32_t) (key_size + value_size);
+    record->op        = parse_op(op, p - op);
+    *key_hash = hash_fmix64(h);
+    return true;
+}
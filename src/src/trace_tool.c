@@ -0,0 +1,582 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "hash.h"
+
+/*
+ * Converts Twitter cache traces to the binary trace format, and replays or
+ * dumps binary traces.
+ */
+
+// Input bytes parsed per thread and batch
+#define BATCH_BYTES (32UL << 20)
+
+static const char *USAGE =
+    "Usage: %s convert [-j <threads>] [-c <chunk records>] <twitter.csv> <out.trace>\n"
+    "       %s stat [-j <threads>] <trace>\n"
+    "       %s dump <trace>\n"
+    "\n"
+    "convert   parses a Twitter cache trace (timestamp,key,key_size,value_size,\n"
+    "          client_id,operation,TTL) and renumbers keys in order of first\n"
+    "          reference.\n"
+    "stat      replays the trace on every thread's share of the chunks and\n"
+    "          prints per-operation counts and the replay rate.\n"
+    "dump      prints timestamp,key,size,operation per record.\n";
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long default_threads(void)
+{
+    return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+/*
+ * Dictionary of key hashes to dense ids, in order of first reference
+ */
+
+struct key_slot {
+    uint64_t hash;
+    uint64_t id;
+};
+
+struct dictionary {
+    struct key_slot *slots;
+    size_t mask;
+    uint64_t num_keys;
+};
+
+static int dictionary_init(struct dictionary *d)
+{
+    d->mask     = (1 << 16) - 1;
+    d->num_keys = 0;
+    d->slots    = (struct key_slot*) calloc(d->mask + 1, sizeof(struct key_slot));
+    return d->slots ? 0 : -1;
+}
+
+static int dictionary_grow(struct dictionary *d)
+{
+    size_t mask = 2 * d->mask + 1;
+    struct key_slot *slots = (struct key_slot*) calloc(mask + 1, sizeof(struct key_slot));
+    if (!slots) return -1;
+
+    for (size_t i = 0; i <= d->mask; i++) {
+        if (!d->slots[i].hash) continue;
+
+        size_t pos = d->slots[i].hash & mask;
+        while (slots[pos].hash) {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos] = d->slots[i];
+    }
+
+    free(d->slots);
+    d->slots = slots;
+    d->mask  = mask;
+    return 0;
+}
+
+/*
+ * Returns the id of hash, assigning the next one on its first reference, or
+ * UINT64_MAX if the dictionary cannot grow.
+ */
+static uint64_t dictionary_id(struct dictionary *d, uint64_t hash)
+{
+    // Zero marks empty slots
+    hash = hash ? hash : 1;
+
+    size_t pos = hash & d->mask;
+    while (d->slots[pos].hash) {
+        if (d->slots[pos].hash == hash) {
+            return d->slots[pos].id;
+        }
+        pos = (pos + 1) & d->mask;
+    }
+
+    if (2 * (d->num_keys + 1) > d->mask + 1) {
+        if (dictionary_grow(d) != 0) return UINT64_MAX;
+
+        pos = hash & d->mask;
+        while (d->slots[pos].hash) {
+            pos = (pos + 1) & d->mask;
+        }
+    }
+
+    d->slots[pos].hash = hash;
+    d->slots[pos].id   = d->num_keys++;
+    return d->slots[pos].id;
+}
+
+/*
+ * Conversion
+ *
+ * The input is converted in batches of BATCH_BYTES per thread, in three
+ * stages: threads parse newline-aligned ranges of the batch, keys are
+ * renumbered in input order on one thread, and threads encode the full
+ * chunks, which are then written in order. Records that do not fill a chunk
+ * are carried over to the next batch.
+ */
+
+struct parse_job {
+    const char *begin;
+    const char *end;
+    // Records with the key hash in place of the key
+    struct trace_record *records;
+    size_t num_records;
+    size_t capacity;
+    size_t malformed;
+};
+
+struct encode_job {
+    const struct trace_record *records;
+    size_t num_records;
+    uint32_t chunk_records;
+    uint8_t *buffers;
+    size_t buffer_bytes;
+    size_t *chunk_bytes;
+    size_t num_chunks;
+    // Next chunk to encode
+    size_t next;
+};
+
+static void *parse_worker(void *arg)
+{
+    struct parse_job *job = (struct parse_job*) arg;
+    const char *p = job->begin;
+
+    while (p < job->end) {
+        const char *nl = (const char*) memchr(p, '\n', job->end - p);
+        const char *line_end = nl ? nl : job->end;
+
+        if (line_end > p) {
+            if (job->num_records == job->capacity) {
+                size_t capacity = job->capacity ? 2 * job->capacity : 1 << 16;
+                struct trace_record *grown = (struct trace_record*) realloc(
+                    job->records, capacity * sizeof(struct trace_record)
+                );
+                if (!grown) {
+                    // Reported as malformed by the caller
+                    job->malformed = SIZE_MAX;
+                    return NULL;
+                }
+                job->records  = grown;
+                job->capacity = capacity;
+            }
+
+            struct trace_record *record = &job->records[job->num_records];
+            if (trace_parse_twitter(p, line_end, record, &record->key)) {
+                job->num_records++;
+            } else {
+                job->malformed++;
+            }
+        }
+        p = line_end + 1;
+    }
+    return NULL;
+}
+
+static void *encode_worker(void *arg)
+{
+    struct encode_job *job = (struct encode_job*) arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->num_chunks) break;
+
+        size_t first = i * job->chunk_records;
+        size_t n = job->num_records - first < job->chunk_records ? job->num_records - first
+                                                                 : job->chunk_records;
+        job->chunk_bytes[i] = trace_encode_chunk(job->records + first, n,
+                                                 job->buffers + i * job->buffer_bytes);
+    }
+    return NULL;
+}
+
+/*
+ * Returns the start of the line after p, or end.
+ */
+static const char *next_line(const char *p, const char *end)
+{
+    const char *nl = (const char*) memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static int convert_trace(const char *in_path, const char *out_path, long num_threads,
+                         uint32_t chunk_records)
+{
+    int fd = open(in_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", in_path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    const char *data = size ? (const char*) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : "";
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s\n", in_path);
+        return 1;
+    }
+    if (size) {
+        madvise((void*) data, size, MADV_SEQUENTIAL);
+    }
+
+    struct trace_writer *w = trace_writer_open(out_path, chunk_records);
+    struct parse_job *parse_jobs = (struct parse_job*) calloc(num_threads, sizeof(struct parse_job));
+    pthread_t *threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    struct dictionary dict = {0};
+    struct trace_record *records = NULL;
+    struct encode_job enc = {.chunk_records = chunk_records,
+                             .buffer_bytes = trace_chunk_max_bytes(chunk_records)};
+    size_t num_records = 0;
+    size_t capacity = 0;
+    size_t malformed = 0;
+    int status = 1;
+
+    if (!w || !parse_jobs || !threads || dictionary_init(&dict) != 0) {
+        fprintf(stderr, "Failed to create %s\n", out_path);
+        goto out;
+    }
+
+    double start = now_seconds();
+    const char *end = data + size;
+    const char *batch = data;
+
+    while (batch < end) {
+        const char *batch_end = (size_t) (end - batch) > num_threads * BATCH_BYTES
+                                    ? next_line(batch + num_threads * BATCH_BYTES, end)
+                                    : end;
+        size_t share = (batch_end - batch) / num_threads + 1;
+
+        const char *p = batch;
+        for (long t = 0; t < num_threads; t++) {
+            struct parse_job *job = &parse_jobs[t];
+
+            job->begin       = p;
+            job->end         = p + share < batch_end ? next_line(p + share, batch_end) : batch_end;
+            job->num_records = 0;
+            job->malformed   = 0;
+            p = job->end;
+            pthread_create(&threads[t], NULL, parse_worker, job);
+        }
+        for (long t = 0; t < num_threads; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        // Renumber keys in input order after the records carried over
+        for (long t = 0; t < num_threads; t++) {
+            struct parse_job *job = &parse_jobs[t];
+
+            if (job->malformed == SIZE_MAX) {
+                fprintf(stderr, "Failed to allocate parsed records\n");
+                goto out;
+            }
+            malformed += job->malformed;
+
+            if (num_records + job->num_records > capacity) {
+                capacity = 2 * (num_records + job->num_records);
+                struct trace_record *grown = (struct trace_record*) realloc(
+                    records, capacity * sizeof(struct trace_record)
+                );
+                if (!grown) {
+                    fprintf(stderr, "Failed to allocate %zu records\n", capacity);
+                    goto out;
+                }
+                records = grown;
+            }
+
+            for (size_t i = 0; i < job->num_records; i++) {
+                struct trace_record *record = &records[num_records++];
+
+                *record = job->records[i];
+                record->key = dictionary_id(&dict, record->key);
+                if (record->key == UINT64_MAX) {
+                    fprintf(stderr, "Failed to grow the key dictionary\n");
+                    goto out;
+                }
+            }
+        }
+
+        batch = batch_end;
+
+        // The last batch also encodes its partial chunk
+        enc.records     = records;
+        enc.num_records = batch < end ? num_records / chunk_records * chunk_records : num_records;
+        enc.num_chunks  = (enc.num_records + chunk_records - 1) / chunk_records;
+        enc.next        = 0;
+        if (enc.num_chunks == 0) continue;
+
+        free(enc.buffers);
+        free(enc.chunk_bytes);
+        enc.buffers     = (uint8_t*) malloc(enc.num_chunks * enc.buffer_bytes);
+        enc.chunk_bytes = (size_t*) malloc(enc.num_chunks * sizeof(size_t));
+        if (!enc.buffers || !enc.chunk_bytes) {
+            fprintf(stderr, "Failed to allocate %zu chunks\n", enc.num_chunks);
+            goto out;
+        }
+
+        long num_encoders = (size_t) num_threads < enc.num_chunks ? num_threads : (long) enc.num_chunks;
+        for (long t = 0; t < num_encoders; t++) {
+            pthread_create(&threads[t], NULL, encode_worker, &enc);
+        }
+        for (long t = 0; t < num_encoders; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        for (size_t i = 0; i < enc.num_chunks; i++) {
+            size_t n = enc.num_records - i * chunk_records < chunk_records
+                           ? enc.num_records - i * chunk_records : chunk_records;
+            if (trace_writer_append_chunk(w, enc.buffers + i * enc.buffer_bytes,
+                                          enc.chunk_bytes[i], n) != 0) {
+                fprintf(stderr, "Failed to write %s\n", out_path);
+                goto out;
+            }
+        }
+
+        memmove(records, records + enc.num_records,
+                (num_records - enc.num_records) * sizeof(struct trace_record));
+        num_records -= enc.num_records;
+    }
+
+    uint64_t total = w->num_records;
+    uint64_t total_bytes = w->offset;
+    w->num_keys = dict.num_keys;
+    if (trace_writer_close(&w) != 0) {
+        fprintf(stderr, "Failed to write %s\n", out_path);
+        goto out;
+    }
+
+    double seconds = now_seconds() - start;
+    fprintf(stderr, "Converted %" PRIu64 " records (%" PRIu64 " keys, %zu malformed lines) "
+            "from %.1f MB to %.1f MB in %.2f s (%.1f MB/s)\n",
+            total, dict.num_keys, malformed, size / 1e6, total_bytes / 1e6, seconds,
+            size / 1e6 / seconds);
+    status = 0;
+
+out:
+    if (w) {
+        trace_writer_close(&w);
+    }
+    if (parse_jobs) {
+        for (long t = 0; t < num_threads; t++) {
+            free(parse_jobs[t].records);
+        }
+    }
+    free(parse_jobs);
+    free(threads);
+    free(dict.slots);
+    free(records);
+    free(enc.buffers);
+    free(enc.chunk_bytes);
+    if (size) {
+        munmap((void*) data, size);
+    }
+    return status;
+}
+
+/*
+ * Replay
+ */
+
+struct stat_job {
+    const struct trace_reader *reader;
+    size_t first_chunk;
+    size_t end_chunk;
+    uint64_t ops[TRACE_NUM_OPS];
+    uint64_t bytes;
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    int error;
+};
+
+static void *stat_worker(void *arg)
+{
+    struct stat_job *job = (struct stat_job*) arg;
+    struct trace_cursor cur;
+
+    job->min_timestamp = UINT64_MAX;
+    if (trace_cursor_init(&cur, job->reader, job->first_chunk, job->end_chunk) != 0) {
+        job->error = 1;
+        return NULL;
+    }
+
+    const struct trace_record *record;
+    while ((record = trace_cursor_next(&cur))) {
+        job->ops[record->op < TRACE_NUM_OPS ? record->op : TRACE_OP_UNKNOWN]++;
+        job->bytes += record->size;
+        if (record->timestamp < job->min_timestamp) {
+            job->min_timestamp = record->timestamp;
+        }
+        if (record->timestamp > job->max_timestamp) {
+            job->max_timestamp = record->timestamp;
+        }
+    }
+
+    // A corrupt chunk ends the range early
+    job->error = cur.chunk != cur.end_chunk || cur.pos != cur.num_records;
+    trace_cursor_free(&cur);
+    return NULL;
+}
+
+static int stat_trace(const char *path, long num_threads)
+{
+    struct trace_reader *r = trace_reader_open(path);
+    if (!r) {
+        fprintf(stderr, "Failed to open trace %s\n", path);
+        return 1;
+    }
+
+    size_t num_chunks = trace_num_chunks(r);
+    if ((size_t) num_threads > num_chunks) {
+        num_threads = num_chunks ? num_chunks : 1;
+    }
+    struct stat_job *jobs = (struct stat_job*) calloc(num_threads, sizeof(struct stat_job));
+    pthread_t *threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    if (!jobs || !threads) {
+        free(jobs);
+        free(threads);
+        trace_reader_free(&r);
+        return 1;
+    }
+
+    double start = now_seconds();
+    for (long t = 0; t < num_threads; t++) {
+        jobs[t].reader      = r;
+        jobs[t].first_chunk = num_chunks * t / num_threads;
+        jobs[t].end_chunk   = num_chunks * (t + 1) / num_threads;
+        pthread_create(&threads[t], NULL, stat_worker, &jobs[t]);
+    }
+
+    struct stat_job total = {.min_timestamp = UINT64_MAX};
+    for (long t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+
+        for (int op = 0; op < TRACE_NUM_OPS; op++) {
+            total.ops[op] += jobs[t].ops[op];
+        }
+        total.bytes += jobs[t].bytes;
+        total.error |= jobs[t].error;
+        if (jobs[t].min_timestamp < total.min_timestamp) {
+            total.min_timestamp = jobs[t].min_timestamp;
+        }
+        if (jobs[t].max_timestamp > total.max_timestamp) {
+            total.max_timestamp = jobs[t].max_timestamp;
+        }
+    }
+    double seconds = now_seconds() - start;
+
+    uint64_t num_records = trace_num_records(r);
+    printf("records: %" PRIu64 "\n", num_records);
+    printf("keys: %" PRIu64 "\n", r->footer->num_keys);
+    printf("chunks: %zu of up to %u records\n", num_chunks, r->chunk_records);
+    printf("timestamps: %" PRIu64 " - %" PRIu64 "\n",
+           num_records ? total.min_timestamp : 0, total.max_timestamp);
+    printf("requested bytes: %" PRIu64 "\n", total.bytes);
+    for (int op = 0; op < TRACE_NUM_OPS; op++) {
+        if (total.ops[op]) {
+            printf("%s: %" PRIu64 "\n", trace_op_name(op), total.ops[op]);
+        }
+    }
+    printf("replay: %.3f s on %ld threads, %.1f M records/s, %.1f MB/s\n",
+           seconds, num_threads, num_records / 1e6 / seconds, r->size / 1e6 / seconds);
+
+    if (total.error) {
+        fprintf(stderr, "Corrupt chunks in %s\n", path);
+    }
+
+    free(jobs);
+    free(threads);
+    trace_reader_free(&r);
+    return total.error;
+}
+
+static int dump_trace(const char *path)
+{
+    struct trace_reader *r = trace_reader_open(path);
+    if (!r) {
+        fprintf(stderr, "Failed to open trace %s\n", path);
+        return 1;
+    }
+
+    struct trace_cursor cur;
+    if (trace_cursor_init(&cur, r, 0, trace_num_chunks(r)) != 0) {
+        trace_reader_free(&r);
+        return 1;
+    }
+
+    const struct trace_record *record;
+    while ((record = trace_cursor_next(&cur))) {
+        printf("%" PRIu64 ",%" PRIu64 ",%" PRIu32 ",%s\n", record->timestamp, record->key,
+               record->size, trace_op_name(record->op));
+    }
+
+    int status = cur.chunk != cur.end_chunk || cur.pos != cur.num_records;
+    trace_cursor_free(&cur);
+    trace_reader_free(&r);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    const char *command = argv[1];
+    long num_threads = default_threads();
+    unsigned long chunk_records = TRACE_CHUNK_RECORDS;
+    int opt;
+
+    optind = 2;
+    while ((opt = getopt(argc, argv, "j:c:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            chunk_records = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    if (strcmp(command, "convert") == 0 && argc - optind == 2) {
+        if (chunk_records == 0 || chunk_records > UINT32_MAX) {
+            fprintf(stderr, "Chunk records must be in [1, %u]\n", UINT32_MAX);
+            return 1;
+        }
+        return convert_trace(argv[optind], argv[optind + 1], num_threads, (uint32_t) chunk_records);
+    }
+    if (strcmp(command, "stat") == 0 && argc - optind == 1) {
+        return stat_trace(argv[optind], num_threads);
+    }
+    if (strcmp(command, "dump") == 0 && argc - optind == 1) {
+        return dump_trace(argv[optind]);
+    }
+
+    fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+    return 1;
+}
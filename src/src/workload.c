@@ -0,0 +1,322 @@
+#include "workload.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_NUM_PAGES (1 << 20)
+#define DEFAULT_ZIPF_S 0.99
+#define DEFAULT_SCAN_FRACTION 0.05
+#define DEFAULT_SCAN_LENGTH 64
+#define DEFAULT_PAGES_PER_FILE 512
+#define DEFAULT_SWEEP_PAGES_PER_FILE 8
+
+// YCSB D and E insert every INSERT_PERIOD-th operation (5%). Spacing the
+// inserts evenly keeps the number of pages at any operation known without
+// generating the operations before it.
+#define INSERT_PERIOD 20
+
+static const char *KIND_NAMES[WORKLOAD_NUM_KINDS] = {
+    "zipf", "ycsb-a", "ycsb-b", "ycsb-c", "ycsb-d", "ycsb-e", "ycsb-f", "get-scan", "sweep",
+};
+
+const char* workload_kind_name(enum workload_kind kind)
+{
+    return kind < WORKLOAD_NUM_KINDS ? KIND_NAMES[kind] : "unknown";
+}
+
+int workload_kind_parse(const char *name, enum workload_kind *kind)
+{
+    for (int k = 0; k < WORKLOAD_NUM_KINDS; k++) {
+        if (strcmp(name, KIND_NAMES[k]) == 0) {
+            *kind = (enum workload_kind) k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Splits the pages into files of 1 to 2 * mean - 1 pages, the last one
+ * truncated.
+ */
+static int init_files(struct workload *w, uint64_t mean)
+{
+    uint64_t capacity = w->config.num_pages / mean + 2;
+    uint64_t offset = 0;
+
+    w->file_offsets = (uint64_t*) malloc(capacity * sizeof(uint64_t));
+    if (!w->file_offsets) return -1;
+
+    w->num_files = 0;
+    while (offset < w->config.num_pages) {
+        if (w->num_files + 1 == capacity) {
+            capacity *= 2;
+            uint64_t *grown = (uint64_t*) realloc(w->file_offsets, capacity * sizeof(uint64_t));
+            if (!grown) return -1;
+            w->file_offsets = grown;
+        }
+
+        w->file_offsets[w->num_files++] = offset;
+        offset += 1 + hash_fmix64(w->config.seed ^ hash_fmix64(w->num_files)) % (2 * mean - 1);
+    }
+    w->file_offsets[w->num_files] = w->config.num_pages;
+    return 0;
+}
+
+struct workload* workload_init(const struct workload_config *config)
+{
+    if (!config || config->kind >= WORKLOAD_NUM_KINDS) return NULL;
+
+    struct workload *w = (struct workload*) calloc(1, sizeof(struct workload));
+    if (!w) return NULL;
+
+    w->config = *config;
+    if (!w->config.num_pages) w->config.num_pages = DEFAULT_NUM_PAGES;
+    if (w->config.zipf_s <= 0) w->config.zipf_s = DEFAULT_ZIPF_S;
+    if (w->config.scan_fraction <= 0) w->config.scan_fraction = DEFAULT_SCAN_FRACTION;
+    if (!w->config.scan_length) w->config.scan_length = DEFAULT_SCAN_LENGTH;
+    if (!w->config.pages_per_file) {
+        w->config.pages_per_file = config->kind == WORKLOAD_SWEEP ? DEFAULT_SWEEP_PAGES_PER_FILE
+                                                                  : DEFAULT_PAGES_PER_FILE;
+    }
+
+    uint64_t n = w->config.num_pages;
+    zipf_init(&w->zipf, n, w->config.zipf_s);
+
+    // Near n / golden ratio, so that consecutive ranks land far apart
+    w->scatter = ((uint64_t) (n * 0.6180339887498949)) | 1;
+    while (n > 1 && gcd(w->scatter, n) != 1) {
+        w->scatter += 2;
+    }
+
+    if (config->kind == WORKLOAD_SWEEP && init_files(w, w->config.pages_per_file) != 0) {
+        workload_free(&w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void workload_free(struct workload **w)
+{
+    if (w && *w) {
+        free((*w)->file_offsets);
+        free(*w);
+        *w = NULL;
+    }
+}
+
+static bool has_inserts(const struct workload *w)
+{
+    return w->config.kind == WORKLOAD_YCSB_D || w->config.kind == WORKLOAD_YCSB_E;
+}
+
+uint64_t workload_num_pages(const struct workload *w, uint64_t num_ops)
+{
+    if (!w) return 0;
+
+    return w->config.num_pages + (has_inserts(w) ? num_ops / INSERT_PERIOD : 0);
+}
+
+/*
+ * State of the generator of operation op, a function of the seed and op only.
+ */
+static inline uint64_t op_seed(const struct workload *w, uint64_t op)
+{
+    return hash_fmix64(w->config.seed ^ hash_fmix64(op * 0x9E3779B97F4A7C15ULL + 1));
+}
+
+/*
+ * A page drawn from the Zipf distribution. Ranks are scattered over the
+ * pages by a multiplication modulo the number of pages (a permutation, the
+ * multiplier being coprime with it), and rotated by a random offset in every
+ * phase.
+ */
+static inline uint64_t zipf_page(const struct workload *w, uint64_t op, uint64_t *rng)
+{
+    uint64_t n = w->config.num_pages;
+    uint64_t rank = zipf_next(&w->zipf, rng) - 1;
+    uint64_t page = (unsigned __int128) rank * w->scatter % n;
+
+    if (w->config.phase_ops) {
+        uint64_t phase = op / w->config.phase_ops;
+        page = (page + hash_fmix64(w->config.seed + phase) % n) % n;
+    }
+    return page;
+}
+
+static inline void locate(const struct workload *w, struct workload_ref *ref)
+{
+    ref->ino   = ref->page / w->config.pages_per_file + 1;
+    ref->index = ref->page % w->config.pages_per_file;
+}
+
+/*
+ * Starts a run of length pages from page, as one scan.
+ */
+static inline void start_scan(struct workload_cursor *cur, uint64_t page, uint64_t length)
+{
+    cur->next.page  = page;
+    cur->next.op    = TRACE_OP_SCAN;
+    cur->next.flags = WORKLOAD_REF_SCAN;
+    cur->refs_left  = length;
+}
+
+static void start_op(struct workload_cursor *cur)
+{
+    const struct workload *w = cur->w;
+    uint64_t op = cur->op++;
+    uint64_t rng = op_seed(w, op);
+    uint64_t pages = workload_num_pages(w, op);
+    struct workload_ref *ref = &cur->next;
+
+    ref->op_number = op;
+    ref->op        = TRACE_OP_GET;
+    ref->flags     = 0;
+    cur->refs_left = 1;
+    cur->rmw       = false;
+
+    bool insert = has_inserts(w) && op % INSERT_PERIOD == INSERT_PERIOD - 1;
+    double u = splitmix64_double(&rng);
+
+    switch (w->config.kind) {
+    case WORKLOAD_YCSB_A:
+    case WORKLOAD_YCSB_B:
+        ref->page = zipf_page(w, op, &rng);
+        if (u >= (w->config.kind == WORKLOAD_YCSB_A ? 0.5 : 0.95)) {
+            ref->op    = TRACE_OP_SET;
+            ref->flags = WORKLOAD_REF_WRITE;
+        }
+        break;
+    case WORKLOAD_YCSB_D:
+        if (insert) {
+            ref->page  = pages;
+            ref->op    = TRACE_OP_ADD;
+            ref->flags = WORKLOAD_REF_WRITE;
+        } else {
+            // The latest records are the most popular
+            uint64_t rank = zipf_next(&w->zipf, &rng);
+            ref->page = pages - (rank < pages ? rank : pages);
+        }
+        break;
+    case WORKLOAD_YCSB_E:
+        if (insert) {
+            ref->page  = pages;
+            ref->op    = TRACE_OP_ADD;
+            ref->flags = WORKLOAD_REF_WRITE;
+        } else {
+            start_scan(cur, zipf_page(w, op, &rng), 1 + splitmix64(&rng) % w->config.scan_length);
+        }
+        break;
+    case WORKLOAD_YCSB_F:
+        ref->page = zipf_page(w, op, &rng);
+        if (u >= 0.5) {
+            cur->rmw       = true;
+            cur->refs_left = 2;
+        }
+        break;
+    case WORKLOAD_GET_SCAN:
+        if (u < w->config.scan_fraction) {
+            start_scan(cur, splitmix64(&rng) % pages, w->config.scan_length);
+        } else {
+            ref->page = zipf_page(w, op, &rng);
+        }
+        break;
+    case WORKLOAD_SWEEP: {
+        uint64_t file = op % w->num_files;
+
+        ref->page      = w->file_offsets[file];
+        ref->ino       = file + 1;
+        ref->index     = 0;
+        cur->refs_left = w->file_offsets[file + 1] - w->file_offsets[file];
+        return;
+    }
+    default:
+        ref->page = zipf_page(w, op, &rng);
+        break;
+    }
+
+    locate(w, ref);
+}
+
+/*
+ * Moves cur->next to the next reference of the current operation.
+ */
+static inline void advance(struct workload_cursor *cur)
+{
+    struct workload_ref *ref = &cur->next;
+
+    if (cur->rmw) {
+        ref->op    = TRACE_OP_SET;
+        ref->flags = WORKLOAD_REF_WRITE;
+    } else if (cur->w->config.kind == WORKLOAD_SWEEP) {
+        ref->page++;
+        ref->index++;
+    } else {
+        // Scans wrap around the pages present at the operation
+        uint64_t pages = workload_num_pages(cur->w, ref->op_number);
+        ref->page = ref->page + 1 < pages ? ref->page + 1 : 0;
+        locate(cur->w, ref);
+    }
+}
+
+void workload_cursor_init(struct workload_cursor *cur, const struct workload *w,
+                          uint64_t first_op, uint64_t end_op)
+{
+    cur->w         = w;
+    cur->op        = first_op;
+    cur->end_op    = end_op;
+    cur->refs_left = 0;
+    cur->rmw       = false;
+}
+
+bool workload_next(struct workload_cursor *cur, struct workload_ref *ref)
+{
+    while (!cur->refs_left) {
+        if (cur->op >= cur->end_op) return false;
+        start_op(cur);
+    }
+
+    *ref = cur->next;
+    if (--cur->refs_left) {
+        advance(cur);
+    }
+    return true;
+}
+
+size_t workload_next_batch(struct workload_cursor *cur, struct workload_ref *refs, size_t n)
+{
+    size_t i = 0;
+    while (i < n && workload_next(cur, &refs[i])) {
+        i++;
+    }
+    return i;
+}
+
+int workload_generate(const struct workload *w, uint64_t first_op, uint64_t end_op,
+                      int (*fn)(void *ctx, const struct workload_ref *refs, size_t n),
+                      void *ctx)
+{
+    struct workload_ref refs[WORKLOAD_BATCH];
+    struct workload_cursor cur;
+    size_t n;
+
+    if (!w || !fn) return -1;
+
+    workload_cursor_init(&cur, w, first_op, end_op);
+    while ((n = workload_next_batch(&cur, refs, WORKLOAD_BATCH)) > 0) {
+        int ret = fn(ctx, refs, n);
+        if (ret) return ret;
+    }
+    return 0;
+}
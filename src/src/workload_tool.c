@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "workload.h"
+#include "trace.h"
+
+/*
+ * Generates a synthetic page reference stream (see workload.h) into a binary
+ * trace, a text trace for the simulator, or nowhere, to measure the rate of
+ * generation.
+ *
+ * Operations are generated in rounds of ROUND_OPS per thread: each thread
+ * encodes the references of its range of operations, and the ranges are then
+ * written in order.
+ */
+
+#define ROUND_OPS (1 << 16)
+
+// Longest line of a text trace
+#define TEXT_LINE_BYTES 64
+
+// Bytes of the records of a binary trace; a page each
+#define PAGE_BYTES 4096
+
+static const char *USAGE =
+    "Usage: %s -w <workload> [-o <out>] [-f binary|text] [-n <ops>] [-k <pages>]\n"
+    "          [-s <seed>] [-z <exponent>] [-P <ops per phase>] [-S <scan fraction>]\n"
+    "          [-L <scan length>] [-F <pages per file>] [-j <threads>]\n"
+    "          [-c <chunk records>]\n"
+    "\n"
+    "-w        zipf, ycsb-a .. ycsb-f, get-scan or sweep.\n"
+    "-o        output; without it, references are generated and dropped, to\n"
+    "          measure the rate.\n"
+    "-f        binary trace (default), with the page as the key, or text trace\n"
+    "          of \"<ino> <index> <scan>\" lines, as read by the simulator.\n"
+    "-n        operations (default 1M; K, M and G suffixes accepted).\n"
+    "-k        pages before inserts (default 1M).\n"
+    "-s        seed (default 42).\n"
+    "-z        Zipf exponent (default 0.99).\n"
+    "-P        operations per hot set (default 0: one hot set).\n"
+    "-S, -L    fraction of scans of get-scan (default 0.05), and pages per\n"
+    "          scan (default 64; the longest of ycsb-e).\n"
+    "-F        pages per file (default 512; the mean of sweep, default 8).\n";
+
+enum format {
+    FORMAT_NONE,
+    FORMAT_BINARY,
+    FORMAT_TEXT,
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t parse_count(const char *arg)
+{
+    char *end;
+    size_t n = strtoull(arg, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+        n <<= 10;
+        // fall through
+    case 'M': case 'm':
+        n <<= 10;
+        // fall through
+    case 'K': case 'k':
+        n <<= 10;
+        break;
+    }
+    return n;
+}
+
+struct gen_job {
+    const struct workload *w;
+    enum format format;
+    uint32_t chunk_records;
+    uint64_t first_op;
+    uint64_t end_op;
+
+    // Encoded output of the round
+    uint8_t *bytes;
+    size_t num_bytes;
+    size_t capacity;
+    // Binary: bytes and records of each chunk of the output
+    size_t *chunk_bytes;
+    size_t *chunk_refs;
+    size_t num_chunks;
+    size_t chunk_capacity;
+    struct trace_record *pending;
+    size_t num_pending;
+
+    uint64_t num_refs;
+    int error;
+};
+
+static int reserve(struct gen_job *job, size_t bytes)
+{
+    if (job->num_bytes + bytes <= job->capacity) return 0;
+
+    size_t capacity = 2 * (job->num_bytes + bytes);
+    uint8_t *grown = (uint8_t*) realloc(job->bytes, capacity);
+    if (!grown) return -1;
+
+    job->bytes    = grown;
+    job->capacity = capacity;
+    return 0;
+}
+
+static int flush_chunk(struct gen_job *job)
+{
+    if (job->num_pending == 0) return 0;
+
+    if (job->num_chunks == job->chunk_capacity) {
+        size_t capacity = job->chunk_capacity ? 2 * job->chunk_capacity : 16;
+        size_t *bytes = (size_t*) realloc(job->chunk_bytes, capacity * sizeof(size_t));
+        if (bytes) job->chunk_bytes = bytes;
+        size_t *refs = (size_t*) realloc(job->chunk_refs, capacity * sizeof(size_t));
+        if (refs) job->chunk_refs = refs;
+        if (!bytes || !refs) return -1;
+        job->chunk_capacity = capacity;
+    }
+    if (reserve(job, trace_chunk_max_bytes(job->num_pending)) != 0) return -1;
+
+    size_t bytes = trace_encode_chunk(job->pending, job->num_pending,
+                                      job->bytes + job->num_bytes);
+    job->num_bytes += bytes;
+    job->chunk_bytes[job->num_chunks] = bytes;
+    job->chunk_refs[job->num_chunks]  = job->num_pending;
+    job->num_chunks++;
+    job->num_pending = 0;
+    return 0;
+}
+
+static int consume(void *ctx, const struct workload_ref *refs, size_t n)
+{
+    struct gen_job *job = (struct gen_job*) ctx;
+
+    job->num_refs += n;
+    switch (job->format) {
+    case FORMAT_BINARY:
+        for (size_t i = 0; i < n; i++) {
+            struct trace_record *record = &job->pending[job->num_pending++];
+
+            record->timestamp = refs[i].op_number;
+            record->key       = refs[i].page;
+            record->size      = PAGE_BYTES;
+            record->op        = refs[i].op;
+            if (job->num_pending == job->chunk_records && flush_chunk(job) != 0) return -1;
+        }
+        break;
+    case FORMAT_TEXT:
+        if (reserve(job, n * TEXT_LINE_BYTES) != 0) return -1;
+        for (size_t i = 0; i < n; i++) {
+            job->num_bytes += snprintf((char*) job->bytes + job->num_bytes, TEXT_LINE_BYTES,
+                                       "%" PRIu64 " %" PRIu64 " %d\n", refs[i].ino,
+                                       refs[i].index, !!(refs[i].flags & WORKLOAD_REF_SCAN));
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void *gen_worker(void *arg)
+{
+    struct gen_job *job = (struct gen_job*) arg;
+
+    job->num_bytes  = 0;
+    job->num_chunks = 0;
+    job->error = workload_generate(job->w, job->first_op, job->end_op, consume, job) != 0
+                 || (job->format == FORMAT_BINARY && flush_chunk(job) != 0);
+    return NULL;
+}
+
+static int write_job(struct gen_job *job, struct trace_writer *tw, FILE *text)
+{
+    if (job->format == FORMAT_TEXT) {
+        return fwrite(job->bytes, 1, job->num_bytes, text) == job->num_bytes ? 0 : -1;
+    }
+
+    const uint8_t *chunk = job->bytes;
+    for (size_t i = 0; i < job->num_chunks; i++) {
+        if (trace_writer_append_chunk(tw, chunk, job->chunk_bytes[i], job->chunk_refs[i]) != 0) {
+            return -1;
+        }
+        chunk += job->chunk_bytes[i];
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct workload_config config = {.seed = 42};
+    const char *out_path = NULL;
+    enum format format = FORMAT_BINARY;
+    uint64_t num_ops = 1 << 20;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long chunk_records = TRACE_CHUNK_RECORDS;
+    bool kind_set = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:o:f:n:k:s:z:P:S:L:F:j:c:h")) != -1) {
+        switch (opt) {
+        case 'w':
+            if (workload_kind_parse(optarg, &config.kind) != 0) {
+                fprintf(stderr, "Unknown workload: %s\n", optarg);
+                return 1;
+            }
+            kind_set = true;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "binary") == 0) {
+                format = FORMAT_BINARY;
+            } else if (strcmp(optarg, "text") == 0) {
+                format = FORMAT_TEXT;
+            } else {
+                fprintf(stderr, "Unknown format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            num_ops = parse_count(optarg);
+            break;
+        case 'k':
+            config.num_pages = parse_count(optarg);
+            break;
+        case 's':
+            config.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'z':
+            config.zipf_s = strtod(optarg, NULL);
+            break;
+        case 'P':
+            config.phase_ops = parse_count(optarg);
+            break;
+        case 'S':
+            config.scan_fraction = strtod(optarg, NULL);
+            break;
+        case 'L':
+            config.scan_length = parse_count(optarg);
+            break;
+        case 'F':
+            config.pages_per_file = parse_count(optarg);
+            break;
+        case 'j':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            chunk_records = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!kind_set || num_threads < 1 || chunk_records == 0 || chunk_records > UINT32_MAX) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+    if (!out_path) {
+        format = FORMAT_NONE;
+    }
+
+    struct workload *w = workload_init(&config);
+    struct gen_job *jobs = (struct gen_job*) calloc(num_threads, sizeof(struct gen_job));
+    pthread_t *threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    struct trace_writer *tw = NULL;
+    FILE *text = NULL;
+    int status = 1;
+
+    if (!w || !jobs || !threads) {
+        fprintf(stderr, "Failed to create the workload\n");
+        goto out;
+    }
+    if (format == FORMAT_BINARY) {
+        tw = trace_writer_open(out_path, chunk_records);
+    } else if (format == FORMAT_TEXT) {
+        text = fopen(out_path, "w");
+    }
+    if (format != FORMAT_NONE && !tw && !text) {
+        fprintf(stderr, "Failed to create %s\n", out_path);
+        goto out;
+    }
+
+    for (long t = 0; t < num_threads; t++) {
+        jobs[t].w             = w;
+        jobs[t].format        = format;
+        jobs[t].chunk_records = chunk_records;
+        if (format == FORMAT_BINARY) {
+            jobs[t].pending = (struct trace_record*) malloc(
+                chunk_records * sizeof(struct trace_record)
+            );
+            if (!jobs[t].pending) {
+                fprintf(stderr, "Failed to allocate %lu records\n", chunk_records);
+                goto out;
+            }
+        }
+    }
+
+    double start = now_seconds();
+    uint64_t num_refs = 0;
+
+    for (uint64_t base = 0; base < num_ops; base += (uint64_t) num_threads * ROUND_OPS) {
+        for (long t = 0; t < num_threads; t++) {
+            uint64_t first = base + (uint64_t) t * ROUND_OPS;
+
+            jobs[t].first_op = first < num_ops ? first : num_ops;
+            jobs[t].end_op   = first + ROUND_OPS < num_ops ? first + ROUND_OPS : num_ops;
+            pthread_create(&threads[t], NULL, gen_worker, &jobs[t]);
+        }
+        for (long t = 0; t < num_threads; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        for (long t = 0; t < num_threads; t++) {
+            if (jobs[t].error || (format != FORMAT_NONE && write_job(&jobs[t], tw, text) != 0)) {
+                fprintf(stderr, "Failed to generate or write the references\n");
+                goto out;
+            }
+            num_refs += jobs[t].num_refs;
+            jobs[t].num_refs = 0;
+        }
+    }
+
+    if (tw) {
+        tw->num_keys = workload_num_pages(w, num_ops);
+        if (trace_writer_close(&tw) != 0) {
+            fprintf(stderr, "Failed to write %s\n", out_path);
+            goto out;
+        }
+    }
+    if (text && fclose(text) != 0) {
+        text = NULL;
+        fprintf(stderr, "Failed to write %s\n", out_path);
+        goto out;
+    }
+    text = NULL;
+
+    double seconds = now_seconds() - start;
+    fprintf(stderr, "Generated %" PRIu64 " references of %" PRIu64 " %s operations "
+            "(%" PRIu64 " pages) in %.2f s on %ld threads, %.1f M references/s\n",
+            num_refs, num_ops, workload_kind_name(config.kind), workload_num_pages(w, num_ops),
+            seconds, num_threads, num_refs / 1e6 / seconds);
+    status = 0;
+
+out:
+    if (tw) {
+        trace_writer_close(&tw);
+    }
+    if (text) {
+        fclose(text);
+    }
+    if (jobs) {
+        for (long t = 0; t < num_threads; t++) {
+            free(jobs[t].bytes);
+            free(jobs[t].chunk_bytes);
+            free(jobs[t].chunk_refs);
+            free(jobs[t].pending);
+        }
+    }
+    free(jobs);
+    free(threads);
+    workload_free(&w);
+    return status;
+}
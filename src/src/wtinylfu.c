@@ -0,0 +1,359 @@
+#include "wtinylfu.h"
+#include <math.h>
+#include <string.h>
+
+// Share of the capacity initially given to the window
+#define WINDOW_PERCENT 0.01
+// Share of the main area given to the protected segment
+#define PROTECTED_PERCENT 0.8
+
+// Hill climbing: accesses per sample, in multiples of the capacity
+#define SAMPLE_MULTIPLIER 10
+// Initial step, as a share of the capacity
+#define STEP_PERCENT 0.0625
+// Decay of the step size after each sample
+#define STEP_DECAY 0.98
+// Hit rate change that restarts climbing with the initial step
+#define RESTART_THRESHOLD 0.05
+
+static inline struct wtinylfu_list* list_of(struct wtinylfu *c, uint8_t queue)
+{
+    switch (queue) {
+    case WTINYLFU_WINDOW:
+        return &c->window;
+    case WTINYLFU_PROBATION:
+        return &c->probation;
+    default:
+        return &c->protected;
+    }
+}
+
+static inline void list_init(struct wtinylfu_list *l)
+{
+    l->head = WTINYLFU_NIL;
+    l->tail = WTINYLFU_NIL;
+    l->size = 0;
+}
+
+static inline void list_push_head(struct wtinylfu *c, uint8_t queue, uint32_t e)
+{
+    struct wtinylfu_list *l = list_of(c, queue);
+    struct wtinylfu_entry *entry = &c->entries[e];
+
+    entry->queue = queue;
+    entry->prev  = WTINYLFU_NIL;
+    entry->next  = l->head;
+
+    if (l->head != WTINYLFU_NIL) {
+        c->entries[l->head].prev = e;
+    } else {
+        l->tail = e;
+    }
+    l->head = e;
+    l->size++;
+}
+
+static inline void list_remove(struct wtinylfu *c, uint32_t e)
+{
+    struct wtinylfu_entry *entry = &c->entries[e];
+    struct wtinylfu_list *l = list_of(c, entry->queue);
+
+    if (entry->prev != WTINYLFU_NIL) {
+        c->entries[entry->prev].next = entry->next;
+    } else {
+        l->head = entry->next;
+    }
+
+    if (entry->next != WTINYLFU_NIL) {
+        c->entries[entry->next].prev = entry->prev;
+    } else {
+        l->tail = entry->prev;
+    }
+
+    l->size--;
+}
+
+static inline void list_move_to_head(struct wtinylfu *c, uint8_t queue, uint32_t e)
+{
+    list_remove(c, e);
+    list_push_head(c, queue, e);
+}
+
+static inline size_t index_home(struct wtinylfu *c, uint64_t key)
+{
+    return hash_64(key) & c->index_mask;
+}
+
+static uint32_t index_find(struct wtinylfu *c, uint64_t key)
+{
+    for (size_t pos = index_home(c, key);; pos = (pos + 1) & c->index_mask) {
+        uint32_t e = c->index[pos];
+
+        if (e == WTINYLFU_NIL || c->entries[e].key == key) {
+            return e;
+        }
+    }
+}
+
+static void index_insert(struct wtinylfu *c, uint32_t e)
+{
+    size_t pos = index_home(c, c->entries[e].key);
+
+    while (c->index[pos] != WTINYLFU_NIL) {
+        pos = (pos + 1) & c->index_mask;
+    }
+    c->index[pos] = e;
+}
+
+/*
+ * Removes e and shifts back the entries that follow it in the probe
+ * sequence, so that lookups never need tombstones.
+ */
+static void index_remove(struct wtinylfu *c, uint32_t e)
+{
+    size_t hole = index_home(c, c->entries[e].key);
+
+    while (c->index[hole] != e) {
+        hole = (hole + 1) & c->index_mask;
+    }
+
+    for (size_t next = (hole + 1) & c->index_mask;
+         c->index[next] != WTINYLFU_NIL;
+         next = (next + 1) & c->index_mask) {
+        size_t home = index_home(c, c->entries[c->index[next]].key);
+
+        // The entry can fill the hole if its home is not in (hole, next]
+        if (((next - home) & c->index_mask) >= ((next - hole) & c->index_mask)) {
+            c->index[hole] = c->index[next];
+            hole = next;
+        }
+    }
+
+    c->index[hole] = WTINYLFU_NIL;
+}
+
+static void evict_entry(struct wtinylfu *c, uint32_t e)
+{
+    tinylfu_evict(c->sketch, c->entries[e].key);
+
+    list_remove(c, e);
+    index_remove(c, e);
+
+    c->entries[e].queue = WTINYLFU_FREE;
+    c->entries[e].next  = c->free_head;
+    c->free_head = e;
+}
+
+/*
+ * Least recently used entry of the main area, or WTINYLFU_NIL if it is empty.
+ */
+static uint32_t main_victim(struct wtinylfu *c)
+{
+    if (c->probation.tail != WTINYLFU_NIL) {
+        return c->probation.tail;
+    }
+    return c->protected.tail;
+}
+
+static void demote_protected(struct wtinylfu *c)
+{
+    while (c->protected.size > c->protected_max) {
+        list_move_to_head(c, WTINYLFU_PROBATION, c->protected.tail);
+    }
+}
+
+/*
+ * Moves the window's overflow to probation. The total size is unchanged, so
+ * these entries do not compete for admission.
+ */
+static void shrink_window(struct wtinylfu *c)
+{
+    while (c->window.size > c->window_max) {
+        list_move_to_head(c, WTINYLFU_PROBATION, c->window.tail);
+    }
+}
+
+/*
+ * Brings the cache back to its capacity after an insertion. The window's LRU
+ * entry, if the window is over its size, competes with the main area's
+ * victim for admission; otherwise the main area's victim is evicted.
+ */
+static void evict(struct wtinylfu *c)
+{
+    if (wtinylfu_size(c) > c->capacity) {
+        uint32_t victim = main_victim(c);
+
+        if (c->window.size > c->window_max && victim != WTINYLFU_NIL) {
+            uint32_t candidate = c->window.tail;
+
+            if (tinylfu_admit(c->sketch, c->entries[candidate].key,
+                              c->entries[victim].key)) {
+                evict_entry(c, victim);
+                list_move_to_head(c, WTINYLFU_PROBATION, candidate);
+            } else {
+                evict_entry(c, candidate);
+            }
+        } else if (victim != WTINYLFU_NIL) {
+            evict_entry(c, victim);
+        } else {
+            evict_entry(c, c->window.tail);
+        }
+    }
+
+    // Below capacity, no competition needed
+    shrink_window(c);
+}
+
+static void set_window_max(struct wtinylfu *c, double window_max)
+{
+    double max = c->capacity > 1 ? c->capacity - 1 : 1;
+
+    if (window_max < 1) {
+        window_max = 1;
+    } else if (window_max > max) {
+        window_max = max;
+    }
+
+    c->window_max    = (size_t) window_max;
+    c->protected_max = (size_t) (PROTECTED_PERCENT * (c->capacity - c->window_max));
+}
+
+/*
+ * Moves the window size by step after every sample: further in the same
+ * direction if the hit rate improved, back otherwise.
+ */
+static void climb(struct wtinylfu *c, bool hit)
+{
+    c->sample_hits += hit;
+    if (++c->sample_accesses < SAMPLE_MULTIPLIER * c->capacity) return;
+
+    double hit_rate = (double) c->sample_hits / c->sample_accesses;
+    double change   = hit_rate - c->prev_hit_rate;
+    double amount   = change >= 0 ? c->step : -c->step;
+
+    if (fabs(change) >= RESTART_THRESHOLD) {
+        c->step = STEP_PERCENT * c->capacity * (amount >= 0 ? 1 : -1);
+    } else {
+        c->step = STEP_DECAY * amount;
+    }
+
+    c->prev_hit_rate   = hit_rate;
+    c->sample_hits     = 0;
+    c->sample_accesses = 0;
+
+    set_window_max(c, (double) c->window_max + amount);
+    shrink_window(c);
+    demote_protected(c);
+}
+
+struct wtinylfu* wtinylfu_init(size_t capacity,
+                               const struct tinylfu_config *sketch_config)
+{
+    if (capacity == 0 || capacity >= WTINYLFU_NIL) return NULL;
+
+    struct wtinylfu *c = (struct wtinylfu*) calloc(1, sizeof(struct wtinylfu));
+    if (!c) return NULL;
+
+    struct tinylfu_config config = {
+        .aging            = TINYLFU_AGING_INCREMENTAL,
+        .doorkeeper_type  = DOORKEEPER_BLOCKED_BLOOM,
+        .expected_entries = capacity,
+    };
+    c->sketch = tinylfu_init(sketch_config ? sketch_config : &config);
+
+    // One spare entry for the key inserted before an eviction
+    c->capacity = capacity;
+    c->entries  = (struct wtinylfu_entry*) malloc(
+        (capacity + 1) * sizeof(struct wtinylfu_entry)
+    );
+
+    // At most half full
+    size_t index_size = 1;
+    while (index_size < 2 * (capacity + 1)) {
+        index_size <<= 1;
+    }
+    c->index_mask = index_size - 1;
+    c->index      = (uint32_t*) malloc(index_size * sizeof(uint32_t));
+
+    if (!c->sketch || !c->entries || !c->index) {
+        wtinylfu_free(&c);
+        return NULL;
+    }
+
+    memset(c->index, 0xff, index_size * sizeof(uint32_t));
+
+    for (uint32_t e = 0; e <= capacity; e++) {
+        c->entries[e].queue = WTINYLFU_FREE;
+        c->entries[e].next  = e < capacity ? e + 1 : WTINYLFU_NIL;
+    }
+    c->free_head = 0;
+
+    list_init(&c->window);
+    list_init(&c->probation);
+    list_init(&c->protected);
+
+    set_window_max(c, WINDOW_PERCENT * capacity);
+    c->step = -STEP_PERCENT * capacity;
+
+    return c;
+}
+
+void wtinylfu_free(struct wtinylfu **c)
+{
+    if (c && *c) {
+        tinylfu_free(&(*c)->sketch);
+        free((*c)->entries);
+        free((*c)->index);
+        free(*c);
+        *c = NULL;
+    }
+}
+
+bool wtinylfu_contains(struct wtinylfu *c, uint64_t key)
+{
+    if (!c) return false;
+
+    return index_find(c, key) != WTINYLFU_NIL;
+}
+
+bool wtinylfu_access(struct wtinylfu *c, uint64_t key)
+{
+    if (!c) return false;
+
+    tinylfu_access(c->sketch, key);
+
+    uint32_t e = index_find(c, key);
+    bool hit = e != WTINYLFU_NIL;
+
+    if (hit) {
+        c->hits++;
+
+        switch (c->entries[e].queue) {
+        case WTINYLFU_WINDOW:
+            list_move_to_head(c, WTINYLFU_WINDOW, e);
+            break;
+        case WTINYLFU_PROBATION:
+            list_move_to_head(c, WTINYLFU_PROTECTED, e);
+            demote_protected(c);
+            break;
+        default:
+            list_move_to_head(c, WTINYLFU_PROTECTED, e);
+            break;
+        }
+    } else {
+        c->misses++;
+
+        e = c->free_head;
+        c->free_head = c->entries[e].next;
+
+        c->entries[e].key = key;
+        list_push_head(c, WTINYLFU_WINDOW, e);
+        index_insert(c, e);
+
+        evict(c);
+    }
+
+    climb(c, hit);
+
+    return hit;
+}